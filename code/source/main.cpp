@@ -6,15 +6,26 @@
 #include <iostream>
 #include <sstream>
 #include <cassert>
+#include <unordered_map>
 #include <unordered_set>
 #include <algorithm>
 #include <array>
-#include <tuple>
 #include <chrono>
+#include <cmath>
 
 #include "shaders_generated/trivial.frag.h"
 #include "shaders_generated/trivial.vert.h"
 
+#include "sdf/Bricks.h"
+#include "sdf/Glsl.h"
+#include "sdf/Memory.h"
+#include "sdf/Optimize.h"
+#include "sdf/Scenes.h"
+#include "sdf/ShaderCompiler.h"
+#include "sdf/ShaderPack.h"
+#include "sdf/SpirvCodec.h"
+#include "sdf/Trace.h"
+
 #define STACK_ARRAY(TYPE, COUNT) (TYPE*)alloca(sizeof(TYPE) * (COUNT))
 #define ARRAY_COUNT(ARR) (sizeof((ARR)) / sizeof((ARR)[0]))
 
@@ -217,16 +228,27 @@ namespace vk
 		{
 			VkImage img;
 			VkDeviceMemory mem;
+			VkDeviceSize size;
+			sdf::memory::GpuUsage usage;
 		};
 
-		Image CreateImage(VkPhysicalDevice phyDev, VkDevice dev, uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties)
+		sdf::memory::GpuUsage ImageUsage(VkImageUsageFlags usage)
+		{
+			if (usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT))
+				return sdf::memory::GpuUsage::ATTACHMENT;
+			if (usage & VK_IMAGE_USAGE_SAMPLED_BIT)
+				return sdf::memory::GpuUsage::SAMPLED;
+			if (usage & VK_IMAGE_USAGE_STORAGE_BIT)
+				return sdf::memory::GpuUsage::STORAGE;
+			return sdf::memory::GpuUsage::OTHER;
+		}
+
+		Image CreateImage(VkPhysicalDevice phyDev, VkDevice dev, VkImageType type, VkExtent3D extent, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties)
 		{
 			VkImageCreateInfo imageInfo = {};
 			imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-			imageInfo.imageType = VK_IMAGE_TYPE_2D;
-			imageInfo.extent.width = width;
-			imageInfo.extent.height = height;
-			imageInfo.extent.depth = 1;
+			imageInfo.imageType = type;
+			imageInfo.extent = extent;
 			imageInfo.mipLevels = 1;
 			imageInfo.arrayLayers = 1;
 			imageInfo.format = format;
@@ -250,14 +272,30 @@ namespace vk
 			vkAllocateMemory(dev, &allocInfo, nullptr, &img.mem);
 			vkBindImageMemory(dev, img.img, img.mem, 0);
 
+			img.size = memRequirements.size;
+			img.usage = ImageUsage(usage);
+			sdf::memory::TrackGpuAllocation(img.usage, img.size);
+
 			return img;
 		}
 
-		VkImageView CreateImageView(VkDevice dev, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags) {
+		void DestroyImage(VkDevice dev, const Image &img)
+		{
+			vkDestroyImage(dev, img.img, nullptr);
+			vkFreeMemory(dev, img.mem, nullptr);
+			sdf::memory::TrackGpuFree(img.usage, img.size);
+		}
+
+		Image CreateImage(VkPhysicalDevice phyDev, VkDevice dev, uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties)
+		{
+			return CreateImage(phyDev, dev, VK_IMAGE_TYPE_2D, { width, height, 1 }, format, tiling, usage, properties);
+		}
+
+		VkImageView CreateImageView(VkDevice dev, VkImage image, VkImageViewType viewType, VkFormat format, VkImageAspectFlags aspectFlags) {
 			VkImageViewCreateInfo viewInfo = {};
 			viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 			viewInfo.image = image;
-			viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewInfo.viewType = viewType;
 			viewInfo.format = format;
 			viewInfo.subresourceRange.aspectMask = aspectFlags;
 			viewInfo.subresourceRange.baseMipLevel = 0;
@@ -271,6 +309,10 @@ namespace vk
 			return imageView;
 		}
 
+		VkImageView CreateImageView(VkDevice dev, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags) {
+			return CreateImageView(dev, image, VK_IMAGE_VIEW_TYPE_2D, format, aspectFlags);
+		}
+
 		void TransitionImageLayout(VkDevice dev, VkQueue gfxQueue, VkCommandPool cmdPool, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout) {
 			VkCommandBuffer commandBuffer = cmd::BeginOneShotCommands(dev, cmdPool);
 
@@ -498,6 +540,72 @@ namespace vk
 
 			return shaderModule;
 		}
+
+		// Words with the reflection that came with them, so layouts and vertex
+		// input state always match the program that is bound.
+		struct Program
+		{
+			const uint32_t *spirv;
+			uint32_t spirvSize;
+			const char *entryPoint;
+			ShaderStageType stage;
+			std::vector<ShaderDescriptorBinding> bindings;   // by set, then binding
+			std::vector<ShaderVertexInput> vertexInputs;     // by location
+			uint32_t pushConstantBytes;
+		};
+
+		// The pack's program of the module's name when there is one, so shader
+		// edits packed by glsltoc -p need no relink, else the compiled in words.
+		// Packed words are used where they are mapped; words compiled in with
+		// glsltoc -z are decoded into the cache the first time they are asked for.
+		// Fails when those don't decode, as there are no other words to fall back on.
+		bool FindProgram(const sdf::shaderpack::Pack &pack, sdf::spirvcodec::Cache *inoutCodecCache, const ShaderModule &module, Program *outProgram)
+		{
+			const sdf::shaderpack::Entry *entry = pack.data ? sdf::shaderpack::Find(pack, module.name) : nullptr;
+			Program &program = *outProgram;
+
+			if (!entry)
+			{
+				program.spirv = module.progam ? module.progam : sdf::spirvcodec::Get(inoutCodecCache, module.compressedProgram, module.compressedBytes, module.programSizeDWords);
+				if (!program.spirv)
+				{
+					std::cout << "Failed to decode the compiled in program of \"" << module.name << "\"." << std::endl;
+					return false;
+				}
+
+				program.spirvSize = module.programSizeDWords;
+				program.entryPoint = module.entryPoint;
+				program.stage = module.type;
+				program.bindings.assign(module.bindings, module.bindings + module.bindingCount);
+				program.vertexInputs.assign(module.vertexInputs, module.vertexInputs + module.vertexInputCount);
+				program.pushConstantBytes = module.pushConstantBytes;
+
+				return true;
+			}
+
+			const sdf::shaderpack::DescriptorBinding * const bindings = sdf::shaderpack::DescriptorBindings(pack, *entry);
+			const sdf::shaderpack::VertexInput * const vertexInputs = sdf::shaderpack::VertexInputs(pack, *entry);
+
+			program.spirv = sdf::shaderpack::ProgramWords(pack, *entry);
+			program.spirvSize = entry->programWords;
+			program.entryPoint = sdf::shaderpack::String(pack, entry->entryPointOffset);
+			program.stage = (ShaderStageType)entry->stage;
+			for (uint32_t bindingIndex = 0; bindingIndex < entry->bindingCount; ++bindingIndex)
+			{
+				const sdf::shaderpack::DescriptorBinding &binding = bindings[bindingIndex];
+
+				program.bindings.push_back({ (unsigned short)binding.set, (unsigned short)binding.binding, (unsigned short)binding.count, (ShaderDescriptorType)binding.type });
+			}
+			for (uint32_t inputIndex = 0; inputIndex < entry->vertexInputCount; ++inputIndex)
+			{
+				const sdf::shaderpack::VertexInput &input = vertexInputs[inputIndex];
+
+				program.vertexInputs.push_back({ (unsigned char)input.location, (unsigned char)input.components, (unsigned char)input.locations, (ShaderComponentType)input.componentType });
+			}
+			program.pushConstantBytes = entry->pushConstantBytes;
+
+			return true;
+		}
 	}
 
 	namespace vertex
@@ -525,21 +633,175 @@ namespace vk
 			return bindingDescription;
 		}
 
-		std::array<VkVertexInputAttributeDescription, 2> GetAttributeDescriptions() 
+		// An attribute per location the vertex shader reads, packed one after
+		// another in location order from binding 0. Returns the stride they take.
+		uint32_t GetAttributeDescriptions(const shader::Program &program, std::vector<VkVertexInputAttributeDescription> *outAttributeDescriptions)
+		{
+			static const VkFormat formats[][4] = {
+				{ VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT },
+				{ VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT },
+				{ VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT },
+				{ VK_FORMAT_R64_SFLOAT, VK_FORMAT_R64G64_SFLOAT, VK_FORMAT_R64G64B64_SFLOAT, VK_FORMAT_R64G64B64A64_SFLOAT }
+			};
+			static const uint32_t componentBytes[] = { 4, 4, 4, 8 };
+			uint32_t offset = 0;
+
+			outAttributeDescriptions->clear();
+
+			for (const ShaderVertexInput &input : program.vertexInputs)
+			{
+				const uint32_t componentType = (uint32_t)input.componentType;
+
+				for (uint32_t column = 0; column < input.locations; ++column)
+				{
+					VkVertexInputAttributeDescription attributeDescription = {};
+					attributeDescription.binding = 0;
+					attributeDescription.location = input.location + column;
+					attributeDescription.format = formats[componentType][input.components - 1];
+					attributeDescription.offset = offset;
+
+					outAttributeDescriptions->push_back(attributeDescription);
+					offset += input.components * componentBytes[componentType];
+				}
+			}
+
+			return offset;
+		}
+	}
+
+	// Descriptor set and pipeline layouts, built from glsltoc's reflection of
+	// the stages using them. Equal layouts are created once and shared, so
+	// pipelines over the same resources are layout compatible and descriptor
+	// sets stay bound when switching between them. The cache owns everything
+	// it hands out.
+	namespace layout
+	{
+		struct Cache
+		{
+			std::unordered_map<std::string, VkDescriptorSetLayout> setLayouts;   // by their bindings
+			std::unordered_map<std::string, VkPipelineLayout> pipelineLayouts;   // by set layouts and push constants
+		};
+
+		struct PipelineLayout
+		{
+			VkPipelineLayout layout;
+			std::vector<VkDescriptorSetLayout> setLayouts;   // by set index
+		};
+
+		// Bindings are sorted first, so the order they come in doesn't matter.
+		VkDescriptorSetLayout GetSetLayout(VkDevice dev, Cache *inoutCache, std::vector<VkDescriptorSetLayoutBinding> bindings)
+		{
+			std::string key;
+
+			std::sort(bindings.begin(), bindings.end(), [](const VkDescriptorSetLayoutBinding &a, const VkDescriptorSetLayoutBinding &b) { return a.binding < b.binding; });
+			for (const VkDescriptorSetLayoutBinding &binding : bindings)
+			{
+				const uint32_t fields[] = { binding.binding, (uint32_t)binding.descriptorType, binding.descriptorCount, binding.stageFlags };
+
+				key.append((const char*)fields, sizeof(fields));
+			}
+
+			const auto found = inoutCache->setLayouts.find(key);
+
+			if (found != inoutCache->setLayouts.end())
+				return found->second;
+
+			VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+			layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+			layoutInfo.bindingCount = (uint32_t)bindings.size();
+			layoutInfo.pBindings = bindings.data();
+
+			VkDescriptorSetLayout descriptorSetLayout;
+			vkCreateDescriptorSetLayout(dev, &layoutInfo, nullptr, &descriptorSetLayout);
+
+			inoutCache->setLayouts.emplace(std::move(key), descriptorSetLayout);
+
+			return descriptorSetLayout;
+		}
+
+		VkPipelineLayout GetPipelineLayout(VkDevice dev, Cache *inoutCache, const VkDescriptorSetLayout *setLayouts, uint32_t setLayoutCount, const VkPushConstantRange *optPushConstants)
 		{
-			std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions = {};
+			std::string key((const char*)setLayouts, setLayoutCount * sizeof(VkDescriptorSetLayout));
+
+			if (optPushConstants)
+				key.append((const char*)optPushConstants, sizeof(VkPushConstantRange));
 
-			attributeDescriptions[0].binding = 0;
-			attributeDescriptions[0].location = 0;
-			attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-			attributeDescriptions[0].offset = offsetof(Vertex, pos);
+			const auto found = inoutCache->pipelineLayouts.find(key);
 
-			attributeDescriptions[1].binding = 0;
-			attributeDescriptions[1].location = 1;
-			attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-			attributeDescriptions[1].offset = offsetof(Vertex, color);
+			if (found != inoutCache->pipelineLayouts.end())
+				return found->second;
 
-			return attributeDescriptions;
+			VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+			pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+			pipelineLayoutInfo.setLayoutCount = setLayoutCount;
+			pipelineLayoutInfo.pSetLayouts = setLayouts;
+			pipelineLayoutInfo.pushConstantRangeCount = optPushConstants ? 1 : 0;
+			pipelineLayoutInfo.pPushConstantRanges = optPushConstants;
+
+			VkPipelineLayout pipelineLayout;
+			vkCreatePipelineLayout(dev, &pipelineLayoutInfo, nullptr, &pipelineLayout);
+
+			inoutCache->pipelineLayouts.emplace(std::move(key), pipelineLayout);
+
+			return pipelineLayout;
+		}
+
+		// The stages' bindings merged by set, each visible to every stage using
+		// it, and one push constant range over the stages that have any.
+		PipelineLayout GetPipelineLayout(VkDevice dev, Cache *inoutCache, const shader::Program * const *programs, uint32_t programCount)
+		{
+			std::vector<std::vector<VkDescriptorSetLayoutBinding>> sets;
+			VkPushConstantRange pushConstants = {};
+			PipelineLayout pipelineLayout;
+
+			for (uint32_t programIndex = 0; programIndex < programCount; ++programIndex)
+			{
+				const shader::Program &program = *programs[programIndex];
+				const VkShaderStageFlags stage = 1u << (uint32_t)program.stage;   // ShaderStageType is in VkShaderStageFlagBits order
+
+				for (const ShaderDescriptorBinding &binding : program.bindings)
+				{
+					if (binding.set >= sets.size())
+						sets.resize(binding.set + 1);
+
+					std::vector<VkDescriptorSetLayoutBinding> &set = sets[binding.set];
+					const auto found = std::find_if(set.begin(), set.end(), [&](const VkDescriptorSetLayoutBinding &other) { return other.binding == binding.binding; });
+
+					if (found == set.end())
+					{
+						set.push_back({ binding.binding, (VkDescriptorType)binding.type, binding.count, stage, nullptr });
+						continue;
+					}
+
+					assert(found->descriptorType == (VkDescriptorType)binding.type);
+					found->descriptorCount = std::max<uint32_t>(found->descriptorCount, binding.count);
+					found->stageFlags |= stage;
+				}
+
+				if (program.pushConstantBytes > 0)
+				{
+					pushConstants.stageFlags |= stage;
+					pushConstants.size = std::max<uint32_t>(pushConstants.size, program.pushConstantBytes);
+				}
+			}
+
+			for (const std::vector<VkDescriptorSetLayoutBinding> &set : sets)
+				pipelineLayout.setLayouts.push_back(GetSetLayout(dev, inoutCache, set));
+
+			pipelineLayout.layout = GetPipelineLayout(dev, inoutCache, pipelineLayout.setLayouts.data(), (uint32_t)pipelineLayout.setLayouts.size(), pushConstants.stageFlags != 0 ? &pushConstants : nullptr);
+
+			return pipelineLayout;
+		}
+
+		void DestroyCache(VkDevice dev, Cache *inoutCache)
+		{
+			for (const auto &pipelineLayout : inoutCache->pipelineLayouts)
+				vkDestroyPipelineLayout(dev, pipelineLayout.second, nullptr);
+			for (const auto &setLayout : inoutCache->setLayouts)
+				vkDestroyDescriptorSetLayout(dev, setLayout.second, nullptr);
+
+			inoutCache->pipelineLayouts.clear();
+			inoutCache->setLayouts.clear();
 		}
 	}
 
@@ -562,27 +824,6 @@ namespace vk
 			return VK_FORMAT_UNDEFINED;
 		}
 
-		VkDescriptorSetLayout CreateDescriptorSetLayout(VkDevice dev)
-		{
-			VkDescriptorSetLayoutBinding uboLayoutBinding = {};
-			uboLayoutBinding.binding = 0;
-			uboLayoutBinding.descriptorCount = 1;
-			uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-			uboLayoutBinding.pImmutableSamplers = nullptr;
-			uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-			VkDescriptorSetLayoutBinding bindings[] = { uboLayoutBinding };
-			VkDescriptorSetLayoutCreateInfo layoutInfo = {};
-			layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-			layoutInfo.bindingCount = ARRAY_COUNT(bindings);
-			layoutInfo.pBindings = bindings;
-
-			VkDescriptorSetLayout descriptorSetLayout;
-			vkCreateDescriptorSetLayout(dev, &layoutInfo, nullptr, &descriptorSetLayout);
-
-			return descriptorSetLayout;
-		}
-
 		VkDescriptorPool CreateDescriptorPool(VkDevice dev) 
 		{
 			VkDescriptorPoolSize poolSizes[1] = {};
@@ -695,30 +936,34 @@ namespace vk
 			return renderPass;
 		}
 
-		std::tuple<VkPipeline, VkPipelineLayout> CreateGraphicsPipeline(VkDevice dev, VkRenderPass renderPass, VkDescriptorSetLayout descSetLayout, VkExtent2D viewportExtents)
+		VkPipeline CreateGraphicsPipeline(VkDevice dev, VkRenderPass renderPass, VkPipelineLayout pipelineLayout, VkExtent2D viewportExtents, const shader::Program &vertProgram, const shader::Program &fragProgram)
 		{
-			VkShaderModule vertShaderModule = shader::CreateShaderModule(dev, trivial_vert_shader.progam, trivial_vert_shader.programSizeDWords);
-			VkShaderModule fragShaderModule = shader::CreateShaderModule(dev, trivial_frag_shader.progam, trivial_frag_shader.programSizeDWords);
+			VkShaderModule vertShaderModule = shader::CreateShaderModule(dev, vertProgram.spirv, vertProgram.spirvSize);
+			VkShaderModule fragShaderModule = shader::CreateShaderModule(dev, fragProgram.spirv, fragProgram.spirvSize);
 
 			VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
 			vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 			vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
 			vertShaderStageInfo.module = vertShaderModule;
-			vertShaderStageInfo.pName = trivial_vert_shader.entryPoint;
+			vertShaderStageInfo.pName = vertProgram.entryPoint;
 
 			VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
 			fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 			fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
 			fragShaderStageInfo.module = fragShaderModule;
-			fragShaderStageInfo.pName = trivial_frag_shader.entryPoint;
+			fragShaderStageInfo.pName = fragProgram.entryPoint;
 
 			VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
 
 			VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
 			vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
+			std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
 			auto bindingDescription = vertex::GetBindingDescription();
-			auto attributeDescriptions = vertex::GetAttributeDescriptions();
+			const uint32_t stride = vertex::GetAttributeDescriptions(vertProgram, &attributeDescriptions);
+
+			assert(stride == bindingDescription.stride);
+			(void)stride;
 
 			vertexInputInfo.vertexBindingDescriptionCount = 1;
 			vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
@@ -787,14 +1032,6 @@ namespace vk
 			colorBlending.blendConstants[2] = 0.0f;
 			colorBlending.blendConstants[3] = 0.0f;
 
-			VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-			pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-			pipelineLayoutInfo.setLayoutCount = 1;
-			pipelineLayoutInfo.pSetLayouts = &descSetLayout;
-
-			VkPipelineLayout pipelineLayout;
-			vkCreatePipelineLayout(dev, &pipelineLayoutInfo, nullptr, &pipelineLayout);
-
 			VkGraphicsPipelineCreateInfo pipelineInfo = {};
 			pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 			pipelineInfo.stageCount = 2;
@@ -817,7 +1054,129 @@ namespace vk
 			vkDestroyShaderModule(dev, fragShaderModule, nullptr);
 			vkDestroyShaderModule(dev, vertShaderModule, nullptr);
 
-			return std::make_tuple(gfxPipeline, pipelineLayout);
+			return gfxPipeline;
+		}
+	}
+
+	namespace raymarch
+	{
+		static const uint32_t MAX_STEPS = 128;
+
+		sdf::glsl::PushConstants MakePushConstants(const sdf::trace::Camera &camera, VkExtent2D extent)
+		{
+			const float tanHalf = std::tan(camera.fovY * 0.5f);
+			const float aspect = (float)extent.width / (float)extent.height;
+			const glm::vec3 forward = glm::normalize(camera.target - camera.eye);
+			const glm::vec3 right = glm::normalize(glm::cross(forward, camera.up)) * (tanHalf * aspect);
+			const glm::vec3 up = glm::normalize(glm::cross(right, forward)) * tanHalf;
+			sdf::glsl::PushConstants constants = {};
+
+			memcpy(constants.eye, &camera.eye, sizeof(glm::vec3));
+			memcpy(constants.forward, &forward, sizeof(glm::vec3));
+			memcpy(constants.right, &right, sizeof(glm::vec3));
+			memcpy(constants.up, &up, sizeof(glm::vec3));
+			constants.viewport[0] = (float)extent.width;
+			constants.viewport[1] = (float)extent.height;
+			constants.viewport[2] = 2.0f * tanHalf / (float)extent.height;
+			constants.viewport[3] = 50.0f;
+
+			return constants;
+		}
+
+		// Scenes with the same volume count share a layout, as their atlases share
+		// a set layout.
+		VkPipelineLayout GetPipelineLayout(VkDevice dev, layout::Cache *inoutLayouts, VkDescriptorSetLayout optDescSetLayout)
+		{
+			VkPushConstantRange pushConstantRange = {};
+			pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+			pushConstantRange.offset = 0;
+			pushConstantRange.size = sizeof(sdf::glsl::PushConstants);
+
+			return layout::GetPipelineLayout(dev, inoutLayouts, &optDescSetLayout, optDescSetLayout != VK_NULL_HANDLE ? 1 : 0, &pushConstantRange);
+		}
+
+		// Full screen sphere tracing pass. Drawn first, with no depth, so the regular
+		// geometry composites over it. Scenes with volumes sample them through the
+		// brick atlas descriptor set.
+		VkPipeline CreatePipeline(VkDevice dev, VkRenderPass renderPass, VkShaderModule vertShaderModule, VkShaderModule fragShaderModule, VkExtent2D viewportExtents, VkPipelineLayout pipelineLayout)
+		{
+			VkPipelineShaderStageCreateInfo shaderStages[2] = {};
+			shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+			shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+			shaderStages[0].module = vertShaderModule;
+			shaderStages[0].pName = "main";
+			shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+			shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+			shaderStages[1].module = fragShaderModule;
+			shaderStages[1].pName = "main";
+
+			VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+			vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+			VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+			inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+			inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+			VkViewport viewport = {};
+			viewport.width = (float)viewportExtents.width;
+			viewport.height = (float)viewportExtents.height;
+			viewport.minDepth = 0.0f;
+			viewport.maxDepth = 1.0f;
+
+			VkRect2D scissor = {};
+			scissor.extent = viewportExtents;
+
+			VkPipelineViewportStateCreateInfo viewportState = {};
+			viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+			viewportState.viewportCount = 1;
+			viewportState.pViewports = &viewport;
+			viewportState.scissorCount = 1;
+			viewportState.pScissors = &scissor;
+
+			VkPipelineRasterizationStateCreateInfo rasterizer = {};
+			rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+			rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+			rasterizer.lineWidth = 1.0f;
+			rasterizer.cullMode = VK_CULL_MODE_NONE;
+			rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+			VkPipelineMultisampleStateCreateInfo multisampling = {};
+			multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+			multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+			VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+			depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+			depthStencil.depthTestEnable = VK_FALSE;
+			depthStencil.depthWriteEnable = VK_FALSE;
+
+			VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+			colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+			VkPipelineColorBlendStateCreateInfo colorBlending = {};
+			colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+			colorBlending.attachmentCount = 1;
+			colorBlending.pAttachments = &colorBlendAttachment;
+
+			VkGraphicsPipelineCreateInfo pipelineInfo = {};
+			pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+			pipelineInfo.stageCount = ARRAY_COUNT(shaderStages);
+			pipelineInfo.pStages = shaderStages;
+			pipelineInfo.pVertexInputState = &vertexInputInfo;
+			pipelineInfo.pInputAssemblyState = &inputAssembly;
+			pipelineInfo.pViewportState = &viewportState;
+			pipelineInfo.pRasterizationState = &rasterizer;
+			pipelineInfo.pMultisampleState = &multisampling;
+			pipelineInfo.pDepthStencilState = &depthStencil;
+			pipelineInfo.pColorBlendState = &colorBlending;
+			pipelineInfo.layout = pipelineLayout;
+			pipelineInfo.renderPass = renderPass;
+			pipelineInfo.subpass = 0;
+			pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+			VkPipeline pipeline;
+			vkCreateGraphicsPipelines(dev, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline);
+
+			return pipeline;
 		}
 	}
 
@@ -954,8 +1313,25 @@ namespace vk
 		{
 			VkBuffer buf;
 			VkDeviceMemory mem;
+			VkDeviceSize size;
+			sdf::memory::GpuUsage usage;
 		};
 
+		sdf::memory::GpuUsage BufferUsage(VkBufferUsageFlags usage)
+		{
+			if (usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)
+				return sdf::memory::GpuUsage::VERTEX;
+			if (usage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT)
+				return sdf::memory::GpuUsage::INDEX;
+			if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
+				return sdf::memory::GpuUsage::UNIFORM;
+			if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+				return sdf::memory::GpuUsage::STORAGE;
+			if (usage & VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
+				return sdf::memory::GpuUsage::STAGING;
+			return sdf::memory::GpuUsage::OTHER;
+		}
+
 		Buffer CreateBuffer(VkPhysicalDevice phyDev, VkDevice dev, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties) 
 		{
 			VkBufferCreateInfo bufferInfo = {};
@@ -979,8 +1355,19 @@ namespace vk
 
 			vkBindBufferMemory(dev, buf.buf, buf.mem, 0);
 
+			buf.size = memRequirements.size;
+			buf.usage = BufferUsage(usage);
+			sdf::memory::TrackGpuAllocation(buf.usage, buf.size);
+
 			return buf;
 		}
+
+		void DestroyBuffer(VkDevice dev, const Buffer &buf)
+		{
+			vkDestroyBuffer(dev, buf.buf, nullptr);
+			vkFreeMemory(dev, buf.mem, nullptr);
+			sdf::memory::TrackGpuFree(buf.usage, buf.size);
+		}
 		
 		void CopyBuffer(VkDevice dev, VkCommandPool cmdPool, VkQueue gfxQueue, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) 
 		{
@@ -1008,8 +1395,7 @@ namespace vk
 
 			CopyBuffer(dev, cmdPool, gfxQueue, staging.buf, vertBuf.buf, bufferSize);
 
-			vkDestroyBuffer(dev, staging.buf, nullptr);
-			vkFreeMemory(dev, staging.mem, nullptr);
+			DestroyBuffer(dev, staging);
 
 			return vertBuf;
 		}
@@ -1029,8 +1415,7 @@ namespace vk
 
 			CopyBuffer(dev, cmdPool, gfxQueue, staging.buf, idxBuf.buf, bufferSize);
 
-			vkDestroyBuffer(dev, staging.buf, nullptr);
-			vkFreeMemory(dev, staging.mem, nullptr);
+			DestroyBuffer(dev, staging);
 
 			return idxBuf;
 		}
@@ -1042,7 +1427,301 @@ namespace vk
 		}
 	}
 
-	void FillCommandBuffers(swap::SwapChain *inoutSwap, VkRenderPass renderPass, VkPipeline gfxPipe, VkPipelineLayout gfxPipeLayout, VkDescriptorSet descSet, VkBuffer vertBuf, VkBuffer idxBuf, const std::vector<vertex::Vertex> &vertices, const std::vector<uint16_t> &indices)
+	namespace bricks
+	{
+		// sdf::bricks::Atlas on the device: the shared brick atlas, one indirection
+		// volume per grid, and a persistently mapped staging buffer. Uploads are
+		// recorded into a command buffer of their own and fenced, so they overlap
+		// with drawing instead of stalling the queue.
+		struct GpuAtlas
+		{
+			sdf::bricks::Atlas atlas;
+			image::Image atlasImage;
+			VkImageView atlasView;
+			std::vector<image::Image> indirectionImages;
+			std::vector<VkImageView> indirectionViews;
+			VkSampler linearSampler;
+			VkSampler nearestSampler;
+
+			buffer::Buffer staging = {};
+			VkDeviceSize stagingSize = 0;
+			void *stagingData = nullptr;
+			VkCommandBuffer cmdBuf;
+			VkFence fence;
+			bool initialized = false;      // images have been through their first upload
+
+			VkDescriptorSetLayout descriptorSetLayout;   // the layout cache's
+			VkDescriptorPool descriptorPool;
+			VkDescriptorSet descriptorSet;
+
+			uint64_t lastUploadBytes = 0;
+			uint32_t lastUploadBricks = 0;
+		};
+
+		VkSampler CreateSampler(VkDevice dev, VkFilter filter)
+		{
+			VkSamplerCreateInfo samplerInfo = {};
+			samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+			samplerInfo.magFilter = filter;
+			samplerInfo.minFilter = filter;
+			samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+			samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+			samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+			samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+			VkSampler sampler;
+			vkCreateSampler(dev, &samplerInfo, nullptr, &sampler);
+
+			return sampler;
+		}
+
+		void CreateDescriptors(VkDevice dev, layout::Cache *inoutLayouts, GpuAtlas *inoutAtlas)
+		{
+			const uint32_t bindingCount = 1 + (uint32_t)inoutAtlas->indirectionViews.size();
+			std::vector<VkDescriptorSetLayoutBinding> bindings(bindingCount);
+			VkDescriptorImageInfo *imageInfos = STACK_ARRAY(VkDescriptorImageInfo, bindingCount);
+			VkWriteDescriptorSet *writes = STACK_ARRAY(VkWriteDescriptorSet, bindingCount);
+
+			for (uint32_t bindingIndex = 0; bindingIndex < bindingCount; ++bindingIndex)
+			{
+				const bool isAtlas = bindingIndex == 0;
+
+				bindings[bindingIndex] = {};
+				bindings[bindingIndex].binding = isAtlas ? sdf::bricks::ATLAS_BINDING : sdf::bricks::IndirectionBinding(bindingIndex - 1);
+				bindings[bindingIndex].descriptorCount = 1;
+				bindings[bindingIndex].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+				bindings[bindingIndex].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+				imageInfos[bindingIndex].sampler = isAtlas ? inoutAtlas->linearSampler : inoutAtlas->nearestSampler;
+				imageInfos[bindingIndex].imageView = isAtlas ? inoutAtlas->atlasView : inoutAtlas->indirectionViews[bindingIndex - 1];
+				imageInfos[bindingIndex].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			}
+
+			inoutAtlas->descriptorSetLayout = layout::GetSetLayout(dev, inoutLayouts, bindings);
+
+			VkDescriptorPoolSize poolSize = {};
+			poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			poolSize.descriptorCount = bindingCount;
+
+			VkDescriptorPoolCreateInfo poolInfo = {};
+			poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+			poolInfo.poolSizeCount = 1;
+			poolInfo.pPoolSizes = &poolSize;
+			poolInfo.maxSets = 1;
+			vkCreateDescriptorPool(dev, &poolInfo, nullptr, &inoutAtlas->descriptorPool);
+
+			VkDescriptorSetAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+			allocInfo.descriptorPool = inoutAtlas->descriptorPool;
+			allocInfo.descriptorSetCount = 1;
+			allocInfo.pSetLayouts = &inoutAtlas->descriptorSetLayout;
+			vkAllocateDescriptorSets(dev, &allocInfo, &inoutAtlas->descriptorSet);
+
+			for (uint32_t bindingIndex = 0; bindingIndex < bindingCount; ++bindingIndex)
+			{
+				writes[bindingIndex] = {};
+				writes[bindingIndex].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writes[bindingIndex].dstSet = inoutAtlas->descriptorSet;
+				writes[bindingIndex].dstBinding = bindings[bindingIndex].binding;
+				writes[bindingIndex].descriptorCount = 1;
+				writes[bindingIndex].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+				writes[bindingIndex].pImageInfo = &imageInfos[bindingIndex];
+			}
+
+			vkUpdateDescriptorSets(dev, bindingCount, writes, 0, nullptr);
+		}
+
+		// Volume k of the atlas is volume k of the program, which is what the
+		// generated shader's bindings assume.
+		GpuAtlas* CreateGpuAtlas(VkPhysicalDevice phyDev, VkDevice dev, VkCommandPool cmdPool, layout::Cache *inoutLayouts, const std::vector<std::shared_ptr<const sdf::volume::Grid>> &volumes)
+		{
+			GpuAtlas *atlas = new GpuAtlas;
+			const VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+			sdf::bricks::CreateAtlas(&atlas->atlas);
+
+			atlas->atlasImage = image::CreateImage(phyDev, dev, VK_IMAGE_TYPE_3D, { sdf::bricks::ATLAS_TEXELS, sdf::bricks::ATLAS_TEXELS, sdf::bricks::ATLAS_TEXELS }, VK_FORMAT_R16_SFLOAT, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			atlas->atlasView = image::CreateImageView(dev, atlas->atlasImage.img, VK_IMAGE_VIEW_TYPE_3D, VK_FORMAT_R16_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT);
+
+			for (const std::shared_ptr<const sdf::volume::Grid> &grid : volumes)
+			{
+				const uint32_t volumeIndex = sdf::bricks::AddVolume(&atlas->atlas, grid);
+				const glm::uvec3 brickDims = atlas->atlas.volumes[volumeIndex].brickDims;
+				const image::Image img = image::CreateImage(phyDev, dev, VK_IMAGE_TYPE_3D, { brickDims.x, brickDims.y, brickDims.z }, VK_FORMAT_R32G32_UINT, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+				atlas->indirectionImages.push_back(img);
+				atlas->indirectionViews.push_back(image::CreateImageView(dev, img.img, VK_IMAGE_VIEW_TYPE_3D, VK_FORMAT_R32G32_UINT, VK_IMAGE_ASPECT_COLOR_BIT));
+			}
+
+			atlas->linearSampler = CreateSampler(dev, VK_FILTER_LINEAR);
+			atlas->nearestSampler = CreateSampler(dev, VK_FILTER_NEAREST);
+
+			VkCommandBufferAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			allocInfo.commandPool = cmdPool;
+			allocInfo.commandBufferCount = 1;
+			vkAllocateCommandBuffers(dev, &allocInfo, &atlas->cmdBuf);
+
+			VkFenceCreateInfo fenceInfo = {};
+			fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+			vkCreateFence(dev, &fenceInfo, nullptr, &atlas->fence);
+
+			CreateDescriptors(dev, inoutLayouts, atlas);
+
+			return atlas;
+		}
+
+		void DestroyGpuAtlas(VkDevice dev, VkCommandPool cmdPool, GpuAtlas *atlas)
+		{
+			if (!atlas)
+				return;
+
+			vkWaitForFences(dev, 1, &atlas->fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+
+			vkDestroyDescriptorPool(dev, atlas->descriptorPool, nullptr);
+			vkDestroyFence(dev, atlas->fence, nullptr);
+			vkFreeCommandBuffers(dev, cmdPool, 1, &atlas->cmdBuf);
+
+			if (atlas->stagingSize)
+			{
+				vkUnmapMemory(dev, atlas->staging.mem);
+				buffer::DestroyBuffer(dev, atlas->staging);
+			}
+
+			vkDestroySampler(dev, atlas->nearestSampler, nullptr);
+			vkDestroySampler(dev, atlas->linearSampler, nullptr);
+
+			for (size_t volumeIndex = 0; volumeIndex < atlas->indirectionImages.size(); ++volumeIndex)
+			{
+				vkDestroyImageView(dev, atlas->indirectionViews[volumeIndex], nullptr);
+				image::DestroyImage(dev, atlas->indirectionImages[volumeIndex]);
+			}
+
+			vkDestroyImageView(dev, atlas->atlasView, nullptr);
+			image::DestroyImage(dev, atlas->atlasImage);
+
+			delete atlas;
+		}
+
+		// Uploads whatever is dirty in the CPU atlas: one batched copy per image,
+		// bracketed by barriers against the fragment shader reads of frames already
+		// submitted and of frames still to come. Doesn't wait for the copy.
+		bool SubmitUpload(VkPhysicalDevice phyDev, VkDevice dev, VkQueue gfxQueue, GpuAtlas *inoutAtlas)
+		{
+			sdf::bricks::Upload upload;
+			const bool complete = sdf::bricks::BuildUpload(&inoutAtlas->atlas, &upload);
+
+			inoutAtlas->lastUploadBytes = upload.staging.size();
+			inoutAtlas->lastUploadBricks = upload.bricksWritten;
+
+			if (upload.staging.empty() && inoutAtlas->initialized)
+				return complete;
+
+			// The previous upload may still be reading the staging buffer.
+			vkWaitForFences(dev, 1, &inoutAtlas->fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+
+			if (upload.staging.size() > inoutAtlas->stagingSize)
+			{
+				if (inoutAtlas->stagingSize)
+				{
+					vkUnmapMemory(dev, inoutAtlas->staging.mem);
+					buffer::DestroyBuffer(dev, inoutAtlas->staging);
+				}
+
+				inoutAtlas->stagingSize = std::max<VkDeviceSize>(upload.staging.size(), inoutAtlas->stagingSize * 2);
+				inoutAtlas->staging = buffer::CreateBuffer(phyDev, dev, inoutAtlas->stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+				vkMapMemory(dev, inoutAtlas->staging.mem, 0, inoutAtlas->stagingSize, 0, &inoutAtlas->stagingData);
+			}
+
+			if (!upload.staging.empty())
+				memcpy(inoutAtlas->stagingData, upload.staging.data(), upload.staging.size());
+
+			// Images in the copy, in order: the atlas, then the indirection volumes.
+			const size_t imageCount = 1 + inoutAtlas->indirectionImages.size();
+			std::vector<VkImageMemoryBarrier> toTransfer, toShader;
+			std::vector<VkBufferImageCopy> regions;
+
+			for (size_t imageIndex = 0; imageIndex < imageCount; ++imageIndex)
+			{
+				const bool isAtlas = imageIndex == 0;
+				const bool hasCopies = isAtlas ? !upload.atlasCopies.empty() : upload.indirectionCopies[imageIndex - 1].extent.x != 0;
+
+				if (!hasCopies && inoutAtlas->initialized)
+					continue;
+
+				VkImageMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				barrier.oldLayout = inoutAtlas->initialized ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+				barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barrier.srcAccessMask = 0;   // write after read only needs the execution dependency
+				barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.image = isAtlas ? inoutAtlas->atlasImage.img : inoutAtlas->indirectionImages[imageIndex - 1].img;
+				barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				barrier.subresourceRange.levelCount = 1;
+				barrier.subresourceRange.layerCount = 1;
+				toTransfer.push_back(barrier);
+
+				barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+				toShader.push_back(barrier);
+			}
+
+			VkCommandBufferBeginInfo beginInfo = {};
+			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+			vkResetFences(dev, 1, &inoutAtlas->fence);
+			vkBeginCommandBuffer(inoutAtlas->cmdBuf, &beginInfo);
+
+			vkCmdPipelineBarrier(inoutAtlas->cmdBuf, inoutAtlas->initialized ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, (uint32_t)toTransfer.size(), toTransfer.data());
+
+			for (size_t imageIndex = 0; imageIndex < imageCount; ++imageIndex)
+			{
+				const bool isAtlas = imageIndex == 0;
+				const sdf::bricks::Copy *copies = isAtlas ? upload.atlasCopies.data() : &upload.indirectionCopies[imageIndex - 1];
+				const size_t copyCount = isAtlas ? upload.atlasCopies.size() : (copies->extent.x != 0 ? 1 : 0);
+
+				regions.clear();
+				for (size_t copyIndex = 0; copyIndex < copyCount; ++copyIndex)
+				{
+					const sdf::bricks::Copy &copy = copies[copyIndex];
+					VkBufferImageCopy region = {};
+
+					region.bufferOffset = copy.offset;
+					region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+					region.imageSubresource.layerCount = 1;
+					region.imageOffset = { (int32_t)copy.origin.x, (int32_t)copy.origin.y, (int32_t)copy.origin.z };
+					region.imageExtent = { copy.extent.x, copy.extent.y, copy.extent.z };
+					regions.push_back(region);
+				}
+
+				if (!regions.empty())
+					vkCmdCopyBufferToImage(inoutAtlas->cmdBuf, inoutAtlas->staging.buf, isAtlas ? inoutAtlas->atlasImage.img : inoutAtlas->indirectionImages[imageIndex - 1].img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+			}
+
+			vkCmdPipelineBarrier(inoutAtlas->cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, (uint32_t)toShader.size(), toShader.data());
+
+			vkEndCommandBuffer(inoutAtlas->cmdBuf);
+
+			VkSubmitInfo submitInfo = {};
+			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &inoutAtlas->cmdBuf;
+
+			vkQueueSubmit(gfxQueue, 1, &submitInfo, inoutAtlas->fence);
+			inoutAtlas->initialized = true;
+
+			return complete;
+		}
+	}
+
+	void FillCommandBuffers(swap::SwapChain *inoutSwap, VkRenderPass renderPass, VkPipeline gfxPipe, VkPipelineLayout gfxPipeLayout, VkDescriptorSet descSet, VkBuffer vertBuf, VkBuffer idxBuf, const std::vector<vertex::Vertex> &vertices, const std::vector<uint16_t> &indices, VkPipeline optSdfPipe, VkPipelineLayout sdfPipeLayout, VkDescriptorSet optSdfDescSet, const sdf::glsl::PushConstants &sdfConstants)
 	{
 		for (size_t cmdBufIndex = 0; cmdBufIndex < inoutSwap->commandBuffers.size(); ++cmdBufIndex) 
 		{
@@ -1070,6 +1749,15 @@ namespace vk
 
 			vkCmdBeginRenderPass(cmdBuf, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
+			if (optSdfPipe != VK_NULL_HANDLE)
+			{
+				vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, optSdfPipe);
+				if (optSdfDescSet != VK_NULL_HANDLE)
+					vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, sdfPipeLayout, 0, 1, &optSdfDescSet, 0, nullptr);
+				vkCmdPushConstants(cmdBuf, sdfPipeLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(sdfConstants), &sdfConstants);
+				vkCmdDraw(cmdBuf, 3, 1, 0, 0);
+			}
+
 			vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, gfxPipe);
 
 			VkBuffer vertexBuffers[] = { vertBuf };
@@ -1103,7 +1791,8 @@ namespace vk
 		swap::SwapChain swapChain;
 
 		VkRenderPass renderPass;
-		VkDescriptorSetLayout descriptorSetLayout;
+		layout::Cache layouts;
+		VkDescriptorSetLayout descriptorSetLayout;   // set 0 of pipelineLayout
 		VkPipelineLayout pipelineLayout;
 		VkPipeline graphicsPipeline;
 
@@ -1123,6 +1812,20 @@ namespace vk
 
 		VkSemaphore imageAvailableSemaphore;
 		VkSemaphore renderFinishedSemaphore;
+
+		sdf::shaderpack::Pack shaderPack;   // mapped from glsltoc -p output, when there is one
+		sdf::spirvcodec::Cache shaderCodecCache;
+
+		sdf::shader::Compiler *shaderCompiler;
+		uint64_t sdfVertHash = 0;
+		uint64_t sdfFragHash = 0;
+		std::vector<uint32_t> sdfVertSpirv;
+		std::vector<uint32_t> sdfFragSpirv;
+		sdf::glsl::PushConstants sdfConstants;
+		VkPipeline sdfPipeline = VK_NULL_HANDLE;
+		VkPipelineLayout sdfPipelineLayout = VK_NULL_HANDLE;
+		bricks::GpuAtlas *sdfAtlas = nullptr;
+		bricks::GpuAtlas *sdfPendingAtlas = nullptr;   // belongs to the requested shader, swapped in with its pipeline
 	};
 
 	const std::vector<vertex::Vertex> vertices = {
@@ -1167,9 +1870,41 @@ namespace vk
 		swap::CreateSwapChain(window, surf, phyDev, dev, gfxQueue, cmdPool, renderPass, &outV->swapChain);
 
 		outV->renderPass = render::CreateRenderPass(surf, phyDev, dev);
-		outV->descriptorSetLayout = render::CreateDescriptorSetLayout(dev);
 
-		std::tie(outV->graphicsPipeline, outV->pipelineLayout) = render::CreateGraphicsPipeline(dev, outV->renderPass, outV->descriptorSetLayout, outV->swapChain.extent);
+		{
+			const auto packStart = std::chrono::high_resolution_clock::now();
+
+			if (sdf::shaderpack::Open("shaders_generated/Shaders.spvpack", &outV->shaderPack))
+			{
+				const double packSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - packStart).count();
+
+				std::cout << "Shader pack: " << sdf::shaderpack::ShaderCount(outV->shaderPack) << " programs mapped in " << packSeconds * 1000.0 << " ms." << std::endl;
+			}
+		}
+
+		{
+			// The layout comes from the same reflection as the words, packed or
+			// compiled in.
+			shader::Program vertProgram, fragProgram;
+
+			if (!shader::FindProgram(outV->shaderPack, &outV->shaderCodecCache, trivial_vert_shader, &vertProgram) || !shader::FindProgram(outV->shaderPack, &outV->shaderCodecCache, trivial_frag_shader, &fragProgram))
+				return false;
+
+			const shader::Program * const programs[] = { &vertProgram, &fragProgram };
+			const layout::PipelineLayout pipelineLayout = layout::GetPipelineLayout(dev, &outV->layouts, programs, ARRAY_COUNT(programs));
+
+			outV->descriptorSetLayout = pipelineLayout.setLayouts[0];
+			outV->pipelineLayout = pipelineLayout.layout;
+			outV->graphicsPipeline = render::CreateGraphicsPipeline(dev, outV->renderPass, outV->pipelineLayout, outV->swapChain.extent, vertProgram, fragProgram);
+		}
+
+		if (outV->shaderCodecCache.stats.words > 0)
+		{
+			const sdf::spirvcodec::Stats &codecStats = outV->shaderCodecCache.stats;
+			const double decodedMB = codecStats.words * sizeof(uint32_t) / (1024.0 * 1024.0);
+
+			std::cout << "Shader decode: " << codecStats.bytes << " bytes to " << codecStats.words * sizeof(uint32_t) << " in " << codecStats.seconds * 1000.0 << " ms, " << decodedMB / std::max(codecStats.seconds, 1e-9) << " MB/s." << std::endl;
+		}
 
 		outV->vertBuf = buffer::CreateVertexBuffer(phyDev, dev, cmdPool, gfxQueue, vertices);
 		outV->indexBuf = buffer::CreateIndexBuffer(phyDev, dev, cmdPool, gfxQueue, indices);
@@ -1191,13 +1926,114 @@ namespace vk
 		vkCreateSemaphore(dev, &semaphoreInfo, nullptr, &outV->imageAvailableSemaphore);
 		vkCreateSemaphore(dev, &semaphoreInfo, nullptr, &outV->renderFinishedSemaphore);
 
-		FillCommandBuffers(&outV->swapChain, outV->renderPass, outV->graphicsPipeline, outV->pipelineLayout, outV->descriptorSet, outV->vertBuf.buf, outV->indexBuf.buf, vertices, indices);
+		outV->shaderCompiler = sdf::shader::CreateCompiler("shader_cache");
+		outV->sdfConstants = raymarch::MakePushConstants(sdf::trace::DefaultCamera(), outV->swapChain.extent);
+
+		FillCommandBuffers(&outV->swapChain, outV->renderPass, outV->graphicsPipeline, outV->pipelineLayout, outV->descriptorSet, outV->vertBuf.buf, outV->indexBuf.buf, vertices, indices, outV->sdfPipeline, outV->sdfPipelineLayout, VK_NULL_HANDLE, outV->sdfConstants);
 
 		return true;
 	}
+
+	// Generates and queues the shaders for a scene. The current pipeline keeps
+	// drawing until UpdateSceneShader sees both stages come back.
+	void RequestSceneShader(VulkanWindow *inoutV, const char *sceneName)
+	{
+		sdf::scene::Scene scene, optimized;
+		sdf::program::Program prog;
+		std::string fragSource;
+
+		if (!inoutV->shaderCompiler || !sdf::scenes::Build(sceneName, &scene) || !sdf::optimize::Optimize(scene, &optimized) || !sdf::program::Compile(optimized, &prog))
+		{
+			std::cout << "Failed to build SDF scene \"" << sceneName << "\"." << std::endl;
+			return;
+		}
+
+		sdf::glsl::GenerateFragmentShader(prog, nullptr, raymarch::MAX_STEPS, &fragSource);
+
+		// The atlas upload runs while the shader compiles.
+		bricks::DestroyGpuAtlas(inoutV->device, inoutV->commandPool, inoutV->sdfPendingAtlas);
+		inoutV->sdfPendingAtlas = nullptr;
+
+		if (!prog.volumes.empty())
+		{
+			inoutV->sdfPendingAtlas = bricks::CreateGpuAtlas(inoutV->physicalDevice, inoutV->device, inoutV->commandPool, &inoutV->layouts, prog.volumes);
+
+			if (!bricks::SubmitUpload(inoutV->physicalDevice, inoutV->device, inoutV->graphicsQueue, inoutV->sdfPendingAtlas))
+				std::cout << "Brick atlas is full. Some volume bricks are missing." << std::endl;
+
+			std::cout << "Brick atlas: " << inoutV->sdfPendingAtlas->lastUploadBricks << " bricks, " << inoutV->sdfPendingAtlas->lastUploadBytes / 1024 << " KB uploaded." << std::endl;
+		}
+
+		inoutV->sdfVertSpirv.clear();
+		inoutV->sdfFragSpirv.clear();
+		inoutV->sdfVertHash = sdf::shader::Request(inoutV->shaderCompiler, sdf::glsl::FullscreenVertexShader(), sdf::shader::Stage::VERTEX);
+		inoutV->sdfFragHash = sdf::shader::Request(inoutV->shaderCompiler, std::move(fragSource), sdf::shader::Stage::FRAGMENT);
+	}
+
+	void UpdateSceneShader(VulkanWindow *inoutV)
+	{
+		static const char * const originNames[] = { "memory cache", "disk cache", "compiled" };
+		sdf::shader::Result result;
+		bool received = false;
+
+		if (!inoutV->shaderCompiler)
+			return;
+
+		while (sdf::shader::Poll(inoutV->shaderCompiler, &result))
+		{
+			if (!result.success)
+			{
+				std::cout << "SDF shader failed to compile." << std::endl << result.log << std::endl;
+				continue;
+			}
+
+			// Anything not matching the latest request belongs to a superseded edit.
+			if (result.hash == inoutV->sdfVertHash)
+				inoutV->sdfVertSpirv.swap(result.spirv);
+			else if (result.hash == inoutV->sdfFragHash)
+			{
+				inoutV->sdfFragSpirv.swap(result.spirv);
+				std::cout << "SDF shader ready in " << result.seconds * 1000.0 << " ms (" << originNames[(unsigned)result.origin] << ")." << std::endl;
+			}
+			else
+				continue;
+
+			received = true;
+		}
+
+		if (!received || inoutV->sdfVertSpirv.empty() || inoutV->sdfFragSpirv.empty())
+			return;
+
+		VkShaderModule vertShaderModule = shader::CreateShaderModule(inoutV->device, inoutV->sdfVertSpirv.data(), (uint32_t)inoutV->sdfVertSpirv.size());
+		VkShaderModule fragShaderModule = shader::CreateShaderModule(inoutV->device, inoutV->sdfFragSpirv.data(), (uint32_t)inoutV->sdfFragSpirv.size());
+		const VkPipelineLayout pipelineLayout = raymarch::GetPipelineLayout(inoutV->device, &inoutV->layouts, inoutV->sdfPendingAtlas ? inoutV->sdfPendingAtlas->descriptorSetLayout : VK_NULL_HANDLE);
+		const VkPipeline pipeline = raymarch::CreatePipeline(inoutV->device, inoutV->renderPass, vertShaderModule, fragShaderModule, inoutV->swapChain.extent, pipelineLayout);
+
+		vkDestroyShaderModule(inoutV->device, fragShaderModule, nullptr);
+		vkDestroyShaderModule(inoutV->device, vertShaderModule, nullptr);
+
+		inoutV->sdfVertSpirv.clear();
+		inoutV->sdfFragSpirv.clear();
+
+		// The command buffers are prerecorded, so they're rerecorded once the old
+		// pipeline is out of flight.
+		vkDeviceWaitIdle(inoutV->device);
+
+		if (inoutV->sdfPipeline != VK_NULL_HANDLE)
+			vkDestroyPipeline(inoutV->device, inoutV->sdfPipeline, nullptr);
+
+		bricks::DestroyGpuAtlas(inoutV->device, inoutV->commandPool, inoutV->sdfAtlas);
+
+		inoutV->sdfPipeline = pipeline;
+		inoutV->sdfPipelineLayout = pipelineLayout;
+		inoutV->sdfAtlas = inoutV->sdfPendingAtlas;
+		inoutV->sdfPendingAtlas = nullptr;
+
+		FillCommandBuffers(&inoutV->swapChain, inoutV->renderPass, inoutV->graphicsPipeline, inoutV->pipelineLayout, inoutV->descriptorSet, inoutV->vertBuf.buf, inoutV->indexBuf.buf, vertices, indices, inoutV->sdfPipeline, inoutV->sdfPipelineLayout, inoutV->sdfAtlas ? inoutV->sdfAtlas->descriptorSet : VK_NULL_HANDLE, inoutV->sdfConstants);
+	}
 }
 
-int main()
+int main(int argc, char *argv[])
 {
 	vk::VulkanWindow vkWindow;
 
@@ -1205,12 +2041,71 @@ int main()
 
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 	GLFWwindow *window = glfwCreateWindow(1024, 768, "SDFMod", nullptr, nullptr);
-	vk::InitVulkan(window, &vkWindow);
+	if (!vk::InitVulkan(window, &vkWindow))
+	{
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		return -1;
+	}
+
+	// Scene names or .sdfv files on the command line join the cycle.
+	std::vector<const char*> sdfScenes = { "csg", "primitives", "grid64" };
+	sdfScenes.insert(sdfScenes.end(), argv + 1, argv + argc);
+
+	unsigned sdfSceneIndex = 0;
+	bool sdfSceneKeyDown = false;
+
+	bool memoryLog = false;
+	bool memoryLogKeyDown = false;
+	std::chrono::high_resolution_clock::time_point memoryLogTime;
+
+	vk::RequestSceneShader(&vkWindow, sdfScenes[sdfSceneIndex]);
 
 	while (!glfwWindowShouldClose(window))
 	{
 		glfwPollEvents();
 
+		{
+			// N cycles the SDF scene. Generation is cheap; the compile runs in the background.
+			const bool keyDown = glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS;
+
+			if (keyDown && !sdfSceneKeyDown)
+			{
+				sdfSceneIndex = (sdfSceneIndex + 1) % sdfScenes.size();
+				vk::RequestSceneShader(&vkWindow, sdfScenes[sdfSceneIndex]);
+			}
+
+			sdfSceneKeyDown = keyDown;
+			vk::UpdateSceneShader(&vkWindow);
+		}
+
+		{
+			// M toggles a memory report in the log every few seconds.
+			static const double MEMORY_LOG_SECONDS = 5.0;
+
+			const bool keyDown = glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS;
+			const auto currentTime = std::chrono::high_resolution_clock::now();
+
+			if (keyDown && !memoryLogKeyDown)
+			{
+				memoryLog = !memoryLog;
+				memoryLogTime = currentTime - std::chrono::hours(1);
+			}
+
+			memoryLogKeyDown = keyDown;
+
+			if (memoryLog && std::chrono::duration<double>(currentTime - memoryLogTime).count() >= MEMORY_LOG_SECONDS)
+			{
+				sdf::memory::Report report;
+				std::string text;
+
+				sdf::memory::GetReport(&report);
+				sdf::memory::FormatReport(report, &text);
+				std::cout << text;
+				memoryLogTime = currentTime;
+			}
+		}
+
 		{
 			static auto startTime = std::chrono::high_resolution_clock::now();
 
@@ -1288,6 +2183,12 @@ int main()
 	//auto vkDestroyDebugReportCallback = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(vkInst, "vkDestroyDebugReportCallbackEXT");
 	//vkDestroyDebugReportCallback(vkInst, vkDbg, nullptr);
 	//vkDestroyInstance(vkInst, nullptr);
+	vkDeviceWaitIdle(vkWindow.device);
+	vk::bricks::DestroyGpuAtlas(vkWindow.device, vkWindow.commandPool, vkWindow.sdfPendingAtlas);
+	vk::bricks::DestroyGpuAtlas(vkWindow.device, vkWindow.commandPool, vkWindow.sdfAtlas);
+	vk::layout::DestroyCache(vkWindow.device, &vkWindow.layouts);
+	sdf::shader::DestroyCompiler(vkWindow.shaderCompiler);
+	sdf::shaderpack::Close(&vkWindow.shaderPack);
 	glfwDestroyWindow(window);
 	glfwTerminate();
 
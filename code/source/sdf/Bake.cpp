@@ -0,0 +1,768 @@
+#include "Bake.h"
+#include "Jobs.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+
+namespace sdf
+{
+	namespace bake
+	{
+		namespace
+		{
+			static const uint32_t INVALID_TRIANGLE = ~0u;
+			static const uint32_t LEAF_SIZE = 4;
+			static const uint32_t BRICK_SIZE = 4;     // band marking granularity
+			static const uint32_t SWEEP_BLOCK = 16;   // fast sweeping works on blocks of this many voxels a side
+			static const float WINDING_BETA = 2.0f;   // far field distance, in node radii, for the dipole approximation
+			static const float FOUR_PI = 12.5663706f;
+
+			enum Feature : unsigned char
+			{
+				FACE,
+				VERTEX0, VERTEX1, VERTEX2,
+				EDGE0, EDGE1, EDGE2         // edge e runs from vertex e to vertex (e + 1) % 3
+			};
+
+			struct Triangle
+			{
+				glm::vec3 v[3];
+			};
+
+			// Pseudo normals of every feature of a triangle. The sign of
+			// dot(p - closest, n) with the normal of the closest feature is exact for
+			// closed manifolds (Baerentzen and Aanaes).
+			struct PseudoNormals
+			{
+				glm::vec3 face;
+				glm::vec3 vertex[3];
+				glm::vec3 edge[3];
+			};
+
+			struct BvhNode
+			{
+				glm::vec3 min;
+				uint32_t first;   // leaf: first triangle, interior: left child, right child follows it
+				glm::vec3 max;
+				uint32_t count;   // triangles in a leaf, 0 for interior nodes
+			};
+
+			// Far field of a node's triangles for the winding number: their summed
+			// area weighted normal, placed at their area weighted centroid.
+			struct Dipole
+			{
+				glm::vec3 areaNormal;
+				glm::vec3 center;
+				float radius;
+			};
+
+			struct Bvh
+			{
+				memory::Vector<BvhNode, memory::Tag::MESHES> nodes;
+				memory::Vector<Triangle, memory::Tag::MESHES> triangles;      // in leaf order
+				memory::Vector<PseudoNormals, memory::Tag::MESHES> normals;   // matches triangles
+				memory::Vector<Dipole, memory::Tag::MESHES> dipoles;          // matches nodes, winding number mode only
+			};
+
+			struct Closest
+			{
+				float distSq;
+				uint32_t triangle;
+				Feature feature;
+				glm::vec3 point;
+			};
+
+			float Angle(const glm::vec3 &a, const glm::vec3 &b)
+			{
+				const float lengths = glm::length(a) * glm::length(b);
+
+				return lengths > 0.0f ? std::acos(glm::clamp(glm::dot(a, b) / lengths, -1.0f, 1.0f)) : 0.0f;
+			}
+
+			glm::vec3 SafeNormalize(const glm::vec3 &v)
+			{
+				const float length = glm::length(v);
+
+				return length > 0.0f ? v / length : glm::vec3(0.0f);
+			}
+
+			// Angle weighted vertex normals and summed face normals per edge.
+			// Edges are matched by sorting, which beats a hash map at a million triangles.
+			void ComputePseudoNormals(const mesh::Mesh &mesh, memory::Vector<PseudoNormals, memory::Tag::MESHES> *outNormals)
+			{
+				const size_t triangleCount = mesh::TriangleCount(mesh);
+				memory::Vector<glm::vec3, memory::Tag::MESHES> vertexNormals(mesh.positions.size(), glm::vec3(0.0f));
+				memory::Vector<std::pair<uint64_t, uint32_t>, memory::Tag::MESHES> edges(triangleCount * 3);
+				memory::Vector<PseudoNormals, memory::Tag::MESHES> &normals = *outNormals;
+
+				normals.resize(triangleCount);
+
+				for (size_t triIndex = 0; triIndex < triangleCount; ++triIndex)
+				{
+					const uint32_t * const corners = mesh.indices.data() + triIndex * 3;
+					const glm::vec3 &a = mesh.positions[corners[0]];
+					const glm::vec3 &b = mesh.positions[corners[1]];
+					const glm::vec3 &c = mesh.positions[corners[2]];
+					const glm::vec3 face = SafeNormalize(glm::cross(b - a, c - a));
+
+					normals[triIndex].face = face;
+					vertexNormals[corners[0]] += face * Angle(b - a, c - a);
+					vertexNormals[corners[1]] += face * Angle(c - b, a - b);
+					vertexNormals[corners[2]] += face * Angle(a - c, b - c);
+
+					for (unsigned edge = 0; edge < 3; ++edge)
+					{
+						const uint64_t lo = std::min(corners[edge], corners[(edge + 1) % 3]);
+						const uint64_t hi = std::max(corners[edge], corners[(edge + 1) % 3]);
+
+						edges[triIndex * 3 + edge] = std::make_pair((hi << 32) | lo, (uint32_t)(triIndex * 3 + edge));
+					}
+				}
+
+				std::sort(edges.begin(), edges.end());
+
+				for (size_t edgeIndex = 0; edgeIndex < edges.size();)
+				{
+					size_t end = edgeIndex;
+					glm::vec3 sum(0.0f);
+
+					for (; end < edges.size() && edges[end].first == edges[edgeIndex].first; ++end)
+						sum += normals[edges[end].second / 3].face;
+
+					for (; edgeIndex < end; ++edgeIndex)
+						normals[edges[edgeIndex].second / 3].edge[edges[edgeIndex].second % 3] = sum;
+				}
+
+				for (size_t triIndex = 0; triIndex < triangleCount; ++triIndex)
+					for (unsigned corner = 0; corner < 3; ++corner)
+						normals[triIndex].vertex[corner] = vertexNormals[mesh.indices[triIndex * 3 + corner]];
+			}
+
+			// Median split on the longest centroid axis. Cheap to build and tight
+			// enough for point queries, which care more about locality than SAH cost.
+			void BuildBvh(const mesh::Mesh &mesh, bool withNormals, bool withDipoles, Bvh *outBvh)
+			{
+				const uint32_t triangleCount = (uint32_t)mesh::TriangleCount(mesh);
+				memory::Vector<uint32_t, memory::Tag::MESHES> order(triangleCount);
+				memory::Vector<glm::vec3, memory::Tag::MESHES> centroids(triangleCount);
+				std::vector<uint32_t> stack;
+				memory::Vector<PseudoNormals, memory::Tag::MESHES> normals;
+
+				if (withNormals)
+					ComputePseudoNormals(mesh, &normals);
+
+				for (uint32_t triIndex = 0; triIndex < triangleCount; ++triIndex)
+				{
+					const uint32_t * const corners = mesh.indices.data() + triIndex * 3;
+
+					order[triIndex] = triIndex;
+					centroids[triIndex] = (mesh.positions[corners[0]] + mesh.positions[corners[1]] + mesh.positions[corners[2]]) / 3.0f;
+				}
+
+				outBvh->nodes.clear();
+				outBvh->nodes.reserve(2 * (triangleCount / LEAF_SIZE + 1));
+				outBvh->nodes.push_back(BvhNode{ glm::vec3(0.0f), 0, glm::vec3(0.0f), triangleCount });
+				stack.push_back(0);
+
+				while (!stack.empty())
+				{
+					const uint32_t nodeIndex = stack.back();
+					stack.pop_back();
+
+					BvhNode node = outBvh->nodes[nodeIndex];
+					glm::vec3 centroidMin(std::numeric_limits<float>::max());
+					glm::vec3 centroidMax(-std::numeric_limits<float>::max());
+
+					node.min = centroidMin;
+					node.max = centroidMax;
+
+					for (uint32_t orderIndex = node.first; orderIndex < node.first + node.count; ++orderIndex)
+					{
+						const uint32_t * const corners = mesh.indices.data() + order[orderIndex] * 3;
+
+						for (unsigned corner = 0; corner < 3; ++corner)
+						{
+							node.min = glm::min(node.min, mesh.positions[corners[corner]]);
+							node.max = glm::max(node.max, mesh.positions[corners[corner]]);
+						}
+
+						centroidMin = glm::min(centroidMin, centroids[order[orderIndex]]);
+						centroidMax = glm::max(centroidMax, centroids[order[orderIndex]]);
+					}
+
+					if (node.count <= LEAF_SIZE)
+					{
+						outBvh->nodes[nodeIndex] = node;
+						continue;
+					}
+
+					const glm::vec3 extent = centroidMax - centroidMin;
+					const unsigned axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+					const uint32_t half = node.count / 2;
+					const uint32_t childIndex = (uint32_t)outBvh->nodes.size();
+
+					std::nth_element(order.begin() + node.first, order.begin() + node.first + half, order.begin() + node.first + node.count, [&](uint32_t a, uint32_t b)
+					{
+						return centroids[a][axis] < centroids[b][axis];
+					});
+
+					outBvh->nodes.push_back(BvhNode{ glm::vec3(0.0f), node.first, glm::vec3(0.0f), half });
+					outBvh->nodes.push_back(BvhNode{ glm::vec3(0.0f), node.first + half, glm::vec3(0.0f), node.count - half });
+
+					node.first = childIndex;
+					node.count = 0;
+					outBvh->nodes[nodeIndex] = node;
+
+					stack.push_back(childIndex);
+					stack.push_back(childIndex + 1);
+				}
+
+				outBvh->triangles.resize(triangleCount);
+				outBvh->normals.resize(withNormals ? triangleCount : 0);
+
+				for (uint32_t orderIndex = 0; orderIndex < triangleCount; ++orderIndex)
+				{
+					const uint32_t * const corners = mesh.indices.data() + order[orderIndex] * 3;
+
+					for (unsigned corner = 0; corner < 3; ++corner)
+						outBvh->triangles[orderIndex].v[corner] = mesh.positions[corners[corner]];
+
+					if (withNormals)
+						outBvh->normals[orderIndex] = normals[order[orderIndex]];
+				}
+
+				if (!withDipoles)
+					return;
+
+				// Children always come after their parent, so a reverse walk is bottom up.
+				memory::Vector<float, memory::Tag::MESHES> areas(outBvh->nodes.size(), 0.0f);
+				outBvh->dipoles.assign(outBvh->nodes.size(), Dipole{ glm::vec3(0.0f), glm::vec3(0.0f), 0.0f });
+
+				for (size_t nodeIndex = outBvh->nodes.size(); nodeIndex-- > 0;)
+				{
+					const BvhNode &node = outBvh->nodes[nodeIndex];
+					Dipole &dipole = outBvh->dipoles[nodeIndex];
+					glm::vec3 weightedCenter(0.0f);
+
+					if (node.count)
+					{
+						for (uint32_t triIndex = node.first; triIndex < node.first + node.count; ++triIndex)
+						{
+							const Triangle &tri = outBvh->triangles[triIndex];
+							const glm::vec3 areaNormal = glm::cross(tri.v[1] - tri.v[0], tri.v[2] - tri.v[0]) * 0.5f;
+							const float area = glm::length(areaNormal);
+
+							dipole.areaNormal += areaNormal;
+							weightedCenter += (tri.v[0] + tri.v[1] + tri.v[2]) * (area / 3.0f);
+							areas[nodeIndex] += area;
+						}
+					}
+					else
+					{
+						for (uint32_t child = node.first; child < node.first + 2; ++child)
+						{
+							dipole.areaNormal += outBvh->dipoles[child].areaNormal;
+							weightedCenter += outBvh->dipoles[child].center * areas[child];
+							areas[nodeIndex] += areas[child];
+						}
+					}
+
+					dipole.center = areas[nodeIndex] > 0.0f ? weightedCenter / areas[nodeIndex] : (node.min + node.max) * 0.5f;
+					dipole.radius = glm::length(glm::max(node.max - dipole.center, dipole.center - node.min));
+				}
+			}
+
+			// Ericson, Real-Time Collision Detection 5.1.5, plus which feature the point is on.
+			glm::vec3 ClosestPointOnTriangle(const glm::vec3 &p, const Triangle &tri, Feature *outFeature)
+			{
+				const glm::vec3 &a = tri.v[0];
+				const glm::vec3 &b = tri.v[1];
+				const glm::vec3 &c = tri.v[2];
+				const glm::vec3 ab = b - a;
+				const glm::vec3 ac = c - a;
+				const glm::vec3 ap = p - a;
+				const float d1 = glm::dot(ab, ap);
+				const float d2 = glm::dot(ac, ap);
+
+				if (d1 <= 0.0f && d2 <= 0.0f)
+				{
+					*outFeature = VERTEX0;
+					return a;
+				}
+
+				const glm::vec3 bp = p - b;
+				const float d3 = glm::dot(ab, bp);
+				const float d4 = glm::dot(ac, bp);
+
+				if (d3 >= 0.0f && d4 <= d3)
+				{
+					*outFeature = VERTEX1;
+					return b;
+				}
+
+				const float vc = d1 * d4 - d3 * d2;
+
+				if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+				{
+					*outFeature = EDGE0;
+					return a + ab * (d1 / (d1 - d3));
+				}
+
+				const glm::vec3 cp = p - c;
+				const float d5 = glm::dot(ab, cp);
+				const float d6 = glm::dot(ac, cp);
+
+				if (d6 >= 0.0f && d5 <= d6)
+				{
+					*outFeature = VERTEX2;
+					return c;
+				}
+
+				const float vb = d5 * d2 - d1 * d6;
+
+				if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+				{
+					*outFeature = EDGE2;
+					return a + ac * (d2 / (d2 - d6));
+				}
+
+				const float va = d3 * d6 - d5 * d4;
+
+				if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+				{
+					*outFeature = EDGE1;
+					return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+				}
+
+				const float denom = 1.0f / (va + vb + vc);
+
+				*outFeature = FACE;
+				return a + ab * (vb * denom) + ac * (vc * denom);
+			}
+
+			float BoxDistanceSq(const BvhNode &node, const glm::vec3 &p)
+			{
+				const glm::vec3 d = glm::max(glm::max(node.min - p, p - node.max), glm::vec3(0.0f));
+
+				return glm::dot(d, d);
+			}
+
+			void TestTriangle(const Bvh &bvh, const glm::vec3 &p, uint32_t triIndex, Closest *inoutClosest)
+			{
+				Feature feature;
+				const glm::vec3 point = ClosestPointOnTriangle(p, bvh.triangles[triIndex], &feature);
+				const glm::vec3 delta = p - point;
+				const float distSq = glm::dot(delta, delta);
+
+				if (distSq < inoutClosest->distSq)
+				{
+					inoutClosest->distSq = distSq;
+					inoutClosest->triangle = triIndex;
+					inoutClosest->feature = feature;
+					inoutClosest->point = point;
+				}
+			}
+
+			// Closest triangle within sqrt(maxDistSq). outClosest->triangle is
+			// INVALID_TRIANGLE if there is none. Testing a hint triangle first (the
+			// answer for a neighbouring voxel) prunes most of the tree right away.
+			void FindClosest(const Bvh &bvh, const glm::vec3 &p, float maxDistSq, uint32_t hintTriangle, Closest *outClosest)
+			{
+				uint32_t stack[64];
+				unsigned stackSize = 0;
+
+				outClosest->distSq = maxDistSq;
+				outClosest->triangle = INVALID_TRIANGLE;
+				stack[stackSize++] = 0;
+
+				if (hintTriangle != INVALID_TRIANGLE)
+					TestTriangle(bvh, p, hintTriangle, outClosest);
+
+				while (stackSize)
+				{
+					const BvhNode &node = bvh.nodes[stack[--stackSize]];
+
+					if (BoxDistanceSq(node, p) >= outClosest->distSq)
+						continue;
+
+					if (node.count)
+					{
+						for (uint32_t triIndex = node.first; triIndex < node.first + node.count; ++triIndex)
+							TestTriangle(bvh, p, triIndex, outClosest);
+
+						continue;
+					}
+
+					// Nearer child on top, so it tightens the bound before the other is tested.
+					const float leftDistSq = BoxDistanceSq(bvh.nodes[node.first], p);
+					const float rightDistSq = BoxDistanceSq(bvh.nodes[node.first + 1], p);
+					const bool leftFirst = leftDistSq <= rightDistSq;
+
+					stack[stackSize++] = leftFirst ? node.first + 1 : node.first;
+					stack[stackSize++] = leftFirst ? node.first : node.first + 1;
+				}
+			}
+
+			glm::vec3 FeatureNormal(const PseudoNormals &normals, Feature feature)
+			{
+				switch (feature)
+				{
+					case VERTEX0: case VERTEX1: case VERTEX2: return normals.vertex[feature - VERTEX0];
+					case EDGE0: case EDGE1: case EDGE2:       return normals.edge[feature - EDGE0];
+					default:                                  return normals.face;
+				}
+			}
+
+			// Van Oosterom and Strackee. Positive when p sees the triangle's back.
+			float SolidAngle(const Triangle &tri, const glm::vec3 &p)
+			{
+				const glm::vec3 a = tri.v[0] - p;
+				const glm::vec3 b = tri.v[1] - p;
+				const glm::vec3 c = tri.v[2] - p;
+				const float la = glm::length(a);
+				const float lb = glm::length(b);
+				const float lc = glm::length(c);
+				const float det = glm::dot(a, glm::cross(b, c));
+				const float div = la * lb * lc + glm::dot(a, b) * lc + glm::dot(b, c) * la + glm::dot(c, a) * lb;
+
+				return 2.0f * std::atan2(det, div);
+			}
+
+			// Generalized winding number (Jacobson et al.) with the far field of
+			// distant nodes replaced by their dipole (Barill et al.). 1 inside, 0 outside.
+			float WindingNumber(const Bvh &bvh, const glm::vec3 &p)
+			{
+				uint32_t stack[64];
+				unsigned stackSize = 0;
+				float solidAngle = 0.0f;
+
+				stack[stackSize++] = 0;
+
+				while (stackSize)
+				{
+					const uint32_t nodeIndex = stack[--stackSize];
+					const BvhNode &node = bvh.nodes[nodeIndex];
+					const Dipole &dipole = bvh.dipoles[nodeIndex];
+					const glm::vec3 toCenter = dipole.center - p;
+					const float distance = glm::length(toCenter);
+
+					if (distance > WINDING_BETA * dipole.radius)
+						solidAngle += glm::dot(dipole.areaNormal, toCenter) / (distance * distance * distance);
+					else if (node.count)
+					{
+						for (uint32_t triIndex = node.first; triIndex < node.first + node.count; ++triIndex)
+							solidAngle += SolidAngle(bvh.triangles[triIndex], p);
+					}
+					else
+					{
+						stack[stackSize++] = node.first;
+						stack[stackSize++] = node.first + 1;
+					}
+				}
+
+				return solidAngle / FOUR_PI;
+			}
+
+			// Set from many threads at once, so every word is atomic.
+			struct BitSet
+			{
+				std::unique_ptr<std::atomic<uint64_t>[]> words;
+			};
+
+			void CreateBitSet(size_t bitCount, BitSet *outBits)
+			{
+				const size_t wordCount = (bitCount + 63) / 64;
+
+				outBits->words.reset(new std::atomic<uint64_t>[wordCount]);
+
+				for (size_t wordIndex = 0; wordIndex < wordCount; ++wordIndex)
+					outBits->words[wordIndex].store(0, std::memory_order_relaxed);
+			}
+
+			void SetBit(BitSet *inoutBits, size_t bit)
+			{
+				std::atomic<uint64_t> &word = inoutBits->words[bit >> 6];
+				const uint64_t mask = 1ull << (bit & 63);
+
+				// Most sets hit bits a neighbouring triangle already set. Skip the atomic then.
+				if (!(word.load(std::memory_order_relaxed) & mask))
+					word.fetch_or(mask, std::memory_order_relaxed);
+			}
+
+			bool TestBit(const BitSet &bits, size_t bit)
+			{
+				return (bits.words[bit >> 6].load(std::memory_order_relaxed) >> (bit & 63)) & 1;
+			}
+
+			// First order upwind eikonal update (Zhao 2005) from the smallest neighbour
+			// along each axis. The sign comes from the closest neighbour.
+			void UpdateVoxel(volume::Grid *inoutGrid, uint32_t x, uint32_t y, uint32_t z)
+			{
+				float * const values = inoutGrid->values.data();
+				const size_t index = volume::Index(*inoutGrid, x, y, z);
+				const uint32_t coords[3] = { x, y, z };
+				const size_t strides[3] = { 1, inoutGrid->dims.x, (size_t)inoutGrid->dims.x * inoutGrid->dims.y };
+				const float h = inoutGrid->voxelSize;
+				float a[3];
+				float nearest = std::numeric_limits<float>::infinity();
+
+				for (unsigned axis = 0; axis < 3; ++axis)
+				{
+					a[axis] = std::numeric_limits<float>::infinity();
+
+					if (coords[axis] > 0)
+					{
+						const float neighbour = values[index - strides[axis]];
+
+						a[axis] = std::abs(neighbour);
+						nearest = std::abs(neighbour) < std::abs(nearest) ? neighbour : nearest;
+					}
+
+					if (coords[axis] + 1 < inoutGrid->dims[axis])
+					{
+						const float neighbour = values[index + strides[axis]];
+
+						a[axis] = std::min(a[axis], std::abs(neighbour));
+						nearest = std::abs(neighbour) < std::abs(nearest) ? neighbour : nearest;
+					}
+				}
+
+				const float u = volume::SolveEikonal(a[0], a[1], a[2], h);
+
+				if (!std::isfinite(u))
+					return;
+
+				if (u < std::abs(values[index]))
+					values[index] = nearest < 0.0f ? -u : u;
+			}
+
+			// One Gauss-Seidel pass in direction signs. Blocks on the same diagonal
+			// level only depend on blocks of the previous level, so each level runs
+			// in parallel while every block sweeps its voxels in cache friendly order.
+			void Sweep(jobs::Pool *pool, const BitSet &fixed, const int signs[3], volume::Grid *inoutGrid)
+			{
+				const glm::uvec3 dims = inoutGrid->dims;
+				const glm::uvec3 blocks = (dims + glm::uvec3(SWEEP_BLOCK - 1)) / SWEEP_BLOCK;
+				const uint32_t levelCount = blocks.x + blocks.y + blocks.z - 2;
+
+				for (uint32_t level = 0; level < levelCount; ++level)
+				{
+					const uint32_t firstX = level > blocks.y + blocks.z - 2 ? level - (blocks.y + blocks.z - 2) : 0;
+					const uint32_t lastX = std::min(blocks.x - 1, level);
+
+					jobs::ParallelFor(pool, lastX - firstX + 1, [&](uint32_t item, unsigned)
+					{
+						const uint32_t bx = firstX + item;
+						const uint32_t firstY = level - bx > blocks.z - 1 ? level - bx - (blocks.z - 1) : 0;
+						const uint32_t lastY = std::min(blocks.y - 1, level - bx);
+
+						for (uint32_t by = firstY; by <= lastY; ++by)
+						{
+							const uint32_t block[3] = { bx, by, level - bx - by };
+							uint32_t begin[3], end[3];
+
+							// Block coordinates count along the sweep direction.
+							for (unsigned axis = 0; axis < 3; ++axis)
+							{
+								const uint32_t b = signs[axis] > 0 ? block[axis] : blocks[axis] - 1 - block[axis];
+
+								begin[axis] = b * SWEEP_BLOCK;
+								end[axis] = std::min(begin[axis] + SWEEP_BLOCK, dims[axis]);
+							}
+
+							for (uint32_t i = 0; i < end[2] - begin[2]; ++i)
+							{
+								const uint32_t z = signs[2] > 0 ? begin[2] + i : end[2] - 1 - i;
+
+								for (uint32_t j = 0; j < end[1] - begin[1]; ++j)
+								{
+									const uint32_t y = signs[1] > 0 ? begin[1] + j : end[1] - 1 - j;
+
+									for (uint32_t k = 0; k < end[0] - begin[0]; ++k)
+									{
+										const uint32_t x = signs[0] > 0 ? begin[0] + k : end[0] - 1 - k;
+
+										if (!TestBit(fixed, volume::Index(*inoutGrid, x, y, z)))
+											UpdateVoxel(inoutGrid, x, y, z);
+									}
+								}
+							}
+						}
+					});
+				}
+			}
+
+			double SecondsSince(const std::chrono::high_resolution_clock::time_point &start)
+			{
+				return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+			}
+		}
+
+		bool BakeMesh(const mesh::Mesh &mesh, const Settings &settings, volume::Grid *outGrid, Stats *outoptStats)
+		{
+			const auto startTime = std::chrono::high_resolution_clock::now();
+			const size_t triangleCount = mesh::TriangleCount(mesh);
+			Stats stats;
+
+			if (triangleCount == 0 || settings.resolution <= 2 * settings.padding + 2)
+				return false;
+
+			// Grid fitted around the mesh with padding on every side.
+			glm::vec3 meshMin, meshMax;
+			mesh::ComputeBounds(mesh, &meshMin, &meshMax);
+
+			const glm::vec3 extent = meshMax - meshMin;
+			const float longest = std::max(extent.x, std::max(extent.y, extent.z));
+
+			if (!(longest > 0.0f))
+				return false;
+
+			volume::Grid &grid = *outGrid;
+			grid.voxelSize = longest / (float)(settings.resolution - 1 - 2 * settings.padding);
+
+			for (unsigned axis = 0; axis < 3; ++axis)
+				grid.dims[axis] = (uint32_t)std::ceil(extent[axis] / grid.voxelSize) + 1 + 2 * settings.padding;
+
+			grid.origin = (meshMin + meshMax) * 0.5f - glm::vec3(grid.dims - glm::uvec3(1)) * (grid.voxelSize * 0.5f);
+			grid.values.assign((size_t)grid.dims.x * grid.dims.y * grid.dims.z, std::numeric_limits<float>::infinity());
+
+			// Triangle BVH, with the extra per node data the sign mode needs.
+			auto phaseStart = std::chrono::high_resolution_clock::now();
+			Bvh bvh;
+			BuildBvh(mesh, settings.sign == SignMode::PSEUDO_NORMAL, settings.sign == SignMode::WINDING_NUMBER, &bvh);
+			stats.bvhSeconds = SecondsSince(phaseStart);
+			stats.bvhNodes = (uint32_t)bvh.nodes.size();
+
+			jobs::Pool * const pool = jobs::CreatePool(settings.threadCount);
+			const float band = settings.bandWidth * grid.voxelSize;
+			const glm::uvec3 bricks = (grid.dims + glm::uvec3(BRICK_SIZE - 1)) / BRICK_SIZE;
+			BitSet bandBricks, fixed;
+
+			CreateBitSet((size_t)bricks.x * bricks.y * bricks.z, &bandBricks);
+			CreateBitSet(grid.values.size(), &fixed);
+
+			// Mark every brick within the band of some triangle.
+			phaseStart = std::chrono::high_resolution_clock::now();
+			const uint32_t TRIANGLES_PER_ITEM = 4096;
+			jobs::ParallelFor(pool, (uint32_t)((triangleCount + TRIANGLES_PER_ITEM - 1) / TRIANGLES_PER_ITEM), [&](uint32_t item, unsigned)
+			{
+				const size_t end = std::min<size_t>((size_t)(item + 1) * TRIANGLES_PER_ITEM, triangleCount);
+
+				for (size_t triIndex = (size_t)item * TRIANGLES_PER_ITEM; triIndex < end; ++triIndex)
+				{
+					const Triangle &tri = bvh.triangles[triIndex];
+					const glm::vec3 lo = (glm::min(tri.v[0], glm::min(tri.v[1], tri.v[2])) - band - grid.origin) / (grid.voxelSize * BRICK_SIZE);
+					const glm::vec3 hi = (glm::max(tri.v[0], glm::max(tri.v[1], tri.v[2])) + band - grid.origin) / (grid.voxelSize * BRICK_SIZE);
+					const glm::uvec3 first = glm::uvec3(glm::max(lo, glm::vec3(0.0f)));
+					const glm::uvec3 last = glm::min(glm::uvec3(glm::max(hi, glm::vec3(0.0f))), bricks - glm::uvec3(1));
+
+					for (uint32_t bz = first.z; bz <= last.z; ++bz)
+						for (uint32_t by = first.y; by <= last.y; ++by)
+							for (uint32_t bx = first.x; bx <= last.x; ++bx)
+								SetBit(&bandBricks, ((size_t)bz * bricks.y + by) * bricks.x + bx);
+				}
+			});
+
+			std::vector<uint32_t> brickList;
+			for (uint32_t brickIndex = 0; brickIndex < bricks.x * bricks.y * bricks.z; ++brickIndex)
+				if (TestBit(bandBricks, brickIndex))
+					brickList.push_back(brickIndex);
+
+			// Exact distance and sign for every voxel of the marked bricks that is inside the band.
+			std::vector<uint64_t> threadBandVoxels(jobs::ThreadCount(pool), 0);
+			const uint32_t BRICKS_PER_ITEM = 16;
+			jobs::ParallelFor(pool, (uint32_t)((brickList.size() + BRICKS_PER_ITEM - 1) / BRICKS_PER_ITEM), [&](uint32_t item, unsigned threadIndex)
+			{
+				const size_t end = std::min<size_t>((size_t)(item + 1) * BRICKS_PER_ITEM, brickList.size());
+
+				for (size_t listIndex = (size_t)item * BRICKS_PER_ITEM; listIndex < end; ++listIndex)
+				{
+					const uint32_t brickIndex = brickList[listIndex];
+					const glm::uvec3 base = glm::uvec3(brickIndex % bricks.x, (brickIndex / bricks.x) % bricks.y, brickIndex / (bricks.x * bricks.y)) * BRICK_SIZE;
+					const glm::uvec3 top = glm::min(base + glm::uvec3(BRICK_SIZE), grid.dims);
+
+					for (uint32_t z = base.z; z < top.z; ++z)
+						for (uint32_t y = base.y; y < top.y; ++y)
+						{
+							float previousDistance = std::numeric_limits<float>::infinity();
+							uint32_t previousTriangle = INVALID_TRIANGLE;
+							bool previousInside = false;
+
+							for (uint32_t x = base.x; x < top.x; ++x)
+							{
+								const glm::vec3 p = grid.origin + glm::vec3(x, y, z) * grid.voxelSize;
+								// Distance is 1-Lipschitz, so the previous voxel bounds the search.
+								const float bound = std::min(band, previousDistance + grid.voxelSize * 1.001f);
+								Closest closest;
+
+								FindClosest(bvh, p, bound * bound, previousTriangle, &closest);
+
+								if (closest.triangle == INVALID_TRIANGLE)
+								{
+									previousDistance = std::numeric_limits<float>::infinity();
+									previousTriangle = INVALID_TRIANGLE;
+									continue;
+								}
+
+								const size_t index = volume::Index(grid, x, y, z);
+								const float distance = std::sqrt(closest.distSq);
+								bool inside;
+
+								if (settings.sign == SignMode::PSEUDO_NORMAL)
+									inside = glm::dot(p - closest.point, FeatureNormal(bvh.normals[closest.triangle], closest.feature)) < 0.0f;
+								else if (previousTriangle != INVALID_TRIANGLE && previousDistance + distance > grid.voxelSize)
+									inside = previousInside; // the surface cannot pass between two voxels this far from it
+								else
+									inside = WindingNumber(bvh, p) > 0.5f;
+
+								grid.values[index] = inside ? -distance : distance;
+								SetBit(&fixed, index);
+								++threadBandVoxels[threadIndex];
+								previousDistance = distance;
+								previousTriangle = closest.triangle;
+								previousInside = inside;
+							}
+						}
+				}
+			});
+
+			for (uint64_t count : threadBandVoxels)
+				stats.bandVoxels += count;
+
+			stats.bandSeconds = SecondsSince(phaseStart);
+
+			// Everything else from the eikonal equation, sweeping outwards from the band.
+			phaseStart = std::chrono::high_resolution_clock::now();
+
+			for (uint32_t round = 0; round < settings.sweepRounds; ++round)
+			{
+				for (unsigned direction = 0; direction < 8; ++direction)
+				{
+					const int signs[3] = { (direction & 1) ? -1 : 1, (direction & 2) ? -1 : 1, (direction & 4) ? -1 : 1 };
+
+					Sweep(pool, fixed, signs, &grid);
+				}
+			}
+
+			stats.sweepSeconds = SecondsSince(phaseStart);
+			jobs::DestroyPool(pool);
+
+			// Only possible for grids the band never reached, such as a degenerate mesh.
+			const float farAway = longest * 2.0f;
+			for (float &value : grid.values)
+				if (!std::isfinite(value))
+					value = farAway;
+
+			stats.triangles = triangleCount;
+			stats.seconds = SecondsSince(startTime);
+
+			if (outoptStats)
+				*outoptStats = stats;
+
+			return true;
+		}
+	}
+}
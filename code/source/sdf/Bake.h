@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Mesh.h"
+#include "Volume.h"
+
+// Triangle mesh to signed distance grid conversion, for using imported assets in
+// CSG with modeled shapes. Distances are exact within a narrow band around the
+// surface and extended to the rest of the grid by solving the eikonal equation.
+namespace sdf
+{
+	namespace bake
+	{
+		enum class SignMode : unsigned char
+		{
+			PSEUDO_NORMAL,   // angle weighted pseudo normals. Exact for closed, manifold meshes.
+			WINDING_NUMBER   // generalized winding number. Tolerates holes and self intersections.
+		};
+
+		struct Settings
+		{
+			uint32_t resolution = 256;   // samples along the longest axis of the mesh bounds
+			uint32_t padding = 4;        // samples of empty space around the mesh bounds
+			float bandWidth = 3.0f;      // in voxels. Exact distances are computed inside it.
+			uint32_t sweepRounds = 1;    // rounds of 8 fast sweeping passes
+			SignMode sign = SignMode::PSEUDO_NORMAL;
+			unsigned threadCount = 0;    // 0 uses every hardware thread
+		};
+
+		struct Stats
+		{
+			uint64_t triangles = 0;
+			uint64_t bandVoxels = 0;
+			uint32_t bvhNodes = 0;
+			double bvhSeconds = 0.0;
+			double bandSeconds = 0.0;    // band marking, exact distances and signs
+			double sweepSeconds = 0.0;
+			double seconds = 0.0;
+		};
+
+		bool BakeMesh(const mesh::Mesh &mesh, const Settings &settings, volume::Grid *outGrid, Stats *outoptStats = nullptr);
+	}
+}
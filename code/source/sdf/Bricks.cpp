@@ -0,0 +1,269 @@
+#include "Bricks.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace sdf
+{
+	namespace bricks
+	{
+		namespace
+		{
+			// vkCmdCopyBufferToImage wants buffer offsets aligned to the texel size
+			// and to 4. 16 covers both formats.
+			static const uint64_t STAGING_ALIGNMENT = 16;
+
+			size_t BrickIndex(const Volume &volume, uint32_t x, uint32_t y, uint32_t z)
+			{
+				return ((size_t)z * volume.brickDims.y + y) * volume.brickDims.x + x;
+			}
+
+			uint64_t Reserve(Upload *inoutUpload, uint64_t size)
+			{
+				const uint64_t offset = (inoutUpload->staging.size() + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+
+				inoutUpload->staging.resize(offset + size);
+				return offset;
+			}
+
+			// Samples of brick (bx, by, bz) in voxels, edge samples repeated past the
+			// end of the grid. Returns the sample with the smallest magnitude and
+			// whether the brick has samples of both signs.
+			float GatherBrick(const volume::Grid &grid, uint32_t bx, uint32_t by, uint32_t bz, float *outSamples, bool *outMixedSigns)
+			{
+				const float scale = 1.0f / grid.voxelSize;
+				float nearest = INFINITY;
+				bool negative = false;
+				bool positive = false;
+
+				for (uint32_t z = 0; z < BRICK_SAMPLES; ++z)
+				{
+					const uint32_t gz = std::min(bz * BRICK_CELLS + z, grid.dims.z - 1);
+
+					for (uint32_t y = 0; y < BRICK_SAMPLES; ++y)
+					{
+						const uint32_t gy = std::min(by * BRICK_CELLS + y, grid.dims.y - 1);
+						const float *row = grid.values.data() + volume::Index(grid, 0, gy, gz);
+
+						for (uint32_t x = 0; x < BRICK_SAMPLES; ++x)
+						{
+							const float value = row[std::min(bx * BRICK_CELLS + x, grid.dims.x - 1)];
+
+							*outSamples++ = value * scale;
+							if (std::abs(value) < std::abs(nearest))
+								nearest = value;
+							negative |= value < 0.0f;
+							positive |= value >= 0.0f;
+						}
+					}
+				}
+
+				*outMixedSigns = negative && positive;
+				return nearest;
+			}
+		}
+
+		void CreateAtlas(Atlas *outAtlas)
+		{
+			const uint32_t slotCount = ATLAS_SLOTS * ATLAS_SLOTS * ATLAS_SLOTS;
+
+			outAtlas->volumes.clear();
+			outAtlas->freeSlots.resize(slotCount);
+			for (uint32_t i = 0; i < slotCount; ++i)
+				outAtlas->freeSlots[i] = slotCount - 1 - i;
+			outAtlas->usedSlots = 0;
+		}
+
+		uint32_t AddVolume(Atlas *inoutAtlas, const std::shared_ptr<const volume::Grid> &grid)
+		{
+			Volume volume;
+
+			volume.grid = grid;
+			volume.brickDims = BrickDims(*grid);
+
+			const size_t brickCount = (size_t)volume.brickDims.x * volume.brickDims.y * volume.brickDims.z;
+
+			volume.entries.assign(brickCount, Entry{ EMPTY_SLOT, 0.0f });
+			volume.dirty.assign(brickCount, true);
+			volume.dirtyMin = glm::uvec3(0);
+			volume.dirtyMax = volume.brickDims - glm::uvec3(1);
+			volume.anyDirty = true;
+
+			inoutAtlas->volumes.push_back(std::move(volume));
+			return (uint32_t)inoutAtlas->volumes.size() - 1;
+		}
+
+		void MarkDirty(Atlas *inoutAtlas, uint32_t volumeIndex, const glm::uvec3 &sampleMin, const glm::uvec3 &sampleMax)
+		{
+			Volume &volume = inoutAtlas->volumes[volumeIndex];
+			glm::uvec3 lo, hi;
+
+			// Border samples belong to both bricks that share them.
+			for (unsigned axis = 0; axis < 3; ++axis)
+			{
+				lo[axis] = std::min(sampleMin[axis] == 0 ? 0 : (sampleMin[axis] - 1) / BRICK_CELLS, volume.brickDims[axis] - 1);
+				hi[axis] = std::min(sampleMax[axis] / BRICK_CELLS, volume.brickDims[axis] - 1);
+			}
+
+			for (uint32_t z = lo.z; z <= hi.z; ++z)
+			{
+				for (uint32_t y = lo.y; y <= hi.y; ++y)
+				{
+					for (uint32_t x = lo.x; x <= hi.x; ++x)
+						volume.dirty[BrickIndex(volume, x, y, z)] = true;
+				}
+			}
+
+			if (volume.anyDirty)
+			{
+				volume.dirtyMin = glm::min(volume.dirtyMin, lo);
+				volume.dirtyMax = glm::max(volume.dirtyMax, hi);
+			}
+			else
+			{
+				volume.dirtyMin = lo;
+				volume.dirtyMax = hi;
+				volume.anyDirty = true;
+			}
+		}
+
+		bool BuildUpload(Atlas *inoutAtlas, Upload *outUpload)
+		{
+			static const uint32_t BRICK_VOLUME = BRICK_SAMPLES * BRICK_SAMPLES * BRICK_SAMPLES;
+			float samples[BRICK_VOLUME];
+			bool complete = true;
+
+			outUpload->staging.clear();
+			outUpload->atlasCopies.clear();
+			outUpload->indirectionCopies.assign(inoutAtlas->volumes.size(), Copy{ 0, glm::uvec3(0), glm::uvec3(0) });
+			outUpload->bricksWritten = 0;
+			outUpload->bricksFreed = 0;
+
+			for (size_t volumeIndex = 0; volumeIndex < inoutAtlas->volumes.size(); ++volumeIndex)
+			{
+				Volume &volume = inoutAtlas->volumes[volumeIndex];
+
+				if (!volume.anyDirty)
+					continue;
+
+				const volume::Grid &grid = *volume.grid;
+				const float band = SURFACE_BAND * grid.voxelSize;
+				bool stillDirty = false;
+
+				for (uint32_t z = volume.dirtyMin.z; z <= volume.dirtyMax.z; ++z)
+				{
+					for (uint32_t y = volume.dirtyMin.y; y <= volume.dirtyMax.y; ++y)
+					{
+						for (uint32_t x = volume.dirtyMin.x; x <= volume.dirtyMax.x; ++x)
+						{
+							const size_t brickIndex = BrickIndex(volume, x, y, z);
+
+							if (!volume.dirty[brickIndex])
+								continue;
+
+							Entry &entry = volume.entries[brickIndex];
+							bool mixedSigns;
+							const float nearest = GatherBrick(grid, x, y, z, samples, &mixedSigns);
+
+							// Trilinear values never have a smaller magnitude than the
+							// samples they blend, unless the signs differ.
+							entry.bound = mixedSigns ? 0.0f : nearest;
+
+							if (!mixedSigns && std::abs(nearest) > band)
+							{
+								if (entry.slot != EMPTY_SLOT)
+								{
+									inoutAtlas->freeSlots.push_back(entry.slot);
+									--inoutAtlas->usedSlots;
+									entry.slot = EMPTY_SLOT;
+									++outUpload->bricksFreed;
+								}
+								volume.dirty[brickIndex] = false;
+								continue;
+							}
+
+							if (entry.slot == EMPTY_SLOT)
+							{
+								if (inoutAtlas->freeSlots.empty())
+								{
+									complete = false;
+									stillDirty = true;
+									continue;
+								}
+								entry.slot = inoutAtlas->freeSlots.back();
+								inoutAtlas->freeSlots.pop_back();
+								++inoutAtlas->usedSlots;
+							}
+
+							const uint64_t offset = Reserve(outUpload, BRICK_BYTES);
+							uint16_t *texels = (uint16_t*)(outUpload->staging.data() + offset);
+
+							for (uint32_t i = 0; i < BRICK_VOLUME; ++i)
+								texels[i] = FloatToHalf(samples[i]);
+
+							outUpload->atlasCopies.push_back(Copy{ offset, SlotOrigin(entry.slot), glm::uvec3(BRICK_SAMPLES) });
+							++outUpload->bricksWritten;
+							volume.dirty[brickIndex] = false;
+						}
+					}
+				}
+
+				// One region for the whole dirty box keeps the copy a single call per
+				// image. Clean entries inside it are rewritten unchanged.
+				const glm::uvec3 extent = volume.dirtyMax - volume.dirtyMin + glm::uvec3(1);
+				const uint64_t offset = Reserve(outUpload, (uint64_t)extent.x * extent.y * extent.z * sizeof(Entry));
+				Entry *entries = (Entry*)(outUpload->staging.data() + offset);
+
+				for (uint32_t z = 0; z < extent.z; ++z)
+				{
+					for (uint32_t y = 0; y < extent.y; ++y)
+					{
+						const Entry *row = volume.entries.data() + BrickIndex(volume, volume.dirtyMin.x, volume.dirtyMin.y + y, volume.dirtyMin.z + z);
+
+						memcpy(entries, row, extent.x * sizeof(Entry));
+						entries += extent.x;
+					}
+				}
+
+				outUpload->indirectionCopies[volumeIndex] = Copy{ offset, volume.dirtyMin, extent };
+				volume.anyDirty = stillDirty;
+			}
+
+			return complete;
+		}
+
+		glm::uvec3 BrickDims(const volume::Grid &grid)
+		{
+			return glm::max((grid.dims - glm::uvec3(1) + glm::uvec3(BRICK_CELLS - 1)) / BRICK_CELLS, glm::uvec3(1));
+		}
+
+		glm::uvec3 SlotOrigin(uint32_t slot)
+		{
+			return glm::uvec3(slot % ATLAS_SLOTS, slot / ATLAS_SLOTS % ATLAS_SLOTS, slot / (ATLAS_SLOTS * ATLAS_SLOTS)) * BRICK_SAMPLES;
+		}
+
+		uint16_t FloatToHalf(float value)
+		{
+			uint32_t bits;
+
+			memcpy(&bits, &value, sizeof(bits));
+
+			const uint32_t sign = (bits >> 16) & 0x8000u;
+			const int32_t exponent = (int32_t)((bits >> 23) & 0xffu) - 127 + 15;
+			uint32_t mantissa = bits & 0x7fffffu;
+
+			if (exponent >= 31)
+				return (uint16_t)(sign | 0x7c00u);   // overflow and infinity. Distances are never NaN.
+			if (exponent <= 0)
+			{
+				if (exponent < -10)
+					return (uint16_t)sign;
+				mantissa |= 0x800000u;
+				return (uint16_t)(sign | ((mantissa >> (14 - exponent)) + ((mantissa >> (13 - exponent)) & 1u)));
+			}
+
+			// Round to nearest. A carry out of the mantissa correctly bumps the exponent.
+			return (uint16_t)(sign | (((uint32_t)exponent << 10) + (mantissa >> 13) + ((mantissa >> 12) & 1u)));
+		}
+	}
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "Volume.h"
+#include <memory>
+
+// Sparse GPU layout for sampled volumes: bricks near the surface live in slots of
+// one shared 3D atlas texture, and a small indirection volume per grid maps each
+// brick to its slot or to a conservative distance for empty space. Edits only
+// re-upload the bricks they touched. This is the CPU side: slot allocation and
+// the staging data and copy regions, ready for vkCmdCopyBufferToImage.
+namespace sdf
+{
+	namespace bricks
+	{
+		static const uint32_t BRICK_SAMPLES = 8;                 // samples per brick side
+		static const uint32_t BRICK_CELLS = BRICK_SAMPLES - 1;   // neighbours share border samples, so filtering never crosses bricks
+		static const uint32_t ATLAS_SLOTS = 32;                  // slots per atlas side
+		static const uint32_t ATLAS_TEXELS = ATLAS_SLOTS * BRICK_SAMPLES;
+		static const uint32_t EMPTY_SLOT = ~0u;
+		static const float SURFACE_BAND = 2.0f;                  // in voxels. Bricks with a sample this close get a slot.
+
+		// Atlas texel format is R16_SFLOAT, in voxels. Indirection texel format
+		// is R32G32_UINT, matching Entry.
+		static const uint32_t ATLAS_TEXEL_BYTES = 2;
+		static const uint32_t BRICK_BYTES = BRICK_SAMPLES * BRICK_SAMPLES * BRICK_SAMPLES * ATLAS_TEXEL_BYTES;
+
+		// Shader bindings in the ray marching descriptor set.
+		static const uint32_t ATLAS_BINDING = 0;
+		inline uint32_t IndirectionBinding(uint32_t volumeIndex) { return 1 + volumeIndex; }
+
+		struct Entry
+		{
+			uint32_t slot;   // EMPTY_SLOT when the brick has no samples near the surface
+			float bound;     // sample with the smallest magnitude. For empty bricks, a lower bound of the field in them.
+		};
+
+		struct Volume
+		{
+			std::shared_ptr<const volume::Grid> grid;
+			glm::uvec3 brickDims;
+			memory::Vector<Entry, memory::Tag::BRICKS> entries; // brickDims, x fastest
+			memory::Vector<bool, memory::Tag::BRICKS> dirty;
+			glm::uvec3 dirtyMin;              // bounding box of dirty bricks, inclusive
+			glm::uvec3 dirtyMax;
+			bool anyDirty;
+		};
+
+		struct Atlas
+		{
+			std::vector<Volume> volumes;
+			memory::Vector<uint32_t, memory::Tag::BRICKS> freeSlots; // popped from the back, so the atlas fills front to back
+			uint32_t usedSlots = 0;
+		};
+
+		// Texel region of one image, sourced from offset in Upload::staging.
+		struct Copy
+		{
+			uint64_t offset;
+			glm::uvec3 origin;
+			glm::uvec3 extent;
+		};
+
+		struct Upload
+		{
+			memory::Vector<uint8_t, memory::Tag::STAGING> staging;
+			std::vector<Copy> atlasCopies;
+			std::vector<Copy> indirectionCopies;   // zero extent for volumes without changes
+			uint32_t bricksWritten = 0;
+			uint32_t bricksFreed = 0;
+		};
+
+		void CreateAtlas(Atlas *outAtlas);
+
+		// Every brick of a new volume starts dirty. Returns the volume's index,
+		// which is also the index of its indirection binding.
+		uint32_t AddVolume(Atlas *inoutAtlas, const std::shared_ptr<const volume::Grid> &grid);
+
+		// The samples in [sampleMin, sampleMax] changed.
+		void MarkDirty(Atlas *inoutAtlas, uint32_t volumeIndex, const glm::uvec3 &sampleMin, const glm::uvec3 &sampleMax);
+
+		// Slots for bricks that reached the surface, slots back for bricks that
+		// left it, and the data and regions to upload for every dirty brick.
+		// Returns false if the atlas ran out of slots. Bricks left without one
+		// stay dirty and keep their conservative bound.
+		bool BuildUpload(Atlas *inoutAtlas, Upload *outUpload);
+
+		glm::uvec3 BrickDims(const volume::Grid &grid);
+		glm::uvec3 SlotOrigin(uint32_t slot);   // in atlas texels
+		uint16_t FloatToHalf(float value);
+	}
+}
@@ -0,0 +1,518 @@
+#include "DirWatch.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#elif defined(__linux__)
+#include <cerrno>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace sdf
+{
+	namespace dirwatch
+	{
+		namespace
+		{
+			typedef std::chrono::steady_clock Clock;
+
+			// Whether a path existed before the batch's first event for it, and
+			// whether it does after its last.
+			struct Pending
+			{
+				bool existed;
+				bool exists;
+			};
+
+			struct Batch
+			{
+				std::unordered_map<std::string, Pending> paths;
+				Clock::time_point first;
+				Clock::time_point last;
+				bool open = false;
+			};
+
+			// An event that starts the batch or extends its quiet window.
+			void Mark(Batch *inoutBatch)
+			{
+				const Clock::time_point now = Clock::now();
+
+				if (!inoutBatch->open)
+					inoutBatch->first = now;
+
+				inoutBatch->last = now;
+				inoutBatch->open = true;
+			}
+
+			void Touch(const std::string &path, bool existed, bool exists, Batch *inoutBatch)
+			{
+				Mark(inoutBatch);
+				inoutBatch->paths.emplace(path, Pending{ existed, exists }).first->second.exists = exists;
+			}
+
+			// -1 when there is no batch, as poll and WaitForSingleObject take it.
+			int DueMs(const Settings &settings, const Batch &batch)
+			{
+				if (!batch.open)
+					return -1;
+
+				const Clock::time_point now = Clock::now();
+				const Clock::time_point due = std::min(batch.last + std::chrono::milliseconds(settings.coalesceMs), batch.first + std::chrono::milliseconds(settings.maxCoalesceMs));
+
+				if (due <= now)
+					return 0;
+
+				return (int)std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count() + 1;
+			}
+
+			// Closes the batch. False when no path changed on the whole, as for
+			// temporaries.
+			bool Resolve(Batch *inoutBatch, Changes *outChanges)
+			{
+				*outChanges = Changes();
+
+				for (const auto &path : inoutBatch->paths)
+				{
+					if (!path.second.existed && path.second.exists)
+						outChanges->added.push_back(path.first);
+					else if (path.second.existed && !path.second.exists)
+						outChanges->removed.push_back(path.first);
+					else if (path.second.existed)
+						outChanges->modified.push_back(path.first);
+				}
+
+				std::sort(outChanges->added.begin(), outChanges->added.end());
+				std::sort(outChanges->removed.begin(), outChanges->removed.end());
+				std::sort(outChanges->modified.begin(), outChanges->modified.end());
+				outChanges->seconds = std::chrono::duration<double>(Clock::now() - inoutBatch->first).count();
+
+				inoutBatch->paths.clear();
+				inoutBatch->open = false;
+
+				return !outChanges->added.empty() || !outChanges->removed.empty() || !outChanges->modified.empty();
+			}
+
+			double SecondsSince(Clock::time_point start)
+			{
+				return std::chrono::duration<double>(Clock::now() - start).count();
+			}
+
+#if !defined(__linux__)
+			// Last write time of every file under dir.
+			typedef std::unordered_map<std::string, int64_t> Snapshot;
+
+			Snapshot WalkTree(const std::string &dir)
+			{
+				Snapshot files;
+				std::error_code error;
+
+				for (std::filesystem::recursive_directory_iterator file(dir, std::filesystem::directory_options::skip_permission_denied, error), end; !error && file != end; file.increment(error))
+				{
+					std::error_code fileError;
+
+					if (file->is_regular_file(fileError))
+						files.emplace(file->path().string(), (int64_t)file->last_write_time(fileError).time_since_epoch().count());
+				}
+
+				return files;
+			}
+
+			void Diff(const Snapshot &oldFiles, const Snapshot &newFiles, Batch *inoutBatch)
+			{
+				for (const auto &oldFile : oldFiles)
+				{
+					const auto newFile = newFiles.find(oldFile.first);
+
+					if (newFile == newFiles.end())
+						Touch(oldFile.first, true, false, inoutBatch);
+					else if (newFile->second != oldFile.second)
+						Touch(oldFile.first, true, true, inoutBatch);
+				}
+
+				for (const auto &newFile : newFiles)
+				{
+					if (oldFiles.find(newFile.first) == oldFiles.end())
+						Touch(newFile.first, false, true, inoutBatch);
+				}
+			}
+#endif
+		}
+
+		struct Watcher
+		{
+			std::string dir;
+			Settings settings;
+			Stats stats;
+			Batch batch;
+#if defined(_WIN32)
+			HANDLE change = INVALID_HANDLE_VALUE;
+			HANDLE stop = nullptr;
+			Snapshot files;
+#elif defined(__linux__)
+			int inotify = -1;
+			int stop = -1;
+			std::unordered_map<int, std::string> directories;   // by watch descriptor
+			std::unordered_set<std::string> files;
+#else
+			std::atomic<bool> stop{ false };
+			Snapshot files;
+#endif
+		};
+
+#if defined(__linux__)
+		namespace
+		{
+			static const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW;
+
+			void AddWatch(const std::string &dir, Watcher *inoutWatcher)
+			{
+				const int watch = inotify_add_watch(inoutWatcher->inotify, dir.c_str(), WATCH_MASK);
+
+				if (watch >= 0)
+					inoutWatcher->directories[watch] = dir;
+			}
+
+			// Watches dir and every directory under it. Each directory is watched
+			// before it is listed, so files created while this runs are either
+			// listed or have events. With report its files go in the batch,
+			// and into optFound when given.
+			void AddTree(const std::string &dir, bool report, std::unordered_set<std::string> *optFound, Watcher *inoutWatcher)
+			{
+				std::error_code error;
+
+				AddWatch(dir, inoutWatcher);
+				for (std::filesystem::recursive_directory_iterator file(dir, std::filesystem::directory_options::skip_permission_denied, error), end; !error && file != end; file.increment(error))
+				{
+					std::error_code fileError;
+
+					if (file->is_directory(fileError) && !file->is_symlink(fileError))
+					{
+						AddWatch(file->path().string(), inoutWatcher);
+					}
+					else if (file->is_regular_file(fileError))
+					{
+						const std::string path = file->path().string();
+
+						if (report)
+							Touch(path, inoutWatcher->files.count(path) != 0, true, &inoutWatcher->batch);
+						if (optFound)
+							optFound->insert(path);
+						inoutWatcher->files.insert(path);
+					}
+				}
+			}
+
+			// A directory moved away takes its files and subdirectories with it,
+			// with no events for them.
+			void RemoveTree(const std::string &dir, Watcher *inoutWatcher)
+			{
+				const std::string prefix = dir + '/';
+
+				for (auto file = inoutWatcher->files.begin(); file != inoutWatcher->files.end();)
+				{
+					if (file->compare(0, prefix.size(), prefix) == 0)
+					{
+						Touch(*file, true, false, &inoutWatcher->batch);
+						file = inoutWatcher->files.erase(file);
+					}
+					else
+					{
+						++file;
+					}
+				}
+
+				for (auto directory = inoutWatcher->directories.begin(); directory != inoutWatcher->directories.end();)
+				{
+					if (directory->second == dir || directory->second.compare(0, prefix.size(), prefix) == 0)
+					{
+						inotify_rm_watch(inoutWatcher->inotify, directory->first);
+						directory = inoutWatcher->directories.erase(directory);
+					}
+					else
+					{
+						++directory;
+					}
+				}
+			}
+
+			// Events were dropped, so what changed is found by walking the tree
+			// again. Every file found is reported, as any of them may have been
+			// written.
+			void Rewalk(Watcher *inoutWatcher)
+			{
+				std::unordered_set<std::string> found;
+
+				AddTree(inoutWatcher->dir, true, &found, inoutWatcher);
+				for (auto file = inoutWatcher->files.begin(); file != inoutWatcher->files.end();)
+				{
+					if (found.count(*file) == 0)
+					{
+						Touch(*file, true, false, &inoutWatcher->batch);
+						file = inoutWatcher->files.erase(file);
+					}
+					else
+					{
+						++file;
+					}
+				}
+
+				++inoutWatcher->stats.walks;
+			}
+
+			void HandleEvent(const inotify_event &event, Watcher *inoutWatcher)
+			{
+				++inoutWatcher->stats.events;
+
+				if (event.mask & IN_Q_OVERFLOW)
+				{
+					Rewalk(inoutWatcher);
+					return;
+				}
+
+				const auto directory = inoutWatcher->directories.find(event.wd);
+
+				if (directory == inoutWatcher->directories.end())
+					return;
+
+				if (event.mask & IN_IGNORED)
+				{
+					inoutWatcher->directories.erase(directory);
+					return;
+				}
+
+				if (event.len == 0)
+					return;
+
+				const std::string path = directory->second + '/' + event.name;
+
+				if (event.mask & IN_ISDIR)
+				{
+					// A removed directory's files and watch have their own events.
+					if (event.mask & (IN_CREATE | IN_MOVED_TO))
+						AddTree(path, true, nullptr, inoutWatcher);
+					else if (event.mask & IN_MOVED_FROM)
+						RemoveTree(path, inoutWatcher);
+				}
+				else if (event.mask & (IN_DELETE | IN_MOVED_FROM))
+				{
+					Touch(path, inoutWatcher->files.erase(path) != 0, false, &inoutWatcher->batch);
+				}
+				else
+				{
+					Touch(path, !inoutWatcher->files.insert(path).second, true, &inoutWatcher->batch);
+				}
+			}
+
+			// Everything queued, without blocking.
+			bool ReadEvents(Watcher *inoutWatcher)
+			{
+				alignas(inotify_event) char buffer[64 * 1024];
+
+				for (;;)
+				{
+					const ssize_t size = read(inoutWatcher->inotify, buffer, sizeof(buffer));
+
+					if (size < 0)
+						return errno == EAGAIN || errno == EINTR;
+					if (size == 0)
+						return false;
+
+					for (ssize_t offset = 0; offset < size;)
+					{
+						const inotify_event &event = *(const inotify_event *)(buffer + offset);
+
+						HandleEvent(event, inoutWatcher);
+						offset += sizeof(inotify_event) + event.len;
+					}
+				}
+			}
+		}
+#endif
+
+		Watcher* CreateWatcher(const char *dir, const Settings &settings)
+		{
+			std::error_code error;
+
+			if (!std::filesystem::is_directory(dir, error))
+				return nullptr;
+
+			const Clock::time_point start = Clock::now();
+			Watcher *watcher = new Watcher;
+
+			watcher->dir = dir;
+			watcher->settings = settings;
+
+#if defined(_WIN32)
+			watcher->change = FindFirstChangeNotificationA(dir, true, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE);
+			watcher->stop = CreateEventA(nullptr, true, false, nullptr);
+			watcher->files = WalkTree(watcher->dir);
+
+			if (watcher->change == INVALID_HANDLE_VALUE || !watcher->stop)
+			{
+				DestroyWatcher(watcher);
+				return nullptr;
+			}
+
+			watcher->stats.files = (uint32_t)watcher->files.size();
+#elif defined(__linux__)
+			// Joined with names as they come, so without a trailing separator.
+			while (watcher->dir.size() > 1 && watcher->dir.back() == '/')
+				watcher->dir.pop_back();
+
+			watcher->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			watcher->stop = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+			if (watcher->inotify < 0 || watcher->stop < 0)
+			{
+				DestroyWatcher(watcher);
+				return nullptr;
+			}
+
+			AddTree(watcher->dir, false, nullptr, watcher);
+			if (watcher->directories.empty())
+			{
+				DestroyWatcher(watcher);
+				return nullptr;
+			}
+
+			watcher->stats.directories = (uint32_t)watcher->directories.size();
+			watcher->stats.files = (uint32_t)watcher->files.size();
+#else
+			watcher->files = WalkTree(watcher->dir);
+			watcher->stats.files = (uint32_t)watcher->files.size();
+#endif
+
+			watcher->stats.walks = 1;
+			watcher->stats.seconds = SecondsSince(start);
+
+			return watcher;
+		}
+
+		void DestroyWatcher(Watcher *watcher)
+		{
+#if defined(_WIN32)
+			if (watcher->change != INVALID_HANDLE_VALUE)
+				FindCloseChangeNotification(watcher->change);
+			if (watcher->stop)
+				CloseHandle(watcher->stop);
+#elif defined(__linux__)
+			if (watcher->inotify >= 0)
+				close(watcher->inotify);
+			if (watcher->stop >= 0)
+				close(watcher->stop);
+#endif
+
+			delete watcher;
+		}
+
+		bool Wait(Watcher *watcher, Changes *outChanges)
+		{
+			for (;;)
+			{
+				const int dueMs = DueMs(watcher->settings, watcher->batch);
+
+				if (dueMs == 0)
+				{
+#if !defined(__linux__)
+					// The tree is walked once things have settled rather than on
+					// every notification of a burst.
+					const Clock::time_point walkStart = Clock::now();
+					Snapshot files = WalkTree(watcher->dir);
+
+					Diff(watcher->files, files, &watcher->batch);
+					watcher->files = std::move(files);
+					++watcher->stats.walks;
+					watcher->stats.files = (uint32_t)watcher->files.size();
+					watcher->stats.seconds += SecondsSince(walkStart);
+#endif
+
+					if (Resolve(&watcher->batch, outChanges))
+					{
+						++watcher->stats.batches;
+						return true;
+					}
+
+					continue;
+				}
+
+#if defined(_WIN32)
+				const HANDLE handles[] = { watcher->stop, watcher->change };
+				const DWORD waitStatus = WaitForMultipleObjects(2, handles, false, dueMs < 0 ? INFINITE : (DWORD)dueMs);
+
+				if (waitStatus == WAIT_OBJECT_0 + 1)
+				{
+					++watcher->stats.events;
+					Mark(&watcher->batch);
+
+					if (!FindNextChangeNotification(watcher->change))
+						return false;
+				}
+				else if (waitStatus != WAIT_TIMEOUT)
+				{
+					return false;
+				}
+#elif defined(__linux__)
+				pollfd handles[] = { { watcher->stop, POLLIN, 0 }, { watcher->inotify, POLLIN, 0 } };
+				const int ready = poll(handles, 2, dueMs);
+
+				if (ready < 0 && errno != EINTR)
+					return false;
+				if (handles[0].revents)
+					return false;
+
+				if (ready > 0 && (handles[1].revents & POLLIN))
+				{
+					const Clock::time_point readStart = Clock::now();
+					const bool read = ReadEvents(watcher);
+
+					watcher->stats.directories = (uint32_t)watcher->directories.size();
+					watcher->stats.files = (uint32_t)watcher->files.size();
+					watcher->stats.seconds += SecondsSince(readStart);
+
+					// The watched directory itself is gone.
+					if (!read || watcher->directories.empty())
+						return false;
+				}
+#else
+				// No notifications, so the tree is polled, a window apart.
+				if (watcher->stop)
+					return false;
+
+				std::this_thread::sleep_for(std::chrono::milliseconds(dueMs < 0 ? watcher->settings.maxCoalesceMs : dueMs));
+				if (dueMs < 0)
+					Mark(&watcher->batch);
+#endif
+			}
+		}
+
+		void Stop(Watcher *watcher)
+		{
+#if defined(_WIN32)
+			SetEvent(watcher->stop);
+#elif defined(__linux__)
+			const uint64_t one = 1;
+			const ssize_t written = write(watcher->stop, &one, sizeof(one));   // only fails once the counter is full, which still wakes Wait
+
+			(void)written;
+#else
+			watcher->stop = true;
+#endif
+		}
+
+		Stats GetStats(const Watcher *watcher)
+		{
+			return watcher->stats;
+		}
+	}
+}
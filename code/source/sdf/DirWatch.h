@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Files added, removed and modified under a directory tree, for tools that
+// rebuild on save. On Linux every directory has an inotify watch and changes
+// come straight from its per-file events, so the tree is only walked once, when
+// watching starts, and again if the kernel's event queue overflows. On Windows
+// a change notification triggers a walk that is diffed with the last one.
+// Editors save through temporaries and renames, so events are collected until
+// the tree has been quiet for a window and each path reports its net change:
+// a temporary written and renamed away reports nothing, and the file it was
+// renamed over reports as modified.
+namespace sdf
+{
+	namespace dirwatch
+	{
+		struct Settings
+		{
+			unsigned coalesceMs = 50;       // quiet time that ends a batch
+			unsigned maxCoalesceMs = 500;   // after its first event, however busy the tree stays
+		};
+
+		// Paths are the watched directory joined with the file's path under it.
+		struct Changes
+		{
+			std::vector<std::string> added;
+			std::vector<std::string> removed;
+			std::vector<std::string> modified;
+			double seconds = 0.0;   // from the batch's first event to its dispatch
+		};
+
+		struct Stats
+		{
+			uint64_t events = 0;    // inotify events, or change notifications
+			uint64_t batches = 0;   // dispatched by Wait
+			uint64_t walks = 0;     // of the whole tree
+			uint32_t directories = 0;
+			uint32_t files = 0;
+			double seconds = 0.0;   // handling events and walking, not waiting
+		};
+
+		struct Watcher;
+
+		// Null when the directory doesn't exist or can't be watched.
+		Watcher* CreateWatcher(const char *dir, const Settings &settings);
+		void DestroyWatcher(Watcher *watcher);
+
+		// Blocks until a batch with a net change is due. Returns false once Stop
+		// has been called, or when the watch is lost, as when the directory
+		// itself is removed.
+		bool Wait(Watcher *watcher, Changes *outChanges);
+
+		// Ends Wait on another thread. Safe to call from any thread.
+		void Stop(Watcher *watcher);
+
+		// From the thread that calls Wait.
+		Stats GetStats(const Watcher *watcher);
+	}
+}
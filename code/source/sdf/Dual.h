@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Simd.h"
+
+// Forward mode automatic differentiation over 8-wide packets. A dual8 carries a
+// value and its partial derivatives with respect to the query point, so running
+// an expression on dual8s yields the distance and its gradient in a single pass.
+namespace sdf
+{
+	namespace simd
+	{
+		struct dual8
+		{
+			float8 v;
+			float8 d[3];
+		};
+
+		inline dual8 Constant(float8 v)
+		{
+			const float8 zero = Zero();
+
+			return { v, { zero, zero, zero } };
+		}
+
+		inline dual8 Variable(float8 v, unsigned axis)
+		{
+			dual8 r = Constant(v);
+			r.d[axis] = Set1(1.0f);
+
+			return r;
+		}
+
+		inline dual8 operator+(const dual8 &a, const dual8 &b) { return { a.v + b.v, { a.d[0] + b.d[0], a.d[1] + b.d[1], a.d[2] + b.d[2] } }; }
+		inline dual8 operator-(const dual8 &a, const dual8 &b) { return { a.v - b.v, { a.d[0] - b.d[0], a.d[1] - b.d[1], a.d[2] - b.d[2] } }; }
+		inline dual8 operator-(const dual8 &a) { return { -a.v, { -a.d[0], -a.d[1], -a.d[2] } }; }
+		inline dual8 operator+(const dual8 &a, float8 b) { return { a.v + b, { a.d[0], a.d[1], a.d[2] } }; }
+		inline dual8 operator-(const dual8 &a, float8 b) { return { a.v - b, { a.d[0], a.d[1], a.d[2] } }; }
+		inline dual8 operator*(const dual8 &a, float8 b) { return { a.v * b, { a.d[0] * b, a.d[1] * b, a.d[2] * b } }; }
+
+		inline dual8 operator*(const dual8 &a, const dual8 &b)
+		{
+			return { a.v * b.v, { a.d[0] * b.v + a.v * b.d[0], a.d[1] * b.v + a.v * b.d[1], a.d[2] * b.v + a.v * b.d[2] } };
+		}
+
+		inline dual8 Select(float8 mask, const dual8 &ifTrue, const dual8 &ifFalse)
+		{
+			return { Select(mask, ifTrue.v, ifFalse.v), { Select(mask, ifTrue.d[0], ifFalse.d[0]), Select(mask, ifTrue.d[1], ifFalse.d[1]), Select(mask, ifTrue.d[2], ifFalse.d[2]) } };
+		}
+
+		// min/max/abs/clamp pick the derivative of whichever side wins. At exact ties
+		// that is a one sided derivative, which is what sphere tracing and QEFs want.
+		inline dual8 Min(const dual8 &a, const dual8 &b) { return Select(CmpLt(b.v, a.v), b, a); }
+		inline dual8 Max(const dual8 &a, const dual8 &b) { return Select(CmpGt(b.v, a.v), b, a); }
+		inline dual8 Abs(const dual8 &a) { return Select(CmpLt(a.v, Zero()), -a, a); }
+		inline dual8 Max(const dual8 &a, float8 b) { return Select(CmpGt(b, a.v), Constant(b), a); }
+		inline dual8 Min(const dual8 &a, float8 b) { return Select(CmpLt(b, a.v), Constant(b), a); }
+		inline dual8 Clamp(const dual8 &a, float8 lo, float8 hi) { return Min(Max(a, lo), hi); }
+
+		// sqrt is not differentiable at 0. Those lanes are flagged in inoutDegenerate
+		// and get a zero derivative, so the caller can patch them up numerically.
+		inline dual8 Sqrt(const dual8 &a, float8 *inoutDegenerate)
+		{
+			const float8 s = Sqrt(a.v);
+			const float8 tiny = CmpLt(s, Set1(1e-12f));
+			const float8 scale = AndNot(tiny, Set1(0.5f) / Max(s, Set1(1e-12f)));
+
+			*inoutDegenerate = Or(*inoutDegenerate, tiny);
+
+			return { s, { a.d[0] * scale, a.d[1] * scale, a.d[2] * scale } };
+		}
+
+		inline dual8 Length(const dual8 &x, const dual8 &y, float8 *inoutDegenerate)
+		{
+			return Sqrt(x * x + y * y, inoutDegenerate);
+		}
+
+		inline dual8 Length(const dual8 &x, const dual8 &y, const dual8 &z, float8 *inoutDegenerate)
+		{
+			return Sqrt(x * x + y * y + z * z, inoutDegenerate);
+		}
+	}
+}
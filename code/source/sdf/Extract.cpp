@@ -0,0 +1,684 @@
+#include "Extract.h"
+#include "Jobs.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace sdf
+{
+	namespace extract
+	{
+		namespace
+		{
+			static const uint64_t EXTERNAL_VERTEX = 1ull << 63;   // corner refers to a cell of an earlier chunk by global key
+			static const uint32_t NO_VERTEX = ~0u;
+			static const uint32_t PLY_COUNT_DIGITS = 10;          // counts are patched in place once known
+			static const uint32_t STL_TRIANGLE_BYTES = 50;
+
+			// Double buffered file output. Write fills one buffer while a writer
+			// thread flushes the other, so meshing only waits on the disk when it
+			// gets a whole buffer ahead of it.
+			struct Stream
+			{
+				FILE *file = nullptr;
+				memory::Vector<char, memory::Tag::STAGING> buffers[2];
+				size_t fill = 0;               // bytes in buffers[current]
+				unsigned current = 0;
+				size_t pendingSize = 0;        // bytes of buffers[current ^ 1] the writer owns
+				bool pending = false;
+				bool quit = false;
+				bool failed = false;
+				uint64_t bytes = 0;
+				std::mutex mutex;
+				std::condition_variable cond;
+				std::thread thread;
+			};
+
+			void WriterLoop(Stream *stream)
+			{
+				std::unique_lock<std::mutex> lock(stream->mutex);
+
+				for (;;)
+				{
+					stream->cond.wait(lock, [stream] { return stream->pending || stream->quit; });
+
+					if (!stream->pending)
+						break;
+
+					const char * const data = stream->buffers[stream->current ^ 1].data();
+					const size_t size = stream->pendingSize;
+
+					lock.unlock();
+					const bool written = std::fwrite(data, 1, size, stream->file) == size;
+					lock.lock();
+
+					stream->failed |= !written;
+					stream->pending = false;
+					stream->cond.notify_all();
+				}
+			}
+
+			bool OpenStream(const char *fileName, const char *mode, uint32_t bufferBytes, Stream *outStream)
+			{
+				outStream->file = std::fopen(fileName, mode);
+
+				if (!outStream->file)
+					return false;
+
+				outStream->buffers[0].resize(std::max(bufferBytes, 4096u));
+				outStream->buffers[1].resize(outStream->buffers[0].size());
+				outStream->thread = std::thread(WriterLoop, outStream);
+
+				return true;
+			}
+
+			void Flush(Stream *inoutStream)
+			{
+				std::unique_lock<std::mutex> lock(inoutStream->mutex);
+
+				inoutStream->cond.wait(lock, [inoutStream] { return !inoutStream->pending; });
+				inoutStream->pendingSize = inoutStream->fill;
+				inoutStream->pending = true;
+				inoutStream->current ^= 1;
+				inoutStream->fill = 0;
+				inoutStream->cond.notify_all();
+			}
+
+			void Write(Stream *inoutStream, const void *data, size_t size)
+			{
+				const char *bytes = (const char*)data;
+				const size_t capacity = inoutStream->buffers[0].size();
+
+				inoutStream->bytes += size;
+
+				while (size)
+				{
+					const size_t chunk = std::min(size, capacity - inoutStream->fill);
+
+					std::memcpy(inoutStream->buffers[inoutStream->current].data() + inoutStream->fill, bytes, chunk);
+					inoutStream->fill += chunk;
+					bytes += chunk;
+					size -= chunk;
+
+					if (inoutStream->fill == capacity)
+						Flush(inoutStream);
+				}
+			}
+
+			// Writes out what is buffered and stops the writer. The file stays open.
+			bool FinishStream(Stream *inoutStream)
+			{
+				if (!inoutStream->thread.joinable())
+					return !inoutStream->failed;
+
+				if (inoutStream->fill)
+					Flush(inoutStream);
+
+				{
+					std::unique_lock<std::mutex> lock(inoutStream->mutex);
+
+					inoutStream->cond.wait(lock, [inoutStream] { return !inoutStream->pending; });
+					inoutStream->quit = true;
+					inoutStream->cond.notify_all();
+				}
+
+				inoutStream->thread.join();
+				return !inoutStream->failed && std::fflush(inoutStream->file) == 0;
+			}
+
+			bool CloseStream(Stream *inoutStream)
+			{
+				bool success = FinishStream(inoutStream);
+
+				if (inoutStream->file)
+					success &= std::fclose(inoutStream->file) == 0;
+				inoutStream->file = nullptr;
+
+				return success;
+			}
+
+			struct Grid
+			{
+				glm::vec3 origin;
+				float voxelSize;
+				glm::uvec3 samples;
+				glm::uvec3 cells;
+				glm::uvec3 chunks;
+				uint32_t chunkSize;
+			};
+
+			uint64_t CellKey(const Grid &grid, const glm::uvec3 &cell)
+			{
+				return ((uint64_t)cell.z * grid.cells.y + cell.y) * grid.cells.x + cell.x;
+			}
+
+			// One chunk's share of the mesh. Triangles use local vertex indices,
+			// except for corners in cells of earlier chunks, which are resolved
+			// through the seam hash when the chunk is written.
+			struct ChunkMesh
+			{
+				memory::Vector<glm::vec3, memory::Tag::MESHES> positions;
+				memory::Vector<std::pair<uint32_t, uint64_t>, memory::Tag::MESHES> seam;   // local vertex, cell key. Needed by later chunks.
+				memory::Vector<uint64_t, memory::Tag::MESHES> corners;                     // 3 per triangle
+				bool empty;
+			};
+
+			struct Scratch
+			{
+				memory::Vector<float, memory::Tag::MESHES> xs, ys, zs, dist;
+				memory::Vector<uint32_t, memory::Tag::MESHES> cellVertices;
+			};
+
+			void MeshChunk(const program::Program &prog, const Grid &grid, const glm::uvec3 &chunk, Scratch *inoutScratch, ChunkMesh *outMesh)
+			{
+				const uint32_t size = grid.chunkSize;
+				const glm::uvec3 first = chunk * size;
+				const glm::uvec3 cellCount = glm::min(first + glm::uvec3(size), grid.cells) - first;
+				const glm::uvec3 sampleCount = cellCount + glm::uvec3(1);
+
+				outMesh->positions.clear();
+				outMesh->seam.clear();
+				outMesh->corners.clear();
+				outMesh->empty = true;
+
+				// Fields are at most 1-Lipschitz, so a center this far from the surface
+				// puts the whole chunk on one side of it.
+				{
+					const glm::vec3 center = grid.origin + (glm::vec3(first) + glm::vec3(cellCount) * 0.5f) * grid.voxelSize;
+					const float halfDiagonal = glm::length(glm::vec3(cellCount)) * 0.5f * grid.voxelSize;
+					float centerDist;
+
+					program::EvaluateBatch(prog, &center.x, &center.y, &center.z, 1, &centerDist);
+
+					if (std::abs(centerDist) > halfDiagonal)
+						return;
+				}
+
+				const size_t sampleTotal = (size_t)sampleCount.x * sampleCount.y * sampleCount.z;
+				const size_t strideY = sampleCount.x;
+				const size_t strideZ = (size_t)sampleCount.x * sampleCount.y;
+				Scratch &scratch = *inoutScratch;
+
+				scratch.xs.resize(sampleTotal);
+				scratch.ys.resize(sampleTotal);
+				scratch.zs.resize(sampleTotal);
+				scratch.dist.resize(sampleTotal);
+
+				for (uint32_t z = 0, sampleIndex = 0; z < sampleCount.z; ++z)
+				{
+					for (uint32_t y = 0; y < sampleCount.y; ++y)
+					{
+						for (uint32_t x = 0; x < sampleCount.x; ++x, ++sampleIndex)
+						{
+							scratch.xs[sampleIndex] = grid.origin.x + (float)(first.x + x) * grid.voxelSize;
+							scratch.ys[sampleIndex] = grid.origin.y + (float)(first.y + y) * grid.voxelSize;
+							scratch.zs[sampleIndex] = grid.origin.z + (float)(first.z + z) * grid.voxelSize;
+						}
+					}
+				}
+
+				program::EvaluateBatch(prog, scratch.xs.data(), scratch.ys.data(), scratch.zs.data(), sampleTotal, scratch.dist.data());
+
+				const float *dist = scratch.dist.data();
+				const size_t cornerOffsets[8] = { 0, 1, strideY, strideY + 1, strideZ, strideZ + 1, strideZ + strideY, strideZ + strideY + 1 };
+
+				// Surface nets: one vertex per cell the surface passes through, at the
+				// mean of where it crosses the cell's edges.
+				scratch.cellVertices.assign((size_t)cellCount.x * cellCount.y * cellCount.z, NO_VERTEX);
+
+				for (uint32_t z = 0, cellIndex = 0; z < cellCount.z; ++z)
+				{
+					for (uint32_t y = 0; y < cellCount.y; ++y)
+					{
+						for (uint32_t x = 0; x < cellCount.x; ++x, ++cellIndex)
+						{
+							const float *v = dist + (z * strideZ + y * strideY + x);
+							float corner[8];
+							unsigned insideMask = 0;
+
+							for (unsigned c = 0; c < 8; ++c)
+							{
+								corner[c] = v[cornerOffsets[c]];
+								insideMask |= (corner[c] < 0.0f ? 1u : 0u) << c;
+							}
+
+							if (insideMask == 0 || insideMask == 0xff)
+								continue;
+
+							glm::vec3 sum(0.0f);
+							unsigned crossings = 0;
+
+							for (unsigned c = 0; c < 8; ++c)
+							{
+								for (unsigned axis = 0; axis < 3; ++axis)
+								{
+									const unsigned bit = 1u << axis;
+									const unsigned other = c | bit;
+
+									if ((c & bit) || ((insideMask >> c) & 1u) == ((insideMask >> other) & 1u))
+										continue;
+
+									glm::vec3 crossing((float)(c & 1u), (float)((c >> 1) & 1u), (float)((c >> 2) & 1u));
+									crossing[axis] = corner[c] / (corner[c] - corner[other]);
+									sum += crossing;
+									++crossings;
+								}
+							}
+
+							const glm::uvec3 cell = first + glm::uvec3(x, y, z);
+
+							scratch.cellVertices[cellIndex] = (uint32_t)outMesh->positions.size();
+
+							// Cells on a face with a later chunk behind it are shared with it.
+							for (unsigned axis = 0; axis < 3; ++axis)
+							{
+								if (cell[axis] + 1 == first[axis] + size && cell[axis] + 1 < grid.cells[axis])
+								{
+									outMesh->seam.push_back(std::make_pair((uint32_t)outMesh->positions.size(), CellKey(grid, cell)));
+									break;
+								}
+							}
+
+							outMesh->positions.push_back(grid.origin + (glm::vec3(cell) + sum / (float)crossings) * grid.voxelSize);
+						}
+					}
+				}
+
+				// A quad around every edge the surface crosses, joining the four cells
+				// that share it. Edges belong to the chunk of their first sample, so
+				// the cells behind them may be in earlier chunks.
+				for (unsigned axis = 0; axis < 3; ++axis)
+				{
+					const unsigned u = (axis + 1) % 3;
+					const unsigned v = (axis + 2) % 3;
+					const size_t axisStride = axis == 0 ? 1 : (axis == 1 ? strideY : strideZ);
+
+					for (uint32_t z = 0; z < cellCount.z; ++z)
+					{
+						for (uint32_t y = 0; y < cellCount.y; ++y)
+						{
+							for (uint32_t x = 0; x < cellCount.x; ++x)
+							{
+								const glm::uvec3 local(x, y, z);
+
+								if (first[u] + local[u] == 0 || first[v] + local[v] == 0)
+									continue;
+
+								const size_t sampleIndex = z * strideZ + y * strideY + x;
+								const bool inside0 = dist[sampleIndex] < 0.0f;
+								const bool inside1 = dist[sampleIndex + axisStride] < 0.0f;
+
+								if (inside0 == inside1)
+									continue;
+
+								// Counter clockwise around +axis.
+								glm::ivec3 cells[4] = { glm::ivec3(local), glm::ivec3(local), glm::ivec3(local), glm::ivec3(local) };
+								uint64_t quad[4];
+
+								cells[0][u] -= 1;
+								cells[0][v] -= 1;
+								cells[1][v] -= 1;
+								cells[3][u] -= 1;
+
+								for (unsigned q = 0; q < 4; ++q)
+								{
+									if (cells[q][u] >= 0 && cells[q][v] >= 0)
+										quad[q] = scratch.cellVertices[((size_t)cells[q].z * cellCount.y + cells[q].y) * cellCount.x + cells[q].x];
+									else
+										quad[q] = EXTERNAL_VERTEX | CellKey(grid, glm::uvec3(glm::ivec3(first) + cells[q]));
+								}
+
+								// The outside is where the normal points.
+								const unsigned order[2][6] = { { 0, 2, 1, 0, 3, 2 }, { 0, 1, 2, 0, 2, 3 } };
+
+								for (unsigned corner = 0; corner < 6; ++corner)
+									outMesh->corners.push_back(quad[order[inside0][corner]]);
+							}
+						}
+					}
+				}
+
+				outMesh->empty = outMesh->positions.empty();
+			}
+
+			struct SeamVertex
+			{
+				uint32_t index;
+				glm::vec3 position;
+			};
+
+			struct Output
+			{
+				Format format;
+				Stream file;
+				Stream faces;                 // PLY only
+				std::string facesFileName;
+				long vertexCountOffset = 0;   // PLY and STL header fields patched at the end
+				long faceCountOffset = 0;
+			};
+
+			void WriteHeader(Output *inoutOutput)
+			{
+				if (inoutOutput->format == Format::PLY)
+				{
+					const std::string zeros(PLY_COUNT_DIGITS, '0');
+					const std::string header =
+						"ply\n"
+						"format binary_little_endian 1.0\n"
+						"comment SDFMod surface export\n"
+						"element vertex " + zeros + "\n"
+						"property float x\n"
+						"property float y\n"
+						"property float z\n"
+						"element face " + zeros + "\n"
+						"property list uchar uint vertex_indices\n"
+						"end_header\n";
+
+					inoutOutput->vertexCountOffset = (long)header.find("element vertex ") + 15;
+					inoutOutput->faceCountOffset = (long)header.find("element face ") + 13;
+					Write(&inoutOutput->file, header.data(), header.size());
+				}
+				else if (inoutOutput->format == Format::STL)
+				{
+					char header[84] = "SDFMod surface export";
+
+					inoutOutput->faceCountOffset = 80;
+					Write(&inoutOutput->file, header, sizeof(header));
+				}
+				else
+				{
+					static const char header[] = "# SDFMod surface export\n";
+
+					Write(&inoutOutput->file, header, sizeof(header) - 1);
+				}
+			}
+
+			void WriteChunk(const ChunkMesh &mesh, uint64_t firstVertex, const std::unordered_map<uint64_t, SeamVertex> &seam, Output *inoutOutput, Stats *inoutStats)
+			{
+				char line[96];
+
+				if (inoutOutput->format == Format::PLY)
+					Write(&inoutOutput->file, mesh.positions.data(), mesh.positions.size() * sizeof(glm::vec3));
+				else if (inoutOutput->format == Format::OBJ)
+				{
+					for (const glm::vec3 &position : mesh.positions)
+						Write(&inoutOutput->file, line, std::snprintf(line, sizeof(line), "v %.7g %.7g %.7g\n", position.x, position.y, position.z));
+				}
+
+				for (size_t cornerIndex = 0; cornerIndex < mesh.corners.size(); cornerIndex += 3)
+				{
+					uint32_t indices[3];
+					glm::vec3 positions[3];
+					bool resolved = true;
+
+					for (unsigned corner = 0; corner < 3; ++corner)
+					{
+						const uint64_t ref = mesh.corners[cornerIndex + corner];
+
+						if (ref & EXTERNAL_VERTEX)
+						{
+							const auto found = seam.find(ref & ~EXTERNAL_VERTEX);
+
+							if (found == seam.end())
+							{
+								resolved = false;
+								break;
+							}
+
+							indices[corner] = found->second.index;
+							positions[corner] = found->second.position;
+						}
+						else
+						{
+							indices[corner] = (uint32_t)(firstVertex + ref);
+							positions[corner] = mesh.positions[(size_t)ref];
+						}
+					}
+
+					// Only a field that breaks the Lipschitz bound can skip a chunk
+					// with surface in it and leave a neighbour's corner unresolved.
+					if (!resolved)
+						continue;
+
+					if (inoutOutput->format == Format::PLY)
+					{
+						unsigned char face[13];
+
+						face[0] = 3;
+						std::memcpy(face + 1, indices, sizeof(indices));
+						Write(&inoutOutput->faces, face, sizeof(face));
+					}
+					else if (inoutOutput->format == Format::STL)
+					{
+						const glm::vec3 cross = glm::cross(positions[1] - positions[0], positions[2] - positions[0]);
+						const float length = glm::length(cross);
+						const glm::vec3 normal = length > 0.0f ? cross / length : glm::vec3(0.0f);
+						char triangle[STL_TRIANGLE_BYTES] = {};
+
+						std::memcpy(triangle, &normal, sizeof(normal));
+						std::memcpy(triangle + 12, positions, sizeof(positions));
+						Write(&inoutOutput->file, triangle, sizeof(triangle));
+					}
+					else
+						Write(&inoutOutput->file, line, std::snprintf(line, sizeof(line), "f %u %u %u\n", indices[0] + 1, indices[1] + 1, indices[2] + 1));
+
+					++inoutStats->triangles;
+				}
+			}
+
+			bool PatchCount(FILE *file, long offset, uint64_t count, bool binary)
+			{
+				if (std::fseek(file, offset, SEEK_SET) != 0)
+					return false;
+
+				if (binary)
+				{
+					const uint32_t value = (uint32_t)count;
+
+					return std::fwrite(&value, sizeof(value), 1, file) == 1;
+				}
+
+				char digits[PLY_COUNT_DIGITS + 1];
+
+				std::snprintf(digits, sizeof(digits), "%010llu", (unsigned long long)count);
+				return std::fwrite(digits, 1, PLY_COUNT_DIGITS, file) == PLY_COUNT_DIGITS;
+			}
+
+			// Appends the spooled PLY faces after the vertices and fills in the
+			// header counts.
+			bool FinishOutput(Output *inoutOutput, const Stats &stats)
+			{
+				bool success = true;
+
+				if (inoutOutput->format == Format::PLY)
+				{
+					success &= FinishStream(&inoutOutput->faces);
+
+					if (success && std::fseek(inoutOutput->faces.file, 0, SEEK_SET) == 0)
+					{
+						memory::Vector<char, memory::Tag::STAGING> block(inoutOutput->faces.buffers[0].size());
+						size_t read;
+
+						while ((read = std::fread(block.data(), 1, block.size(), inoutOutput->faces.file)) != 0)
+							Write(&inoutOutput->file, block.data(), read);
+					}
+					else
+						success = false;
+
+					CloseStream(&inoutOutput->faces);
+					std::remove(inoutOutput->facesFileName.c_str());
+				}
+
+				success &= FinishStream(&inoutOutput->file);
+
+				if (inoutOutput->format == Format::PLY)
+				{
+					success = success && PatchCount(inoutOutput->file.file, inoutOutput->vertexCountOffset, stats.vertices, false);
+					success = success && PatchCount(inoutOutput->file.file, inoutOutput->faceCountOffset, stats.triangles, false);
+				}
+				else if (inoutOutput->format == Format::STL)
+					success = success && PatchCount(inoutOutput->file.file, inoutOutput->faceCountOffset, stats.triangles, true);
+
+				return CloseStream(&inoutOutput->file) && success;
+			}
+
+			bool EndsWith(const char *str, const char *suffix)
+			{
+				const size_t strLen = std::strlen(str);
+				const size_t suffixLen = std::strlen(suffix);
+
+				if (suffixLen > strLen)
+					return false;
+
+				for (size_t charIndex = 0; charIndex < suffixLen; ++charIndex)
+					if (std::tolower((unsigned char)str[strLen - suffixLen + charIndex]) != suffix[charIndex])
+						return false;
+
+				return true;
+			}
+		}
+
+		bool FormatFromFileName(const char *fileName, Format *outFormat)
+		{
+			if (EndsWith(fileName, ".ply"))
+				*outFormat = Format::PLY;
+			else if (EndsWith(fileName, ".stl"))
+				*outFormat = Format::STL;
+			else if (EndsWith(fileName, ".obj"))
+				*outFormat = Format::OBJ;
+			else
+				return false;
+
+			return true;
+		}
+
+		bool ExportMesh(const program::Program &prog, const Settings &settings, const char *fileName, Format format, Stats *outoptStats)
+		{
+			const auto start = std::chrono::high_resolution_clock::now();
+			const glm::vec3 extent = settings.max - settings.min;
+			const float longest = std::max(extent.x, std::max(extent.y, extent.z));
+
+			if (!(longest > 0.0f) || settings.resolution < 2 || settings.chunkSize == 0)
+				return false;
+
+			Grid grid;
+			grid.origin = settings.min;
+			grid.voxelSize = longest / (float)(settings.resolution - 1);
+			grid.samples = glm::max(glm::uvec3(glm::ceil(extent / grid.voxelSize - 1e-3f)) + glm::uvec3(1), glm::uvec3(2));
+			grid.cells = grid.samples - glm::uvec3(1);
+			grid.chunkSize = settings.chunkSize;
+			grid.chunks = (grid.cells + glm::uvec3(settings.chunkSize - 1)) / settings.chunkSize;
+
+			Output output;
+			output.format = format;
+
+			if (!OpenStream(fileName, "wb", settings.writeBufferBytes, &output.file))
+				return false;
+
+			if (format == Format::PLY)
+			{
+				output.facesFileName = std::string(fileName) + ".faces";
+
+				if (!OpenStream(output.facesFileName.c_str(), "w+b", settings.writeBufferBytes, &output.faces))
+				{
+					CloseStream(&output.file);
+					return false;
+				}
+			}
+
+			WriteHeader(&output);
+
+			jobs::Pool * const pool = jobs::CreatePool(settings.threadCount);
+			const unsigned threadCount = jobs::ThreadCount(pool);
+			const uint32_t chunkCount = grid.chunks.x * grid.chunks.y * grid.chunks.z;
+			const uint32_t batchSize = threadCount * 4;
+			memory::Vector<ChunkMesh, memory::Tag::MESHES> meshes(batchSize);
+			memory::Vector<Scratch, memory::Tag::MESHES> scratch(threadCount);
+			std::vector<double> meshSeconds(threadCount, 0.0);
+			std::unordered_map<uint64_t, SeamVertex> seam;
+			uint32_t seamLayer = 0;
+			Stats stats;
+			bool success = true;
+
+			stats.chunks = chunkCount;
+
+			// Chunks go out in order, x fastest, so every cell a chunk's quads reach
+			// back into was written by an earlier one.
+			for (uint32_t batchStart = 0; batchStart < chunkCount && success; batchStart += batchSize)
+			{
+				const uint32_t batchCount = std::min(batchSize, chunkCount - batchStart);
+
+				jobs::ParallelFor(pool, batchCount, [&](uint32_t itemIndex, unsigned threadIndex)
+				{
+					const auto chunkStart = std::chrono::high_resolution_clock::now();
+					const uint32_t chunkIndex = batchStart + itemIndex;
+					const glm::uvec3 chunk(chunkIndex % grid.chunks.x, chunkIndex / grid.chunks.x % grid.chunks.y, chunkIndex / (grid.chunks.x * grid.chunks.y));
+
+					MeshChunk(prog, grid, chunk, &scratch[threadIndex], &meshes[itemIndex]);
+					meshSeconds[threadIndex] += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - chunkStart).count();
+				});
+
+				for (uint32_t itemIndex = 0; itemIndex < batchCount; ++itemIndex)
+				{
+					const uint32_t chunkIndex = batchStart + itemIndex;
+					const uint32_t layer = chunkIndex / (grid.chunks.x * grid.chunks.y);
+					const ChunkMesh &mesh = meshes[itemIndex];
+
+					// Seam vertices more than a cell behind the current layer of chunks
+					// have been used by every chunk that can reach them.
+					if (layer != seamLayer)
+					{
+						const uint64_t firstKey = CellKey(grid, glm::uvec3(0, 0, layer * grid.chunkSize - 1));
+
+						for (auto it = seam.begin(); it != seam.end();)
+							it = it->first < firstKey ? seam.erase(it) : std::next(it);
+						seamLayer = layer;
+					}
+
+					if (mesh.empty)
+					{
+						++stats.emptyChunks;
+						continue;
+					}
+
+					if (stats.vertices + mesh.positions.size() > 0xffffffffull)
+					{
+						success = false;   // past what 32 bit indices can address
+						break;
+					}
+
+					WriteChunk(mesh, stats.vertices, seam, &output, &stats);
+
+					for (const std::pair<uint32_t, uint64_t> &seamVertex : mesh.seam)
+						seam[seamVertex.second] = SeamVertex{ (uint32_t)(stats.vertices + seamVertex.first), mesh.positions[seamVertex.first] };
+
+					stats.vertices += mesh.positions.size();
+					stats.peakSeamVertices = std::max(stats.peakSeamVertices, (uint32_t)seam.size());
+				}
+			}
+
+			jobs::DestroyPool(pool);
+
+			success = FinishOutput(&output, stats) && success;
+
+			for (double seconds : meshSeconds)
+				stats.meshSeconds += seconds;
+			stats.bytes = output.file.bytes;
+			stats.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+			if (outoptStats)
+				*outoptStats = stats;
+
+			return success;
+		}
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Program.h"
+
+// Surface extraction from SDF programs straight into mesh files, for printing
+// and exporting to other tools. The sampling grid is meshed chunk by chunk with
+// surface nets and each chunk is written out as soon as it is done, so memory
+// stays bounded by the chunk size and the seam between chunk layers, not by the
+// size of the mesh.
+namespace sdf
+{
+	namespace extract
+	{
+		enum class Format : unsigned char
+		{
+			PLY,   // binary little endian, indexed
+			STL,   // binary, unindexed
+			OBJ    // text, indexed
+		};
+
+		struct Settings
+		{
+			glm::vec3 min = glm::vec3(-1.0f);
+			glm::vec3 max = glm::vec3(1.0f);
+			uint32_t resolution = 256;          // samples along the longest axis of the bounds
+			uint32_t chunkSize = 32;            // cells per chunk side
+			unsigned threadCount = 0;           // 0 uses every hardware thread
+			uint32_t writeBufferBytes = 4 << 20; // per buffer. Each file has two: one filling, one writing.
+		};
+
+		struct Stats
+		{
+			uint64_t vertices = 0;
+			uint64_t triangles = 0;
+			uint64_t bytes = 0;
+			uint32_t chunks = 0;
+			uint32_t emptyChunks = 0;           // skipped on a single distance evaluation
+			uint32_t peakSeamVertices = 0;      // most vertices waiting for a later chunk
+			double meshSeconds = 0.0;           // summed over threads
+			double seconds = 0.0;
+		};
+
+		// From the extension: .ply, .stl or .obj.
+		bool FormatFromFileName(const char *fileName, Format *outFormat);
+
+		// Meshes the surface inside the bounds and streams it to fileName. PLY
+		// faces are spooled to fileName.faces next to it until the vertices are
+		// done, since the format wants every vertex first.
+		bool ExportMesh(const program::Program &prog, const Settings &settings, const char *fileName, Format format, Stats *outoptStats = nullptr);
+	}
+}
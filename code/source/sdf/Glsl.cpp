@@ -0,0 +1,438 @@
+#include "Glsl.h"
+#include "Bricks.h"
+#include "Occupancy.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+namespace sdf
+{
+	namespace glsl
+	{
+		namespace
+		{
+			using program::Instruction;
+			using program::OpCode;
+
+			// Round trips exactly and always reads as a float literal to glslang.
+			std::string Float(float value)
+			{
+				char buf[32];
+
+				std::snprintf(buf, sizeof(buf), "%.9g", value);
+
+				if (!std::strpbrk(buf, ".eEn"))
+					std::strcat(buf, ".0");
+
+				return buf;
+			}
+
+			std::string Vec3(const float *v)
+			{
+				return "vec3(" + Float(v[0]) + ", " + Float(v[1]) + ", " + Float(v[2]) + ")";
+			}
+
+			void EmitInstruction(const Instruction &inst, const std::vector<std::string> &instanceFunctions, std::ostringstream *out)
+			{
+				const float * const params = inst.params;
+				const std::string p = "p" + std::to_string(inst.src0);
+				const std::string d = "d" + std::to_string(inst.dst);
+				const std::string i = "i" + std::to_string(inst.dst);
+				const std::string a = "d" + std::to_string(inst.src0);
+				const std::string b = "d" + std::to_string(inst.src1);
+				const std::string ia = "i" + std::to_string(inst.src0);
+				const std::string ib = "i" + std::to_string(inst.src1);
+				const std::string id = std::to_string(inst.primitiveId) + "u";
+
+				switch (inst.op)
+				{
+					case OpCode::SPHERE:
+						*out << "\t" << d << " = length(" << p << ") - " << Float(params[0]) << ";\n";
+					break;
+					case OpCode::BOX:
+						*out << "\tq3 = abs(" << p << ") - " << Vec3(params) << ";\n";
+						*out << "\t" << d << " = length(max(q3, 0.0)) + min(max(q3.x, max(q3.y, q3.z)), 0.0) - " << Float(params[3]) << ";\n";
+					break;
+					case OpCode::TORUS:
+						*out << "\t" << d << " = length(vec2(length(" << p << ".xz) - " << Float(params[0]) << ", " << p << ".y)) - " << Float(params[1]) << ";\n";
+					break;
+					case OpCode::CAPSULE:
+						*out << "\t" << d << " = length(vec3(" << p << ".x, " << p << ".y - clamp(" << p << ".y, " << Float(-params[0]) << ", " << Float(params[0]) << "), " << p << ".z)) - " << Float(params[1]) << ";\n";
+					break;
+					case OpCode::CYLINDER:
+						*out << "\tq2 = vec2(length(" << p << ".xz) - " << Float(params[1]) << ", abs(" << p << ".y) - " << Float(params[0]) << ");\n";
+						*out << "\t" << d << " = min(max(q2.x, q2.y), 0.0) + length(max(q2, 0.0));\n";
+					break;
+					case OpCode::PLANE:
+						*out << "\t" << d << " = dot(" << p << ", " << Vec3(params) << ") + " << Float(params[3]) << ";\n";
+					break;
+					case OpCode::VOLUME:
+						*out << "\t" << d << " = SampleVolume" << (uint32_t)params[0] << "(" << p << ");\n";
+					break;
+					case OpCode::INSTANCE:
+						*out << "\t" << d << " = " << instanceFunctions[(size_t)params[0]] << "(" << p << ", " << i << ");\n";
+					return;
+					case OpCode::TRANSFORM:
+						*out << "\tp" << inst.dst << " = vec3(";
+						for (unsigned row = 0; row < 3; ++row)
+							*out << (row ? ", " : "") << "dot(" << p << ", " << Vec3(params + row * 4) << ") + " << Float(params[row * 4 + 3]);
+						*out << ");\n";
+					return;
+					case OpCode::REPEAT:
+						*out << "\tp" << inst.dst << " = " << p << " - " << Vec3(params) << " * clamp(floor(" << p << " * " << Vec3(params + 6) << " + 0.5), -" << Vec3(params + 3) << ", " << Vec3(params + 3) << ");\n";
+					return;
+					case OpCode::SCALE:
+						*out << "\t" << d << " = " << a << " * " << Float(params[0]) << ";\n";
+						*out << "\t" << i << " = " << ia << ";\n";
+					return;
+					case OpCode::UNION:
+						*out << "\t" << i << " = " << b << " < " << a << " ? " << ib << " : " << ia << ";\n";
+						*out << "\t" << d << " = min(" << a << ", " << b << ");\n";
+					return;
+					case OpCode::INTERSECT:
+						*out << "\t" << i << " = " << b << " > " << a << " ? " << ib << " : " << ia << ";\n";
+						*out << "\t" << d << " = max(" << a << ", " << b << ");\n";
+					return;
+					case OpCode::SUBTRACT:
+						*out << "\t" << i << " = -" << b << " > " << a << " ? " << ib << " : " << ia << ";\n";
+						*out << "\t" << d << " = max(" << a << ", -" << b << ");\n";
+					return;
+					case OpCode::SMOOTH_UNION:
+						*out << "\th = clamp(0.5 + 0.5 * (" << b << " - " << a << ") / " << Float(params[0]) << ", 0.0, 1.0);\n";
+						*out << "\t" << i << " = " << b << " < " << a << " ? " << ib << " : " << ia << ";\n";
+						*out << "\t" << d << " = mix(" << b << ", " << a << ", h) - " << Float(params[0]) << " * h * (1.0 - h);\n";
+					return;
+					case OpCode::SMOOTH_SUBTRACT:
+						*out << "\th = clamp(0.5 - 0.5 * (" << a << " + " << b << ") / " << Float(params[0]) << ", 0.0, 1.0);\n";
+						*out << "\t" << i << " = -" << b << " > " << a << " ? " << ib << " : " << ia << ";\n";
+						*out << "\t" << d << " = mix(" << a << ", -" << b << ", h) + " << Float(params[0]) << " * h * (1.0 - h);\n";
+					return;
+				}
+
+				// Primitives fall through to here.
+				*out << "\t" << i << " = " << id << ";\n";
+			}
+
+			// Looks up the brick of a grid point in the indirection volume and filters
+			// inside its atlas slot. The grid's layout is baked in as constants, so
+			// the shader is tied to the atlas built from prog.volumes in order.
+			void EmitVolumeSampler(uint32_t volumeIndex, const volume::Grid &grid, std::ostringstream *out)
+			{
+				const glm::uvec3 brickDims = bricks::BrickDims(grid);
+				const glm::vec3 lo = volume::MinCorner(grid);
+				const glm::vec3 hi = volume::MaxCorner(grid);
+				const std::string k = std::to_string(volumeIndex);
+
+				*out << "layout(set = 0, binding = " << bricks::IndirectionBinding(volumeIndex) << ") uniform usampler3D brickIndirection" << k << ";\n";
+				*out << "\n";
+				*out << "float SampleVolume" << k << "(vec3 p)\n";
+				*out << "{\n";
+				*out << "\tvec3 c = clamp(p, " << Vec3(&lo.x) << ", " << Vec3(&hi.x) << ");\n";
+				*out << "\tfloat outside = length(p - c);\n";
+				*out << "\tvec3 g = (c - " << Vec3(&lo.x) << ") * " << Float(1.0f / grid.voxelSize) << ";\n";
+				*out << "\tivec3 brick = min(ivec3(g * " << Float(1.0f / bricks::BRICK_CELLS) << "), ivec3(" << brickDims.x - 1 << ", " << brickDims.y - 1 << ", " << brickDims.z - 1 << "));\n";
+				*out << "\tuvec2 entry = texelFetch(brickIndirection" << k << ", brick, 0).xy;\n";
+				*out << "\tfloat border;\n";
+				*out << "\n";
+				*out << "\tif (entry.x == " << bricks::EMPTY_SLOT << "u)\n";
+				*out << "\t\tborder = uintBitsToFloat(entry.y);\n";
+				*out << "\telse\n";
+				*out << "\t{\n";
+				*out << "\t\tuvec3 slot = uvec3(entry.x % " << bricks::ATLAS_SLOTS << "u, entry.x / " << bricks::ATLAS_SLOTS << "u % " << bricks::ATLAS_SLOTS << "u, entry.x / " << bricks::ATLAS_SLOTS * bricks::ATLAS_SLOTS << "u);\n";
+				*out << "\t\tvec3 texel = vec3(slot * " << bricks::BRICK_SAMPLES << "u) + g - vec3(brick * " << bricks::BRICK_CELLS << ") + 0.5;\n";
+				*out << "\t\tborder = texture(brickAtlas, texel * " << Float(1.0f / bricks::ATLAS_TEXELS) << ").r * " << Float(grid.voxelSize) << ";\n";
+				*out << "\t}\n";
+				*out << "\n";
+				*out << "\treturn outside > 0.0 ? max(outside, border - outside) : border;\n";
+				*out << "}\n";
+				*out << "\n";
+			}
+
+			// The hierarchy's layout is baked in as constants, a lookup per level from
+			// the coarsest down, as occupancy::SkipEmpty does it.
+			void EmitOccupancy(const occupancy::Hierarchy &hierarchy, std::ostringstream *out)
+			{
+				*out << "layout(std430, set = " << occupancy::DESCRIPTOR_SET << ", binding = " << occupancy::BINDING << ") readonly buffer Occupancy\n";
+				*out << "{\n";
+				*out << "\tuvec2 occupancyMasks[];\n";
+				*out << "};\n";
+				*out << "\n";
+				*out << "float ExitCell(vec3 g, vec3 invDir, vec3 cell, float cellSize)\n";
+				*out << "{\n";
+				*out << "\tvec3 exits = ((cell + step(0.0, invDir)) * cellSize - g) * invDir;\n";
+				*out << "\n";
+				*out << "\treturn max(min(exits.x, min(exits.y, exits.z)), 0.0) + " << Float(hierarchy.levels[0].cellSize * 1e-3f) << ";\n";
+				*out << "}\n";
+				*out << "\n";
+				*out << "float SkipEmpty(vec3 p, vec3 invDir)\n";
+				*out << "{\n";
+				*out << "\tif (any(lessThan(p, " << Vec3(&hierarchy.min.x) << ")) || any(greaterThanEqual(p, " << Vec3(&hierarchy.max.x) << ")))\n";
+				*out << "\t\treturn 0.0;\n";
+				*out << "\n";
+				*out << "\tvec3 g = p - " << Vec3(&hierarchy.min.x) << ";\n";
+				*out << "\tuvec3 cell;\n";
+				*out << "\tuvec2 mask;\n";
+				*out << "\tuint bit;\n";
+
+				for (size_t levelIndex = hierarchy.levels.size(); levelIndex-- > 0;)
+				{
+					const occupancy::Level &level = hierarchy.levels[levelIndex];
+					const glm::uvec3 last = level.blockDims * occupancy::BLOCK_CELLS - glm::uvec3(1);
+
+					*out << "\n";
+					*out << "\tcell = min(uvec3(g * " << Float(1.0f / level.cellSize) << "), uvec3(" << last.x << "u, " << last.y << "u, " << last.z << "u));\n";
+					*out << "\tmask = occupancyMasks[" << level.firstMask << "u + ((cell.z >> 2u) * " << level.blockDims.y << "u + (cell.y >> 2u)) * " << level.blockDims.x << "u + (cell.x >> 2u)];\n";
+					*out << "\tbit = ((cell.z & 3u) * 4u + (cell.y & 3u)) * 4u + (cell.x & 3u);\n";
+					*out << "\tif (((bit < 32u ? mask.x >> bit : mask.y >> (bit - 32u)) & 1u) == 0u)\n";
+					*out << "\t\treturn ExitCell(g, invDir, vec3(cell), " << Float(level.cellSize) << ");\n";
+				}
+
+				*out << "\n";
+				*out << "\treturn 0.0;\n";
+				*out << "}\n";
+				*out << "\n";
+			}
+
+			void EmitFunction(const program::Program &prog, const std::string &name, uint32_t *inoutFunctionCount, std::ostringstream *out);
+
+			// The placements as constant arrays and a loop calling the child's function.
+			void EmitInstances(const program::Instances &instances, const std::string &name, uint32_t *inoutFunctionCount, std::ostringstream *out)
+			{
+				const std::string child = name + "Child";
+				const size_t count = instances.table->placements.size();
+
+				EmitFunction(*instances.child, child, inoutFunctionCount, out);
+
+				*out << "const vec4 " << name << "Rows[" << std::max<size_t>(count * 3, 1) << "] = vec4[](";
+				for (size_t placementIndex = 0; placementIndex < count; ++placementIndex)
+				{
+					const float * const m = instances.table->placements[placementIndex].params;
+
+					for (unsigned row = 0; row < 3; ++row)
+						*out << (placementIndex || row ? ", " : "") << "vec4(" << Float(m[row * 4]) << ", " << Float(m[row * 4 + 1]) << ", " << Float(m[row * 4 + 2]) << ", " << Float(m[row * 4 + 3]) << ")";
+				}
+				*out << (count ? "" : "vec4(0.0)") << ");\n";
+
+				*out << "const float " << name << "Scales[" << std::max<size_t>(count, 1) << "] = float[](";
+				for (size_t placementIndex = 0; placementIndex < count; ++placementIndex)
+					*out << (placementIndex ? ", " : "") << Float(instances.table->placements[placementIndex].params[12]);
+				*out << (count ? "" : "0.0") << ");\n";
+				*out << "\n";
+
+				*out << "float " << name << "(vec3 p, out uint id)\n";
+				*out << "{\n";
+				*out << "\tfloat best = uintBitsToFloat(0x7F800000u);\n";
+				*out << "\n";
+				*out << "\tid = " << scene::INVALID_NODE << "u;\n";
+				*out << "\tfor (int k = 0; k < " << count << "; ++k)\n";
+				*out << "\t{\n";
+				*out << "\t\tvec4 r0 = " << name << "Rows[k * 3], r1 = " << name << "Rows[k * 3 + 1], r2 = " << name << "Rows[k * 3 + 2];\n";
+				*out << "\t\tuint childId;\n";
+				*out << "\t\tfloat d = " << child << "(vec3(dot(p, r0.xyz) + r0.w, dot(p, r1.xyz) + r1.w, dot(p, r2.xyz) + r2.w), childId) * " << name << "Scales[k];\n";
+				*out << "\n";
+				*out << "\t\tif (d < best)\n";
+				*out << "\t\t{\n";
+				*out << "\t\t\tbest = d;\n";
+				*out << "\t\t\tid = childId;\n";
+				*out << "\t\t}\n";
+				*out << "\t}\n";
+				*out << "\n";
+				*out << "\treturn best;\n";
+				*out << "}\n";
+				*out << "\n";
+			}
+
+			// Instanced children come first, as GLSL needs functions declared before
+			// they are called. Names are numbered in emission order.
+			void EmitFunction(const program::Program &prog, const std::string &name, uint32_t *inoutFunctionCount, std::ostringstream *out)
+			{
+				std::vector<std::string> instanceFunctions;
+
+				for (const program::Instances &instances : prog.instances)
+				{
+					instanceFunctions.push_back("Instances" + std::to_string((*inoutFunctionCount)++));
+					EmitInstances(instances, instanceFunctions.back(), inoutFunctionCount, out);
+				}
+
+				*out << "float " << name << "(vec3 p0, out uint id)\n";
+				*out << "{\n";
+				*out << "\tvec3 q3;\n";
+				*out << "\tvec2 q2;\n";
+				*out << "\tfloat h;\n";
+
+				for (uint16_t pointReg = 1; pointReg < prog.pointRegisterCount; ++pointReg)
+					*out << "\tvec3 p" << pointReg << ";\n";
+
+				for (uint16_t reg = 0; reg < prog.registerCount; ++reg)
+					*out << "\tfloat d" << reg << ";\n\tuint i" << reg << ";\n";
+
+				*out << "\n";
+
+				for (const Instruction &inst : prog.code)
+					EmitInstruction(inst, instanceFunctions, out);
+
+				*out << "\n";
+				*out << "\tid = i" << prog.result << ";\n";
+				*out << "\treturn d" << prog.result << ";\n";
+				*out << "}\n";
+			}
+		}
+
+		void GenerateDistanceFunction(const program::Program &prog, std::string *outSource)
+		{
+			std::ostringstream out;
+			uint32_t functionCount = 0;
+
+			// Instanced children share the scene's volumes, so one set of samplers serves all.
+			if (!prog.volumes.empty())
+			{
+				out << "layout(set = 0, binding = " << bricks::ATLAS_BINDING << ") uniform sampler3D brickAtlas;\n";
+				for (size_t volumeIndex = 0; volumeIndex < prog.volumes.size(); ++volumeIndex)
+					EmitVolumeSampler((uint32_t)volumeIndex, *prog.volumes[volumeIndex], &out);
+			}
+
+			EmitFunction(prog, "SceneDistance", &functionCount, &out);
+
+			*outSource += out.str();
+		}
+
+		void GenerateFragmentShader(const program::Program &prog, const occupancy::Hierarchy *optOccupancy, uint32_t maxSteps, std::string *outSource)
+		{
+			outSource->clear();
+			*outSource +=
+				"#version 450\n"
+				"\n"
+				"layout(push_constant) uniform Camera\n"
+				"{\n"
+				"\tvec4 eye;\n"
+				"\tvec4 forward;\n"
+				"\tvec4 right;\n"
+				"\tvec4 up;\n"
+				"\tvec4 viewport;\n"
+				"} camera;\n"
+				"\n"
+				"layout(location = 0) out vec4 outColor;\n"
+				"\n";
+
+			GenerateDistanceFunction(prog, outSource);
+
+			if (optOccupancy && !optOccupancy->levels.empty())
+			{
+				std::ostringstream out;
+
+				out << "\n";
+				EmitOccupancy(*optOccupancy, &out);
+				*outSource += out.str();
+			}
+
+			*outSource +=
+				"\n"
+				"vec3 PrimitiveColor(uint primitiveId)\n"
+				"{\n"
+				"\tif (primitiveId == 0u)\n"
+				"\t\treturn vec3(0.55, 0.55, 0.5);\n"
+				"\n"
+				"\tuint h = primitiveId * 0x9E3779B1u;\n"
+				"\th ^= h >> 15;\n"
+				"\th *= 0x85EBCA77u;\n"
+				"\th ^= h >> 13;\n"
+				"\n"
+				"\treturn vec3(0.25) + 0.75 * vec3(h & 0xFFu, (h >> 8) & 0xFFu, (h >> 16) & 0xFFu) / 255.0;\n"
+				"}\n"
+				"\n"
+				"vec3 SceneNormal(vec3 p, float h)\n"
+				"{\n"
+				"\tconst vec2 k = vec2(1.0, -1.0);\n"
+				"\tuint id;\n"
+				"\n"
+				"\treturn normalize(k.xyy * SceneDistance(p + k.xyy * h, id) + k.yyx * SceneDistance(p + k.yyx * h, id) +\n"
+				"\t                 k.yxy * SceneDistance(p + k.yxy * h, id) + k.xxx * SceneDistance(p + k.xxx * h, id));\n"
+				"}\n"
+				"\n"
+				"void main()\n"
+				"{\n"
+				"\tvec2 ndc = vec2(gl_FragCoord.x / camera.viewport.x * 2.0 - 1.0, 1.0 - gl_FragCoord.y / camera.viewport.y * 2.0);\n"
+				"\tvec3 dir = normalize(camera.forward.xyz + camera.right.xyz * ndc.x + camera.up.xyz * ndc.y);\n"
+				"\tfloat cone = camera.viewport.z;\n"
+				"\tfloat t = 0.0;\n"
+				"\tuint id = 0u;\n"
+				"\tbool hit = false;\n";
+
+			// Skips count against the step budget, so no ray loops for ever.
+			if (optOccupancy && !optOccupancy->levels.empty())
+			{
+				*outSource +=
+					"\tvec3 invDir = 1.0 / mix(dir, vec3(1e-20), equal(dir, vec3(0.0)));\n"
+					"\n"
+					"\tfor (int step = 0; step < " + std::to_string(maxSteps) + "; ++step)\n"
+					"\t{\n"
+					"\t\tfloat skip = SkipEmpty(camera.eye.xyz + dir * t, invDir);\n"
+					"\n"
+					"\t\tif (skip > 0.0)\n"
+					"\t\t{\n"
+					"\t\t\tt += skip;\n"
+					"\t\t\tif (t > camera.viewport.w)\n"
+					"\t\t\t\tbreak;\n"
+					"\t\t\tcontinue;\n"
+					"\t\t}\n"
+					"\n";
+			}
+			else
+			{
+				*outSource +=
+					"\n"
+					"\tfor (int step = 0; step < " + std::to_string(maxSteps) + "; ++step)\n"
+					"\t{\n";
+			}
+
+			*outSource +=
+				"\t\tfloat dist = SceneDistance(camera.eye.xyz + dir * t, id);\n"
+				"\n"
+				"\t\tif (dist < max(1e-5, cone * t))\n"
+				"\t\t{\n"
+				"\t\t\thit = true;\n"
+				"\t\t\tbreak;\n"
+				"\t\t}\n"
+				"\n"
+				"\t\tt += dist;\n"
+				"\t\tif (t > camera.viewport.w)\n"
+				"\t\t\tbreak;\n"
+				"\t}\n"
+				"\n"
+				"\tvec3 color;\n"
+				"\n"
+				"\tif (hit)\n"
+				"\t{\n"
+				"\t\tvec3 n = SceneNormal(camera.eye.xyz + dir * t, max(1e-4, cone * t));\n"
+				"\t\tfloat diffuse = max(dot(n, normalize(vec3(0.6, 0.8, 0.4))), 0.0);\n"
+				"\t\tfloat sky = 0.5 + 0.5 * n.y;\n"
+				"\n"
+				"\t\tcolor = PrimitiveColor(id) * (0.15 + 0.2 * sky + 0.75 * diffuse);\n"
+				"\t}\n"
+				"\telse\n"
+				"\t\tcolor = mix(vec3(0.9, 0.9, 0.95), vec3(0.35, 0.5, 0.8), 0.5 + 0.5 * dir.y);\n"
+				"\n"
+				"\toutColor = vec4(sqrt(clamp(color, 0.0, 1.0)), 1.0);\n"
+				"}\n";
+		}
+
+		const char* FullscreenVertexShader()
+		{
+			return
+				"#version 450\n"
+				"\n"
+				"out gl_PerVertex\n"
+				"{\n"
+				"\tvec4 gl_Position;\n"
+				"};\n"
+				"\n"
+				"void main()\n"
+				"{\n"
+				"\tvec2 uv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);\n"
+				"\n"
+				"\tgl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);\n"
+				"}\n";
+		}
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Occupancy.h"
+#include "Program.h"
+#include <string>
+
+// GLSL code generation for compiled SDF programs. The register code is emitted
+// as straight line GLSL, so the GPU evaluates exactly what the CPU tracer does.
+namespace sdf
+{
+	namespace glsl
+	{
+		// Matches the push constant block declared by the generated fragment shader.
+		struct PushConstants
+		{
+			float eye[4];
+			float forward[4];
+			float right[4];       // scaled by tan(fovY / 2) * aspect
+			float up[4];          // scaled by tan(fovY / 2)
+			float viewport[4];    // width, height, pixel cone, max distance
+		};
+
+		// Appends "float SceneDistance(vec3 p0, out uint id)" to outSource, after
+		// the functions it calls for instance nodes. Placements become constant
+		// arrays looped over in full, without the CPU's grid, so this is for
+		// tables of hundreds rather than hundreds of thousands.
+		void GenerateDistanceFunction(const program::Program &prog, std::string *outSource);
+
+		// A complete sphere tracing fragment shader for a full screen triangle,
+		// shaded the same way as trace::Render. With an occupancy hierarchy, rays
+		// skip its empty cells, read from the storage buffer at
+		// occupancy::DESCRIPTOR_SET and occupancy::BINDING laid out as uploaded.
+		void GenerateFragmentShader(const program::Program &prog, const occupancy::Hierarchy *optOccupancy, uint32_t maxSteps, std::string *outSource);
+
+		// Full screen triangle from gl_VertexIndex. No vertex inputs.
+		const char* FullscreenVertexShader();
+	}
+}
@@ -0,0 +1,240 @@
+#include "Instance.h"
+#include <algorithm>
+#include <cmath>
+
+namespace sdf
+{
+	namespace instance
+	{
+		namespace
+		{
+			static const uint32_t MAX_CELLS_PER_AXIS = 1024;
+
+			glm::vec3 Xyz(const glm::vec4 &v)
+			{
+				return glm::vec3(v.x, v.y, v.z);
+			}
+
+			bool IsFinite(const glm::vec3 &min, const glm::vec3 &max)
+			{
+				for (unsigned axis = 0; axis < 3; ++axis)
+					if (!std::isfinite(min[axis]) || !std::isfinite(max[axis]))
+						return false;
+
+				return true;
+			}
+
+			size_t CellIndex(const Table &table, uint32_t x, uint32_t y, uint32_t z)
+			{
+				return ((size_t)z * table.dims.y + y) * table.dims.x + x;
+			}
+
+			// Placements sit in every cell their bounds overlap.
+			template<typename Fn>
+			void ForEachCell(const Table &table, const Placement &placement, Fn fn)
+			{
+				const glm::uvec3 lo = CellAt(table, placement.min);
+				const glm::uvec3 hi = CellAt(table, placement.max);
+
+				for (uint32_t z = lo.z; z <= hi.z; ++z)
+				{
+					for (uint32_t y = lo.y; y <= hi.y; ++y)
+					{
+						for (uint32_t x = lo.x; x <= hi.x; ++x)
+							fn(CellIndex(table, x, y, z));
+					}
+				}
+			}
+		}
+
+		void Build(const glm::mat4 *localToWorld, size_t count, const glm::vec3 &childMin, const glm::vec3 &childMax, Table *outTable)
+		{
+			const bool bounded = IsFinite(childMin, childMax);
+			const glm::vec3 localCenter = (childMin + childMax) * 0.5f;
+			const glm::vec3 halfSize = (childMax - childMin) * 0.5f;
+			float sizeSum = 0.0f;
+
+			outTable->placements.resize(count);
+			outTable->min = glm::vec3(INFINITY);
+			outTable->max = glm::vec3(-INFINITY);
+
+			for (size_t placementIndex = 0; placementIndex < count; ++placementIndex)
+			{
+				const glm::mat4 &m = localToWorld[placementIndex];
+				const glm::mat4 worldToLocal = glm::inverse(m);
+				Placement &placement = outTable->placements[placementIndex];
+
+				for (unsigned row = 0; row < 3; ++row)
+					for (unsigned col = 0; col < 4; ++col)
+						placement.params[row * 4 + col] = worldToLocal[col][row];
+
+				placement.params[12] = glm::length(Xyz(m[0]));
+
+				if (bounded)
+				{
+					const glm::vec3 center = Xyz(m * glm::vec4(localCenter, 1.0f));
+					glm::vec3 extent(0.0f);
+
+					for (unsigned col = 0; col < 3; ++col)
+						extent += glm::abs(Xyz(m[col])) * halfSize[col];
+
+					placement.min = center - extent;
+					placement.max = center + extent;
+					sizeSum += std::max(extent.x, std::max(extent.y, extent.z)) * 2.0f;
+				}
+				else
+				{
+					placement.min = glm::vec3(-INFINITY);
+					placement.max = glm::vec3(INFINITY);
+				}
+
+				outTable->min = glm::min(outTable->min, placement.min);
+				outTable->max = glm::max(outTable->max, placement.max);
+			}
+
+			outTable->dims = glm::uvec3(1);
+			outTable->cellSize = 1.0f;
+
+			// Cells about as big as a placement and holding a couple of them each.
+			if (bounded && count > 0)
+			{
+				const float meanSize = std::max(sizeSum / (float)count, 1e-6f);
+				const glm::vec3 extent = glm::max(outTable->max - outTable->min, glm::vec3(meanSize));
+				const float cellVolume = extent.x * extent.y * extent.z / std::max((float)count * 0.5f, 1.0f);
+
+				outTable->cellSize = std::max(std::cbrt(cellVolume), meanSize);
+				outTable->cellSize = std::max(outTable->cellSize, std::max(extent.x, std::max(extent.y, extent.z)) / (float)MAX_CELLS_PER_AXIS);
+
+				for (unsigned axis = 0; axis < 3; ++axis)
+				{
+					const float cells = std::ceil((outTable->max[axis] - outTable->min[axis]) / outTable->cellSize);
+
+					outTable->dims[axis] = (uint32_t)glm::clamp(cells, 1.0f, (float)MAX_CELLS_PER_AXIS);
+				}
+			}
+
+			// Counting sort of the placements into their cells.
+			const size_t cellCount = (size_t)outTable->dims.x * outTable->dims.y * outTable->dims.z;
+
+			outTable->cellStarts.assign(cellCount + 1, 0);
+
+			for (const Placement &placement : outTable->placements)
+				ForEachCell(*outTable, placement, [&](size_t cell) { ++outTable->cellStarts[cell + 1]; });
+
+			for (size_t cell = 0; cell < cellCount; ++cell)
+				outTable->cellStarts[cell + 1] += outTable->cellStarts[cell];
+
+			memory::Vector<uint32_t, memory::Tag::SCENE> cursors(outTable->cellStarts.begin(), outTable->cellStarts.end() - 1);
+
+			outTable->cellItems.resize(outTable->cellStarts[cellCount]);
+
+			for (uint32_t placementIndex = 0; placementIndex < (uint32_t)count; ++placementIndex)
+				ForEachCell(*outTable, outTable->placements[placementIndex], [&](size_t cell) { outTable->cellItems[cursors[cell]++] = placementIndex; });
+		}
+
+		glm::uvec3 CellAt(const Table &table, const glm::vec3 &pos)
+		{
+			glm::uvec3 cell(0);
+
+			for (unsigned axis = 0; axis < 3; ++axis)
+			{
+				if (table.dims[axis] == 1)
+					continue;
+
+				const float f = (pos[axis] - table.min[axis]) / table.cellSize;
+
+				cell[axis] = (uint32_t)glm::clamp(f, 0.0f, (float)(table.dims[axis] - 1));
+			}
+
+			return cell;
+		}
+
+		Block Grow(const Table &table, const Block &block)
+		{
+			Block grown;
+
+			for (unsigned axis = 0; axis < 3; ++axis)
+			{
+				grown.lo[axis] = block.lo[axis] ? block.lo[axis] - 1 : 0;
+				grown.hi[axis] = std::min(block.hi[axis] + 1, table.dims[axis] - 1);
+			}
+
+			return grown;
+		}
+
+		void GatherBlock(const Table &table, const Block &block, const Block *optSkip, std::vector<uint32_t> *inoutPlacements)
+		{
+			for (uint32_t z = block.lo.z; z <= block.hi.z; ++z)
+			{
+				for (uint32_t y = block.lo.y; y <= block.hi.y; ++y)
+				{
+					const bool skipRow = optSkip && z >= optSkip->lo.z && z <= optSkip->hi.z && y >= optSkip->lo.y && y <= optSkip->hi.y;
+
+					for (uint32_t x = block.lo.x; x <= block.hi.x; ++x)
+					{
+						// Rows through the skipped block jump over it.
+						if (skipRow && x == optSkip->lo.x)
+						{
+							x = optSkip->hi.x;
+							continue;
+						}
+
+						const size_t cellIndex = CellIndex(table, x, y, z);
+
+						inoutPlacements->insert(inoutPlacements->end(), table.cellItems.begin() + table.cellStarts[cellIndex], table.cellItems.begin() + table.cellStarts[cellIndex + 1]);
+					}
+				}
+			}
+		}
+
+		float BlockBound(const Table &table, const glm::vec3 &pos, const Block &visited)
+		{
+			float outside[3];
+			float outsideSum = 0.0f;
+			float bound = INFINITY;
+
+			for (unsigned axis = 0; axis < 3; ++axis)
+			{
+				const float excess = std::max(std::max(table.min[axis] - pos[axis], pos[axis] - table.max[axis]), 0.0f);
+
+				outside[axis] = excess * excess;
+				outsideSum += outside[axis];
+			}
+
+			// Whatever was not visited lies inside the grid and past one of the
+			// visited block's faces that are not on the grid's boundary. Squared
+			// distances to those regions differ from pos' to the grid on one axis.
+			for (unsigned axis = 0; axis < 3; ++axis)
+			{
+				const float others = outsideSum - outside[axis];
+
+				if (visited.lo[axis] > 0)
+				{
+					const float excess = std::max(pos[axis] - (table.min[axis] + (float)visited.lo[axis] * table.cellSize), 0.0f);
+
+					bound = std::min(bound, others + excess * excess);
+				}
+
+				if (visited.hi[axis] + 1 < table.dims[axis])
+				{
+					const float excess = std::max(table.min[axis] + (float)(visited.hi[axis] + 1) * table.cellSize - pos[axis], 0.0f);
+
+					bound = std::min(bound, others + excess * excess);
+				}
+			}
+
+			return std::sqrt(bound);
+		}
+
+		glm::vec3 ToLocal(const Placement &placement, const glm::vec3 &pos)
+		{
+			const float * const m = placement.params;
+
+			return glm::vec3(
+				m[0] * pos.x + m[1] * pos.y + m[2] * pos.z + m[3],
+				m[4] * pos.x + m[5] * pos.y + m[6] * pos.z + m[7],
+				m[8] * pos.x + m[9] * pos.y + m[10] * pos.z + m[11]
+			);
+		}
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Memory.h"
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+// Placement tables for instance nodes: one shared sub-tree placed many times,
+// at 13 floats a copy instead of a transform and union entry per copy. A
+// uniform grid over the placements' bounds lets a point query visit only the
+// copies near it.
+namespace sdf
+{
+	namespace instance
+	{
+		struct Placement
+		{
+			float params[13]; // as a TRANSFORM node: 3x4 world to local rows, local to world distance scale
+			glm::vec3 min;    // bounds of the placed child
+			glm::vec3 max;
+		};
+
+		struct Table
+		{
+			memory::Vector<Placement, memory::Tag::SCENE> placements;
+			glm::vec3 min;                                             // over every placement
+			glm::vec3 max;
+			glm::uvec3 dims;                                           // grid cells over [min, max]
+			float cellSize;
+			memory::Vector<uint32_t, memory::Tag::SCENE> cellStarts;   // cell c lists cellItems[cellStarts[c], cellStarts[c + 1])
+			memory::Vector<uint32_t, memory::Tag::SCENE> cellItems;    // placement indices
+		};
+
+		// childMin and childMax bound the child in its local space. Each
+		// localToWorld must be rigid with an optional uniform scale, as for
+		// scene::AddTransform. An unbounded child gets a single cell, so every
+		// query visits every placement.
+		void Build(const glm::mat4 *localToWorld, size_t count, const glm::vec3 &childMin, const glm::vec3 &childMax, Table *outTable);
+
+		// Inclusive range of grid cells.
+		struct Block
+		{
+			glm::uvec3 lo;
+			glm::uvec3 hi;
+		};
+
+		// Cell containing pos, or the nearest one when pos is outside the grid.
+		glm::uvec3 CellAt(const Table &table, const glm::vec3 &pos);
+
+		// block with one more cell on every side, within the grid.
+		Block Grow(const Table &table, const Block &block);
+
+		// Appends the placements listed in the cells of block that are not in
+		// optSkip. Placements spanning several cells are appended once per cell.
+		void GatherBlock(const Table &table, const Block &block, const Block *optSkip, std::vector<uint32_t> *inoutPlacements);
+
+		// Lower bound on the distance from pos to every placement not listed in
+		// the cells of visited. INFINITY once visited covers the grid.
+		float BlockBound(const Table &table, const glm::vec3 &pos, const Block &visited);
+
+		glm::vec3 ToLocal(const Placement &placement, const glm::vec3 &pos);
+	}
+}
@@ -0,0 +1,135 @@
+#include "Jobs.h"
+#include <condition_variable>
+#include <mutex>
+
+namespace sdf
+{
+	namespace jobs
+	{
+		struct Pool
+		{
+			std::vector<std::thread> threads;
+			std::mutex mutex;
+			std::condition_variable wake;
+			std::condition_variable done;
+			uint64_t generation = 0;
+			unsigned busy = 0;              // workers still inside the current batch
+			bool quit = false;
+
+			ItemFn fn = nullptr;
+			void *context = nullptr;
+			uint32_t itemCount = 0;
+			std::atomic<uint32_t> nextItem;
+		};
+
+		namespace
+		{
+			void Drain(Pool *pool, unsigned threadIndex)
+			{
+				for (;;)
+				{
+					const uint32_t itemIndex = pool->nextItem.fetch_add(1, std::memory_order_relaxed);
+
+					if (itemIndex >= pool->itemCount)
+						break;
+
+					pool->fn(pool->context, itemIndex, threadIndex);
+				}
+			}
+
+			void Worker(Pool *pool, unsigned threadIndex)
+			{
+				uint64_t seen = 0;
+
+				for (;;)
+				{
+					{
+						std::unique_lock<std::mutex> lock(pool->mutex);
+						pool->wake.wait(lock, [&] { return pool->quit || pool->generation != seen; });
+
+						if (pool->quit)
+							return;
+
+						seen = pool->generation;
+					}
+
+					Drain(pool, threadIndex);
+
+					std::lock_guard<std::mutex> lock(pool->mutex);
+					if (--pool->busy == 0)
+						pool->done.notify_one();
+				}
+			}
+		}
+
+		Pool* CreatePool(unsigned threadCount)
+		{
+			Pool * const pool = new Pool();
+
+			if (threadCount == 0)
+				threadCount = HardwareThreadCount();
+
+			pool->nextItem = 0;
+			pool->threads.reserve(threadCount - 1);
+
+			for (unsigned threadIndex = 1; threadIndex < threadCount; ++threadIndex)
+				pool->threads.emplace_back(Worker, pool, threadIndex);
+
+			return pool;
+		}
+
+		void DestroyPool(Pool *pool)
+		{
+			if (!pool)
+				return;
+
+			{
+				std::lock_guard<std::mutex> lock(pool->mutex);
+				pool->quit = true;
+			}
+
+			pool->wake.notify_all();
+
+			for (std::thread &thread : pool->threads)
+				thread.join();
+
+			delete pool;
+		}
+
+		unsigned ThreadCount(const Pool *pool)
+		{
+			return (unsigned)pool->threads.size() + 1;
+		}
+
+		void Run(Pool *pool, uint32_t itemCount, ItemFn fn, void *context)
+		{
+			if (itemCount == 0)
+				return;
+
+			// Waking workers costs more than a single item.
+			if (pool->threads.empty() || itemCount == 1)
+			{
+				for (uint32_t itemIndex = 0; itemIndex < itemCount; ++itemIndex)
+					fn(context, itemIndex, 0);
+
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(pool->mutex);
+				pool->fn = fn;
+				pool->context = context;
+				pool->itemCount = itemCount;
+				pool->nextItem = 0;
+				pool->busy = (unsigned)pool->threads.size();
+				++pool->generation;
+			}
+
+			pool->wake.notify_all();
+			Drain(pool, 0);
+
+			std::unique_lock<std::mutex> lock(pool->mutex);
+			pool->done.wait(lock, [&] { return pool->busy == 0; });
+		}
+	}
+}
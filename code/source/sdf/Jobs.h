@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+namespace sdf
+{
+	namespace jobs
+	{
+		inline unsigned HardwareThreadCount()
+		{
+			const unsigned count = std::thread::hardware_concurrency();
+
+			return count ? count : 1;
+		}
+
+		// Runs fn(itemIndex, threadIndex) for every item in [0, itemCount). Items are
+		// handed out one at a time from a shared counter, so uneven items (tiles that
+		// hit a lot of surface, bricks near the band) balance themselves.
+		template<typename Fn>
+		void ParallelFor(uint32_t itemCount, unsigned threadCount, const Fn &fn)
+		{
+			std::atomic<uint32_t> nextItem(0);
+			auto Worker = [&](unsigned threadIndex)
+			{
+				for (;;)
+				{
+					const uint32_t itemIndex = nextItem.fetch_add(1, std::memory_order_relaxed);
+
+					if (itemIndex >= itemCount)
+						break;
+
+					fn(itemIndex, threadIndex);
+				}
+			};
+
+			if (threadCount == 0)
+				threadCount = HardwareThreadCount();
+
+			if (threadCount > itemCount)
+				threadCount = itemCount ? itemCount : 1;
+
+			std::vector<std::thread> threads;
+			threads.reserve(threadCount - 1);
+
+			for (unsigned threadIndex = 1; threadIndex < threadCount; ++threadIndex)
+				threads.emplace_back(Worker, threadIndex);
+
+			Worker(0);
+
+			for (std::thread &thread : threads)
+				thread.join();
+		}
+
+		// Persistent worker threads for work issued often and in small batches,
+		// where starting threads on every call (as ParallelFor does) would cost more
+		// than the work itself. One batch runs at a time, and the calling thread
+		// works on it as thread 0.
+		struct Pool;
+
+		typedef void (*ItemFn)(void *context, uint32_t itemIndex, unsigned threadIndex);
+
+		// threadCount includes the calling thread. 0 uses every hardware thread.
+		Pool* CreatePool(unsigned threadCount);
+		void DestroyPool(Pool *pool);
+		unsigned ThreadCount(const Pool *pool);
+
+		// Returns once every item has run. Not reentrant.
+		void Run(Pool *pool, uint32_t itemCount, ItemFn fn, void *context);
+
+		template<typename Fn>
+		void ParallelFor(Pool *pool, uint32_t itemCount, const Fn &fn)
+		{
+			Run(pool, itemCount, [](void *context, uint32_t itemIndex, unsigned threadIndex)
+			{
+				(*(const Fn*)context)(itemIndex, threadIndex);
+			}, (void*)&fn);
+		}
+	}
+}
@@ -0,0 +1,140 @@
+#include "Memory.h"
+#include <atomic>
+#include <cstdio>
+
+namespace sdf
+{
+	namespace memory
+	{
+		namespace
+		{
+			// A cache line each, so threads allocating under different tags do not
+			// contend.
+			struct alignas(64) AtomicCounter
+			{
+				std::atomic<int64_t> current{ 0 };
+				std::atomic<int64_t> peak{ 0 };
+				std::atomic<uint64_t> allocations{ 0 };
+				std::atomic<uint64_t> frees{ 0 };
+			};
+
+			AtomicCounter cpuCounters[(unsigned)Tag::COUNT];
+			AtomicCounter gpuCounters[(unsigned)GpuUsage::COUNT];
+
+			void Add(AtomicCounter *inoutCounter, int64_t bytes)
+			{
+				const int64_t current = inoutCounter->current.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+				int64_t peak = inoutCounter->peak.load(std::memory_order_relaxed);
+
+				while (current > peak && !inoutCounter->peak.compare_exchange_weak(peak, current, std::memory_order_relaxed))
+					;
+				inoutCounter->allocations.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			void Remove(AtomicCounter *inoutCounter, int64_t bytes)
+			{
+				inoutCounter->current.fetch_sub(bytes, std::memory_order_relaxed);
+				inoutCounter->frees.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			Counter Read(const AtomicCounter &counter)
+			{
+				Counter result;
+
+				result.current = counter.current.load(std::memory_order_relaxed);
+				result.peak = counter.peak.load(std::memory_order_relaxed);
+				result.allocations = counter.allocations.load(std::memory_order_relaxed);
+				result.frees = counter.frees.load(std::memory_order_relaxed);
+				return result;
+			}
+
+			void FormatLine(const char *name, const Counter &counter, std::string *inoutText)
+			{
+				char line[160];
+
+				snprintf(line, sizeof(line), "  %-14s %10.2f MB current %10.2f MB peak %10llu live\n", name, counter.current / (1024.0 * 1024.0), counter.peak / (1024.0 * 1024.0), (unsigned long long)(counter.allocations - counter.frees));
+				inoutText->append(line);
+			}
+
+			void WriteCounters(FILE *file, const char *name, const Counter &counter, bool last)
+			{
+				fprintf(file, "\t\t\"%s\": { \"current\": %lld, \"peak\": %lld, \"allocations\": %llu, \"frees\": %llu }%s\n", name, (long long)counter.current, (long long)counter.peak, (unsigned long long)counter.allocations, (unsigned long long)counter.frees, last ? "" : ",");
+			}
+		}
+
+		void TrackAllocation(Tag tag, size_t bytes)
+		{
+			Add(&cpuCounters[(unsigned)tag], (int64_t)bytes);
+		}
+
+		void TrackFree(Tag tag, size_t bytes)
+		{
+			Remove(&cpuCounters[(unsigned)tag], (int64_t)bytes);
+		}
+
+		void TrackGpuAllocation(GpuUsage usage, uint64_t bytes)
+		{
+			Add(&gpuCounters[(unsigned)usage], (int64_t)bytes);
+		}
+
+		void TrackGpuFree(GpuUsage usage, uint64_t bytes)
+		{
+			Remove(&gpuCounters[(unsigned)usage], (int64_t)bytes);
+		}
+
+		void GetReport(Report *outReport)
+		{
+			for (unsigned tag = 0; tag < (unsigned)Tag::COUNT; ++tag)
+				outReport->cpu[tag] = Read(cpuCounters[tag]);
+			for (unsigned usage = 0; usage < (unsigned)GpuUsage::COUNT; ++usage)
+				outReport->gpu[usage] = Read(gpuCounters[usage]);
+		}
+
+		const char* TagName(Tag tag)
+		{
+			static const char * const NAMES[] = { "scene", "volumes", "bricks", "occupancy", "meshes", "shader_cache", "staging" };
+			static_assert(sizeof(NAMES) / sizeof(NAMES[0]) == (size_t)Tag::COUNT, "Tag names out of date.");
+
+			return NAMES[(unsigned)tag];
+		}
+
+		const char* GpuUsageName(GpuUsage usage)
+		{
+			static const char * const NAMES[] = { "vertex", "index", "uniform", "storage", "staging", "attachment", "sampled", "other" };
+			static_assert(sizeof(NAMES) / sizeof(NAMES[0]) == (size_t)GpuUsage::COUNT, "GPU usage names out of date.");
+
+			return NAMES[(unsigned)usage];
+		}
+
+		void FormatReport(const Report &report, std::string *outText)
+		{
+			outText->assign("CPU memory:\n");
+			for (unsigned tag = 0; tag < (unsigned)Tag::COUNT; ++tag)
+				FormatLine(TagName((Tag)tag), report.cpu[tag], outText);
+
+			outText->append("GPU memory:\n");
+			for (unsigned usage = 0; usage < (unsigned)GpuUsage::COUNT; ++usage)
+				FormatLine(GpuUsageName((GpuUsage)usage), report.gpu[usage], outText);
+		}
+
+		bool WriteJson(const char *fileName, const Report &report)
+		{
+			FILE * const file = std::fopen(fileName, "w");
+
+			if (!file)
+				return false;
+
+			fprintf(file, "{\n\t\"cpu\": {\n");
+			for (unsigned tag = 0; tag < (unsigned)Tag::COUNT; ++tag)
+				WriteCounters(file, TagName((Tag)tag), report.cpu[tag], tag + 1 == (unsigned)Tag::COUNT);
+
+			fprintf(file, "\t},\n\t\"gpu\": {\n");
+			for (unsigned usage = 0; usage < (unsigned)GpuUsage::COUNT; ++usage)
+				WriteCounters(file, GpuUsageName((GpuUsage)usage), report.gpu[usage], usage + 1 == (unsigned)GpuUsage::COUNT);
+
+			fprintf(file, "\t}\n}\n");
+
+			return std::fclose(file) == 0;
+		}
+	}
+}
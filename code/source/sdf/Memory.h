@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Memory accounting by subsystem. CPU containers that can grow large allocate
+// through a tagged allocator, and GPU allocations are reported by usage. Each
+// allocation costs a couple of relaxed atomic adds, so accounting stays on in
+// release builds.
+namespace sdf
+{
+	namespace memory
+	{
+		enum class Tag : unsigned char
+		{
+			SCENE,          // scene nodes and compiled programs
+			VOLUMES,        // sampled distance grids
+			BRICKS,         // brick atlas bookkeeping
+			OCCUPANCY,      // empty space skipping masks
+			MESHES,
+			SHADER_CACHE,   // SPIR-V binaries kept by shader compilers
+			STAGING,        // data waiting to be uploaded
+			COUNT
+		};
+
+		enum class GpuUsage : unsigned char
+		{
+			VERTEX,
+			INDEX,
+			UNIFORM,
+			STORAGE,
+			STAGING,        // transfer sources
+			ATTACHMENT,     // color and depth targets
+			SAMPLED,
+			OTHER,
+			COUNT
+		};
+
+		struct Counter
+		{
+			int64_t current = 0;      // bytes
+			int64_t peak = 0;
+			uint64_t allocations = 0; // since startup
+			uint64_t frees = 0;
+		};
+
+		struct Report
+		{
+			Counter cpu[(unsigned)Tag::COUNT];
+			Counter gpu[(unsigned)GpuUsage::COUNT];
+		};
+
+		void TrackAllocation(Tag tag, size_t bytes);
+		void TrackFree(Tag tag, size_t bytes);
+		void TrackGpuAllocation(GpuUsage usage, uint64_t bytes);
+		void TrackGpuFree(GpuUsage usage, uint64_t bytes);
+
+		// Counters are read one at a time, so a report taken while other threads
+		// allocate is close to, but not exactly, a single point in time.
+		void GetReport(Report *outReport);
+
+		const char* TagName(Tag tag);
+		const char* GpuUsageName(GpuUsage usage);
+
+		// One line per subsystem with current and peak sizes, for logs.
+		void FormatReport(const Report &report, std::string *outText);
+		bool WriteJson(const char *fileName, const Report &report);
+
+		// std::allocator that reports its allocations under TAG.
+		template<typename T, Tag TAG>
+		struct Allocator
+		{
+			typedef T value_type;
+
+			template<typename U>
+			struct rebind
+			{
+				typedef Allocator<U, TAG> other;
+			};
+
+			Allocator() = default;
+			template<typename U> Allocator(const Allocator<U, TAG>&) {}
+
+			T* allocate(size_t count)
+			{
+				TrackAllocation(TAG, count * sizeof(T));
+				return std::allocator<T>().allocate(count);
+			}
+
+			void deallocate(T *ptr, size_t count)
+			{
+				TrackFree(TAG, count * sizeof(T));
+				std::allocator<T>().deallocate(ptr, count);
+			}
+
+			template<typename U> bool operator==(const Allocator<U, TAG>&) const { return true; }
+			template<typename U> bool operator!=(const Allocator<U, TAG>&) const { return false; }
+		};
+
+		template<typename T, Tag TAG>
+		using Vector = std::vector<T, Allocator<T, TAG>>;
+	}
+}
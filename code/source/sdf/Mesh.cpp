@@ -0,0 +1,483 @@
+#include "Mesh.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <unordered_map>
+
+namespace sdf
+{
+	namespace mesh
+	{
+		namespace
+		{
+			struct File
+			{
+				FILE *handle;
+
+				explicit File(const char *fileName) : handle(std::fopen(fileName, "rb")) {}
+				~File() { if (handle) std::fclose(handle); }
+			};
+
+			bool EndsWith(const char *str, const char *suffix)
+			{
+				const size_t strLen = std::strlen(str);
+				const size_t suffixLen = std::strlen(suffix);
+
+				if (suffixLen > strLen)
+					return false;
+
+				for (size_t charIndex = 0; charIndex < suffixLen; ++charIndex)
+					if (std::tolower((unsigned char)str[strLen - suffixLen + charIndex]) != suffix[charIndex])
+						return false;
+
+				return true;
+			}
+
+			// Fans a polygon from its first vertex.
+			void AddPolygon(const uint32_t *corners, size_t cornerCount, Mesh *inoutMesh)
+			{
+				for (size_t corner = 2; corner < cornerCount; ++corner)
+				{
+					inoutMesh->indices.push_back(corners[0]);
+					inoutMesh->indices.push_back(corners[corner - 1]);
+					inoutMesh->indices.push_back(corners[corner]);
+				}
+			}
+
+			bool ValidateIndices(const Mesh &mesh)
+			{
+				for (uint32_t index : mesh.indices)
+					if (index >= mesh.positions.size())
+						return false;
+
+				return !mesh.indices.empty();
+			}
+
+			enum class PlyType : unsigned char
+			{
+				INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32, FLOAT64, INVALID
+			};
+
+			struct PlyProperty
+			{
+				std::string name;
+				PlyType type;
+				PlyType countType; // INVALID unless this is a list
+			};
+
+			struct PlyElement
+			{
+				std::string name;
+				size_t count;
+				std::vector<PlyProperty> properties;
+			};
+
+			PlyType ParsePlyType(const char *name)
+			{
+				static const struct { const char *name; PlyType type; } types[] =
+				{
+					{ "char", PlyType::INT8 },    { "int8", PlyType::INT8 },
+					{ "uchar", PlyType::UINT8 },  { "uint8", PlyType::UINT8 },
+					{ "short", PlyType::INT16 },  { "int16", PlyType::INT16 },
+					{ "ushort", PlyType::UINT16 },{ "uint16", PlyType::UINT16 },
+					{ "int", PlyType::INT32 },    { "int32", PlyType::INT32 },
+					{ "uint", PlyType::UINT32 },  { "uint32", PlyType::UINT32 },
+					{ "float", PlyType::FLOAT32 },{ "float32", PlyType::FLOAT32 },
+					{ "double", PlyType::FLOAT64 },{ "float64", PlyType::FLOAT64 },
+				};
+
+				for (const auto &entry : types)
+					if (std::strcmp(entry.name, name) == 0)
+						return entry.type;
+
+				return PlyType::INVALID;
+			}
+
+			// Zero for INVALID.
+			size_t PlyTypeSize(PlyType type)
+			{
+				static const size_t sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+
+				return (unsigned)type < std::size(sizes) ? sizes[(unsigned)type] : 0;
+			}
+
+			bool ReadPlyBinary(FILE *file, PlyType type, bool bigEndian, double *outValue)
+			{
+				unsigned char bytes[8];
+				const size_t size = PlyTypeSize(type);
+
+				if (size == 0 || size > sizeof(bytes))
+					return false;
+
+				if (std::fread(bytes, 1, size, file) != size)
+					return false;
+
+				if (bigEndian)
+					std::reverse(bytes, bytes + size);
+
+				switch (type)
+				{
+					case PlyType::INT8:    { int8_t v;   std::memcpy(&v, bytes, size); *outValue = v; } break;
+					case PlyType::UINT8:   { uint8_t v;  std::memcpy(&v, bytes, size); *outValue = v; } break;
+					case PlyType::INT16:   { int16_t v;  std::memcpy(&v, bytes, size); *outValue = v; } break;
+					case PlyType::UINT16:  { uint16_t v; std::memcpy(&v, bytes, size); *outValue = v; } break;
+					case PlyType::INT32:   { int32_t v;  std::memcpy(&v, bytes, size); *outValue = v; } break;
+					case PlyType::UINT32:  { uint32_t v; std::memcpy(&v, bytes, size); *outValue = v; } break;
+					case PlyType::FLOAT32: { float v;    std::memcpy(&v, bytes, size); *outValue = v; } break;
+					case PlyType::FLOAT64: { double v;   std::memcpy(&v, bytes, size); *outValue = v; } break;
+					default: return false;
+				}
+
+				return true;
+			}
+
+			bool ReadPlyAscii(FILE *file, double *outValue)
+			{
+				return std::fscanf(file, "%lf", outValue) == 1;
+			}
+
+			struct PositionHash
+			{
+				size_t operator()(const glm::vec3 &pos) const
+				{
+					uint32_t bits[3];
+					std::memcpy(bits, &pos.x, sizeof(bits));
+
+					return (size_t)(bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u);
+				}
+			};
+
+			struct PositionEqual
+			{
+				bool operator()(const glm::vec3 &a, const glm::vec3 &b) const
+				{
+					return a.x == b.x && a.y == b.y && a.z == b.z;
+				}
+			};
+
+			uint32_t Weld(const glm::vec3 &pos, std::unordered_map<glm::vec3, uint32_t, PositionHash, PositionEqual> *inoutLookup, Mesh *inoutMesh)
+			{
+				const auto inserted = inoutLookup->emplace(pos, (uint32_t)inoutMesh->positions.size());
+
+				if (inserted.second)
+					inoutMesh->positions.push_back(pos);
+
+				return inserted.first->second;
+			}
+		}
+
+		bool Load(const char *fileName, Mesh *outMesh)
+		{
+			if (EndsWith(fileName, ".obj"))
+				return LoadOBJ(fileName, outMesh);
+
+			if (EndsWith(fileName, ".ply"))
+				return LoadPLY(fileName, outMesh);
+
+			if (EndsWith(fileName, ".stl"))
+				return LoadSTL(fileName, outMesh);
+
+			return false;
+		}
+
+		bool LoadOBJ(const char *fileName, Mesh *outMesh)
+		{
+			File file(fileName);
+			char line[4096];
+			std::vector<uint32_t> corners;
+
+			*outMesh = Mesh();
+
+			if (!file.handle)
+				return false;
+
+			while (std::fgets(line, sizeof(line), file.handle))
+			{
+				if (line[0] == 'v' && line[1] == ' ')
+				{
+					char *cursor = line + 2;
+					glm::vec3 pos;
+
+					for (unsigned axis = 0; axis < 3; ++axis)
+						pos[axis] = std::strtof(cursor, &cursor);
+
+					outMesh->positions.push_back(pos);
+				}
+				else if (line[0] == 'f' && line[1] == ' ')
+				{
+					char *cursor = line + 2;
+
+					corners.clear();
+
+					for (;;)
+					{
+						char *end;
+						const long index = std::strtol(cursor, &end, 10);
+
+						if (end == cursor)
+							break;
+
+						// 1 based, negative counts back from the most recent vertex.
+						corners.push_back(index < 0 ? (uint32_t)(outMesh->positions.size() + index) : (uint32_t)(index - 1));
+
+						// Skip texture and normal indices.
+						cursor = end;
+						while (*cursor && *cursor != ' ' && *cursor != '\t' && *cursor != '\r' && *cursor != '\n')
+							++cursor;
+					}
+
+					AddPolygon(corners.data(), corners.size(), outMesh);
+				}
+			}
+
+			return ValidateIndices(*outMesh);
+		}
+
+		bool LoadPLY(const char *fileName, Mesh *outMesh)
+		{
+			File file(fileName);
+			char line[1024];
+			std::vector<PlyElement> elements;
+			bool ascii = false;
+			bool bigEndian = false;
+
+			*outMesh = Mesh();
+
+			if (!file.handle || !std::fgets(line, sizeof(line), file.handle) || std::strncmp(line, "ply", 3) != 0)
+				return false;
+
+			for (;;)
+			{
+				char word[64], arg0[64], arg1[64], arg2[64];
+
+				if (!std::fgets(line, sizeof(line), file.handle))
+					return false;
+
+				if (std::sscanf(line, "%63s", word) != 1)
+					continue;
+
+				if (std::strcmp(word, "end_header") == 0)
+					break;
+
+				if (std::strcmp(word, "format") == 0 && std::sscanf(line, "%*s %63s", arg0) == 1)
+				{
+					ascii = std::strcmp(arg0, "ascii") == 0;
+					bigEndian = std::strcmp(arg0, "binary_big_endian") == 0;
+				}
+				else if (std::strcmp(word, "element") == 0)
+				{
+					unsigned long count = 0;
+
+					if (std::sscanf(line, "%*s %63s %lu", arg0, &count) != 2)
+						return false;
+
+					elements.push_back(PlyElement{ arg0, (size_t)count, {} });
+				}
+				else if (std::strcmp(word, "property") == 0 && !elements.empty())
+				{
+					PlyProperty property;
+
+					if (std::sscanf(line, "%*s list %63s %63s %63s", arg0, arg1, arg2) == 3)
+					{
+						property.countType = ParsePlyType(arg0);
+						property.type = ParsePlyType(arg1);
+						property.name = arg2;
+
+						if (property.countType == PlyType::INVALID)
+							return false;
+					}
+					else if (std::sscanf(line, "%*s %63s %63s", arg0, arg1) == 2)
+					{
+						property.countType = PlyType::INVALID;
+						property.type = ParsePlyType(arg0);
+						property.name = arg1;
+					}
+					else
+						return false;
+
+					if (property.type == PlyType::INVALID)
+						return false;
+
+					elements.back().properties.push_back(property);
+				}
+			}
+
+			std::vector<uint32_t> corners;
+
+			for (const PlyElement &element : elements)
+			{
+				const bool isVertex = element.name == "vertex";
+				const bool isFace = element.name == "face";
+
+				for (size_t itemIndex = 0; itemIndex < element.count; ++itemIndex)
+				{
+					glm::vec3 pos(0.0f);
+
+					for (const PlyProperty &property : element.properties)
+					{
+						double value;
+						size_t valueCount = 1;
+
+						if (property.countType != PlyType::INVALID)
+						{
+							if (!(ascii ? ReadPlyAscii(file.handle, &value) : ReadPlyBinary(file.handle, property.countType, bigEndian, &value)))
+								return false;
+
+							valueCount = (size_t)value;
+						}
+
+						const bool faceIndices = isFace && property.countType != PlyType::INVALID && (property.name == "vertex_indices" || property.name == "vertex_index");
+
+						corners.clear();
+
+						for (size_t valueIndex = 0; valueIndex < valueCount; ++valueIndex)
+						{
+							if (!(ascii ? ReadPlyAscii(file.handle, &value) : ReadPlyBinary(file.handle, property.type, bigEndian, &value)))
+								return false;
+
+							if (faceIndices)
+								corners.push_back((uint32_t)value);
+						}
+
+						if (faceIndices)
+							AddPolygon(corners.data(), corners.size(), outMesh);
+						else if (isVertex && property.name.size() == 1 && property.name[0] >= 'x' && property.name[0] <= 'z')
+							pos[property.name[0] - 'x'] = (float)value;
+					}
+
+					if (isVertex)
+						outMesh->positions.push_back(pos);
+				}
+			}
+
+			return ValidateIndices(*outMesh);
+		}
+
+		bool LoadSTL(const char *fileName, Mesh *outMesh)
+		{
+			File file(fileName);
+			std::unordered_map<glm::vec3, uint32_t, PositionHash, PositionEqual> lookup;
+			char header[80];
+			uint32_t triangleCount = 0;
+
+			*outMesh = Mesh();
+
+			if (!file.handle)
+				return false;
+
+			std::fseek(file.handle, 0, SEEK_END);
+			const long fileSize = std::ftell(file.handle);
+			std::fseek(file.handle, 0, SEEK_SET);
+
+			// Binary files often start with "solid" too, so trust the size instead.
+			const bool binary = std::fread(header, 1, sizeof(header), file.handle) == sizeof(header) &&
+				std::fread(&triangleCount, sizeof(triangleCount), 1, file.handle) == 1 &&
+				fileSize == 84 + 50 * (long)triangleCount;
+
+			if (binary)
+			{
+				for (uint32_t triIndex = 0; triIndex < triangleCount; ++triIndex)
+				{
+					unsigned char record[50];
+					float values[12];
+
+					if (std::fread(record, 1, sizeof(record), file.handle) != sizeof(record))
+						return false;
+
+					std::memcpy(values, record, sizeof(values));
+
+					// Skip the facet normal, it is recomputed from the winding anyway.
+					for (unsigned corner = 0; corner < 3; ++corner)
+						outMesh->indices.push_back(Weld(glm::vec3(values[3 + corner * 3], values[4 + corner * 3], values[5 + corner * 3]), &lookup, outMesh));
+				}
+			}
+			else
+			{
+				char line[1024];
+
+				std::fseek(file.handle, 0, SEEK_SET);
+
+				while (std::fgets(line, sizeof(line), file.handle))
+				{
+					glm::vec3 pos;
+
+					if (std::sscanf(line, " vertex %f %f %f", &pos.x, &pos.y, &pos.z) == 3)
+						outMesh->indices.push_back(Weld(pos, &lookup, outMesh));
+				}
+
+				outMesh->indices.resize(outMesh->indices.size() / 3 * 3);
+			}
+
+			return ValidateIndices(*outMesh);
+		}
+
+		void MakeTorusKnot(uint32_t triangleCount, Mesh *outMesh)
+		{
+			const uint32_t sides = std::max<uint32_t>(6, (uint32_t)std::sqrt(triangleCount / 32.0));
+			const uint32_t rings = std::max<uint32_t>(16, triangleCount / (2 * sides));
+			const float tubeRadius = 0.12f;
+			const float twoPi = 6.28318531f;
+
+			*outMesh = Mesh();
+			outMesh->positions.reserve((size_t)rings * sides);
+			outMesh->indices.reserve((size_t)rings * sides * 6);
+
+			for (uint32_t ring = 0; ring < rings; ++ring)
+			{
+				const float t = twoPi * ring / rings;
+				const float r = 2.0f + std::cos(3.0f * t);
+				const glm::vec3 center = glm::vec3(r * std::cos(2.0f * t), std::sin(3.0f * t), r * std::sin(2.0f * t)) * 0.25f;
+				const glm::vec3 tangent = glm::normalize(glm::vec3(
+					-3.0f * std::sin(3.0f * t) * std::cos(2.0f * t) - 2.0f * r * std::sin(2.0f * t),
+					3.0f * std::cos(3.0f * t),
+					-3.0f * std::sin(3.0f * t) * std::sin(2.0f * t) + 2.0f * r * std::cos(2.0f * t)));
+
+				// The knot never runs parallel to Y, so Y gives a frame with no flips.
+				const glm::vec3 normal = glm::normalize(glm::cross(tangent, glm::vec3(0.0f, 1.0f, 0.0f)));
+				const glm::vec3 binormal = glm::cross(normal, tangent);
+
+				for (uint32_t side = 0; side < sides; ++side)
+				{
+					const float theta = twoPi * side / sides;
+
+					outMesh->positions.push_back(center + (normal * std::cos(theta) + binormal * std::sin(theta)) * tubeRadius);
+				}
+			}
+
+			for (uint32_t ring = 0; ring < rings; ++ring)
+			{
+				const uint32_t nextRing = (ring + 1) % rings;
+
+				for (uint32_t side = 0; side < sides; ++side)
+				{
+					const uint32_t nextSide = (side + 1) % sides;
+					const uint32_t a = ring * sides + side;
+					const uint32_t b = nextRing * sides + side;
+					const uint32_t c = nextRing * sides + nextSide;
+					const uint32_t d = ring * sides + nextSide;
+					const uint32_t quad[] = { a, b, c, a, c, d };
+
+					outMesh->indices.insert(outMesh->indices.end(), quad, quad + 6);
+				}
+			}
+		}
+
+		void ComputeBounds(const Mesh &mesh, glm::vec3 *outMin, glm::vec3 *outMax)
+		{
+			*outMin = glm::vec3(std::numeric_limits<float>::max());
+			*outMax = glm::vec3(-std::numeric_limits<float>::max());
+
+			for (const glm::vec3 &pos : mesh.positions)
+			{
+				*outMin = glm::min(*outMin, pos);
+				*outMax = glm::max(*outMax, pos);
+			}
+		}
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Memory.h"
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+// Indexed triangle meshes, for importing assets into SDF scenes.
+namespace sdf
+{
+	namespace mesh
+	{
+		struct Mesh
+		{
+			memory::Vector<glm::vec3, memory::Tag::MESHES> positions;
+			memory::Vector<uint32_t, memory::Tag::MESHES> indices; // 3 per triangle, counter clockwise seen from outside
+		};
+
+		inline size_t TriangleCount(const Mesh &mesh)
+		{
+			return mesh.indices.size() / 3;
+		}
+
+		// Picks the loader from the extension: .obj, .ply (ascii or binary) or .stl
+		// (ascii or binary). Polygons are fanned into triangles, and STL's
+		// unindexed triangles are welded on exact position so edges are shared.
+		bool Load(const char *fileName, Mesh *outMesh);
+		bool LoadOBJ(const char *fileName, Mesh *outMesh);
+		bool LoadPLY(const char *fileName, Mesh *outMesh);
+		bool LoadSTL(const char *fileName, Mesh *outMesh);
+
+		// Closed tube around a (2, 3) torus knot with about triangleCount
+		// triangles. Watertight, for bake benchmarks at any size.
+		void MakeTorusKnot(uint32_t triangleCount, Mesh *outMesh);
+
+		void ComputeBounds(const Mesh &mesh, glm::vec3 *outMin, glm::vec3 *outMax);
+	}
+}
@@ -0,0 +1,300 @@
+#include "Mip.h"
+#include "Jobs.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace sdf
+{
+	namespace mip
+	{
+		namespace
+		{
+			typedef std::chrono::high_resolution_clock Clock;
+
+			size_t CellIndex(const Level &level, uint32_t x, uint32_t y, uint32_t z)
+			{
+				return ((size_t)z * level.dims.y + y) * level.dims.x + x;
+			}
+
+			// Bound over the union of two regions.
+			float Combine(float a, float b)
+			{
+				if (a > 0.0f && b > 0.0f)
+					return std::min(a, b);
+				if (a < 0.0f && b < 0.0f)
+					return std::max(a, b);
+				return 0.0f;
+			}
+
+			// Every point of a voxel is within half its diagonal of one of its
+			// corners, and the field is 1-Lipschitz, so the corner closest to the
+			// surface less that is a bound over the voxel.
+			float VoxelBound(const volume::Grid &grid, uint32_t x, uint32_t y, uint32_t z)
+			{
+				const float halfDiagonal = grid.voxelSize * 0.8660254f;
+				const size_t dy = grid.dims.x;
+				const size_t dz = (size_t)grid.dims.x * grid.dims.y;
+				const float * const v = grid.values.data() + volume::Index(grid, x, y, z);
+				const float corners[8] = { v[0], v[1], v[dy], v[dy + 1], v[dz], v[dz + 1], v[dz + dy], v[dz + dy + 1] };
+				float bound = corners[0];
+
+				for (unsigned cornerIndex = 1; cornerIndex < 8; ++cornerIndex)
+					bound = Combine(bound, corners[cornerIndex]);
+
+				if (bound > 0.0f)
+					return std::max(bound - halfDiagonal, 0.0f);
+				return std::min(bound + halfDiagonal, 0.0f);
+			}
+
+			// Finest level cells are 2x2x2 voxels.
+			float VoxelsBound(const volume::Grid &grid, uint32_t x, uint32_t y, uint32_t z)
+			{
+				const uint32_t x1 = std::min(x * 2 + 1, grid.dims.x - 2);
+				const uint32_t y1 = std::min(y * 2 + 1, grid.dims.y - 2);
+				const uint32_t z1 = std::min(z * 2 + 1, grid.dims.z - 2);
+				float bound = VoxelBound(grid, x * 2, y * 2, z * 2);
+
+				for (uint32_t vz = z * 2; vz <= z1; ++vz)
+				{
+					for (uint32_t vy = y * 2; vy <= y1; ++vy)
+					{
+						for (uint32_t vx = x * 2; vx <= x1; ++vx)
+							bound = Combine(bound, VoxelBound(grid, vx, vy, vz));
+					}
+				}
+
+				return bound;
+			}
+
+			float ChildrenBound(const Level &children, uint32_t x, uint32_t y, uint32_t z)
+			{
+				const uint32_t x1 = std::min(x * 2 + 1, children.dims.x - 1);
+				const uint32_t y1 = std::min(y * 2 + 1, children.dims.y - 1);
+				const uint32_t z1 = std::min(z * 2 + 1, children.dims.z - 1);
+				float bound = children.bounds[CellIndex(children, x * 2, y * 2, z * 2)];
+
+				for (uint32_t cz = z * 2; cz <= z1; ++cz)
+				{
+					for (uint32_t cy = y * 2; cy <= y1; ++cy)
+					{
+						for (uint32_t cx = x * 2; cx <= x1; ++cx)
+							bound = Combine(bound, children.bounds[CellIndex(children, cx, cy, cz)]);
+					}
+				}
+
+				return bound;
+			}
+
+			// Cells [lo, hi] of level levelIndex, from the grid or the level below.
+			void BuildCells(const volume::Grid &grid, uint32_t levelIndex, const glm::uvec3 &lo, const glm::uvec3 &hi, unsigned threadCount, Pyramid *inoutPyramid)
+			{
+				Level &level = inoutPyramid->levels[levelIndex];
+				const Level * const children = levelIndex ? &inoutPyramid->levels[levelIndex - 1] : nullptr;
+				auto BuildSlab = [&](uint32_t z)
+				{
+					for (uint32_t y = lo.y; y <= hi.y; ++y)
+					{
+						float *bounds = level.bounds.data() + CellIndex(level, 0, y, z);
+
+						for (uint32_t x = lo.x; x <= hi.x; ++x)
+							bounds[x] = children ? ChildrenBound(*children, x, y, z) : VoxelsBound(grid, x, y, z);
+					}
+				};
+
+				// Small ranges, as from single edits, aren't worth the threads.
+				if (threadCount == 1 || (uint64_t)(hi.x - lo.x + 1) * (hi.y - lo.y + 1) * (hi.z - lo.z + 1) < 32768)
+				{
+					for (uint32_t z = lo.z; z <= hi.z; ++z)
+						BuildSlab(z);
+				}
+				else
+				{
+					jobs::ParallelFor(hi.z - lo.z + 1, threadCount, [&](uint32_t item, unsigned) { BuildSlab(lo.z + item); });
+				}
+			}
+
+			// Distance from pos to the box, or 0 inside it.
+			float OutsideDistance(const glm::vec3 &min, const glm::vec3 &max, const glm::vec3 &pos, glm::vec3 *outClamped)
+			{
+				*outClamped = glm::clamp(pos, min, max);
+				return glm::length(pos - *outClamped);
+			}
+
+			glm::uvec3 CellAt(const Pyramid &pyramid, const Level &level, const glm::vec3 &pos)
+			{
+				const glm::vec3 f = (pos - pyramid.min) / level.cellSize;
+				glm::uvec3 cell;
+
+				for (unsigned axis = 0; axis < 3; ++axis)
+					cell[axis] = std::min((uint32_t)std::max(f[axis], 0.0f), level.dims[axis] - 1);
+
+				return cell;
+			}
+		}
+
+		void Build(const volume::Grid &grid, unsigned threadCount, Pyramid *outPyramid, Stats *outoptStats)
+		{
+			const Clock::time_point startTime = Clock::now();
+			glm::uvec3 dims = grid.dims / 2u;   // ceil((dims - 1) / 2) voxel pairs
+			float cellSize = grid.voxelSize * 2.0f;
+			uint64_t cells = 0;
+
+			outPyramid->min = volume::MinCorner(grid);
+			outPyramid->max = volume::MaxCorner(grid);
+			outPyramid->levels.clear();
+
+			for (;;)
+			{
+				outPyramid->levels.emplace_back();
+
+				Level &level = outPyramid->levels.back();
+
+				level.dims = dims;
+				level.cellSize = cellSize;
+				level.bounds.resize((size_t)dims.x * dims.y * dims.z);
+
+				BuildCells(grid, (uint32_t)outPyramid->levels.size() - 1, glm::uvec3(0), dims - glm::uvec3(1), threadCount, outPyramid);
+				cells += level.bounds.size();
+
+				if (dims == glm::uvec3(1))
+					break;
+
+				dims = (dims + glm::uvec3(1)) / 2u;
+				cellSize *= 2.0f;
+			}
+
+			if (outoptStats)
+			{
+				outoptStats->cells = cells;
+				outoptStats->seconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+			}
+		}
+
+		void Update(const volume::Grid &grid, const glm::uvec3 &sampleMin, const glm::uvec3 &sampleMax, Pyramid *inoutPyramid, Stats *outoptStats)
+		{
+			const Clock::time_point startTime = Clock::now();
+			const glm::uvec3 &finestDims = inoutPyramid->levels[0].dims;
+			glm::uvec3 lo, hi;
+			uint64_t cells = 0;
+
+			// A sample is a corner of the voxels on both sides of it.
+			for (unsigned axis = 0; axis < 3; ++axis)
+			{
+				lo[axis] = std::min((sampleMin[axis] == 0 ? 0 : sampleMin[axis] - 1) / 2, finestDims[axis] - 1);
+				hi[axis] = std::min(sampleMax[axis] / 2, finestDims[axis] - 1);
+			}
+
+			for (uint32_t levelIndex = 0; levelIndex < inoutPyramid->levels.size(); ++levelIndex)
+			{
+				BuildCells(grid, levelIndex, lo, hi, 1, inoutPyramid);
+				cells += (uint64_t)(hi.x - lo.x + 1) * (hi.y - lo.y + 1) * (hi.z - lo.z + 1);
+				lo = lo / 2u;
+				hi = hi / 2u;
+			}
+
+			if (outoptStats)
+			{
+				outoptStats->cells = cells;
+				outoptStats->seconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+			}
+		}
+
+		uint32_t LevelForRadius(const Pyramid &pyramid, float radius)
+		{
+			uint32_t levelIndex = 0;
+
+			while (levelIndex + 1 < pyramid.levels.size() && pyramid.levels[levelIndex + 1].cellSize <= radius)
+				++levelIndex;
+
+			return levelIndex;
+		}
+
+		float SampleLevel(const Pyramid &pyramid, uint32_t level, const glm::vec3 &pos)
+		{
+			const Level &l = pyramid.levels[level];
+			glm::vec3 clamped;
+			const float outside = OutsideDistance(pyramid.min, pyramid.max, pos, &clamped);
+			const glm::uvec3 cell = CellAt(pyramid, l, clamped);
+			const float border = l.bounds[CellIndex(l, cell.x, cell.y, cell.z)];
+
+			// As in volume::Sample, past the border the field is 1-Lipschitz from it.
+			return outside > 0.0f ? std::max(outside, border - outside) : border;
+		}
+
+		float SampleBound(const Pyramid &pyramid, const glm::vec3 &pos, float radius)
+		{
+			return SampleLevel(pyramid, LevelForRadius(pyramid, radius), pos);
+		}
+
+		float FindEmptyCell(const Pyramid &pyramid, const glm::vec3 &pos, glm::vec3 *outMin, glm::vec3 *outMax)
+		{
+			for (unsigned axis = 0; axis < 3; ++axis)
+				if (pos[axis] < pyramid.min[axis] || pos[axis] > pyramid.max[axis])
+					return 0.0f;
+
+			for (size_t levelIndex = pyramid.levels.size(); levelIndex-- > 0;)
+			{
+				const Level &level = pyramid.levels[levelIndex];
+				const glm::uvec3 cell = CellAt(pyramid, level, pos);
+				const float bound = level.bounds[CellIndex(level, cell.x, cell.y, cell.z)];
+
+				if (bound != 0.0f)
+				{
+					*outMin = pyramid.min + glm::vec3(cell) * level.cellSize;
+					*outMax = glm::min(*outMin + glm::vec3(level.cellSize), pyramid.max);
+					return bound;
+				}
+			}
+
+			return 0.0f;
+		}
+
+		bool March(const volume::Grid &grid, const Pyramid *optPyramid, const glm::vec3 &origin, const glm::vec3 &dir, float maxDistance, uint32_t maxSteps, float *outT, uint32_t *outSteps)
+		{
+			const float hitDistance = grid.voxelSize * 0.01f;
+			const float cellNudge = grid.voxelSize * 1e-3f;
+			float t = 0.0f;
+			uint32_t step = 0;
+
+			while (step < maxSteps && t <= maxDistance)
+			{
+				const glm::vec3 pos = origin + dir * t;
+				const float distance = volume::Sample(grid, pos);
+				glm::vec3 cellMin, cellMax;
+
+				++step;
+
+				if (distance < hitDistance)
+				{
+					*outT = t;
+					*outSteps = step;
+					return true;
+				}
+
+				// Only cells outside the surface. Rays starting inside it hit at once.
+				if (optPyramid && FindEmptyCell(*optPyramid, pos, &cellMin, &cellMax) > 0.0f)
+				{
+					float exit = INFINITY;
+
+					for (unsigned axis = 0; axis < 3; ++axis)
+					{
+						if (dir[axis] > 0.0f)
+							exit = std::min(exit, (cellMax[axis] - pos[axis]) / dir[axis]);
+						else if (dir[axis] < 0.0f)
+							exit = std::min(exit, (cellMin[axis] - pos[axis]) / dir[axis]);
+					}
+
+					t += std::max(distance, exit + cellNudge);
+				}
+				else
+				{
+					t += distance;
+				}
+			}
+
+			*outSteps = step;
+			return false;
+		}
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "Volume.h"
+
+// Conservative mip pyramid of a sampled volume, for queries that don't need
+// full resolution: broad collision, LOD meshing and the early steps of ray
+// marching. Each level stores, per cell, a signed bound on the field over the
+// whole cell, so anything read from any level is safe for sphere tracing.
+namespace sdf
+{
+	namespace mip
+	{
+		// Cells of level k are 2^(k+1) grid voxels on a side, starting at the
+		// grid's origin. Cells past the end of the grid only cover the part inside
+		// it. A positive bound means the field is at least that everywhere in the
+		// cell, a negative one that it is at most that, and 0 that the cell may
+		// hold surface.
+		struct Level
+		{
+			glm::uvec3 dims;
+			float cellSize;
+			memory::Vector<float, memory::Tag::VOLUMES> bounds; // x fastest
+		};
+
+		struct Pyramid
+		{
+			glm::vec3 min;             // the grid's corners
+			glm::vec3 max;
+			std::vector<Level> levels; // finest first, down to a single cell
+		};
+
+		struct Stats
+		{
+			uint64_t cells = 0;          // rebuilt, over every level
+			double seconds = 0.0;
+		};
+
+		// Finest level from the grid's samples, each coarser one from the level
+		// below, slabs of each level in parallel. threadCount 0 uses every
+		// hardware thread.
+		void Build(const volume::Grid &grid, unsigned threadCount, Pyramid *outPyramid, Stats *outoptStats = nullptr);
+
+		// Rebuilds the cells covering the samples in [sampleMin, sampleMax] and
+		// their parents. Takes the same range as bricks::MarkDirty.
+		void Update(const volume::Grid &grid, const glm::uvec3 &sampleMin, const glm::uvec3 &sampleMax, Pyramid *inoutPyramid, Stats *outoptStats = nullptr);
+
+		// Finest level whose cells are no bigger than radius.
+		uint32_t LevelForRadius(const Pyramid &pyramid, float radius);
+
+		// Bound over the level's cell containing pos. Outside the pyramid, the
+		// distance to it, which is a bound as long as the surface is inside.
+		float SampleLevel(const Pyramid &pyramid, uint32_t level, const glm::vec3 &pos);
+
+		// Bound at pos from a level with cells about radius in size. Cheaper than
+		// volume::Sample and never larger in magnitude.
+		float SampleBound(const Pyramid &pyramid, const glm::vec3 &pos, float radius);
+
+		// Coarsest cell containing pos that holds no surface. Returns its bound, or
+		// 0 if pos is outside the grid or even the finest cell may hold surface.
+		float FindEmptyCell(const Pyramid &pyramid, const glm::vec3 &pos, glm::vec3 *outMin, glm::vec3 *outMax);
+
+		// Sphere traces the grid from origin along the normalized dir. With a
+		// pyramid, a ray in an empty cell steps to where it leaves the cell when
+		// that is further than the distance, which it is for rays grazing the
+		// surface and in fields clamped to a narrow band. Returns whether the
+		// surface was hit and where along the ray.
+		bool March(const volume::Grid &grid, const Pyramid *optPyramid, const glm::vec3 &origin, const glm::vec3 &dir, float maxDistance, uint32_t maxSteps, float *outT, uint32_t *outSteps);
+	}
+}
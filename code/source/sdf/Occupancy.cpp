@@ -0,0 +1,390 @@
+#include "Occupancy.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace sdf
+{
+	namespace occupancy
+	{
+		namespace
+		{
+			typedef std::chrono::high_resolution_clock Clock;
+
+			static const uint32_t BLOCK_BITS = BLOCK_CELLS * BLOCK_CELLS * BLOCK_CELLS;
+			static const float HALF_DIAGONAL = 0.8660254f;   // of a unit cube
+			static const float EXIT_NUDGE = 1e-3f;           // in finest cells, so skips land past the cell they leave
+
+			size_t BlockIndex(const Level &level, uint32_t x, uint32_t y, uint32_t z)
+			{
+				return ((size_t)z * level.blockDims.y + y) * level.blockDims.x + x;
+			}
+
+			uint32_t CellBit(uint32_t x, uint32_t y, uint32_t z)
+			{
+				return ((z % BLOCK_CELLS) * BLOCK_CELLS + y % BLOCK_CELLS) * BLOCK_CELLS + x % BLOCK_CELLS;
+			}
+
+			void MarkDirty(const glm::uvec3 &lo, const glm::uvec3 &hi, Level *inoutLevel)
+			{
+				inoutLevel->dirtyMin = inoutLevel->anyDirty ? glm::min(inoutLevel->dirtyMin, lo) : lo;
+				inoutLevel->dirtyMax = inoutLevel->anyDirty ? glm::max(inoutLevel->dirtyMax, hi) : hi;
+				inoutLevel->anyDirty = true;
+			}
+
+			// Finest blocks [x0, x1] of a row. Their centers go first, a batch at a
+			// time, and only blocks the surface may pass through evaluate their
+			// cells. Returns the points evaluated.
+			uint64_t BuildRow(const program::Program &prog, const glm::vec3 &min, uint32_t x0, uint32_t x1, uint32_t y, uint32_t z, Level *inoutLevel)
+			{
+				const float cellSize = inoutLevel->cellSize;
+				const float blockSize = cellSize * BLOCK_CELLS;
+				float xs[BLOCK_BITS], ys[BLOCK_BITS], zs[BLOCK_BITS];
+				float centers[BLOCK_BITS], dist[BLOCK_BITS];
+				uint64_t evaluations = 0;
+
+				for (uint32_t first = x0; first <= x1; first += BLOCK_BITS)
+				{
+					const uint32_t count = std::min(x1 - first + 1, BLOCK_BITS);
+
+					for (uint32_t blockIndex = 0; blockIndex < count; ++blockIndex)
+					{
+						xs[blockIndex] = min.x + ((float)(first + blockIndex) + 0.5f) * blockSize;
+						ys[blockIndex] = min.y + ((float)y + 0.5f) * blockSize;
+						zs[blockIndex] = min.z + ((float)z + 0.5f) * blockSize;
+					}
+
+					program::EvaluateBatch(prog, xs, ys, zs, count, centers);
+					evaluations += count;
+
+					for (uint32_t blockIndex = 0; blockIndex < count; ++blockIndex)
+					{
+						uint64_t &mask = inoutLevel->masks[BlockIndex(*inoutLevel, first + blockIndex, y, z)];
+
+						if (centers[blockIndex] > blockSize * HALF_DIAGONAL)
+						{
+							mask = 0;
+							continue;
+						}
+
+						if (centers[blockIndex] < -blockSize * HALF_DIAGONAL)
+						{
+							mask = ~0ull;
+							continue;
+						}
+
+						const glm::vec3 corner = min + glm::vec3((float)(first + blockIndex), (float)y, (float)z) * blockSize + glm::vec3(cellSize * 0.5f);
+
+						for (uint32_t bit = 0; bit < BLOCK_BITS; ++bit)
+						{
+							xs[bit] = corner.x + (float)(bit % BLOCK_CELLS) * cellSize;
+							ys[bit] = corner.y + (float)(bit / BLOCK_CELLS % BLOCK_CELLS) * cellSize;
+							zs[bit] = corner.z + (float)(bit / (BLOCK_CELLS * BLOCK_CELLS)) * cellSize;
+						}
+
+						program::EvaluateBatch(prog, xs, ys, zs, BLOCK_BITS, dist);
+						evaluations += BLOCK_BITS;
+						mask = 0;
+
+						for (uint32_t bit = 0; bit < BLOCK_BITS; ++bit)
+							if (dist[bit] <= cellSize * HALF_DIAGONAL)
+								mask |= 1ull << bit;
+					}
+				}
+
+				return evaluations;
+			}
+
+			// A parent bit is set when its child block has any bit set.
+			void BuildParents(const Level &children, const glm::uvec3 &lo, const glm::uvec3 &hi, Level *inoutLevel)
+			{
+				for (uint32_t z = lo.z; z <= hi.z; ++z)
+				{
+					for (uint32_t y = lo.y; y <= hi.y; ++y)
+					{
+						for (uint32_t x = lo.x; x <= hi.x; ++x)
+						{
+							uint64_t mask = 0;
+
+							for (uint32_t bit = 0; bit < BLOCK_BITS; ++bit)
+							{
+								const uint32_t cx = x * BLOCK_CELLS + bit % BLOCK_CELLS;
+								const uint32_t cy = y * BLOCK_CELLS + bit / BLOCK_CELLS % BLOCK_CELLS;
+								const uint32_t cz = z * BLOCK_CELLS + bit / (BLOCK_CELLS * BLOCK_CELLS);
+
+								if (cx < children.blockDims.x && cy < children.blockDims.y && cz < children.blockDims.z && children.masks[BlockIndex(children, cx, cy, cz)])
+									mask |= 1ull << bit;
+							}
+
+							inoutLevel->masks[BlockIndex(*inoutLevel, x, y, z)] = mask;
+						}
+					}
+				}
+			}
+		}
+
+		void Build(jobs::Pool *optPool, const program::Program &prog, const glm::vec3 &min, const glm::vec3 &max, uint32_t resolution, Hierarchy *outHierarchy, Stats *outoptStats)
+		{
+			const Clock::time_point startTime = Clock::now();
+			const glm::vec3 extent = glm::max(max - min, glm::vec3(1e-6f));
+			const float cellSize = std::max(extent.x, std::max(extent.y, extent.z)) / (float)std::max(resolution, 1u);
+			glm::uvec3 blockDims;
+			float levelCellSize = cellSize;
+			uint64_t firstMask = 0;
+
+			for (unsigned axis = 0; axis < 3; ++axis)
+				blockDims[axis] = std::max((uint32_t)std::ceil(extent[axis] / (cellSize * BLOCK_CELLS)), 1u);
+
+			outHierarchy->min = min;
+			outHierarchy->max = min + glm::vec3(blockDims) * (cellSize * BLOCK_CELLS);
+			outHierarchy->levels.clear();
+
+			for (;;)
+			{
+				outHierarchy->levels.emplace_back();
+
+				Level &level = outHierarchy->levels.back();
+
+				level.blockDims = blockDims;
+				level.cellSize = levelCellSize;
+				level.firstMask = firstMask;
+				level.masks.assign((size_t)blockDims.x * blockDims.y * blockDims.z, 0);
+				level.dirtyMin = glm::uvec3(0);
+				level.dirtyMax = blockDims - glm::uvec3(1);
+				level.anyDirty = true;
+				firstMask += level.masks.size();
+
+				if (blockDims == glm::uvec3(1))
+					break;
+
+				blockDims = (blockDims + glm::uvec3(BLOCK_CELLS - 1)) / BLOCK_CELLS;
+				levelCellSize *= (float)BLOCK_CELLS;
+			}
+
+			// Rows of finest blocks in parallel, then the levels above, which are
+			// 64 times smaller each.
+			Level &finest = outHierarchy->levels[0];
+			const uint32_t rowCount = finest.blockDims.y * finest.blockDims.z;
+			std::vector<uint64_t> rowEvaluations(rowCount);
+			auto RunRow = [&](uint32_t row)
+			{
+				rowEvaluations[row] = BuildRow(prog, outHierarchy->min, 0, finest.blockDims.x - 1, row % finest.blockDims.y, row / finest.blockDims.y, &finest);
+			};
+
+			if (optPool)
+			{
+				jobs::ParallelFor(optPool, rowCount, [&](uint32_t row, unsigned) { RunRow(row); });
+			}
+			else
+			{
+				for (uint32_t row = 0; row < rowCount; ++row)
+					RunRow(row);
+			}
+
+			for (size_t levelIndex = 1; levelIndex < outHierarchy->levels.size(); ++levelIndex)
+			{
+				Level &level = outHierarchy->levels[levelIndex];
+
+				BuildParents(outHierarchy->levels[levelIndex - 1], glm::uvec3(0), level.blockDims - glm::uvec3(1), &level);
+			}
+
+			if (outoptStats)
+			{
+				outoptStats->blocks = finest.masks.size();
+				outoptStats->evaluations = 0;
+
+				for (uint64_t evaluations : rowEvaluations)
+					outoptStats->evaluations += evaluations;
+
+				outoptStats->seconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+			}
+		}
+
+		void Update(const program::Program &prog, const glm::vec3 &min, const glm::vec3 &max, Hierarchy *inoutHierarchy, Stats *outoptStats)
+		{
+			const Clock::time_point startTime = Clock::now();
+			Level &finest = inoutHierarchy->levels[0];
+			const float blockSize = finest.cellSize * BLOCK_CELLS;
+			bool overlaps = true;
+			uint64_t evaluations = 0;
+			glm::uvec3 lo, hi;
+
+			for (unsigned axis = 0; axis < 3; ++axis)
+			{
+				const float last = (float)(finest.blockDims[axis] - 1);
+
+				overlaps = overlaps && max[axis] >= inoutHierarchy->min[axis] && min[axis] <= inoutHierarchy->max[axis];
+				lo[axis] = (uint32_t)glm::clamp((min[axis] - inoutHierarchy->min[axis]) / blockSize, 0.0f, last);
+				hi[axis] = (uint32_t)glm::clamp((max[axis] - inoutHierarchy->min[axis]) / blockSize, 0.0f, last);
+			}
+
+			if (overlaps)
+			{
+				for (uint32_t z = lo.z; z <= hi.z; ++z)
+				{
+					for (uint32_t y = lo.y; y <= hi.y; ++y)
+						evaluations += BuildRow(prog, inoutHierarchy->min, lo.x, hi.x, y, z, &finest);
+				}
+
+				MarkDirty(lo, hi, &finest);
+
+				for (size_t levelIndex = 1; levelIndex < inoutHierarchy->levels.size(); ++levelIndex)
+				{
+					Level &level = inoutHierarchy->levels[levelIndex];
+
+					lo = lo / BLOCK_CELLS;
+					hi = hi / BLOCK_CELLS;
+					BuildParents(inoutHierarchy->levels[levelIndex - 1], lo, hi, &level);
+					MarkDirty(lo, hi, &level);
+				}
+			}
+
+			if (outoptStats)
+			{
+				outoptStats->blocks = overlaps ? (uint64_t)(hi.x - lo.x + 1) * (hi.y - lo.y + 1) * (hi.z - lo.z + 1) : 0;
+				outoptStats->evaluations = evaluations;
+				outoptStats->seconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+			}
+		}
+
+		float SkipEmpty(const Hierarchy &hierarchy, const glm::vec3 &pos, const glm::vec3 &invDir)
+		{
+			const float g[3] = { pos.x - hierarchy.min.x, pos.y - hierarchy.min.y, pos.z - hierarchy.min.z };
+
+			// Written so NaN positions count as outside.
+			for (unsigned axis = 0; axis < 3; ++axis)
+				if (!(g[axis] >= 0.0f && pos[axis] < hierarchy.max[axis]))
+					return 0.0f;
+
+			for (size_t levelIndex = hierarchy.levels.size(); levelIndex-- > 0;)
+			{
+				const Level &level = hierarchy.levels[levelIndex];
+				const float scale = 1.0f / level.cellSize;
+				uint32_t cell[3];
+
+				for (unsigned axis = 0; axis < 3; ++axis)
+					cell[axis] = std::min((uint32_t)(g[axis] * scale), level.blockDims[axis] * BLOCK_CELLS - 1);
+
+				const uint64_t mask = level.masks[BlockIndex(level, cell[0] / BLOCK_CELLS, cell[1] / BLOCK_CELLS, cell[2] / BLOCK_CELLS)];
+
+				if (mask >> CellBit(cell[0], cell[1], cell[2]) & 1)
+					continue;
+
+				float exit = INFINITY;
+
+				for (unsigned axis = 0; axis < 3; ++axis)
+				{
+					const float face = (float)(cell[axis] + (invDir[axis] > 0.0f ? 1 : 0)) * level.cellSize;
+
+					exit = std::min(exit, (face - g[axis]) * invDir[axis]);
+				}
+
+				return std::max(exit, 0.0f) + hierarchy.levels[0].cellSize * EXIT_NUDGE;
+			}
+
+			return 0.0f;
+		}
+
+		simd::float8 SkipEmpty(const Hierarchy &hierarchy, const simd::float8 pos[3], const simd::float8 invDir[3], const simd::float8 &mask)
+		{
+			using simd::float8;
+
+			const float8 nudge = simd::Set1(hierarchy.levels[0].cellSize * EXIT_NUDGE);
+			float8 g[3];
+			float8 undecided = mask;
+			float8 skip = simd::Zero();
+
+			for (unsigned axis = 0; axis < 3; ++axis)
+			{
+				g[axis] = pos[axis] - simd::Set1(hierarchy.min[axis]);
+				undecided = simd::And(undecided, simd::And(simd::CmpGe(g[axis], simd::Zero()), simd::CmpLt(pos[axis], simd::Set1(hierarchy.max[axis]))));
+			}
+
+			// Cells are found 8 at a time, and only their masks are read lane by lane.
+			for (size_t levelIndex = hierarchy.levels.size(); levelIndex-- > 0 && simd::Any(undecided);)
+			{
+				const Level &level = hierarchy.levels[levelIndex];
+				const float8 scale = simd::Set1(1.0f / level.cellSize);
+				const float8 cellSize = simd::Set1(level.cellSize);
+				const unsigned laneBits = simd::MoveMask(undecided);
+				float8 cell[3];
+				float cells[3][simd::WIDTH];
+				float empty[simd::WIDTH];
+
+				for (unsigned axis = 0; axis < 3; ++axis)
+				{
+					cell[axis] = simd::Min(simd::Floor(g[axis] * scale), simd::Set1((float)(level.blockDims[axis] * BLOCK_CELLS - 1)));
+					simd::Store(cells[axis], cell[axis]);
+				}
+
+				for (unsigned lane = 0; lane < simd::WIDTH; ++lane)
+				{
+					empty[lane] = 0.0f;
+
+					if (!(laneBits & (1u << lane)))
+						continue;
+
+					const uint32_t x = (uint32_t)cells[0][lane];
+					const uint32_t y = (uint32_t)cells[1][lane];
+					const uint32_t z = (uint32_t)cells[2][lane];
+
+					if (!(level.masks[BlockIndex(level, x / BLOCK_CELLS, y / BLOCK_CELLS, z / BLOCK_CELLS)] >> CellBit(x, y, z) & 1))
+						empty[lane] = -1.0f;
+				}
+
+				const float8 emptyLanes = simd::And(undecided, simd::CmpLt(simd::Load(empty), simd::Zero()));
+
+				if (!simd::Any(emptyLanes))
+					continue;
+
+				float8 exit = simd::Set1(INFINITY);
+
+				for (unsigned axis = 0; axis < 3; ++axis)
+				{
+					const float8 face = (cell[axis] + simd::And(simd::CmpGt(invDir[axis], simd::Zero()), simd::Set1(1.0f))) * cellSize;
+
+					exit = simd::Min(exit, (face - g[axis]) * invDir[axis]);
+				}
+
+				skip = simd::Select(emptyLanes, simd::Max(exit, simd::Zero()) + nudge, skip);
+				undecided = simd::AndNot(emptyLanes, undecided);
+			}
+
+			return skip;
+		}
+
+		void BuildUpload(Hierarchy *inoutHierarchy, Upload *outUpload)
+		{
+			outUpload->staging.clear();
+			outUpload->copies.clear();
+
+			for (Level &level : inoutHierarchy->levels)
+			{
+				if (!level.anyDirty)
+					continue;
+
+				const size_t first = BlockIndex(level, level.dirtyMin.x, level.dirtyMin.y, level.dirtyMin.z);
+				const size_t last = BlockIndex(level, level.dirtyMax.x, level.dirtyMax.y, level.dirtyMax.z);
+				Copy copy;
+
+				// Rows between the dirty box's corners come along, to keep one copy per level.
+				copy.srcOffset = outUpload->staging.size();
+				copy.dstOffset = (level.firstMask + first) * sizeof(uint64_t);
+				copy.size = (last - first + 1) * sizeof(uint64_t);
+				outUpload->staging.resize(outUpload->staging.size() + copy.size);
+				std::memcpy(outUpload->staging.data() + copy.srcOffset, level.masks.data() + first, copy.size);
+				outUpload->copies.push_back(copy);
+				level.anyDirty = false;
+			}
+		}
+
+		uint64_t BufferBytes(const Hierarchy &hierarchy)
+		{
+			if (hierarchy.levels.empty())
+				return 0;
+
+			return (hierarchy.levels.back().firstMask + hierarchy.levels.back().masks.size()) * sizeof(uint64_t);
+		}
+	}
+}
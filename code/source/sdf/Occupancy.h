@@ -0,0 +1,91 @@
+#pragma once
+
+#include "Jobs.h"
+#include "Program.h"
+
+// Hierarchy of occupancy bits over a box of SDF space, for skipping empty space
+// when ray marching. Each 64 bit mask covers a 4x4x4 block of cells, and a bit
+// of the next level up is set when its block below has any bit set, so the
+// levels stack into a compact bit octree that branches 64 ways. Rays walk it
+// top down, step over the largest empty cell around them in one go and only
+// sphere trace where bits are set. The masks of every level upload as one
+// storage buffer, which the generated shaders walk the same way.
+namespace sdf
+{
+	namespace occupancy
+	{
+		static const uint32_t BLOCK_CELLS = 4;   // cells per block side, so a block's cells are one 64 bit mask
+
+		// Storage buffer binding in the ray marching shaders. A set of its own, as
+		// the first holds the brick atlas and a binding per volume.
+		static const uint32_t DESCRIPTOR_SET = 1;
+		static const uint32_t BINDING = 0;
+
+		// Cells of level k + 1 are the blocks of level k. Cell (x, y, z) of a
+		// block is bit (z * 4 + y) * 4 + x of its mask. A set bit means the cell
+		// may hold surface or lies inside it.
+		struct Level
+		{
+			glm::uvec3 blockDims;
+			float cellSize;
+			uint64_t firstMask;                                      // of the level, in the storage buffer
+			memory::Vector<uint64_t, memory::Tag::OCCUPANCY> masks;  // blockDims, x fastest
+			glm::uvec3 dirtyMin;                                     // bounding box of blocks not uploaded since they changed, inclusive
+			glm::uvec3 dirtyMax;
+			bool anyDirty;
+		};
+
+		struct Hierarchy
+		{
+			glm::vec3 min;              // rounded out to whole blocks of the finest level
+			glm::vec3 max;
+			std::vector<Level> levels;  // finest first, down to a single block
+		};
+
+		struct Stats
+		{
+			uint64_t blocks = 0;        // finest blocks built
+			uint64_t evaluations = 0;   // points of the field evaluated
+			double seconds = 0.0;
+		};
+
+		// Region of the storage buffer, sourced from offset in Upload::staging,
+		// as for vkCmdCopyBuffer.
+		struct Copy
+		{
+			uint64_t srcOffset;
+			uint64_t dstOffset;
+			uint64_t size;
+		};
+
+		struct Upload
+		{
+			memory::Vector<uint8_t, memory::Tag::STAGING> staging;
+			std::vector<Copy> copies;
+		};
+
+		// Cells resolution to a side along the longest axis of [min, max]. A cell
+		// is empty when the field at its center is further from the surface than
+		// half its diagonal, which holds as long as the field is a distance bound.
+		// Blocks that are wholly empty or wholly inside by the same test at their
+		// own center skip their cells. A null pool runs on the calling thread.
+		void Build(jobs::Pool *optPool, const program::Program &prog, const glm::vec3 &min, const glm::vec3 &max, uint32_t resolution, Hierarchy *outHierarchy, Stats *outoptStats = nullptr);
+
+		// Rebuilds the finest blocks overlapping [min, max], where the field
+		// changed, and their parents.
+		void Update(const program::Program &prog, const glm::vec3 &min, const glm::vec3 &max, Hierarchy *inoutHierarchy, Stats *outoptStats = nullptr);
+
+		// Distance along the ray from pos to where it leaves the largest empty cell
+		// around pos, or 0 when the finest cell there is set or pos is outside the
+		// hierarchy. invDir is 1 / dir, with zero components made tiny instead.
+		float SkipEmpty(const Hierarchy &hierarchy, const glm::vec3 &pos, const glm::vec3 &invDir);
+
+		// The same for 8 rays at once, for the lanes set in mask.
+		simd::float8 SkipEmpty(const Hierarchy &hierarchy, const simd::float8 pos[3], const simd::float8 invDir[3], const simd::float8 &mask);
+
+		// Every dirty block range, one copy per level. Clears the dirty ranges.
+		void BuildUpload(Hierarchy *inoutHierarchy, Upload *outUpload);
+
+		uint64_t BufferBytes(const Hierarchy &hierarchy);
+	}
+}
@@ -0,0 +1,486 @@
+#include "Optimize.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+namespace sdf
+{
+	namespace optimize
+	{
+		namespace
+		{
+			using scene::Node;
+			using scene::NodeType;
+			using scene::Scene;
+
+			static const float EPSILON = 1e-5f;
+
+			// A transform node's parameters: local = linear * parent + offset, then
+			// the child's distance is multiplied by scale.
+			struct Affine
+			{
+				glm::mat3 linear;
+				glm::vec3 offset;
+				float scale;
+			};
+
+			Affine ReadAffine(const Node &node)
+			{
+				Affine xform;
+
+				for (unsigned row = 0; row < 3; ++row)
+				{
+					for (unsigned col = 0; col < 3; ++col)
+						xform.linear[col][row] = node.params[row * 4 + col];
+
+					xform.offset[row] = node.params[row * 4 + 3];
+				}
+
+				xform.scale = node.params[12];
+
+				return xform;
+			}
+
+			Node MakeTransform(const Affine &xform)
+			{
+				Node node = {};
+				node.type = NodeType::TRANSFORM;
+				node.primitiveId = scene::INVALID_NODE;
+				node.childCount = 1;
+
+				for (unsigned row = 0; row < 3; ++row)
+				{
+					for (unsigned col = 0; col < 3; ++col)
+						node.params[row * 4 + col] = xform.linear[col][row];
+
+					node.params[row * 4 + 3] = xform.offset[row];
+				}
+
+				node.params[12] = xform.scale;
+
+				return node;
+			}
+
+			// outer is applied first, so the result maps outer's parent space straight
+			// into inner's local space.
+			Affine Compose(const Affine &outer, const Affine &inner)
+			{
+				Affine xform;
+				xform.linear = inner.linear * outer.linear;
+				xform.offset = inner.linear * outer.offset + inner.offset;
+				xform.scale = outer.scale * inner.scale;
+
+				return xform;
+			}
+
+			bool IsNear(float a, float b)
+			{
+				return std::abs(a - b) <= EPSILON;
+			}
+
+			bool IsIdentity(const glm::mat3 &m)
+			{
+				for (unsigned col = 0; col < 3; ++col)
+					for (unsigned row = 0; row < 3; ++row)
+						if (!IsNear(m[col][row], col == row ? 1.0f : 0.0f))
+							return false;
+
+				return true;
+			}
+
+			bool IsIdentity(const Affine &xform)
+			{
+				return IsIdentity(xform.linear) && glm::length(xform.offset) <= EPSILON && IsNear(xform.scale, 1.0f);
+			}
+
+			// True if every row of m picks a single parent axis, possibly negated.
+			// outAxes receives the parent axis for each local axis.
+			bool IsSignedPermutation(const glm::mat3 &m, unsigned outAxes[3])
+			{
+				for (unsigned row = 0; row < 3; ++row)
+				{
+					unsigned picked = 0;
+
+					for (unsigned col = 0; col < 3; ++col)
+					{
+						const float value = std::abs(m[col][row]);
+
+						if (IsNear(value, 1.0f))
+						{
+							outAxes[row] = col;
+							++picked;
+						}
+						else if (!IsNear(value, 0.0f))
+							return false;
+					}
+
+					if (picked != 1)
+						return false;
+				}
+
+				return true;
+			}
+
+			// Moves as much of xform as the primitive's symmetry allows into its
+			// parameters. Returns false when nothing is left, otherwise outResidual is
+			// the unscaled rigid transform the new primitive still needs.
+			bool FoldIntoPrimitive(const Affine &xform, Node *inoutPrim, Affine *outResidual)
+			{
+				float * const params = inoutPrim->params;
+				const float s = xform.scale;
+
+				// The linear part is a rotation divided by the distance scale, so
+				// s * f(R p / s + t) is f with its sizes scaled by s, evaluated at R p + s t.
+				glm::mat3 rotation = xform.linear;
+				glm::vec3 offset = xform.offset * s;
+
+				for (unsigned col = 0; col < 3; ++col)
+					rotation[col] *= s;
+
+				// Translation expressed before the rotation: R p + offset = R (p + shift)
+				const glm::vec3 shift = glm::transpose(rotation) * offset;
+
+				switch (inoutPrim->type)
+				{
+					case NodeType::SPHERE:
+						params[0] *= s;
+						rotation = glm::mat3(1.0f);
+						offset = shift;
+					break;
+					case NodeType::BOX:
+					{
+						unsigned axes[3] = {};
+
+						for (unsigned param = 0; param < 4; ++param)
+							params[param] *= s;
+
+						// A box is symmetric under any axis flip, so an axis permutation
+						// just reorders its extents.
+						if (IsSignedPermutation(rotation, axes))
+						{
+							float extents[3];
+
+							for (unsigned axis = 0; axis < 3; ++axis)
+								extents[axes[axis]] = params[axis];
+
+							std::copy(extents, extents + 3, params);
+							rotation = glm::mat3(1.0f);
+							offset = shift;
+						}
+					}
+					break;
+					case NodeType::TORUS:
+					case NodeType::CAPSULE:
+					case NodeType::CYLINDER:
+						params[0] *= s;
+						params[1] *= s;
+
+						// Symmetric about Y and under a Y flip. Any rotation keeping the
+						// Y axis on itself only spins the shape in place.
+						if (IsNear(std::abs(rotation[1][1]), 1.0f))
+						{
+							rotation = glm::mat3(1.0f);
+							offset = shift;
+						}
+					break;
+					case NodeType::PLANE:
+					{
+						// n.(R p + offset) + s d = (Rt n).p + n.offset + s d. A plane absorbs any rigid transform.
+						const glm::vec3 normal(params[0], params[1], params[2]);
+						const glm::vec3 rotated = glm::transpose(rotation) * normal;
+
+						params[0] = rotated.x;
+						params[1] = rotated.y;
+						params[2] = rotated.z;
+						params[3] = glm::dot(normal, offset) + s * params[3];
+					}
+					return false;
+					default:
+						assert(0);
+				}
+
+				outResidual->linear = rotation;
+				outResidual->offset = offset;
+				outResidual->scale = 1.0f;
+
+				return !IsIdentity(*outResidual);
+			}
+
+			struct Builder
+			{
+				Scene scene;
+				std::vector<scene::Bounds> bounds;
+				std::unordered_map<std::string, uint32_t> interned;
+				Stats stats;
+			};
+
+			// Hash consing. A structurally identical node is only ever added once.
+			uint32_t Intern(Builder *inoutBuilder, const Node &node, const uint32_t *children)
+			{
+				std::string key;
+
+				key.append((const char*)&node.type, sizeof(node.type));
+				key.append((const char*)&node.primitiveId, sizeof(node.primitiveId));
+				key.append((const char*)node.params, sizeof(node.params));
+				key.append((const char*)&node.childCount, sizeof(node.childCount));
+				if (node.childCount)
+					key.append((const char*)children, node.childCount * sizeof(uint32_t));
+
+				const auto found = inoutBuilder->interned.find(key);
+
+				if (found != inoutBuilder->interned.end())
+				{
+					++inoutBuilder->stats.sharedNodes;
+					return found->second;
+				}
+
+				Scene &scene = inoutBuilder->scene;
+				Node copy = node;
+
+				copy.firstChild = (uint32_t)scene.children.size();
+				if (node.childCount)
+					scene.children.insert(scene.children.end(), children, children + node.childCount);
+				scene.nodes.push_back(copy);
+				scene::ComputeBounds(scene, &inoutBuilder->bounds);
+
+				const uint32_t nodeIndex = (uint32_t)scene.nodes.size() - 1;
+				inoutBuilder->interned.emplace(std::move(key), nodeIndex);
+
+				return nodeIndex;
+			}
+
+			uint32_t RewriteTransform(Builder *inoutBuilder, const Node &node, uint32_t child)
+			{
+				const Scene &scene = inoutBuilder->scene;
+				Affine xform = ReadAffine(node);
+				bool folded = false;
+
+				// Gizmo edits stack transforms. Any chain of them is a single transform.
+				while (scene.nodes[child].type == NodeType::TRANSFORM)
+				{
+					const Node &inner = scene.nodes[child];
+
+					xform = Compose(xform, ReadAffine(inner));
+					child = scene.children[inner.firstChild];
+					folded = true;
+				}
+
+				const Node childNode = scene.nodes[child];
+
+				// A sampled volume has no symmetry or size parameters to take anything in.
+				if (scene::IsPrimitive(childNode.type) && childNode.type != NodeType::VOLUME)
+				{
+					Node prim = childNode;
+					Affine residual;
+					const bool hasResidual = FoldIntoPrimitive(xform, &prim, &residual);
+					const bool paramsChanged = std::memcmp(prim.params, childNode.params, sizeof(prim.params)) != 0;
+
+					if (!hasResidual || paramsChanged || residual.scale != xform.scale || !IsIdentity(glm::transpose(residual.linear) * xform.linear))
+					{
+						if (paramsChanged)
+							child = Intern(inoutBuilder, prim, nullptr);
+
+						if (!hasResidual)
+						{
+							++inoutBuilder->stats.foldedTransforms;
+							return child;
+						}
+
+						xform = residual;
+						folded = true;
+					}
+				}
+
+				const bool identity = IsIdentity(xform);
+
+				if (folded || identity)
+					++inoutBuilder->stats.foldedTransforms;
+
+				if (identity)
+					return child;
+
+				return Intern(inoutBuilder, MakeTransform(xform), &child);
+			}
+
+			uint32_t RewriteOperation(Builder *inoutBuilder, const Node &node, const std::vector<uint32_t> &children)
+			{
+				const Scene &scene = inoutBuilder->scene;
+				Stats &stats = inoutBuilder->stats;
+				std::vector<uint32_t> kept;
+
+				for (size_t childIndex = 0; childIndex < children.size(); ++childIndex)
+				{
+					const Node &child = scene.nodes[children[childIndex]];
+					const uint32_t * const grandChildren = scene.children.data() + child.firstChild;
+
+					// Union and intersect are associative. Subtract only through its
+					// first child: (a - b) - c = a - b - c.
+					const bool splice = child.type == node.type &&
+						(node.type == NodeType::UNION || node.type == NodeType::INTERSECT || (node.type == NodeType::SUBTRACT && childIndex == 0));
+
+					if (splice)
+					{
+						kept.insert(kept.end(), grandChildren, grandChildren + child.childCount);
+						++stats.flattenedOps;
+					}
+					else
+						kept.push_back(children[childIndex]);
+				}
+
+				// min(a, a) = a, and likewise for max. Pasted duplicates are the same
+				// node by now, so a repeat is just a repeated index.
+				if (node.type == NodeType::UNION || node.type == NodeType::INTERSECT || node.type == NodeType::SUBTRACT)
+				{
+					const size_t first = node.type == NodeType::SUBTRACT ? 1 : 0;
+					size_t count = std::min(first, kept.size());
+
+					for (size_t childIndex = first; childIndex < kept.size(); ++childIndex)
+					{
+						if (std::find(kept.begin() + first, kept.begin() + count, kept[childIndex]) != kept.begin() + count)
+							++stats.culledBranches;
+						else
+							kept[count++] = kept[childIndex];
+					}
+
+					kept.resize(count);
+				}
+
+				// A cutter that cannot reach the first child never changes its surface.
+				// A smooth one still reaches as far as its blend radius.
+				if (node.type == NodeType::SUBTRACT || node.type == NodeType::SMOOTH_SUBTRACT)
+				{
+					const float reach = node.type == NodeType::SMOOTH_SUBTRACT ? node.params[0] : 0.0f;
+					const scene::Bounds target = inoutBuilder->bounds[kept[0]];
+					size_t count = 1;
+
+					for (size_t childIndex = 1; childIndex < kept.size(); ++childIndex)
+					{
+						if (scene::Overlaps(target, inoutBuilder->bounds[kept[childIndex]], reach + EPSILON))
+							kept[count++] = kept[childIndex];
+						else
+							++stats.culledBranches;
+					}
+
+					kept.resize(count);
+				}
+
+				if (kept.size() == 1)
+					return kept[0];
+
+				Node op = node;
+				op.childCount = (uint32_t)kept.size();
+
+				return Intern(inoutBuilder, op, kept.data());
+			}
+
+			// Nodes only reference earlier nodes, so one backwards sweep from the
+			// root marks everything reachable.
+			std::vector<bool> MarkReachable(const Scene &scene)
+			{
+				std::vector<bool> reachable(scene.nodes.size(), false);
+
+				if (scene.root >= scene.nodes.size())
+					return reachable;
+
+				reachable[scene.root] = true;
+
+				for (size_t nodeIndex = scene.root + 1; nodeIndex-- > 0;)
+				{
+					if (!reachable[nodeIndex])
+						continue;
+
+					const Node &node = scene.nodes[nodeIndex];
+					for (uint32_t childIndex = 0; childIndex < node.childCount; ++childIndex)
+						reachable[scene.children[node.firstChild + childIndex]] = true;
+				}
+
+				return reachable;
+			}
+
+			// Folding leaves behind nodes nothing references any more.
+			void Compact(const Scene &scene, Scene *outScene)
+			{
+				const std::vector<bool> reachable = MarkReachable(scene);
+				std::vector<uint32_t> remap(scene.nodes.size(), scene::INVALID_NODE);
+
+				*outScene = Scene();
+				outScene->volumes = scene.volumes;
+				outScene->instances = scene.instances;
+
+				for (size_t nodeIndex = 0; nodeIndex < scene.nodes.size(); ++nodeIndex)
+				{
+					if (!reachable[nodeIndex])
+						continue;
+
+					Node node = scene.nodes[nodeIndex];
+					const uint32_t firstChild = node.firstChild;
+
+					node.firstChild = (uint32_t)outScene->children.size();
+
+					for (uint32_t childIndex = 0; childIndex < node.childCount; ++childIndex)
+						outScene->children.push_back(remap[scene.children[firstChild + childIndex]]);
+
+					remap[nodeIndex] = (uint32_t)outScene->nodes.size();
+					outScene->nodes.push_back(node);
+				}
+
+				outScene->root = remap[scene.root];
+			}
+		}
+
+		bool Optimize(const scene::Scene &scene, scene::Scene *outScene, Stats *outoptStats)
+		{
+			assert(outScene != &scene);
+
+			if (scene.root >= scene.nodes.size())
+				return false;
+
+			const std::vector<bool> reachable = MarkReachable(scene);
+			std::vector<uint32_t> remap(scene.nodes.size(), scene::INVALID_NODE);
+			std::vector<uint32_t> children;
+			Builder builder;
+
+			// Instance nodes keep their table indices, and their bounds come from the tables.
+			builder.scene.instances = scene.instances;
+
+			// Children always come before their parents, so a forward pass rewrites
+			// bottom up and every child is already in its final form.
+			for (size_t nodeIndex = 0; nodeIndex < scene.nodes.size(); ++nodeIndex)
+			{
+				if (!reachable[nodeIndex])
+					continue;
+
+				const Node &node = scene.nodes[nodeIndex];
+
+				children.clear();
+				for (uint32_t childIndex = 0; childIndex < node.childCount; ++childIndex)
+					children.push_back(remap[scene.children[node.firstChild + childIndex]]);
+
+				if (scene::IsPrimitive(node.type))
+					remap[nodeIndex] = Intern(&builder, node, nullptr);
+				else if (node.type == NodeType::TRANSFORM)
+					remap[nodeIndex] = RewriteTransform(&builder, node, children[0]);
+				else if (node.type == NodeType::INSTANCE || node.type == NodeType::REPEAT)
+					remap[nodeIndex] = Intern(&builder, node, children.data());
+				else
+					remap[nodeIndex] = RewriteOperation(&builder, node, children);
+			}
+
+			builder.scene.root = remap[scene.root];
+			builder.scene.volumes = scene.volumes;
+			Compact(builder.scene, outScene);
+
+			if (outoptStats)
+			{
+				*outoptStats = builder.stats;
+				outoptStats->nodesBefore = scene::CountReachableNodes(scene);
+				outoptStats->nodesAfter = outScene->nodes.size();
+			}
+
+			return true;
+		}
+	}
+}
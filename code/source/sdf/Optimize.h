@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Scene.h"
+
+// Rewrites a scene DAG into a cheaper one with the same surface. Editors produce
+// trees full of redundancy: copy pasted sub-trees, stacks of gizmo transforms,
+// nested binary unions and cutters left behind after their target moved away.
+namespace sdf
+{
+	namespace optimize
+	{
+		struct Stats
+		{
+			size_t nodesBefore = 0;          // reachable from the root
+			size_t nodesAfter = 0;
+			uint32_t sharedNodes = 0;        // structural duplicates merged into one node
+			uint32_t foldedTransforms = 0;   // composed, absorbed by a primitive or dropped as identity
+			uint32_t culledBranches = 0;     // cutters out of reach of their target, repeated union children
+			uint32_t flattenedOps = 0;       // nested unions, intersects and subtracts spliced into their parent
+		};
+
+		// Identical sub-trees are hash consed into one node, transform chains are
+		// composed and folded into primitive parameters where the primitive's
+		// symmetry allows, nested associative operations are flattened and subtract
+		// children whose bounds cannot reach the first child are dropped.
+		// Primitive ids are preserved. outScene must not alias scene.
+		bool Optimize(const scene::Scene &scene, scene::Scene *outScene, Stats *outoptStats = nullptr);
+	}
+}
@@ -0,0 +1,995 @@
+#include "Program.h"
+#include "Dual.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <map>
+#include <unordered_map>
+
+namespace sdf
+{
+	namespace program
+	{
+		namespace
+		{
+			using simd::float8;
+
+			struct Compiler
+			{
+				const scene::Scene *scene;
+				Program *prog;
+				std::map<std::pair<uint32_t, uint32_t>, uint32_t> spaces;   // (parent space, transform node) -> space
+				std::unordered_map<uint64_t, uint32_t> uses;                // (space, node) -> reference count
+				std::unordered_map<uint64_t, uint16_t> saved;               // (space, node) -> SAVED_REGISTER + its slot
+				std::unordered_map<uint32_t, uint32_t> instances;           // instance node -> index into Program::instances
+				uint16_t savedCount = 0;
+				uint16_t savedLimit = MAX_REGISTERS;                        // past it, shared sub-trees are computed again
+			};
+
+			// Saved results get slots in the order they are computed, numbered
+			// from here until PackSavedRegisters places them after the working
+			// registers, whose count is only known once the whole tree is compiled.
+			static const uint16_t SAVED_REGISTER = 0x8000;
+
+			uint64_t ValueKey(uint32_t space, uint32_t nodeIndex)
+			{
+				return ((uint64_t)space << 32) | nodeIndex;
+			}
+
+			// Coordinate spaces are identified by the chain of transform nodes that
+			// leads to them, so the same node reached through the same transforms
+			// always computes the same value.
+			uint32_t ChildSpace(Compiler *inoutCompiler, uint32_t space, uint32_t transformNode)
+			{
+				const auto inserted = inoutCompiler->spaces.emplace(std::make_pair(space, transformNode), (uint32_t)inoutCompiler->spaces.size() + 1);
+
+				return inserted.first->second;
+			}
+
+			void CountUses(Compiler *inoutCompiler, uint32_t nodeIndex, uint32_t space)
+			{
+				if (++inoutCompiler->uses[ValueKey(space, nodeIndex)] > 1)
+					return;
+
+				const scene::Node &node = inoutCompiler->scene->nodes[nodeIndex];
+				const uint32_t * const children = inoutCompiler->scene->children.data() + node.firstChild;
+
+				// Instanced children are compiled into programs of their own.
+				if (node.type == scene::NodeType::INSTANCE)
+					return;
+
+				if (node.type == scene::NodeType::TRANSFORM || node.type == scene::NodeType::REPEAT)
+				{
+					CountUses(inoutCompiler, children[0], ChildSpace(inoutCompiler, space, nodeIndex));
+					return;
+				}
+
+				for (uint32_t childIndex = 0; childIndex < node.childCount; ++childIndex)
+					CountUses(inoutCompiler, children[childIndex], space);
+			}
+
+			// dst = src, primitive id included.
+			void EmitCopy(Program *inoutProg, uint16_t dst, uint16_t src)
+			{
+				Instruction copy = {};
+				copy.op = OpCode::SCALE;
+				copy.dst = dst;
+				copy.src0 = src;
+				copy.params[0] = 1.0f;
+				inoutProg->code.push_back(copy);
+			}
+
+			bool CompileNode(Compiler *inoutCompiler, uint32_t nodeIndex, uint32_t space, uint16_t pointReg, uint16_t dstReg);
+			bool CompileRoot(const scene::Scene &scene, uint32_t root, Program *outProgram);
+
+			// Every reference to an instance node shares one compiled child.
+			bool CompileInstances(Compiler *inoutCompiler, uint32_t nodeIndex, uint32_t *outIndex)
+			{
+				const auto found = inoutCompiler->instances.find(nodeIndex);
+
+				if (found != inoutCompiler->instances.end())
+				{
+					*outIndex = found->second;
+					return true;
+				}
+
+				const scene::Scene &scene = *inoutCompiler->scene;
+				const scene::Node &node = scene.nodes[nodeIndex];
+				std::shared_ptr<Program> child = std::make_shared<Program>();
+
+				if (!CompileRoot(scene, scene.children[node.firstChild], child.get()))
+					return false;
+
+				*outIndex = (uint32_t)inoutCompiler->prog->instances.size();
+				inoutCompiler->prog->instances.push_back(Instances{ scene.instances[(size_t)node.params[0]], std::move(child) });
+				inoutCompiler->instances.emplace(nodeIndex, *outIndex);
+
+				return true;
+			}
+
+			// Compiles nodeIndex so its result ends up in dstReg, or reuses a sub-tree
+			// an earlier reference already computed.
+			bool CompileValue(Compiler *inoutCompiler, uint32_t nodeIndex, uint32_t space, uint16_t pointReg, uint16_t dstReg)
+			{
+				const uint64_t key = ValueKey(space, nodeIndex);
+				const auto found = inoutCompiler->saved.find(key);
+
+				if (found != inoutCompiler->saved.end())
+				{
+					EmitCopy(inoutCompiler->prog, dstReg, found->second);
+					return true;
+				}
+
+				if (!CompileNode(inoutCompiler, nodeIndex, space, pointReg, dstReg))
+					return false;
+
+				if (inoutCompiler->uses[key] > 1 && inoutCompiler->savedCount < inoutCompiler->savedLimit)
+				{
+					const uint16_t savedReg = SAVED_REGISTER + inoutCompiler->savedCount++;
+
+					EmitCopy(inoutCompiler->prog, savedReg, dstReg);
+					inoutCompiler->saved.emplace(key, savedReg);
+				}
+
+				return true;
+			}
+
+			bool CompileNode(Compiler *inoutCompiler, uint32_t nodeIndex, uint32_t space, uint16_t pointReg, uint16_t dstReg)
+			{
+				const scene::Scene &scene = *inoutCompiler->scene;
+				Program * const inoutProg = inoutCompiler->prog;
+				const scene::Node &node = scene.nodes[nodeIndex];
+				const uint32_t * const children = scene.children.data() + node.firstChild;
+
+				if (dstReg >= MAX_REGISTERS)
+					return false;
+
+				inoutProg->registerCount = std::max<uint16_t>(inoutProg->registerCount, dstReg + 1);
+
+				Instruction inst = {};
+				inst.primitiveId = node.primitiveId;
+
+				if (scene::IsPrimitive(node.type))
+				{
+					inst.op = (OpCode)((unsigned)OpCode::SPHERE + ((unsigned)node.type - (unsigned)scene::NodeType::SPHERE));
+					inst.dst = dstReg;
+					inst.src0 = pointReg;
+					std::copy(node.params, node.params + 7, inst.params);
+
+					inoutProg->code.push_back(inst);
+					return true;
+				}
+
+				if (node.type == scene::NodeType::INSTANCE)
+				{
+					uint32_t instancesIndex;
+
+					if (!CompileInstances(inoutCompiler, nodeIndex, &instancesIndex))
+						return false;
+
+					inst.op = OpCode::INSTANCE;
+					inst.dst = dstReg;
+					inst.src0 = pointReg;
+					inst.params[0] = (float)instancesIndex;
+
+					inoutProg->code.push_back(inst);
+					return true;
+				}
+
+				if (node.type == scene::NodeType::TRANSFORM || node.type == scene::NodeType::REPEAT)
+				{
+					const uint16_t localReg = pointReg + 1;
+
+					if (localReg >= MAX_POINT_REGISTERS)
+						return false;
+
+					inoutProg->pointRegisterCount = std::max<uint16_t>(inoutProg->pointRegisterCount, localReg + 1);
+
+					inst.op = node.type == scene::NodeType::TRANSFORM ? OpCode::TRANSFORM : OpCode::REPEAT;
+					inst.dst = localReg;
+					inst.src0 = pointReg;
+					std::copy(node.params, node.params + 12, inst.params);
+					inoutProg->code.push_back(inst);
+
+					if (!CompileValue(inoutCompiler, children[0], ChildSpace(inoutCompiler, space, nodeIndex), localReg, dstReg))
+						return false;
+
+					if (node.type == scene::NodeType::TRANSFORM && node.params[12] != 1.0f)
+					{
+						Instruction scale = {};
+						scale.op = OpCode::SCALE;
+						scale.dst = dstReg;
+						scale.src0 = dstReg;
+						scale.params[0] = node.params[12];
+						inoutProg->code.push_back(scale);
+					}
+
+					return true;
+				}
+
+				if (!CompileValue(inoutCompiler, children[0], space, pointReg, dstReg))
+					return false;
+
+				switch (node.type)
+				{
+					case scene::NodeType::UNION:           inst.op = OpCode::UNION; break;
+					case scene::NodeType::INTERSECT:       inst.op = OpCode::INTERSECT; break;
+					case scene::NodeType::SUBTRACT:        inst.op = OpCode::SUBTRACT; break;
+					case scene::NodeType::SMOOTH_UNION:    inst.op = OpCode::SMOOTH_UNION; break;
+					case scene::NodeType::SMOOTH_SUBTRACT: inst.op = OpCode::SMOOTH_SUBTRACT; break;
+					default:
+						assert(0);
+						return false;
+				}
+
+				inst.dst = dstReg;
+				inst.src0 = dstReg;
+				inst.params[0] = node.params[0];
+
+				for (uint32_t childIndex = 1; childIndex < node.childCount; ++childIndex)
+				{
+					const auto found = inoutCompiler->saved.find(ValueKey(space, children[childIndex]));
+
+					// Already computed sub-trees are read straight from their saved register.
+					if (found != inoutCompiler->saved.end())
+						inst.src1 = found->second;
+					else
+					{
+						if (!CompileValue(inoutCompiler, children[childIndex], space, pointReg, dstReg + 1))
+							return false;
+
+						inst.src1 = dstReg + 1;
+					}
+
+					inoutProg->code.push_back(inst);
+				}
+
+				return true;
+			}
+
+			// Moves saved slots to sit just past the working registers, in the order
+			// they were allocated. Fails when together they don't fit the register file.
+			bool PackSavedRegisters(Compiler *inoutCompiler)
+			{
+				Program &prog = *inoutCompiler->prog;
+				const uint16_t base = prog.registerCount;
+				const auto remap = [&](uint16_t reg) -> uint16_t
+				{
+					return reg >= SAVED_REGISTER ? (uint16_t)(base + (reg - SAVED_REGISTER)) : reg;
+				};
+
+				if (base + inoutCompiler->savedCount > MAX_REGISTERS)
+					return false;
+
+				for (Instruction &inst : prog.code)
+				{
+					if (inst.op == OpCode::TRANSFORM || inst.op == OpCode::REPEAT)
+						continue;
+
+					inst.dst = remap(inst.dst);
+
+					if (inst.op >= OpCode::SCALE)
+						inst.src0 = remap(inst.src0);
+
+					if (inst.op > OpCode::SCALE)
+						inst.src1 = remap(inst.src1);
+				}
+
+				prog.registerCount = base + inoutCompiler->savedCount;
+				return true;
+			}
+
+			// Saved results stay live to the end, so a scene with more shared
+			// sub-trees than registers left over saves as many as fit and computes
+			// the rest again at each reference. Saving fewer can need more working
+			// registers, so the limit drops until both fit or nothing is saved.
+			bool CompileRoot(const scene::Scene &scene, uint32_t root, Program *outProgram)
+			{
+				if (root >= scene.nodes.size())
+					return false;
+
+				for (uint16_t savedLimit = MAX_REGISTERS;;)
+				{
+					Compiler compiler;
+					compiler.scene = &scene;
+					compiler.prog = outProgram;
+					compiler.savedLimit = savedLimit;
+
+					outProgram->code.clear();
+					outProgram->volumes = scene.volumes;
+					outProgram->instances.clear();
+					outProgram->registerCount = 0;
+					outProgram->pointRegisterCount = 1;
+					outProgram->result = 0;
+
+					CountUses(&compiler, root, 0);
+
+					if (!CompileValue(&compiler, root, 0, 0, 0))
+						return false;
+
+					if (PackSavedRegisters(&compiler))
+						return true;
+
+					if (compiler.savedCount == 0)
+						return false;
+
+					savedLimit = (uint16_t)std::min<int>(compiler.savedCount - 1, std::max<int>(MAX_REGISTERS - outProgram->registerCount, 0));
+				}
+			}
+
+			// Visits the placements that can be closest to any lane. Lanes close
+			// together search as a group, from the block of cells holding them out
+			// one shell of cells at a time, until nothing left unvisited can be
+			// closer than what each lane already has. evaluate(placement, best)
+			// returns the per lane minimum of best and the placement's distance.
+			template<typename Evaluate>
+			float8 VisitPlacements(const instance::Table &table, const float8 &x, const float8 &y, const float8 &z, Evaluate evaluate)
+			{
+				static const uint32_t MAX_GROUP_CELLS = 4; // per axis
+
+				float lanes[3][8];
+				glm::vec3 pos[8];
+				glm::uvec3 cells[8];
+				unsigned groups[8];
+				instance::Block blocks[8];
+				unsigned groupCount = 0;
+				float8 best = simd::Set1(INFINITY);
+				std::vector<uint32_t> candidates, evaluated;
+
+				simd::Store(lanes[0], x);
+				simd::Store(lanes[1], y);
+				simd::Store(lanes[2], z);
+
+				for (unsigned lane = 0; lane < 8; ++lane)
+				{
+					pos[lane] = glm::vec3(lanes[0][lane], lanes[1][lane], lanes[2][lane]);
+					cells[lane] = instance::CellAt(table, pos[lane]);
+
+					const glm::uvec3 &cell = cells[lane];
+					unsigned group = 0;
+
+					for (; group < groupCount; ++group)
+					{
+						const glm::uvec3 lo = glm::min(blocks[group].lo, cell);
+						const glm::uvec3 hi = glm::max(blocks[group].hi, cell);
+
+						if (hi.x - lo.x < MAX_GROUP_CELLS && hi.y - lo.y < MAX_GROUP_CELLS && hi.z - lo.z < MAX_GROUP_CELLS)
+						{
+							blocks[group] = { lo, hi };
+							break;
+						}
+					}
+
+					if (group == groupCount)
+						blocks[groupCount++] = { cell, cell };
+
+					groups[lane] = group;
+				}
+
+				for (unsigned group = 0; group < groupCount; ++group)
+				{
+					instance::Block visited = blocks[group];
+
+					candidates.clear();
+					instance::GatherBlock(table, visited, nullptr, &candidates);
+
+					for (;;)
+					{
+						for (const uint32_t placementIndex : candidates)
+						{
+							const instance::Placement &placement = table.placements[placementIndex];
+							const float8 dx = simd::Max(simd::Max(simd::Set1(placement.min.x) - x, x - simd::Set1(placement.max.x)), simd::Zero());
+							const float8 dy = simd::Max(simd::Max(simd::Set1(placement.min.y) - y, y - simd::Set1(placement.max.y)), simd::Zero());
+							const float8 dz = simd::Max(simd::Max(simd::Set1(placement.min.z) - z, z - simd::Set1(placement.max.z)), simd::Zero());
+
+							// Most candidates are culled by their bounds, so only the ones
+							// evaluated need remembering. Placements spanning several cells
+							// come up more than once.
+							if (!simd::Any(simd::CmpLt(simd::Length(dx, dy, dz), best)))
+								continue;
+
+							const auto found = std::lower_bound(evaluated.begin(), evaluated.end(), placementIndex);
+
+							if (found != evaluated.end() && *found == placementIndex)
+								continue;
+
+							evaluated.insert(found, placementIndex);
+							best = evaluate(placement, best);
+						}
+
+						float bests[8];
+						bool active = false;
+
+						simd::Store(bests, best);
+
+						for (unsigned lane = 0; lane < 8 && !active; ++lane)
+							active = groups[lane] == group && instance::BlockBound(table, pos[lane], visited) < bests[lane];
+
+						if (!active)
+							break;
+
+						const instance::Block grown = instance::Grow(table, visited);
+
+						candidates.clear();
+						instance::GatherBlock(table, grown, &visited, &candidates);
+						visited = grown;
+					}
+				}
+
+				return best;
+			}
+
+			void EvaluateInstances(const Instances &instances, const float8 p[3], float8 *outDist, float8 *outIds)
+			{
+				float8 ids = simd::Set1Bits(scene::INVALID_NODE);
+
+				*outDist = VisitPlacements(*instances.table, p[0], p[1], p[2], [&](const instance::Placement &placement, const float8 &best)
+				{
+					float8 local[3], dist, childIds;
+
+					for (unsigned row = 0; row < 3; ++row)
+					{
+						const float * const m = placement.params + row * 4;
+
+						local[row] = p[0] * simd::Set1(m[0]) + p[1] * simd::Set1(m[1]) + p[2] * simd::Set1(m[2]) + simd::Set1(m[3]);
+					}
+
+					EvaluatePacket(*instances.child, local[0], local[1], local[2], &dist, &childIds);
+					dist = dist * simd::Set1(placement.params[12]);
+
+					const float8 closer = simd::CmpLt(dist, best);
+
+					ids = simd::Select(closer, childIds, ids);
+					return simd::Select(closer, dist, best);
+				});
+
+				*outIds = ids;
+			}
+
+			// The child's gradient is taken in its own space, then chained through
+			// the placement and whatever the point register's derivatives carry.
+			void EvaluateInstancesGradient(const Instances &instances, const simd::dual8 p[3], float h, simd::dual8 *outDist, float8 *outIds)
+			{
+				using simd::dual8;
+
+				float8 ids = simd::Set1Bits(scene::INVALID_NODE);
+				dual8 result = simd::Constant(simd::Set1(INFINITY));
+
+				VisitPlacements(*instances.table, p[0].v, p[1].v, p[2].v, [&](const instance::Placement &placement, const float8 &best)
+				{
+					const float8 scale = simd::Set1(placement.params[12]);
+					dual8 local[3];
+					float8 dist, grad[3], childIds;
+
+					for (unsigned row = 0; row < 3; ++row)
+					{
+						const float * const m = placement.params + row * 4;
+
+						local[row] = p[0] * simd::Set1(m[0]) + p[1] * simd::Set1(m[1]) + p[2] * simd::Set1(m[2]) + simd::Set1(m[3]);
+					}
+
+					EvaluatePacketGradient(*instances.child, local[0].v, local[1].v, local[2].v, &dist, grad, &childIds, h);
+
+					dual8 d;
+					d.v = dist * scale;
+
+					for (unsigned wrt = 0; wrt < 3; ++wrt)
+						d.d[wrt] = (grad[0] * local[0].d[wrt] + grad[1] * local[1].d[wrt] + grad[2] * local[2].d[wrt]) * scale;
+
+					const float8 closer = simd::CmpLt(d.v, best);
+
+					ids = simd::Select(closer, childIds, ids);
+					result = simd::Select(closer, d, result);
+					return result.v;
+				});
+
+				*outDist = result;
+				*outIds = ids;
+			}
+		}
+
+		bool Compile(const scene::Scene &scene, Program *outProgram)
+		{
+			return CompileRoot(scene, scene.root, outProgram);
+		}
+
+		void EvaluatePacket(const Program &prog, const float8 &x, const float8 &y, const float8 &z, float8 *outDist, float8 *outoptIds)
+		{
+			float8 dist[MAX_REGISTERS];
+			float8 ids[MAX_REGISTERS];
+			float8 pts[MAX_POINT_REGISTERS][3];
+			const float8 zero = simd::Zero();
+			const float8 half = simd::Set1(0.5f);
+			const float8 one = simd::Set1(1.0f);
+
+			pts[0][0] = x;
+			pts[0][1] = y;
+			pts[0][2] = z;
+
+			for (const Instruction &inst : prog.code)
+			{
+				const float * const params = inst.params;
+
+				switch (inst.op)
+				{
+					case OpCode::SPHERE:
+					{
+						const float8 * const p = pts[inst.src0];
+
+						dist[inst.dst] = simd::Length(p[0], p[1], p[2]) - simd::Set1(params[0]);
+						ids[inst.dst] = simd::Set1Bits(inst.primitiveId);
+					}
+					break;
+					case OpCode::BOX:
+					{
+						const float8 * const p = pts[inst.src0];
+						const float8 qx = simd::Abs(p[0]) - simd::Set1(params[0]);
+						const float8 qy = simd::Abs(p[1]) - simd::Set1(params[1]);
+						const float8 qz = simd::Abs(p[2]) - simd::Set1(params[2]);
+						const float8 outside = simd::Length(simd::Max(qx, zero), simd::Max(qy, zero), simd::Max(qz, zero));
+						const float8 inside = simd::Min(simd::Max(qx, simd::Max(qy, qz)), zero);
+
+						dist[inst.dst] = outside + inside - simd::Set1(params[3]);
+						ids[inst.dst] = simd::Set1Bits(inst.primitiveId);
+					}
+					break;
+					case OpCode::TORUS:
+					{
+						const float8 * const p = pts[inst.src0];
+						const float8 ring = simd::Length(p[0], p[2]) - simd::Set1(params[0]);
+
+						dist[inst.dst] = simd::Length(ring, p[1]) - simd::Set1(params[1]);
+						ids[inst.dst] = simd::Set1Bits(inst.primitiveId);
+					}
+					break;
+					case OpCode::CAPSULE:
+					{
+						const float8 * const p = pts[inst.src0];
+						const float8 h = simd::Set1(params[0]);
+						const float8 py = p[1] - simd::Clamp(p[1], -h, h);
+
+						dist[inst.dst] = simd::Length(p[0], py, p[2]) - simd::Set1(params[1]);
+						ids[inst.dst] = simd::Set1Bits(inst.primitiveId);
+					}
+					break;
+					case OpCode::CYLINDER:
+					{
+						const float8 * const p = pts[inst.src0];
+						const float8 dx = simd::Length(p[0], p[2]) - simd::Set1(params[1]);
+						const float8 dy = simd::Abs(p[1]) - simd::Set1(params[0]);
+
+						dist[inst.dst] = simd::Min(simd::Max(dx, dy), zero) + simd::Length(simd::Max(dx, zero), simd::Max(dy, zero));
+						ids[inst.dst] = simd::Set1Bits(inst.primitiveId);
+					}
+					break;
+					case OpCode::PLANE:
+					{
+						const float8 * const p = pts[inst.src0];
+
+						dist[inst.dst] = p[0] * simd::Set1(params[0]) + p[1] * simd::Set1(params[1]) + p[2] * simd::Set1(params[2]) + simd::Set1(params[3]);
+						ids[inst.dst] = simd::Set1Bits(inst.primitiveId);
+					}
+					break;
+					case OpCode::VOLUME:
+					{
+						const volume::Grid &grid = *prog.volumes[(size_t)params[0]];
+						const float8 * const p = pts[inst.src0];
+						float lanes[3][8], values[8];
+
+						// Gathers are no faster than scalar loads here, so sample lane by lane.
+						for (unsigned axis = 0; axis < 3; ++axis)
+							simd::Store(lanes[axis], p[axis]);
+
+						for (unsigned lane = 0; lane < 8; ++lane)
+							values[lane] = volume::Sample(grid, glm::vec3(lanes[0][lane], lanes[1][lane], lanes[2][lane]));
+
+						dist[inst.dst] = simd::Load(values);
+						ids[inst.dst] = simd::Set1Bits(inst.primitiveId);
+					}
+					break;
+					case OpCode::INSTANCE:
+						EvaluateInstances(prog.instances[(size_t)params[0]], pts[inst.src0], &dist[inst.dst], &ids[inst.dst]);
+					break;
+					case OpCode::TRANSFORM:
+					{
+						const float8 * const p = pts[inst.src0];
+						float8 * const local = pts[inst.dst];
+
+						for (unsigned row = 0; row < 3; ++row)
+						{
+							const float * const m = params + row * 4;
+
+							local[row] = p[0] * simd::Set1(m[0]) + p[1] * simd::Set1(m[1]) + p[2] * simd::Set1(m[2]) + simd::Set1(m[3]);
+						}
+					}
+					break;
+					case OpCode::REPEAT:
+					{
+						const float8 * const p = pts[inst.src0];
+						float8 * const local = pts[inst.dst];
+
+						for (unsigned axis = 0; axis < 3; ++axis)
+						{
+							const float8 limit = simd::Set1(params[3 + axis]);
+							const float8 cell = simd::Clamp(simd::Floor(p[axis] * simd::Set1(params[6 + axis]) + half), -limit, limit);
+
+							local[axis] = p[axis] - cell * simd::Set1(params[axis]);
+						}
+					}
+					break;
+					case OpCode::SCALE:
+						dist[inst.dst] = dist[inst.src0] * simd::Set1(params[0]);
+						ids[inst.dst] = ids[inst.src0];
+					break;
+					case OpCode::UNION:
+					{
+						const float8 a = dist[inst.src0];
+						const float8 b = dist[inst.src1];
+						const float8 takeB = simd::CmpLt(b, a);
+
+						dist[inst.dst] = simd::Min(a, b);
+						ids[inst.dst] = simd::Select(takeB, ids[inst.src1], ids[inst.src0]);
+					}
+					break;
+					case OpCode::INTERSECT:
+					{
+						const float8 a = dist[inst.src0];
+						const float8 b = dist[inst.src1];
+						const float8 takeB = simd::CmpGt(b, a);
+
+						dist[inst.dst] = simd::Max(a, b);
+						ids[inst.dst] = simd::Select(takeB, ids[inst.src1], ids[inst.src0]);
+					}
+					break;
+					case OpCode::SUBTRACT:
+					{
+						const float8 a = dist[inst.src0];
+						const float8 b = -dist[inst.src1];
+						const float8 takeB = simd::CmpGt(b, a);
+
+						dist[inst.dst] = simd::Max(a, b);
+						ids[inst.dst] = simd::Select(takeB, ids[inst.src1], ids[inst.src0]);
+					}
+					break;
+					case OpCode::SMOOTH_UNION:
+					{
+						const float8 a = dist[inst.src0];
+						const float8 b = dist[inst.src1];
+						const float8 k = simd::Set1(params[0]);
+						const float8 h = simd::Clamp(half + half * (b - a) / k, zero, one);
+
+						dist[inst.dst] = b + (a - b) * h - k * h * (one - h);
+						ids[inst.dst] = simd::Select(simd::CmpLt(b, a), ids[inst.src1], ids[inst.src0]);
+					}
+					break;
+					case OpCode::SMOOTH_SUBTRACT:
+					{
+						const float8 a = dist[inst.src0];
+						const float8 b = dist[inst.src1];
+						const float8 k = simd::Set1(params[0]);
+						const float8 h = simd::Clamp(half - half * (a + b) / k, zero, one);
+
+						dist[inst.dst] = a + (-b - a) * h + k * h * (one - h);
+						ids[inst.dst] = simd::Select(simd::CmpGt(-b, a), ids[inst.src1], ids[inst.src0]);
+					}
+					break;
+				}
+			}
+
+			*outDist = dist[prog.result];
+
+			if (outoptIds)
+				*outoptIds = ids[prog.result];
+		}
+
+		unsigned EvaluatePacketGradient(const Program &prog, const float8 &x, const float8 &y, const float8 &z, float8 *outDist, float8 outGrad[3], float8 *outoptIds, float h)
+		{
+			using simd::dual8;
+
+			dual8 dist[MAX_REGISTERS];
+			float8 ids[MAX_REGISTERS];
+			dual8 pts[MAX_POINT_REGISTERS][3];
+			const float8 zero = simd::Zero();
+			const float8 half = simd::Set1(0.5f);
+			const float8 one = simd::Set1(1.0f);
+			float8 degenerate = zero;
+
+			pts[0][0] = simd::Variable(x, 0);
+			pts[0][1] = simd::Variable(y, 1);
+			pts[0][2] = simd::Variable(z, 2);
+
+			// Written by the program's last instruction; seeded so the read below
+			// never sees an unwritten register, even for an empty program.
+			dist[prog.result] = simd::Constant(zero);
+			ids[prog.result] = zero;
+
+			for (const Instruction &inst : prog.code)
+			{
+				const float * const params = inst.params;
+
+				switch (inst.op)
+				{
+					case OpCode::SPHERE:
+					{
+						const dual8 * const p = pts[inst.src0];
+
+						dist[inst.dst] = simd::Length(p[0], p[1], p[2], &degenerate) - simd::Set1(params[0]);
+						ids[inst.dst] = simd::Set1Bits(inst.primitiveId);
+					}
+					break;
+					case OpCode::BOX:
+					{
+						const dual8 * const p = pts[inst.src0];
+						const dual8 qx = simd::Abs(p[0]) - simd::Set1(params[0]);
+						const dual8 qy = simd::Abs(p[1]) - simd::Set1(params[1]);
+						const dual8 qz = simd::Abs(p[2]) - simd::Set1(params[2]);
+						const float8 anyOutside = simd::CmpGt(simd::Max(qx.v, simd::Max(qy.v, qz.v)), zero);
+						float8 outsideDegenerate = zero;
+						const dual8 outside = simd::Length(simd::Max(qx, zero), simd::Max(qy, zero), simd::Max(qz, zero), &outsideDegenerate);
+						const dual8 inside = simd::Min(simd::Max(qx, simd::Max(qy, qz)), zero);
+
+						// The outside term is exactly zero inside the box, which is not a kink.
+						degenerate = simd::Or(degenerate, simd::And(anyOutside, outsideDegenerate));
+						dist[inst.dst] = outside + inside - simd::Set1(params[3]);
+						ids[inst.dst] = simd::Set1Bits(inst.primitiveId);
+					}
+					break;
+					case OpCode::TORUS:
+					{
+						const dual8 * const p = pts[inst.src0];
+						const dual8 ring = simd::Length(p[0], p[2], &degenerate) - simd::Set1(params[0]);
+
+						dist[inst.dst] = simd::Length(ring, p[1], &degenerate) - simd::Set1(params[1]);
+						ids[inst.dst] = simd::Set1Bits(inst.primitiveId);
+					}
+					break;
+					case OpCode::CAPSULE:
+					{
+						const dual8 * const p = pts[inst.src0];
+						const float8 h = simd::Set1(params[0]);
+						const dual8 py = p[1] - simd::Clamp(p[1], -h, h);
+
+						dist[inst.dst] = simd::Length(p[0], py, p[2], &degenerate) - simd::Set1(params[1]);
+						ids[inst.dst] = simd::Set1Bits(inst.primitiveId);
+					}
+					break;
+					case OpCode::CYLINDER:
+					{
+						const dual8 * const p = pts[inst.src0];
+						const dual8 dx = simd::Length(p[0], p[2], &degenerate) - simd::Set1(params[1]);
+						const dual8 dy = simd::Abs(p[1]) - simd::Set1(params[0]);
+						const float8 anyOutside = simd::CmpGt(simd::Max(dx.v, dy.v), zero);
+						float8 outsideDegenerate = zero;
+						const dual8 outside = simd::Length(simd::Max(dx, zero), simd::Max(dy, zero), &outsideDegenerate);
+
+						degenerate = simd::Or(degenerate, simd::And(anyOutside, outsideDegenerate));
+						dist[inst.dst] = simd::Min(simd::Max(dx, dy), zero) + outside;
+						ids[inst.dst] = simd::Set1Bits(inst.primitiveId);
+					}
+					break;
+					case OpCode::PLANE:
+					{
+						const dual8 * const p = pts[inst.src0];
+
+						dist[inst.dst] = p[0] * simd::Set1(params[0]) + p[1] * simd::Set1(params[1]) + p[2] * simd::Set1(params[2]) + simd::Set1(params[3]);
+						ids[inst.dst] = simd::Set1Bits(inst.primitiveId);
+					}
+					break;
+					case OpCode::VOLUME:
+					{
+						const volume::Grid &grid = *prog.volumes[(size_t)params[0]];
+						const dual8 * const p = pts[inst.src0];
+						float lanes[3][8], values[8], grads[3][8];
+
+						for (unsigned axis = 0; axis < 3; ++axis)
+							simd::Store(lanes[axis], p[axis].v);
+
+						for (unsigned lane = 0; lane < 8; ++lane)
+						{
+							glm::vec3 grad;
+
+							values[lane] = volume::SampleGradient(grid, glm::vec3(lanes[0][lane], lanes[1][lane], lanes[2][lane]), &grad);
+
+							for (unsigned axis = 0; axis < 3; ++axis)
+								grads[axis][lane] = grad[axis];
+						}
+
+						dual8 &d = dist[inst.dst];
+						d.v = simd::Load(values);
+
+						// Chain rule through the local point's derivatives.
+						for (unsigned wrt = 0; wrt < 3; ++wrt)
+							d.d[wrt] = simd::Load(grads[0]) * p[0].d[wrt] + simd::Load(grads[1]) * p[1].d[wrt] + simd::Load(grads[2]) * p[2].d[wrt];
+
+						ids[inst.dst] = simd::Set1Bits(inst.primitiveId);
+					}
+					break;
+					case OpCode::INSTANCE:
+						EvaluateInstancesGradient(prog.instances[(size_t)params[0]], pts[inst.src0], h, &dist[inst.dst], &ids[inst.dst]);
+					break;
+					case OpCode::TRANSFORM:
+					{
+						const dual8 * const p = pts[inst.src0];
+						dual8 * const local = pts[inst.dst];
+
+						for (unsigned row = 0; row < 3; ++row)
+						{
+							const float * const m = params + row * 4;
+
+							local[row] = p[0] * simd::Set1(m[0]) + p[1] * simd::Set1(m[1]) + p[2] * simd::Set1(m[2]) + simd::Set1(m[3]);
+						}
+					}
+					break;
+					case OpCode::REPEAT:
+					{
+						const dual8 * const p = pts[inst.src0];
+						dual8 * const local = pts[inst.dst];
+
+						for (unsigned axis = 0; axis < 3; ++axis)
+						{
+							const float8 limit = simd::Set1(params[3 + axis]);
+							const float8 cell = simd::Clamp(simd::Floor(p[axis].v * simd::Set1(params[6 + axis]) + half), -limit, limit);
+
+							local[axis] = p[axis] - cell * simd::Set1(params[axis]);
+						}
+					}
+					break;
+					case OpCode::SCALE:
+						dist[inst.dst] = dist[inst.src0] * simd::Set1(params[0]);
+						ids[inst.dst] = ids[inst.src0];
+					break;
+					case OpCode::UNION:
+					{
+						const dual8 &a = dist[inst.src0];
+						const dual8 &b = dist[inst.src1];
+						const float8 takeB = simd::CmpLt(b.v, a.v);
+
+						ids[inst.dst] = simd::Select(takeB, ids[inst.src1], ids[inst.src0]);
+						dist[inst.dst] = simd::Select(takeB, b, a);
+					}
+					break;
+					case OpCode::INTERSECT:
+					{
+						const dual8 &a = dist[inst.src0];
+						const dual8 &b = dist[inst.src1];
+						const float8 takeB = simd::CmpGt(b.v, a.v);
+
+						ids[inst.dst] = simd::Select(takeB, ids[inst.src1], ids[inst.src0]);
+						dist[inst.dst] = simd::Select(takeB, b, a);
+					}
+					break;
+					case OpCode::SUBTRACT:
+					{
+						const dual8 &a = dist[inst.src0];
+						const dual8 b = -dist[inst.src1];
+						const float8 takeB = simd::CmpGt(b.v, a.v);
+
+						ids[inst.dst] = simd::Select(takeB, ids[inst.src1], ids[inst.src0]);
+						dist[inst.dst] = simd::Select(takeB, b, a);
+					}
+					break;
+					case OpCode::SMOOTH_UNION:
+					{
+						const dual8 a = dist[inst.src0];
+						const dual8 b = dist[inst.src1];
+						const float8 k = simd::Set1(params[0]);
+						const dual8 h = simd::Clamp((b - a) * (half / k) + half, zero, one);
+
+						ids[inst.dst] = simd::Select(simd::CmpLt(b.v, a.v), ids[inst.src1], ids[inst.src0]);
+						dist[inst.dst] = b + (a - b) * h - (h * (simd::Constant(one) - h)) * k;
+					}
+					break;
+					case OpCode::SMOOTH_SUBTRACT:
+					{
+						const dual8 a = dist[inst.src0];
+						const dual8 b = dist[inst.src1];
+						const float8 k = simd::Set1(params[0]);
+						const dual8 h = simd::Clamp(-((a + b) * (half / k)) + half, zero, one);
+
+						ids[inst.dst] = simd::Select(simd::CmpGt(-b.v, a.v), ids[inst.src1], ids[inst.src0]);
+						dist[inst.dst] = a + (-b - a) * h + (h * (simd::Constant(one) - h)) * k;
+					}
+					break;
+				}
+			}
+
+			const dual8 &result = dist[prog.result];
+			const unsigned fallbackLanes = simd::MoveMask(degenerate);
+
+			*outDist = result.v;
+			outGrad[0] = result.d[0];
+			outGrad[1] = result.d[1];
+			outGrad[2] = result.d[2];
+
+			if (outoptIds)
+				*outoptIds = ids[prog.result];
+
+			if (fallbackLanes)
+			{
+				float8 numeric[3];
+
+				EvaluatePacketCentralDifference(prog, x, y, z, h, numeric);
+
+				for (unsigned axis = 0; axis < 3; ++axis)
+					outGrad[axis] = simd::Select(degenerate, numeric[axis], outGrad[axis]);
+			}
+
+			return fallbackLanes;
+		}
+
+		void EvaluatePacketCentralDifference(const Program &prog, const float8 &x, const float8 &y, const float8 &z, float h, float8 outGrad[3])
+		{
+			const float8 step = simd::Set1(h);
+			const float8 zero = simd::Zero();
+			const float8 invTwoH = simd::Set1(0.5f / h);
+
+			for (unsigned axis = 0; axis < 3; ++axis)
+			{
+				const float8 ox = axis == 0 ? step : zero;
+				const float8 oy = axis == 1 ? step : zero;
+				const float8 oz = axis == 2 ? step : zero;
+				float8 dPos, dNeg;
+
+				EvaluatePacket(prog, x + ox, y + oy, z + oz, &dPos, nullptr);
+				EvaluatePacket(prog, x - ox, y - oy, z - oz, &dNeg, nullptr);
+				outGrad[axis] = (dPos - dNeg) * invTwoH;
+			}
+		}
+
+		void EvaluateBatch(const Program &prog, const float *xs, const float *ys, const float *zs, size_t count, float *outDist)
+		{
+			size_t pointIndex = 0;
+
+			for (; pointIndex + simd::WIDTH <= count; pointIndex += simd::WIDTH)
+			{
+				float8 dist;
+
+				EvaluatePacket(prog, simd::Load(xs + pointIndex), simd::Load(ys + pointIndex), simd::Load(zs + pointIndex), &dist, nullptr);
+				simd::Store(outDist + pointIndex, dist);
+			}
+
+			if (pointIndex < count)
+			{
+				float tail[4][simd::WIDTH] = {};
+				const size_t tailCount = count - pointIndex;
+				float8 dist;
+
+				std::copy(xs + pointIndex, xs + count, tail[0]);
+				std::copy(ys + pointIndex, ys + count, tail[1]);
+				std::copy(zs + pointIndex, zs + count, tail[2]);
+
+				EvaluatePacket(prog, simd::Load(tail[0]), simd::Load(tail[1]), simd::Load(tail[2]), &dist, nullptr);
+				simd::Store(tail[3], dist);
+
+				std::copy(tail[3], tail[3] + tailCount, outDist + pointIndex);
+			}
+		}
+
+		void EvaluateGradientBatch(const Program &prog, const float *xs, const float *ys, const float *zs, size_t count, float *outDist, float *outGradX, float *outGradY, float *outGradZ)
+		{
+			float * const outs[4] = { outDist, outGradX, outGradY, outGradZ };
+
+			for (size_t pointIndex = 0; pointIndex < count; pointIndex += simd::WIDTH)
+			{
+				const size_t laneCount = std::min<size_t>(simd::WIDTH, count - pointIndex);
+				float in[3][simd::WIDTH] = {};
+				float out[4][simd::WIDTH];
+				float8 dist, grad[3];
+
+				std::copy(xs + pointIndex, xs + pointIndex + laneCount, in[0]);
+				std::copy(ys + pointIndex, ys + pointIndex + laneCount, in[1]);
+				std::copy(zs + pointIndex, zs + pointIndex + laneCount, in[2]);
+
+				EvaluatePacketGradient(prog, simd::Load(in[0]), simd::Load(in[1]), simd::Load(in[2]), &dist, grad, nullptr);
+
+				simd::Store(out[0], dist);
+				simd::Store(out[1], grad[0]);
+				simd::Store(out[2], grad[1]);
+				simd::Store(out[3], grad[2]);
+
+				for (unsigned channel = 0; channel < 4; ++channel)
+					std::copy(out[channel], out[channel] + laneCount, outs[channel] + pointIndex);
+			}
+		}
+	}
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Scene.h"
+#include "Simd.h"
+
+namespace sdf
+{
+	namespace program
+	{
+		static const unsigned MAX_REGISTERS = 64;
+		static const unsigned MAX_POINT_REGISTERS = 32;
+
+		enum class OpCode : unsigned char
+		{
+			// dst distance register = primitive(point register src0)
+			SPHERE,
+			BOX,
+			TORUS,
+			CAPSULE,
+			CYLINDER,
+			PLANE,
+			VOLUME,          // params: index into Program::volumes, grid bounds min xyz, max xyz
+			// dst distance register = closest placement at point register src0. params: index into Program::instances
+			INSTANCE,
+
+			// dst point register = 3x4 params * point register src0
+			TRANSFORM,
+			// dst point register = point register src0 moved into the nearest repetition cell. params: as the REPEAT node
+			REPEAT,
+			// dst = src0 * params[0], primitive id included. Also serves as a register copy.
+			SCALE,
+
+			// dst = op(src0, src1)
+			UNION,
+			INTERSECT,
+			SUBTRACT,
+			SMOOTH_UNION,
+			SMOOTH_SUBTRACT
+		};
+
+		struct Instruction
+		{
+			OpCode op;
+			uint16_t dst;
+			uint16_t src0;
+			uint16_t src1;
+			uint32_t primitiveId;
+			float params[13];
+		};
+
+		struct Program;
+
+		// An instance node's placements, with its child compiled on its own so
+		// each placement near a packet runs it once.
+		struct Instances
+		{
+			std::shared_ptr<const instance::Table> table;
+			std::shared_ptr<const Program> child;
+		};
+
+		// A scene DAG flattened into straight line register code, so a packet of
+		// points walks the expression once with no recursion or pointer chasing.
+		struct Program
+		{
+			memory::Vector<Instruction, memory::Tag::SCENE> code;
+			std::vector<std::shared_ptr<const volume::Grid>> volumes;
+			std::vector<Instances> instances;
+			uint16_t registerCount = 0;
+			uint16_t pointRegisterCount = 0;
+			uint16_t result = 0;
+		};
+
+		// A sub-tree referenced more than once from the same coordinate space is
+		// evaluated once and its result kept in a register for the other references.
+		bool Compile(const scene::Scene &scene, Program *outProgram);
+
+		// Evaluates 8 points at once. outoptIds receives the primitive id bits of
+		// the closest surface per lane (reinterpret with simd::LaneBits).
+		void EvaluatePacket(const Program &prog, const simd::float8 &x, const simd::float8 &y, const simd::float8 &z, simd::float8 *outDist, simd::float8 *outoptIds);
+
+		// Distance plus its analytic gradient in one pass using forward mode dual numbers.
+		// Lanes where an op has no derivative (a sphere's center, a torus' core ring)
+		// fall back to central differences of size h. Returns the mask of those lanes.
+		unsigned EvaluatePacketGradient(const Program &prog, const simd::float8 &x, const simd::float8 &y, const simd::float8 &z, simd::float8 *outDist, simd::float8 outGrad[3], simd::float8 *outoptIds, float h = 1e-4f);
+
+		// 6 tap central difference gradient. The slow path, kept as the reference.
+		void EvaluatePacketCentralDifference(const Program &prog, const simd::float8 &x, const simd::float8 &y, const simd::float8 &z, float h, simd::float8 outGrad[3]);
+
+		// Structure of arrays batch evaluation. Tail lanes are padded internally.
+		void EvaluateBatch(const Program &prog, const float *xs, const float *ys, const float *zs, size_t count, float *outDist);
+		void EvaluateGradientBatch(const Program &prog, const float *xs, const float *ys, const float *zs, size_t count, float *outDist, float *outGradX, float *outGradY, float *outGradZ);
+	}
+}
@@ -0,0 +1,229 @@
+#include "Query.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace sdf
+{
+	namespace query
+	{
+		namespace
+		{
+			using simd::float8;
+
+			// Queries per work item. Enough packets to amortize the shared counter,
+			// few enough that a 10k batch still balances across every core.
+			static const uint32_t QUERIES_PER_ITEM = 64;
+
+			struct alignas(64) ThreadStats
+			{
+				uint64_t evaluations;
+				uint64_t gradientEvaluations;
+			};
+
+			struct Packet
+			{
+				float in[7][simd::WIDTH];   // AoS queries transposed: xyz, then ray direction xyz and max distance
+				float valid[simd::WIDTH];
+				size_t first;
+				unsigned count;
+			};
+
+			// Tail lanes repeat the last query so they march like a real ray, then get dropped on store.
+			void LoadRays(const Ray *rays, size_t first, size_t count, Packet *outPacket)
+			{
+				outPacket->first = first;
+				outPacket->count = (unsigned)std::min<size_t>(count - first, simd::WIDTH);
+
+				for (unsigned lane = 0; lane < simd::WIDTH; ++lane)
+				{
+					const Ray &ray = rays[first + std::min(lane, outPacket->count - 1)];
+
+					for (unsigned axis = 0; axis < 3; ++axis)
+					{
+						outPacket->in[axis][lane] = ray.origin[axis];
+						outPacket->in[3 + axis][lane] = ray.direction[axis];
+					}
+
+					outPacket->in[6][lane] = ray.maxDistance;
+					outPacket->valid[lane] = lane < outPacket->count ? -1.0f : 0.0f;
+				}
+			}
+
+			void LoadPoints(const glm::vec3 *points, size_t first, size_t count, Packet *outPacket)
+			{
+				outPacket->first = first;
+				outPacket->count = (unsigned)std::min<size_t>(count - first, simd::WIDTH);
+
+				for (unsigned lane = 0; lane < simd::WIDTH; ++lane)
+				{
+					const glm::vec3 &point = points[first + std::min(lane, outPacket->count - 1)];
+
+					for (unsigned axis = 0; axis < 3; ++axis)
+						outPacket->in[axis][lane] = point[axis];
+
+					outPacket->valid[lane] = lane < outPacket->count ? -1.0f : 0.0f;
+				}
+			}
+
+			void StoreHits(const Packet &packet, const float8 pos[3], const float8 grad[3], const float8 &distance, const float8 &ids, const float8 &hit, Hit *outHits)
+			{
+				float values[8][simd::WIDTH];
+				const float8 invLen = simd::Set1(1.0f) / simd::Max(simd::Length(grad[0], grad[1], grad[2]), simd::Set1(1e-20f));
+				const unsigned hitBits = simd::MoveMask(hit);
+
+				for (unsigned axis = 0; axis < 3; ++axis)
+				{
+					simd::Store(values[axis], pos[axis]);
+					simd::Store(values[3 + axis], grad[axis] * invLen);
+				}
+
+				simd::Store(values[6], distance);
+				simd::Store(values[7], ids);
+
+				for (unsigned lane = 0; lane < packet.count; ++lane)
+				{
+					Hit &out = outHits[packet.first + lane];
+
+					out.position = glm::vec3(values[0][lane], values[1][lane], values[2][lane]);
+					out.normal = glm::vec3(values[3][lane], values[4][lane], values[5][lane]);
+					out.distance = values[6][lane];
+					out.primitiveId = simd::LaneBits(ids, lane);
+					out.hit = (hitBits & (1u << lane)) != 0;
+				}
+			}
+
+			void CastPacket(const program::Program &prog, const Settings &settings, const Packet &packet, Hit *outHits, ThreadStats *inoutStats)
+			{
+				const float8 ox = simd::Load(packet.in[0]);
+				const float8 oy = simd::Load(packet.in[1]);
+				const float8 oz = simd::Load(packet.in[2]);
+				const float8 dx = simd::Load(packet.in[3]);
+				const float8 dy = simd::Load(packet.in[4]);
+				const float8 dz = simd::Load(packet.in[5]);
+				const float8 maxDist = simd::Load(packet.in[6]);
+				const float8 tolerance = simd::Set1(settings.tolerance);
+				float8 active = simd::CmpLt(simd::Load(packet.valid), simd::Zero());
+				float8 hit = simd::Zero();
+				float8 t = simd::Zero();
+				float8 ids = simd::Set1Bits(scene::INVALID_NODE);
+
+				for (uint32_t step = 0; step < settings.maxSteps && simd::Any(active); ++step)
+				{
+					float8 dist, stepIds;
+
+					program::EvaluatePacket(prog, ox + dx * t, oy + dy * t, oz + dz * t, &dist, &stepIds);
+					++inoutStats->evaluations;
+
+					const float8 laneHit = simd::And(active, simd::CmpLt(dist, tolerance));
+					hit = simd::Or(hit, laneHit);
+					ids = simd::Select(laneHit, stepIds, ids);
+					active = simd::AndNot(laneHit, active);
+
+					t = t + simd::And(active, dist);
+					active = simd::AndNot(simd::CmpGt(t, maxDist), active);
+				}
+
+				const float8 pos[3] = { ox + dx * t, oy + dy * t, oz + dz * t };
+				float8 grad[3] = { simd::Zero(), simd::Zero(), simd::Zero() };
+
+				if (simd::Any(hit))
+				{
+					float8 dist;
+
+					program::EvaluatePacketGradient(prog, pos[0], pos[1], pos[2], &dist, grad, nullptr);
+					++inoutStats->gradientEvaluations;
+				}
+
+				StoreHits(packet, pos, grad, t, ids, hit, outHits);
+			}
+
+			void ProjectPacket(const program::Program &prog, const Settings &settings, const Packet &packet, Hit *outHits, ThreadStats *inoutStats)
+			{
+				const float8 tolerance = simd::Set1(settings.tolerance);
+				float8 pos[3] = { simd::Load(packet.in[0]), simd::Load(packet.in[1]), simd::Load(packet.in[2]) };
+				float8 dist, ids, grad[3];
+
+				program::EvaluatePacketGradient(prog, pos[0], pos[1], pos[2], &dist, grad, &ids);
+				++inoutStats->gradientEvaluations;
+
+				const float8 queryDist = dist;
+				float8 active = simd::And(simd::CmpLt(simd::Load(packet.valid), simd::Zero()), simd::CmpGe(simd::Abs(dist), tolerance));
+
+				// Newton steps along the normalized gradient. Converged lanes hold still.
+				for (uint32_t step = 0; step < settings.projectionSteps && simd::Any(active); ++step)
+				{
+					const float8 invLen = simd::Set1(1.0f) / simd::Max(simd::Length(grad[0], grad[1], grad[2]), simd::Set1(1e-20f));
+					const float8 move = simd::And(active, dist * invLen);
+					float8 stepDist, stepIds, stepGrad[3];
+
+					for (unsigned axis = 0; axis < 3; ++axis)
+						pos[axis] = pos[axis] - grad[axis] * move;
+
+					program::EvaluatePacketGradient(prog, pos[0], pos[1], pos[2], &stepDist, stepGrad, &stepIds);
+					++inoutStats->gradientEvaluations;
+
+					dist = simd::Select(active, stepDist, dist);
+					ids = simd::Select(active, stepIds, ids);
+
+					for (unsigned axis = 0; axis < 3; ++axis)
+						grad[axis] = simd::Select(active, stepGrad[axis], grad[axis]);
+
+					active = simd::And(active, simd::CmpGe(simd::Abs(dist), tolerance));
+				}
+
+				StoreHits(packet, pos, grad, queryDist, ids, simd::CmpLt(simd::Abs(dist), tolerance), outHits);
+			}
+
+			template<typename Query, typename LoadFn, typename PacketFn>
+			void RunBatch(jobs::Pool *pool, const Query *queries, size_t count, Stats *outoptStats, const LoadFn &load, const PacketFn &run)
+			{
+				const auto startTime = std::chrono::high_resolution_clock::now();
+				const uint32_t itemCount = (uint32_t)((count + QUERIES_PER_ITEM - 1) / QUERIES_PER_ITEM);
+				std::vector<ThreadStats> threadStats(jobs::ThreadCount(pool), ThreadStats{});
+
+				jobs::ParallelFor(pool, itemCount, [&](uint32_t itemIndex, unsigned threadIndex)
+				{
+					const size_t end = std::min<size_t>((size_t)(itemIndex + 1) * QUERIES_PER_ITEM, count);
+					Packet packet;
+
+					for (size_t first = (size_t)itemIndex * QUERIES_PER_ITEM; first < end; first += simd::WIDTH)
+					{
+						load(queries, first, end, &packet);
+						run(packet, &threadStats[threadIndex]);
+					}
+				});
+
+				if (outoptStats)
+				{
+					*outoptStats = Stats();
+					outoptStats->queries = count;
+
+					for (const ThreadStats &stats : threadStats)
+					{
+						outoptStats->evaluations += stats.evaluations;
+						outoptStats->gradientEvaluations += stats.gradientEvaluations;
+					}
+
+					outoptStats->seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+				}
+			}
+		}
+
+		void CastRays(jobs::Pool *pool, const program::Program &prog, const Ray *rays, size_t count, const Settings &settings, Hit *outHits, Stats *outoptStats)
+		{
+			RunBatch(pool, rays, count, outoptStats, LoadRays, [&](const Packet &packet, ThreadStats *inoutStats)
+			{
+				CastPacket(prog, settings, packet, outHits, inoutStats);
+			});
+		}
+
+		void ClosestPoints(jobs::Pool *pool, const program::Program &prog, const glm::vec3 *points, size_t count, const Settings &settings, Hit *outHits, Stats *outoptStats)
+		{
+			RunBatch(pool, points, count, outoptStats, LoadPoints, [&](const Packet &packet, ThreadStats *inoutStats)
+			{
+				ProjectPacket(prog, settings, packet, outHits, inoutStats);
+			});
+		}
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Jobs.h"
+#include "Program.h"
+
+// Batched ray casts and closest point queries for picking, snapping and gizmo
+// placement. Queries are packed 8 to a SIMD packet and spread over a persistent
+// worker pool, so a batch costs close to the distance evaluations it needs.
+namespace sdf
+{
+	namespace query
+	{
+		struct Ray
+		{
+			glm::vec3 origin;
+			glm::vec3 direction;   // normalized
+			float maxDistance;
+		};
+
+		struct Hit
+		{
+			glm::vec3 position;    // on the surface
+			glm::vec3 normal;
+			float distance;        // along the ray, or signed distance from the query point
+			uint32_t primitiveId;
+			bool hit;              // false for rays that escaped or points that did not converge
+		};
+
+		struct Settings
+		{
+			uint32_t maxSteps = 256;          // sphere tracing steps per ray
+			uint32_t projectionSteps = 4;     // closest point projections per point
+			float tolerance = 1e-4f;          // a surface is reached when closer than this
+		};
+
+		struct Stats
+		{
+			uint64_t queries = 0;
+			uint64_t evaluations = 0;         // distance packet evaluations
+			uint64_t gradientEvaluations = 0; // distance and gradient packet evaluations
+			double seconds = 0.0;
+		};
+
+		void CastRays(jobs::Pool *pool, const program::Program &prog, const Ray *rays, size_t count, const Settings &settings, Hit *outHits, Stats *outoptStats = nullptr);
+
+		// Projects each point onto the surface along the field's gradient. One step
+		// is exact for exact distance fields. Bounds, such as those from subtraction,
+		// take a few more.
+		void ClosestPoints(jobs::Pool *pool, const program::Program &prog, const glm::vec3 *points, size_t count, const Settings &settings, Hit *outHits, Stats *outoptStats = nullptr);
+	}
+}
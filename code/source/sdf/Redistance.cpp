@@ -0,0 +1,493 @@
+#include "Redistance.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace sdf
+{
+	namespace redistance
+	{
+		namespace
+		{
+			typedef std::chrono::high_resolution_clock Clock;
+
+			static const uint32_t TILE_SAMPLES = sculpt::TILE_SAMPLES;
+			static const uint32_t SAMPLES_PER_TILE = TILE_SAMPLES * TILE_SAMPLES * TILE_SAMPLES;
+			static const uint32_t APRON_ROW = TILE_SAMPLES + 2;
+			static const uint32_t APRON_SLICE = APRON_ROW * APRON_ROW;
+			static const uint32_t APRON_SAMPLES = APRON_SLICE * APRON_ROW;
+
+			struct Region
+			{
+				glm::uvec3 tileDims;
+				std::vector<uint64_t> tiles;         // sorted tile indices
+				std::vector<uint32_t> neighbours;    // 6 a tile, region slots or ~0u
+			};
+
+			uint64_t TileIndex(const glm::uvec3 &tileDims, const glm::uvec3 &tile)
+			{
+				return ((uint64_t)tile.z * tileDims.y + tile.y) * tileDims.x + tile.x;
+			}
+
+			glm::uvec3 TileAt(const glm::uvec3 &tileDims, uint64_t tileIndex)
+			{
+				return glm::uvec3((uint32_t)(tileIndex % tileDims.x), (uint32_t)(tileIndex / tileDims.x % tileDims.y), (uint32_t)(tileIndex / ((uint64_t)tileDims.x * tileDims.y)));
+			}
+
+			void BuildRegion(const volume::Grid &grid, const std::vector<glm::uvec3> &tiles, uint32_t margin, Region *outRegion)
+			{
+				const glm::uvec3 tileDims = sculpt::TileDims(grid);
+
+				outRegion->tileDims = tileDims;
+				outRegion->tiles.clear();
+
+				for (const glm::uvec3 &tile : tiles)
+				{
+					const glm::uvec3 lo = glm::uvec3(glm::max(glm::ivec3(tile) - glm::ivec3((int)margin), glm::ivec3(0)));
+					const glm::uvec3 hi = glm::min(tile + glm::uvec3(margin), tileDims - glm::uvec3(1));
+
+					for (uint32_t z = lo.z; z <= hi.z; ++z)
+					{
+						for (uint32_t y = lo.y; y <= hi.y; ++y)
+						{
+							for (uint32_t x = lo.x; x <= hi.x; ++x)
+								outRegion->tiles.push_back(TileIndex(tileDims, glm::uvec3(x, y, z)));
+						}
+					}
+				}
+
+				std::sort(outRegion->tiles.begin(), outRegion->tiles.end());
+				outRegion->tiles.erase(std::unique(outRegion->tiles.begin(), outRegion->tiles.end()), outRegion->tiles.end());
+				outRegion->neighbours.assign(outRegion->tiles.size() * 6, ~0u);
+
+				for (size_t slot = 0; slot < outRegion->tiles.size(); ++slot)
+				{
+					const glm::uvec3 tile = TileAt(tileDims, outRegion->tiles[slot]);
+
+					for (unsigned face = 0; face < 6; ++face)
+					{
+						const unsigned axis = face / 2;
+						glm::uvec3 neighbour = tile;
+
+						if (face & 1)
+						{
+							if (tile[axis] + 1 >= tileDims[axis])
+								continue;
+							++neighbour[axis];
+						}
+						else
+						{
+							if (tile[axis] == 0)
+								continue;
+							--neighbour[axis];
+						}
+
+						const auto found = std::lower_bound(outRegion->tiles.begin(), outRegion->tiles.end(), TileIndex(tileDims, neighbour));
+
+						if (found != outRegion->tiles.end() && *found == TileIndex(tileDims, neighbour))
+							outRegion->neighbours[slot * 6 + face] = (uint32_t)(found - outRegion->tiles.begin());
+					}
+				}
+			}
+
+			// Distance to where the surface crosses between the sample and its
+			// neighbours, combined over the axes it crosses on. Infinity if it
+			// crosses on none.
+			float InterfaceDistance(const volume::Grid &grid, uint32_t x, uint32_t y, uint32_t z)
+			{
+				const float * const values = grid.values.data();
+				const size_t index = volume::Index(grid, x, y, z);
+				const float value = values[index];
+				const uint32_t coords[3] = { x, y, z };
+				const size_t strides[3] = { 1, grid.dims.x, (size_t)grid.dims.x * grid.dims.y };
+				float inverseSquaredSum = 0.0f;
+
+				if (value == 0.0f)
+					return 0.0f;
+
+				for (unsigned axis = 0; axis < 3; ++axis)
+				{
+					float nearest = std::numeric_limits<float>::infinity();
+
+					for (int side = -1; side <= 1; side += 2)
+					{
+						if ((side < 0 && coords[axis] == 0) || (side > 0 && coords[axis] + 1 >= grid.dims[axis]))
+							continue;
+
+						const float neighbour = values[side < 0 ? index - strides[axis] : index + strides[axis]];
+
+						// Linear interpolation puts the crossing this far along the edge.
+						if ((value < 0.0f) != (neighbour < 0.0f))
+							nearest = std::min(nearest, value / (value - neighbour) * grid.voxelSize);
+					}
+
+					if (std::isfinite(nearest))
+						inverseSquaredSum += 1.0f / std::max(nearest * nearest, 1e-12f);
+				}
+
+				return inverseSquaredSum > 0.0f ? 1.0f / std::sqrt(inverseSquaredSum) : std::numeric_limits<float>::infinity();
+			}
+
+			// Gauss-Seidel in all 8 directions over a copy of the tile with a sample
+			// of apron on every face, which the face neighbours, of the other color,
+			// don't change meanwhile. Edge and corner apron belongs to diagonal tiles
+			// that may be sweeping on other threads, so it is never read; the stencil
+			// doesn't need it. Samples keep their sign. Returns the largest change.
+			float SweepTile(const glm::uvec3 &tile, const uint8_t *fixed, volume::Grid *inoutGrid)
+			{
+				const glm::uvec3 first = tile * TILE_SAMPLES;
+				const glm::uvec3 count = glm::min(inoutGrid->dims - first, glm::uvec3(TILE_SAMPLES));
+				const glm::ivec3 last = glm::ivec3(inoutGrid->dims) - glm::ivec3(1);
+				const float h = inoutGrid->voxelSize;
+				float samples[APRON_SAMPLES];
+				float maxChange = 0.0f;
+
+				// Past the grid's edge there is no neighbour to solve from.
+				for (uint32_t z = 0; z < APRON_ROW; ++z)
+				{
+					const int gz = (int)first.z + (int)z - 1;
+					const uint32_t apronZ = z == 0 || z == APRON_ROW - 1;
+
+					for (uint32_t y = 0; y < APRON_ROW; ++y)
+					{
+						const int gy = (int)first.y + (int)y - 1;
+						const uint32_t apronYZ = apronZ + (y == 0 || y == APRON_ROW - 1);
+						float * const row = samples + z * APRON_SLICE + y * APRON_ROW;
+
+						for (uint32_t x = 0; x < APRON_ROW; ++x)
+						{
+							const int gx = (int)first.x + (int)x - 1;
+							const bool face = apronYZ + (x == 0 || x == APRON_ROW - 1) <= 1;
+							const bool inside = face && gx >= 0 && gy >= 0 && gz >= 0 && gx <= last.x && gy <= last.y && gz <= last.z;
+
+							row[x] = inside ? inoutGrid->values[volume::Index(*inoutGrid, gx, gy, gz)] : std::numeric_limits<float>::infinity();
+						}
+					}
+				}
+
+				for (unsigned direction = 0; direction < 8; ++direction)
+				{
+					for (uint32_t i = 0; i < count.z; ++i)
+					{
+						const uint32_t z = (direction & 4) ? count.z - 1 - i : i;
+
+						for (uint32_t j = 0; j < count.y; ++j)
+						{
+							const uint32_t y = (direction & 2) ? count.y - 1 - j : j;
+
+							for (uint32_t k = 0; k < count.x; ++k)
+							{
+								const uint32_t x = (direction & 1) ? count.x - 1 - k : k;
+
+								if (fixed[(z * TILE_SAMPLES + y) * TILE_SAMPLES + x])
+									continue;
+
+								float * const s = samples + (z + 1) * APRON_SLICE + (y + 1) * APRON_ROW + x + 1;
+								const float u = volume::SolveEikonal(
+									std::min(std::abs(s[-1]), std::abs(s[1])),
+									std::min(std::abs(s[-(int)APRON_ROW]), std::abs(s[APRON_ROW])),
+									std::min(std::abs(s[-(int)APRON_SLICE]), std::abs(s[APRON_SLICE])), h);
+
+								if (u < std::abs(*s))
+								{
+									maxChange = std::max(maxChange, std::abs(*s) - u);
+									*s = std::copysign(u, *s);
+								}
+							}
+						}
+					}
+				}
+
+				for (uint32_t z = 0; z < count.z; ++z)
+				{
+					for (uint32_t y = 0; y < count.y; ++y)
+					{
+						const float * const src = samples + (z + 1) * APRON_SLICE + (y + 1) * APRON_ROW + 1;
+
+						std::copy(src, src + count.x, inoutGrid->values.data() + volume::Index(*inoutGrid, first.x, first.y + y, first.z + z));
+					}
+				}
+
+				return maxChange;
+			}
+
+			template<typename Fn>
+			void ForEachTile(jobs::Pool *optPool, uint32_t tileCount, const Fn &fn)
+			{
+				if (optPool)
+				{
+					jobs::ParallelFor(optPool, tileCount, [&](uint32_t item, unsigned) { fn(item); });
+				}
+				else
+				{
+					for (uint32_t item = 0; item < tileCount; ++item)
+						fn(item);
+				}
+			}
+
+			void MeasureRegionError(const volume::Grid &grid, const Region &region, float bandWidth, Error *outError)
+			{
+				std::vector<glm::uvec3> tiles;
+
+				for (const uint64_t tileIndex : region.tiles)
+					tiles.push_back(TileAt(region.tileDims, tileIndex));
+
+				MeasureError(grid, tiles, bandWidth, outError);
+			}
+		}
+
+		void Redistance(jobs::Pool *optPool, const Settings &settings, volume::Grid *inoutGrid, sculpt::DirtySet *inoutDirty, Stats *outoptStats)
+		{
+			Region region;
+			Stats stats;
+
+			BuildRegion(*inoutGrid, inoutDirty->tiles, settings.margin, &region);
+
+			if (outoptStats)
+				MeasureRegionError(*inoutGrid, region, settings.bandWidth, &stats.before);
+
+			const Clock::time_point startTime = Clock::now();
+			const uint32_t regionCount = (uint32_t)region.tiles.size();
+			const float band = settings.bandWidth * inoutGrid->voxelSize;
+			std::vector<float> original((size_t)regionCount * SAMPLES_PER_TILE);
+			std::vector<float> initial((size_t)regionCount * SAMPLES_PER_TILE);
+			std::vector<uint8_t> fixed((size_t)regionCount * SAMPLES_PER_TILE, 0);
+			std::vector<uint32_t> interfaceCounts(regionCount, 0);
+			std::vector<uint32_t> bandCounts(regionCount, 0);
+
+			// Samples next to the surface get their distance from where it crosses
+			// and stay fixed while sweeping, as do samples past the band. The rest of
+			// the band is reset for sweeping to fill in.
+			ForEachTile(optPool, regionCount, [&](uint32_t slot)
+			{
+				const glm::uvec3 first = TileAt(region.tileDims, region.tiles[slot]) * TILE_SAMPLES;
+				const glm::uvec3 count = glm::min(inoutGrid->dims - first, glm::uvec3(TILE_SAMPLES));
+
+				for (uint32_t z = 0; z < count.z; ++z)
+				{
+					for (uint32_t y = 0; y < count.y; ++y)
+					{
+						for (uint32_t x = 0; x < count.x; ++x)
+						{
+							const size_t local = (size_t)slot * SAMPLES_PER_TILE + (z * TILE_SAMPLES + y) * TILE_SAMPLES + x;
+							const float value = inoutGrid->values[volume::Index(*inoutGrid, first.x + x, first.y + y, first.z + z)];
+							const float distance = InterfaceDistance(*inoutGrid, first.x + x, first.y + y, first.z + z);
+
+							original[local] = value;
+
+							if (std::isfinite(distance))
+							{
+								initial[local] = value < 0.0f ? -distance : distance;
+								fixed[local] = 1;
+								++interfaceCounts[slot];
+							}
+							else if (std::abs(value) < band)
+							{
+								initial[local] = std::copysign(std::numeric_limits<float>::infinity(), value);
+								++bandCounts[slot];
+							}
+							else
+							{
+								initial[local] = value;
+								fixed[local] = 1;
+							}
+						}
+					}
+				}
+			});
+
+			ForEachTile(optPool, regionCount, [&](uint32_t slot)
+			{
+				const glm::uvec3 first = TileAt(region.tileDims, region.tiles[slot]) * TILE_SAMPLES;
+				const glm::uvec3 count = glm::min(inoutGrid->dims - first, glm::uvec3(TILE_SAMPLES));
+
+				for (uint32_t z = 0; z < count.z; ++z)
+				{
+					for (uint32_t y = 0; y < count.y; ++y)
+					{
+						for (uint32_t x = 0; x < count.x; ++x)
+							inoutGrid->values[volume::Index(*inoutGrid, first.x + x, first.y + y, first.z + z)] = initial[(size_t)slot * SAMPLES_PER_TILE + (z * TILE_SAMPLES + y) * TILE_SAMPLES + x];
+					}
+				}
+			});
+
+			// Eikonal updates only read face neighbours, and face neighbours differ
+			// in color, so tiles of one color sweep in parallel. Tiles stay active
+			// while they or a neighbour still change, and tiles with nothing to
+			// solve never are.
+			const float tolerance = settings.tolerance * inoutGrid->voxelSize;
+			std::vector<uint8_t> active(regionCount);
+			std::vector<uint8_t> moved(regionCount, 0);
+			std::vector<uint32_t> batch;
+
+			for (uint32_t slot = 0; slot < regionCount; ++slot)
+				active[slot] = bandCounts[slot] > 0;
+
+			for (uint32_t round = 0; round < settings.maxRounds; ++round)
+			{
+				bool anyActive = false;
+
+				std::fill(moved.begin(), moved.end(), 0);
+
+				for (uint32_t color = 0; color < 2; ++color)
+				{
+					batch.clear();
+
+					for (uint32_t slot = 0; slot < regionCount; ++slot)
+					{
+						const glm::uvec3 tile = TileAt(region.tileDims, region.tiles[slot]);
+
+						if (active[slot] && ((tile.x + tile.y + tile.z) & 1) == color)
+							batch.push_back(slot);
+					}
+
+					ForEachTile(optPool, (uint32_t)batch.size(), [&](uint32_t item)
+					{
+						const uint32_t slot = batch[item];
+
+						moved[slot] = SweepTile(TileAt(region.tileDims, region.tiles[slot]), fixed.data() + (size_t)slot * SAMPLES_PER_TILE, inoutGrid) > tolerance;
+					});
+
+					stats.tileSweeps += batch.size();
+				}
+
+				for (uint32_t slot = 0; slot < regionCount; ++slot)
+				{
+					if (!bandCounts[slot])
+						continue;
+
+					active[slot] = moved[slot];
+
+					for (unsigned face = 0; face < 6 && !active[slot]; ++face)
+					{
+						const uint32_t neighbour = region.neighbours[slot * 6 + face];
+
+						active[slot] = neighbour != ~0u && moved[neighbour];
+					}
+
+					anyActive |= active[slot] != 0;
+				}
+
+				stats.rounds = round + 1;
+
+				if (!anyActive)
+					break;
+			}
+
+			// Band samples cut off from every finite neighbour, which a region
+			// smaller than the edit can leave, get the band's edge.
+			std::vector<uint8_t> changed(regionCount, 0);
+
+			ForEachTile(optPool, regionCount, [&](uint32_t slot)
+			{
+				const glm::uvec3 first = TileAt(region.tileDims, region.tiles[slot]) * TILE_SAMPLES;
+				const glm::uvec3 count = glm::min(inoutGrid->dims - first, glm::uvec3(TILE_SAMPLES));
+
+				for (uint32_t z = 0; z < count.z; ++z)
+				{
+					for (uint32_t y = 0; y < count.y; ++y)
+					{
+						float * const row = inoutGrid->values.data() + volume::Index(*inoutGrid, first.x, first.y + y, first.z + z);
+						const float * const originalRow = original.data() + (size_t)slot * SAMPLES_PER_TILE + (z * TILE_SAMPLES + y) * TILE_SAMPLES;
+
+						for (uint32_t x = 0; x < count.x; ++x)
+						{
+							if (!std::isfinite(row[x]))
+								row[x] = std::copysign(band, row[x]);
+
+							changed[slot] |= row[x] != originalRow[x];
+						}
+					}
+				}
+			});
+
+			// Margin tiles that changed join the dirty set.
+			std::vector<uint64_t> dirtyTiles;
+
+			for (const glm::uvec3 &tile : inoutDirty->tiles)
+				dirtyTiles.push_back(TileIndex(region.tileDims, tile));
+
+			std::sort(dirtyTiles.begin(), dirtyTiles.end());
+
+			for (uint32_t slot = 0; slot < regionCount; ++slot)
+			{
+				if (!changed[slot])
+					continue;
+
+				++stats.tilesChanged;
+
+				if (std::binary_search(dirtyTiles.begin(), dirtyTiles.end(), region.tiles[slot]))
+					continue;
+
+				const glm::uvec3 tile = TileAt(region.tileDims, region.tiles[slot]);
+				glm::uvec3 sampleMin, sampleMax;
+
+				sculpt::TileSamples(*inoutGrid, tile, &sampleMin, &sampleMax);
+				inoutDirty->sampleMin = inoutDirty->tiles.empty() ? sampleMin : glm::min(inoutDirty->sampleMin, sampleMin);
+				inoutDirty->sampleMax = inoutDirty->tiles.empty() ? sampleMax : glm::max(inoutDirty->sampleMax, sampleMax);
+				inoutDirty->tiles.push_back(tile);
+			}
+
+			stats.seconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+
+			if (outoptStats)
+			{
+				stats.tiles = regionCount;
+
+				for (const uint32_t interfaceCount : interfaceCounts)
+					stats.interfaceSamples += interfaceCount;
+
+				MeasureRegionError(*inoutGrid, region, settings.bandWidth, &stats.after);
+				*outoptStats = stats;
+			}
+		}
+
+		void MeasureError(const volume::Grid &grid, const std::vector<glm::uvec3> &tiles, float bandWidth, Error *outError)
+		{
+			const float band = bandWidth * grid.voxelSize;
+			const size_t strides[3] = { 1, grid.dims.x, (size_t)grid.dims.x * grid.dims.y };
+			double sum = 0.0;
+
+			*outError = Error();
+
+			for (const glm::uvec3 &tile : tiles)
+			{
+				const glm::uvec3 first = tile * TILE_SAMPLES;
+				const glm::uvec3 count = glm::min(grid.dims - first, glm::uvec3(TILE_SAMPLES));
+
+				for (uint32_t z = first.z; z < first.z + count.z; ++z)
+				{
+					for (uint32_t y = first.y; y < first.y + count.y; ++y)
+					{
+						for (uint32_t x = first.x; x < first.x + count.x; ++x)
+						{
+							const uint32_t coords[3] = { x, y, z };
+							const size_t index = volume::Index(grid, x, y, z);
+							glm::vec3 gradient;
+							bool inside = std::abs(grid.values[index]) < band;
+
+							for (unsigned axis = 0; axis < 3 && inside; ++axis)
+							{
+								inside = coords[axis] > 0 && coords[axis] + 1 < grid.dims[axis];
+
+								if (inside)
+									gradient[axis] = (grid.values[index + strides[axis]] - grid.values[index - strides[axis]]) / (2.0f * grid.voxelSize);
+							}
+
+							if (!inside)
+								continue;
+
+							const float error = std::abs(glm::length(gradient) - 1.0f);
+
+							sum += error;
+							outError->max = std::max(outError->max, error);
+							++outError->samples;
+						}
+					}
+				}
+			}
+
+			outError->mean = outError->samples ? sum / (double)outError->samples : 0.0;
+		}
+	}
+}
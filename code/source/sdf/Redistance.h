@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Sculpt.h"
+
+// Level set reinitialization after edits. Blends, smoothing and flattening
+// leave samples that are no longer distances, with |grad d| drifting from 1,
+// which slows sphere tracing and skews offsets. This restores distances near
+// the surface in the tiles an edit touched, without re-baking: samples
+// straddling the surface get their distance from where it crosses between
+// them, and the rest of the narrow band is solved from those by fast
+// sweeping, tile by tile in red-black order so tiles of a color run in
+// parallel.
+namespace sdf
+{
+	namespace redistance
+	{
+		struct Settings
+		{
+			float bandWidth = 6.0f;     // in voxels. Samples further from the surface keep their value.
+			uint32_t margin = 0;        // tiles around the given ones redistanced as well, for edits that smear past what they report
+			uint32_t maxRounds = 64;    // red and black passes over the tiles still changing
+			float tolerance = 1e-3f;    // in voxels. Tiles whose samples moved less stop being swept.
+		};
+
+		// | |grad d| - 1 | by central differences, over samples in the band.
+		struct Error
+		{
+			double mean = 0.0;
+			float max = 0.0f;
+			uint64_t samples = 0;
+		};
+
+		struct Stats
+		{
+			uint32_t tiles = 0;              // with the margin
+			uint32_t tilesChanged = 0;
+			uint32_t rounds = 0;
+			uint64_t tileSweeps = 0;         // tiles swept in all 8 directions, over every round
+			uint64_t interfaceSamples = 0;   // next to the surface, and fixed while sweeping
+			Error before;
+			Error after;
+			double seconds = 0.0;            // not counting the error measurements
+		};
+
+		// Redistances the band in and around the dirty set's tiles, which is
+		// usually what sculpt::Apply just returned, and adds the tiles around them
+		// that changed to it. A null pool runs on the calling thread. The errors
+		// are only measured when stats are asked for.
+		void Redistance(jobs::Pool *optPool, const Settings &settings, volume::Grid *inoutGrid, sculpt::DirtySet *inoutDirty, Stats *outoptStats = nullptr);
+
+		void MeasureError(const volume::Grid &grid, const std::vector<glm::uvec3> &tiles, float bandWidth, Error *outError);
+	}
+}
@@ -0,0 +1,617 @@
+#include "Scene.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+namespace sdf
+{
+	namespace scene
+	{
+		namespace
+		{
+			Node MakeNode(NodeType type, uint32_t primitiveId)
+			{
+				Node node = {};
+				node.type = type;
+				node.primitiveId = primitiveId;
+				node.firstChild = 0;
+				node.childCount = 0;
+
+				return node;
+			}
+
+			uint32_t PushNode(Scene *inoutScene, const Node &node)
+			{
+				inoutScene->nodes.push_back(node);
+				inoutScene->root = (uint32_t)inoutScene->nodes.size() - 1;
+
+				return inoutScene->root;
+			}
+
+			Bounds Unbounded()
+			{
+				const float inf = std::numeric_limits<float>::infinity();
+
+				return Bounds{ glm::vec3(-inf), glm::vec3(inf) };
+			}
+
+			bool IsFinite(const Bounds &bounds)
+			{
+				for (unsigned axis = 0; axis < 3; ++axis)
+					if (!std::isfinite(bounds.min[axis]) || !std::isfinite(bounds.max[axis]))
+						return false;
+
+				return true;
+			}
+
+			Bounds PrimitiveBounds(const Node &node)
+			{
+				const float * const params = node.params;
+				glm::vec3 extent;
+
+				switch (node.type)
+				{
+					case NodeType::SPHERE:   extent = glm::vec3(params[0]); break;
+					case NodeType::BOX:      extent = glm::vec3(params[0], params[1], params[2]) + params[3]; break;
+					case NodeType::TORUS:    extent = glm::vec3(params[0] + params[1], params[1], params[0] + params[1]); break;
+					case NodeType::CAPSULE:  extent = glm::vec3(params[1], params[0] + params[1], params[1]); break;
+					case NodeType::CYLINDER: extent = glm::vec3(params[1], params[0], params[1]); break;
+					case NodeType::VOLUME:   return Bounds{ glm::vec3(params[1], params[2], params[3]), glm::vec3(params[4], params[5], params[6]) };
+					default:                 return Unbounded();
+				}
+
+				return Bounds{ -extent, extent };
+			}
+
+			// Local bounds taken back out to the transform's parent space.
+			Bounds TransformBounds(const Node &node, const Bounds &local)
+			{
+				if (!IsFinite(local))
+					return Unbounded();
+
+				const float * const m = node.params;
+				glm::mat3 worldToLocal;
+				glm::vec3 offset;
+
+				for (unsigned row = 0; row < 3; ++row)
+				{
+					for (unsigned col = 0; col < 3; ++col)
+						worldToLocal[col][row] = m[row * 4 + col];
+
+					offset[row] = m[row * 4 + 3];
+				}
+
+				const glm::mat3 localToWorld = glm::inverse(worldToLocal);
+				const glm::vec3 center = localToWorld * ((local.min + local.max) * 0.5f - offset);
+				const glm::vec3 halfSize = (local.max - local.min) * 0.5f;
+				glm::vec3 extent(0.0f);
+
+				for (unsigned col = 0; col < 3; ++col)
+					extent += glm::abs(localToWorld[col]) * halfSize[col];
+
+				return Bounds{ center - extent, center + extent };
+			}
+
+			float SmoothUnion(float a, float b, float k)
+			{
+				const float h = glm::clamp(0.5f + 0.5f * (b - a) / k, 0.0f, 1.0f);
+
+				return glm::mix(b, a, h) - k * h * (1.0f - h);
+			}
+
+			float SmoothSubtract(float a, float b, float k)
+			{
+				const float h = glm::clamp(0.5f - 0.5f * (a + b) / k, 0.0f, 1.0f);
+
+				return glm::mix(a, -b, h) + k * h * (1.0f - h);
+			}
+		}
+
+		bool IsPrimitive(NodeType type)
+		{
+			return type < NodeType::TRANSFORM;
+		}
+
+		const char* NodeTypeName(NodeType type)
+		{
+			switch (type)
+			{
+				case NodeType::SPHERE:          return "sphere";
+				case NodeType::BOX:             return "box";
+				case NodeType::TORUS:           return "torus";
+				case NodeType::CAPSULE:         return "capsule";
+				case NodeType::CYLINDER:        return "cylinder";
+				case NodeType::PLANE:           return "plane";
+				case NodeType::VOLUME:          return "volume";
+				case NodeType::TRANSFORM:       return "transform";
+				case NodeType::INSTANCE:        return "instance";
+				case NodeType::REPEAT:          return "repeat";
+				case NodeType::UNION:           return "union";
+				case NodeType::INTERSECT:       return "intersect";
+				case NodeType::SUBTRACT:        return "subtract";
+				case NodeType::SMOOTH_UNION:    return "smooth_union";
+				case NodeType::SMOOTH_SUBTRACT: return "smooth_subtract";
+				case NodeType::COUNT:           break;
+			}
+
+			return "<unknown>";
+		}
+
+		uint32_t AddSphere(Scene *inoutScene, float radius, uint32_t primitiveId)
+		{
+			Node node = MakeNode(NodeType::SPHERE, primitiveId);
+			node.params[0] = radius;
+
+			return PushNode(inoutScene, node);
+		}
+
+		uint32_t AddBox(Scene *inoutScene, const glm::vec3 &halfExtents, float rounding, uint32_t primitiveId)
+		{
+			Node node = MakeNode(NodeType::BOX, primitiveId);
+			node.params[0] = halfExtents.x;
+			node.params[1] = halfExtents.y;
+			node.params[2] = halfExtents.z;
+			node.params[3] = rounding;
+
+			return PushNode(inoutScene, node);
+		}
+
+		uint32_t AddTorus(Scene *inoutScene, float majorRadius, float minorRadius, uint32_t primitiveId)
+		{
+			Node node = MakeNode(NodeType::TORUS, primitiveId);
+			node.params[0] = majorRadius;
+			node.params[1] = minorRadius;
+
+			return PushNode(inoutScene, node);
+		}
+
+		uint32_t AddCapsule(Scene *inoutScene, float halfHeight, float radius, uint32_t primitiveId)
+		{
+			Node node = MakeNode(NodeType::CAPSULE, primitiveId);
+			node.params[0] = halfHeight;
+			node.params[1] = radius;
+
+			return PushNode(inoutScene, node);
+		}
+
+		uint32_t AddCylinder(Scene *inoutScene, float halfHeight, float radius, uint32_t primitiveId)
+		{
+			Node node = MakeNode(NodeType::CYLINDER, primitiveId);
+			node.params[0] = halfHeight;
+			node.params[1] = radius;
+
+			return PushNode(inoutScene, node);
+		}
+
+		uint32_t AddPlane(Scene *inoutScene, const glm::vec3 &normal, float offset, uint32_t primitiveId)
+		{
+			const glm::vec3 n = glm::normalize(normal);
+			Node node = MakeNode(NodeType::PLANE, primitiveId);
+			node.params[0] = n.x;
+			node.params[1] = n.y;
+			node.params[2] = n.z;
+			node.params[3] = offset;
+
+			return PushNode(inoutScene, node);
+		}
+
+		uint32_t AddVolume(Scene *inoutScene, const std::shared_ptr<const volume::Grid> &grid, uint32_t primitiveId)
+		{
+			const size_t volumeIndex = std::find(inoutScene->volumes.begin(), inoutScene->volumes.end(), grid) - inoutScene->volumes.begin();
+			const glm::vec3 lo = volume::MinCorner(*grid);
+			const glm::vec3 hi = volume::MaxCorner(*grid);
+			Node node = MakeNode(NodeType::VOLUME, primitiveId);
+
+			if (volumeIndex == inoutScene->volumes.size())
+				inoutScene->volumes.push_back(grid);
+
+			node.params[0] = (float)volumeIndex;
+			node.params[1] = lo.x;
+			node.params[2] = lo.y;
+			node.params[3] = lo.z;
+			node.params[4] = hi.x;
+			node.params[5] = hi.y;
+			node.params[6] = hi.z;
+
+			return PushNode(inoutScene, node);
+		}
+
+		uint32_t AddTransform(Scene *inoutScene, uint32_t child, const glm::mat4 &localToWorld)
+		{
+			const glm::mat4 worldToLocal = glm::inverse(localToWorld);
+			const float scale = glm::length(glm::vec3(localToWorld[0].x, localToWorld[0].y, localToWorld[0].z));
+			Node node = MakeNode(NodeType::TRANSFORM, INVALID_NODE);
+
+			assert(child < inoutScene->nodes.size());
+
+			for (unsigned row = 0; row < 3; ++row)
+				for (unsigned col = 0; col < 4; ++col)
+					node.params[row * 4 + col] = worldToLocal[col][row];
+
+			node.params[12] = scale;
+			node.firstChild = (uint32_t)inoutScene->children.size();
+			node.childCount = 1;
+			inoutScene->children.push_back(child);
+
+			return PushNode(inoutScene, node);
+		}
+
+		uint32_t AddTranslate(Scene *inoutScene, uint32_t child, const glm::vec3 &offset)
+		{
+			glm::mat4 localToWorld(1.0f);
+			localToWorld[3] = glm::vec4(offset, 1.0f);
+
+			return AddTransform(inoutScene, child, localToWorld);
+		}
+
+		uint32_t AddInstances(Scene *inoutScene, uint32_t child, const glm::mat4 *localToWorld, size_t count)
+		{
+			std::shared_ptr<instance::Table> table = std::make_shared<instance::Table>();
+			std::vector<Bounds> bounds;
+			Node node = MakeNode(NodeType::INSTANCE, INVALID_NODE);
+
+			assert(child < inoutScene->nodes.size());
+
+			ComputeBounds(*inoutScene, &bounds);
+			instance::Build(localToWorld, count, bounds[child].min, bounds[child].max, table.get());
+
+			node.params[0] = (float)inoutScene->instances.size();
+			node.firstChild = (uint32_t)inoutScene->children.size();
+			node.childCount = 1;
+			inoutScene->children.push_back(child);
+			inoutScene->instances.push_back(std::move(table));
+
+			return PushNode(inoutScene, node);
+		}
+
+		uint32_t AddRepeat(Scene *inoutScene, uint32_t child, const glm::vec3 &period, const glm::uvec3 &limit)
+		{
+			Node node = MakeNode(NodeType::REPEAT, INVALID_NODE);
+
+			assert(child < inoutScene->nodes.size());
+
+			for (unsigned axis = 0; axis < 3; ++axis)
+			{
+				node.params[axis] = period[axis];
+				node.params[3 + axis] = period[axis] != 0.0f ? (float)limit[axis] : 0.0f;
+				node.params[6 + axis] = period[axis] != 0.0f ? 1.0f / period[axis] : 0.0f;
+			}
+
+			node.firstChild = (uint32_t)inoutScene->children.size();
+			node.childCount = 1;
+			inoutScene->children.push_back(child);
+
+			return PushNode(inoutScene, node);
+		}
+
+		uint32_t AddOperation(Scene *inoutScene, NodeType type, const uint32_t *children, uint32_t childCount, float blendRadius)
+		{
+			Node node = MakeNode(type, INVALID_NODE);
+
+			assert(type >= NodeType::UNION && type < NodeType::COUNT);
+			assert(childCount > 0);
+
+			node.params[0] = blendRadius;
+			node.firstChild = (uint32_t)inoutScene->children.size();
+			node.childCount = childCount;
+
+			for (uint32_t childIndex = 0; childIndex < childCount; ++childIndex)
+			{
+				assert(children[childIndex] < inoutScene->nodes.size());
+				inoutScene->children.push_back(children[childIndex]);
+			}
+
+			return PushNode(inoutScene, node);
+		}
+
+		uint32_t AddUnion(Scene *inoutScene, const uint32_t *children, uint32_t childCount)
+		{
+			return AddOperation(inoutScene, NodeType::UNION, children, childCount);
+		}
+
+		uint32_t AddUnion(Scene *inoutScene, uint32_t a, uint32_t b)
+		{
+			const uint32_t children[] = { a, b };
+			return AddOperation(inoutScene, NodeType::UNION, children, 2);
+		}
+
+		uint32_t AddIntersect(Scene *inoutScene, uint32_t a, uint32_t b)
+		{
+			const uint32_t children[] = { a, b };
+			return AddOperation(inoutScene, NodeType::INTERSECT, children, 2);
+		}
+
+		uint32_t AddSubtract(Scene *inoutScene, uint32_t a, uint32_t b)
+		{
+			const uint32_t children[] = { a, b };
+			return AddOperation(inoutScene, NodeType::SUBTRACT, children, 2);
+		}
+
+		uint32_t AddSmoothUnion(Scene *inoutScene, uint32_t a, uint32_t b, float blendRadius)
+		{
+			const uint32_t children[] = { a, b };
+			return AddOperation(inoutScene, NodeType::SMOOTH_UNION, children, 2, blendRadius);
+		}
+
+		uint32_t AddSmoothSubtract(Scene *inoutScene, uint32_t a, uint32_t b, float blendRadius)
+		{
+			const uint32_t children[] = { a, b };
+			return AddOperation(inoutScene, NodeType::SMOOTH_SUBTRACT, children, 2, blendRadius);
+		}
+
+		float EvaluatePrimitive(const Scene &scene, const Node &node, const glm::vec3 &p)
+		{
+			const float * const params = node.params;
+
+			switch (node.type)
+			{
+				case NodeType::SPHERE:
+					return glm::length(p) - params[0];
+				case NodeType::BOX:
+				{
+					const glm::vec3 q = glm::abs(p) - glm::vec3(params[0], params[1], params[2]);
+
+					return glm::length(glm::max(q, 0.0f)) + std::min(std::max(q.x, std::max(q.y, q.z)), 0.0f) - params[3];
+				}
+				case NodeType::TORUS:
+				{
+					const float ring = glm::length(glm::vec2(p.x, p.z)) - params[0];
+
+					return glm::length(glm::vec2(ring, p.y)) - params[1];
+				}
+				case NodeType::CAPSULE:
+				{
+					const float y = p.y - glm::clamp(p.y, -params[0], params[0]);
+
+					return glm::length(glm::vec3(p.x, y, p.z)) - params[1];
+				}
+				case NodeType::CYLINDER:
+				{
+					const glm::vec2 d = glm::abs(glm::vec2(glm::length(glm::vec2(p.x, p.z)), p.y)) - glm::vec2(params[1], params[0]);
+
+					return std::min(std::max(d.x, d.y), 0.0f) + glm::length(glm::max(d, 0.0f));
+				}
+				case NodeType::PLANE:
+					return p.x * params[0] + p.y * params[1] + p.z * params[2] + params[3];
+				case NodeType::VOLUME:
+					return volume::Sample(*scene.volumes[(size_t)params[0]], p);
+				default:
+					assert(0);
+			}
+
+			return 0.0f;
+		}
+
+		float EvaluateDistance(const Scene &scene, uint32_t nodeIndex, const glm::vec3 &pos, uint32_t *outoptPrimitiveId)
+		{
+			const Node &node = scene.nodes[nodeIndex];
+			const uint32_t * const children = scene.children.data() + node.firstChild;
+
+			if (IsPrimitive(node.type))
+			{
+				if (outoptPrimitiveId)
+					*outoptPrimitiveId = node.primitiveId;
+
+				return EvaluatePrimitive(scene, node, pos);
+			}
+
+			if (node.type == NodeType::TRANSFORM)
+			{
+				const float * const m = node.params;
+				const glm::vec3 local(
+					m[0] * pos.x + m[1] * pos.y + m[2] * pos.z + m[3],
+					m[4] * pos.x + m[5] * pos.y + m[6] * pos.z + m[7],
+					m[8] * pos.x + m[9] * pos.y + m[10] * pos.z + m[11]
+				);
+
+				return EvaluateDistance(scene, children[0], local, outoptPrimitiveId) * m[12];
+			}
+
+			// Every placement, the way the union it stands for would be evaluated.
+			if (node.type == NodeType::INSTANCE)
+			{
+				const instance::Table &table = *scene.instances[(size_t)node.params[0]];
+				float dist = INFINITY;
+				uint32_t id = INVALID_NODE;
+
+				for (const instance::Placement &placement : table.placements)
+				{
+					uint32_t childId = INVALID_NODE;
+					const float childDist = EvaluateDistance(scene, children[0], instance::ToLocal(placement, pos), &childId) * placement.params[12];
+
+					if (childDist < dist)
+					{
+						dist = childDist;
+						id = childId;
+					}
+				}
+
+				if (outoptPrimitiveId)
+					*outoptPrimitiveId = id;
+
+				return dist;
+			}
+
+			if (node.type == NodeType::REPEAT)
+			{
+				const float * const params = node.params;
+				glm::vec3 local;
+
+				for (unsigned axis = 0; axis < 3; ++axis)
+					local[axis] = pos[axis] - params[axis] * glm::clamp(std::floor(pos[axis] * params[6 + axis] + 0.5f), -params[3 + axis], params[3 + axis]);
+
+				return EvaluateDistance(scene, children[0], local, outoptPrimitiveId);
+			}
+
+			uint32_t id = INVALID_NODE;
+			float dist = EvaluateDistance(scene, children[0], pos, &id);
+
+			for (uint32_t childIndex = 1; childIndex < node.childCount; ++childIndex)
+			{
+				uint32_t childId = INVALID_NODE;
+				const float childDist = EvaluateDistance(scene, children[childIndex], pos, &childId);
+
+				switch (node.type)
+				{
+					case NodeType::UNION:
+						if (childDist < dist)
+						{
+							dist = childDist;
+							id = childId;
+						}
+					break;
+					case NodeType::INTERSECT:
+						if (childDist > dist)
+						{
+							dist = childDist;
+							id = childId;
+						}
+					break;
+					case NodeType::SUBTRACT:
+						if (-childDist > dist)
+						{
+							dist = -childDist;
+							id = childId;
+						}
+					break;
+					case NodeType::SMOOTH_UNION:
+						if (childDist < dist)
+							id = childId;
+
+						dist = SmoothUnion(dist, childDist, node.params[0]);
+					break;
+					case NodeType::SMOOTH_SUBTRACT:
+						if (-childDist > dist)
+							id = childId;
+
+						dist = SmoothSubtract(dist, childDist, node.params[0]);
+					break;
+					default:
+						assert(0);
+				}
+			}
+
+			if (outoptPrimitiveId)
+				*outoptPrimitiveId = id;
+
+			return dist;
+		}
+
+		float EvaluateDistance(const Scene &scene, const glm::vec3 &pos, uint32_t *outoptPrimitiveId)
+		{
+			assert(scene.root < scene.nodes.size());
+
+			return EvaluateDistance(scene, scene.root, pos, outoptPrimitiveId);
+		}
+
+		size_t CountReachableNodes(const Scene &scene)
+		{
+			std::vector<bool> visited(scene.nodes.size(), false);
+			std::vector<uint32_t> stack;
+			size_t count = 0;
+
+			if (scene.root < scene.nodes.size())
+				stack.push_back(scene.root);
+
+			while (!stack.empty())
+			{
+				const uint32_t nodeIndex = stack.back();
+				stack.pop_back();
+
+				if (visited[nodeIndex])
+					continue;
+
+				visited[nodeIndex] = true;
+				++count;
+
+				const Node &node = scene.nodes[nodeIndex];
+				for (uint32_t childIndex = 0; childIndex < node.childCount; ++childIndex)
+					stack.push_back(scene.children[node.firstChild + childIndex]);
+			}
+
+			return count;
+		}
+
+		void ComputeBounds(const Scene &scene, std::vector<Bounds> *inoutBounds)
+		{
+			std::vector<Bounds> &bounds = *inoutBounds;
+
+			for (size_t nodeIndex = bounds.size(); nodeIndex < scene.nodes.size(); ++nodeIndex)
+			{
+				const Node &node = scene.nodes[nodeIndex];
+				const uint32_t * const children = scene.children.data() + node.firstChild;
+
+				if (IsPrimitive(node.type))
+				{
+					bounds.push_back(PrimitiveBounds(node));
+					continue;
+				}
+
+				if (node.type == NodeType::TRANSFORM)
+				{
+					bounds.push_back(TransformBounds(node, bounds[children[0]]));
+					continue;
+				}
+
+				if (node.type == NodeType::INSTANCE)
+				{
+					const instance::Table &table = *scene.instances[(size_t)node.params[0]];
+
+					bounds.push_back(Bounds{ table.min, table.max });
+					continue;
+				}
+
+				if (node.type == NodeType::REPEAT)
+				{
+					const glm::vec3 reach = glm::vec3(node.params[0], node.params[1], node.params[2]) * glm::vec3(node.params[3], node.params[4], node.params[5]);
+					const Bounds &child = bounds[children[0]];
+
+					bounds.push_back(Bounds{ child.min - glm::abs(reach), child.max + glm::abs(reach) });
+					continue;
+				}
+
+				Bounds merged = bounds[children[0]];
+
+				for (uint32_t childIndex = 1; childIndex < node.childCount; ++childIndex)
+				{
+					const Bounds &child = bounds[children[childIndex]];
+
+					switch (node.type)
+					{
+						case NodeType::UNION:
+						case NodeType::SMOOTH_UNION:
+							merged.min = glm::min(merged.min, child.min);
+							merged.max = glm::max(merged.max, child.max);
+						break;
+						case NodeType::INTERSECT:
+							merged.min = glm::max(merged.min, child.min);
+							merged.max = glm::min(merged.max, child.max);
+						break;
+						default:
+							// Subtraction only ever removes from the first child.
+						break;
+					}
+				}
+
+				// A smooth union can bulge out past both children, but never by more than the blend radius.
+				if (node.type == NodeType::SMOOTH_UNION)
+				{
+					merged.min -= node.params[0];
+					merged.max += node.params[0];
+				}
+
+				bounds.push_back(merged);
+			}
+		}
+
+		bool Overlaps(const Bounds &a, const Bounds &b, float margin)
+		{
+			for (unsigned axis = 0; axis < 3; ++axis)
+				if (a.min[axis] > b.max[axis] + margin || b.min[axis] > a.max[axis] + margin)
+					return false;
+
+			return true;
+		}
+	}
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "Instance.h"
+#include "Memory.h"
+#include "Volume.h"
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+namespace sdf
+{
+	namespace scene
+	{
+		static const uint32_t INVALID_NODE = ~0u;
+
+		enum class NodeType : unsigned char
+		{
+			// Primitives, evaluated in their local space
+			SPHERE,          // params: radius
+			BOX,             // params: half extents xyz, edge rounding
+			TORUS,           // params: major radius, minor radius. Lies in the XZ plane.
+			CAPSULE,         // params: half height, radius. Aligned to Y.
+			CYLINDER,        // params: half height, radius. Aligned to Y.
+			PLANE,           // params: normal xyz, offset
+			VOLUME,          // params: index into Scene::volumes, grid bounds min xyz, max xyz
+
+			// Unary
+			TRANSFORM,       // params: 3x4 world to local rows, local to world distance scale
+			INSTANCE,        // params: index into Scene::instances. The child once per placement, unioned.
+			REPEAT,          // params: period xyz, limit xyz, 1 / period xyz. Copies of the child at period * i for every -limit <= i <= limit.
+
+			// N-ary booleans, applied left to right over the children
+			UNION,
+			INTERSECT,
+			SUBTRACT,        // first child minus every other child
+			SMOOTH_UNION,    // params: blend radius
+			SMOOTH_SUBTRACT, // params: blend radius
+
+			COUNT
+		};
+
+		struct Bounds
+		{
+			glm::vec3 min;
+			glm::vec3 max;
+		};
+
+		struct Node
+		{
+			NodeType type;
+			uint32_t primitiveId; // Primitives only. Reported back by hits and queries.
+			uint32_t firstChild;  // Index into Scene::children
+			uint32_t childCount;
+			float params[13];
+		};
+
+		// A CSG expression stored as a flat DAG. Nodes reference their children by
+		// index, so a sub-tree may be shared by any number of parents.
+		struct Scene
+		{
+			memory::Vector<Node, memory::Tag::SCENE> nodes;
+			memory::Vector<uint32_t, memory::Tag::SCENE> children;
+			std::vector<std::shared_ptr<const volume::Grid>> volumes; // sampled fields, shared with programs compiled from the scene
+			std::vector<std::shared_ptr<const instance::Table>> instances; // placements of INSTANCE nodes, shared likewise
+			uint32_t root = INVALID_NODE;
+		};
+
+		bool IsPrimitive(NodeType type);
+		const char* NodeTypeName(NodeType type);
+
+		uint32_t AddSphere(Scene *inoutScene, float radius, uint32_t primitiveId);
+		uint32_t AddBox(Scene *inoutScene, const glm::vec3 &halfExtents, float rounding, uint32_t primitiveId);
+		uint32_t AddTorus(Scene *inoutScene, float majorRadius, float minorRadius, uint32_t primitiveId);
+		uint32_t AddCapsule(Scene *inoutScene, float halfHeight, float radius, uint32_t primitiveId);
+		uint32_t AddCylinder(Scene *inoutScene, float halfHeight, float radius, uint32_t primitiveId);
+		uint32_t AddPlane(Scene *inoutScene, const glm::vec3 &normal, float offset, uint32_t primitiveId);
+		// Adding the same grid again reuses its Scene::volumes entry.
+		uint32_t AddVolume(Scene *inoutScene, const std::shared_ptr<const volume::Grid> &grid, uint32_t primitiveId);
+
+		// localToWorld must be rigid with an optional uniform scale, or distances stop being Lipschitz bounded.
+		uint32_t AddTransform(Scene *inoutScene, uint32_t child, const glm::mat4 &localToWorld);
+		uint32_t AddTranslate(Scene *inoutScene, uint32_t child, const glm::vec3 &offset);
+
+		// The union of child placed at each of localToWorld, as AddTransform would,
+		// without a node per copy.
+		uint32_t AddInstances(Scene *inoutScene, uint32_t child, const glm::mat4 *localToWorld, size_t count);
+		// Finite domain repetition, the special case of a regular lattice of
+		// placements that needs no table at all. A zero period leaves that axis
+		// alone. Only exact while the child stays within half a period of its origin.
+		uint32_t AddRepeat(Scene *inoutScene, uint32_t child, const glm::vec3 &period, const glm::uvec3 &limit);
+
+		uint32_t AddOperation(Scene *inoutScene, NodeType type, const uint32_t *children, uint32_t childCount, float blendRadius = 0.0f);
+		uint32_t AddUnion(Scene *inoutScene, const uint32_t *children, uint32_t childCount);
+		uint32_t AddUnion(Scene *inoutScene, uint32_t a, uint32_t b);
+		uint32_t AddIntersect(Scene *inoutScene, uint32_t a, uint32_t b);
+		uint32_t AddSubtract(Scene *inoutScene, uint32_t a, uint32_t b);
+		uint32_t AddSmoothUnion(Scene *inoutScene, uint32_t a, uint32_t b, float blendRadius);
+		uint32_t AddSmoothSubtract(Scene *inoutScene, uint32_t a, uint32_t b, float blendRadius);
+
+		float EvaluatePrimitive(const Scene &scene, const Node &node, const glm::vec3 &localPos);
+
+		// Reference scalar evaluation straight off the DAG. Slow, but the ground truth
+		// every other evaluation path is compared against.
+		float EvaluateDistance(const Scene &scene, uint32_t node, const glm::vec3 &pos, uint32_t *outoptPrimitiveId);
+		float EvaluateDistance(const Scene &scene, const glm::vec3 &pos, uint32_t *outoptPrimitiveId = nullptr);
+
+		size_t CountReachableNodes(const Scene &scene);
+
+		// Conservative bounds of each node's surface, in the space the node is
+		// evaluated in (its parent's local space, world space for the root). Planes
+		// are unbounded. Nodes only reference earlier nodes, so entries already in
+		// inoutBounds are kept and only nodes appended since are computed.
+		void ComputeBounds(const Scene &scene, std::vector<Bounds> *inoutBounds);
+		bool Overlaps(const Bounds &a, const Bounds &b, float margin = 0.0f);
+	}
+}
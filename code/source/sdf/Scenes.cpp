@@ -0,0 +1,338 @@
+#include "Scenes.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+
+namespace sdf
+{
+	namespace scenes
+	{
+		namespace
+		{
+			uint32_t AddGround(scene::Scene *inoutScene, uint32_t primitiveId)
+			{
+				const uint32_t ground = scene::AddBox(inoutScene, glm::vec3(4.0f, 0.1f, 4.0f), 0.0f, primitiveId);
+
+				return scene::AddTranslate(inoutScene, ground, glm::vec3(0.0f, -1.1f, 0.0f));
+			}
+
+			// One part as an editor would leave it, roughly a unit in size.
+			uint32_t AddClutterPart(scene::Scene *inoutScene)
+			{
+				const glm::mat4 identity(1.0f);
+				const uint32_t body = scene::AddTransform(inoutScene, scene::AddBox(inoutScene, glm::vec3(0.8f, 0.5f, 0.8f), 0.05f, 1), identity);
+				const uint32_t hole = scene::AddTranslate(inoutScene, scene::AddSphere(inoutScene, 0.6f, 2), glm::vec3(0.0f, 0.5f, 0.0f));
+				const uint32_t strayA = scene::AddTranslate(inoutScene, scene::AddCylinder(inoutScene, 0.3f, 0.2f, 3), glm::vec3(3.0f, 0.0f, 0.0f));
+				const uint32_t strayB = scene::AddTranslate(inoutScene, scene::AddCylinder(inoutScene, 0.3f, 0.2f, 3), glm::vec3(0.0f, 0.0f, -3.0f));
+
+				// Cutters left behind after the part they were drilling moved away.
+				uint32_t carved = scene::AddSubtract(inoutScene, body, hole);
+				carved = scene::AddSubtract(inoutScene, carved, strayA);
+				carved = scene::AddSubtract(inoutScene, carved, strayB);
+
+				// Scaled, then spun about its own axis, then moved. A gizmo edit each.
+				const glm::mat4 knobSpin = glm::rotate(identity, glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+				uint32_t knob = scene::AddTransform(inoutScene, scene::AddTorus(inoutScene, 0.5f, 0.1f, 4), glm::scale(identity, glm::vec3(0.8f)));
+				knob = scene::AddTransform(inoutScene, knob, knobSpin);
+				knob = scene::AddTranslate(inoutScene, knob, glm::vec3(0.0f, 0.6f, 0.0f));
+
+				// Pasted twice into the same spot.
+				uint32_t knobCopy = scene::AddTransform(inoutScene, scene::AddTorus(inoutScene, 0.5f, 0.1f, 4), glm::scale(identity, glm::vec3(0.8f)));
+				knobCopy = scene::AddTransform(inoutScene, knobCopy, knobSpin);
+				knobCopy = scene::AddTranslate(inoutScene, knobCopy, glm::vec3(0.0f, 0.6f, 0.0f));
+
+				const glm::mat4 handleXform = glm::rotate(glm::translate(identity, glm::vec3(0.9f, 0.0f, 0.0f)), glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+				const uint32_t handle = scene::AddTransform(inoutScene, scene::AddCapsule(inoutScene, 0.2f, 0.1f, 5), handleXform);
+
+				return scene::AddUnion(inoutScene, scene::AddUnion(inoutScene, carved, knob), scene::AddUnion(inoutScene, knobCopy, handle));
+			}
+
+			// A unit wide part standing on y = 0, to be copied many times.
+			uint32_t AddInstancedPart(scene::Scene *inoutScene)
+			{
+				const uint32_t body = scene::AddTranslate(inoutScene, scene::AddBox(inoutScene, glm::vec3(0.45f, 0.25f, 0.3f), 0.05f, 1), glm::vec3(0.0f, 0.3f, 0.0f));
+				const uint32_t knob = scene::AddTranslate(inoutScene, scene::AddSphere(inoutScene, 0.25f, 2), glm::vec3(0.0f, 0.6f, 0.0f));
+				const uint32_t notch = scene::AddTranslate(inoutScene, scene::AddCylinder(inoutScene, 0.4f, 0.1f, 3), glm::vec3(0.35f, 0.3f, 0.0f));
+
+				return scene::AddSubtract(inoutScene, scene::AddUnion(inoutScene, body, knob), notch);
+			}
+
+			float Hash(uint32_t value)
+			{
+				value ^= value >> 16;
+				value *= 0x7FEB352Du;
+				value ^= value >> 15;
+				value *= 0x846CA68Bu;
+				value ^= value >> 16;
+
+				return (float)(value >> 8) / 16777216.0f;
+			}
+		}
+
+		void BuildPrimitives(scene::Scene *outScene)
+		{
+			*outScene = scene::Scene();
+
+			uint32_t parts[6];
+			parts[0] = scene::AddTranslate(outScene, scene::AddSphere(outScene, 0.5f, 1), glm::vec3(-1.5f, -0.5f, 0.0f));
+			parts[1] = scene::AddTranslate(outScene, scene::AddBox(outScene, glm::vec3(0.4f), 0.05f, 2), glm::vec3(0.0f, -0.55f, 0.0f));
+			parts[2] = scene::AddTranslate(outScene, scene::AddTorus(outScene, 0.4f, 0.12f, 3), glm::vec3(1.5f, -0.85f, 0.0f));
+			parts[3] = scene::AddTranslate(outScene, scene::AddCapsule(outScene, 0.3f, 0.2f, 4), glm::vec3(-0.75f, -0.5f, 1.2f));
+			parts[4] = scene::AddTranslate(outScene, scene::AddCylinder(outScene, 0.4f, 0.3f, 5), glm::vec3(0.75f, -0.6f, 1.2f));
+			parts[5] = AddGround(outScene, 0);
+
+			scene::AddUnion(outScene, parts, 6);
+		}
+
+		void BuildCSG(scene::Scene *outScene)
+		{
+			*outScene = scene::Scene();
+
+			const uint32_t body = scene::AddBox(outScene, glm::vec3(0.6f), 0.05f, 1);
+			const uint32_t hole = scene::AddSphere(outScene, 0.75f, 2);
+			const uint32_t carved = scene::AddSubtract(outScene, body, hole);
+
+			const glm::mat4 ringXform = glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.6f, 0.0f)), glm::radians(30.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+			const uint32_t ring = scene::AddTransform(outScene, scene::AddTorus(outScene, 0.7f, 0.1f, 3), ringXform);
+			const uint32_t blended = scene::AddSmoothUnion(outScene, carved, ring, 0.15f);
+
+			const glm::mat4 pillarXform = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -0.2f, 0.0f)), glm::vec3(1.5f));
+			const uint32_t pillar = scene::AddTransform(outScene, scene::AddCylinder(outScene, 0.6f, 0.12f, 4), pillarXform);
+			const uint32_t drilled = scene::AddSmoothSubtract(outScene, blended, pillar, 0.05f);
+
+			const uint32_t ground = AddGround(outScene, 0);
+
+			scene::AddUnion(outScene, drilled, ground);
+		}
+
+		void BuildGrid(uint32_t primitiveCount, scene::Scene *outScene)
+		{
+			*outScene = scene::Scene();
+
+			const uint32_t side = (uint32_t)std::ceil(std::sqrt((double)primitiveCount));
+			const float spacing = 3.0f / (float)side;
+			const float radius = spacing * 0.35f;
+			std::vector<uint32_t> parts;
+
+			parts.reserve(primitiveCount + 1);
+
+			for (uint32_t primIndex = 0; primIndex < primitiveCount; ++primIndex)
+			{
+				const uint32_t ix = primIndex % side;
+				const uint32_t iz = primIndex / side;
+				const glm::vec3 center(-1.5f + spacing * (ix + 0.5f), -1.0f + radius, -1.5f + spacing * (iz + 0.5f));
+				const uint32_t prim = (primIndex & 1)
+					? scene::AddBox(outScene, glm::vec3(radius * 0.8f), radius * 0.1f, primIndex + 1)
+					: scene::AddSphere(outScene, radius, primIndex + 1);
+
+				parts.push_back(scene::AddTranslate(outScene, prim, center));
+			}
+
+			parts.push_back(AddGround(outScene, 0));
+
+			scene::AddUnion(outScene, parts.data(), (uint32_t)parts.size());
+		}
+
+		void BuildClutter(uint32_t copyCount, scene::Scene *outScene)
+		{
+			*outScene = scene::Scene();
+
+			const uint32_t side = (uint32_t)std::ceil(std::sqrt((double)copyCount));
+			const float spacing = 3.0f / (float)side;
+			const float scale = spacing * 0.3f;
+			const glm::mat4 identity(1.0f);
+			uint32_t world = AddGround(outScene, 0);
+
+			for (uint32_t copyIndex = 0; copyIndex < copyCount; ++copyIndex)
+			{
+				const uint32_t ix = copyIndex % side;
+				const uint32_t iz = copyIndex / side;
+				const glm::vec3 center(-1.5f + spacing * (ix + 0.5f), -1.0f + scale * 0.55f, -1.5f + spacing * (iz + 0.5f));
+
+				// Every copy is built from scratch, the way a paste would.
+				uint32_t placed = scene::AddTransform(outScene, AddClutterPart(outScene), glm::scale(identity, glm::vec3(scale)));
+				placed = scene::AddTransform(outScene, placed, glm::rotate(identity, glm::radians(90.0f * (copyIndex & 3)), glm::vec3(0.0f, 1.0f, 0.0f)));
+				placed = scene::AddTranslate(outScene, placed, center);
+				placed = scene::AddTransform(outScene, placed, identity);
+
+				world = scene::AddUnion(outScene, world, placed);
+			}
+		}
+
+		void BuildInstances(uint32_t copyCount, bool useTable, scene::Scene *outScene)
+		{
+			*outScene = scene::Scene();
+
+			const uint32_t side = (uint32_t)std::ceil(std::sqrt((double)copyCount));
+			const float spacing = 3.0f / (float)side;
+			const glm::mat4 identity(1.0f);
+			const uint32_t part = AddInstancedPart(outScene);
+			std::vector<glm::mat4> placements(copyCount);
+
+			for (uint32_t copyIndex = 0; copyIndex < copyCount; ++copyIndex)
+			{
+				const uint32_t ix = copyIndex % side;
+				const uint32_t iz = copyIndex / side;
+				const float jitterX = (Hash(copyIndex * 4) - 0.5f) * 0.3f;
+				const float jitterZ = (Hash(copyIndex * 4 + 1) - 0.5f) * 0.3f;
+				const glm::vec3 center(-1.5f + spacing * (ix + 0.5f + jitterX), -1.0f, -1.5f + spacing * (iz + 0.5f + jitterZ));
+				const float angle = Hash(copyIndex * 4 + 2) * 6.2831853f;
+				const float scale = spacing * (0.3f + 0.15f * Hash(copyIndex * 4 + 3));
+
+				placements[copyIndex] = glm::scale(glm::rotate(glm::translate(identity, center), angle, glm::vec3(0.0f, 1.0f, 0.0f)), glm::vec3(scale));
+			}
+
+			std::vector<uint32_t> parts;
+
+			if (useTable)
+				parts.push_back(scene::AddInstances(outScene, part, placements.data(), placements.size()));
+			else
+			{
+				parts.reserve(copyCount + 1);
+				for (const glm::mat4 &placement : placements)
+					parts.push_back(scene::AddTransform(outScene, part, placement));
+			}
+
+			parts.push_back(AddGround(outScene, 0));
+
+			scene::AddUnion(outScene, parts.data(), (uint32_t)parts.size());
+		}
+
+		void BuildRepeat(uint32_t copyCount, scene::Scene *outScene)
+		{
+			*outScene = scene::Scene();
+
+			const uint32_t limit = (uint32_t)std::sqrt((double)copyCount) / 2;
+			const float spacing = 3.0f / (float)(limit * 2 + 1);
+			const glm::mat4 identity(1.0f);
+			const uint32_t part = scene::AddTransform(outScene, AddInstancedPart(outScene), glm::scale(identity, glm::vec3(spacing * 0.4f)));
+			const uint32_t repeated = scene::AddRepeat(outScene, part, glm::vec3(spacing, 0.0f, spacing), glm::uvec3(limit, 0, limit));
+			const uint32_t parts[] = { scene::AddTranslate(outScene, repeated, glm::vec3(0.0f, -1.0f, 0.0f)), AddGround(outScene, 0) };
+
+			scene::AddUnion(outScene, parts, 2);
+		}
+
+		void BuildShared(uint32_t sharedCount, scene::Scene *outScene)
+		{
+			*outScene = scene::Scene();
+
+			const uint32_t side = (uint32_t)std::ceil(std::sqrt((double)sharedCount));
+			const float spacing = 3.0f / (float)side;
+			const float radius = spacing * 0.35f;
+			const uint32_t slab = scene::AddBox(outScene, glm::vec3(4.0f, radius * 0.5f, 4.0f), 0.0f, sharedCount + 1);
+			std::vector<uint32_t> parts, cuts;
+
+			parts.reserve(sharedCount + 1);
+			cuts.reserve(sharedCount);
+
+			for (uint32_t sharedIndex = 0; sharedIndex < sharedCount; ++sharedIndex)
+			{
+				const uint32_t ix = sharedIndex % side;
+				const uint32_t iz = sharedIndex / side;
+				const glm::vec3 center(-1.5f + spacing * (ix + 0.5f), -1.0f + radius, -1.5f + spacing * (iz + 0.5f));
+				const uint32_t ball = scene::AddSphere(outScene, radius, sharedIndex + 1);
+				const uint32_t block = scene::AddTranslate(outScene, scene::AddBox(outScene, glm::vec3(radius * 0.6f), radius * 0.1f, sharedIndex + 1), glm::vec3(0.0f, radius * 0.8f, 0.0f));
+				const uint32_t part = scene::AddTranslate(outScene, scene::AddUnion(outScene, ball, block), center);
+
+				parts.push_back(part);
+				cuts.push_back(scene::AddIntersect(outScene, part, scene::AddTranslate(outScene, slab, glm::vec3(0.0f, center.y, 0.0f))));
+			}
+
+			parts.push_back(AddGround(outScene, 0));
+
+			scene::AddUnion(outScene, scene::AddUnion(outScene, parts.data(), (uint32_t)parts.size()), scene::AddUnion(outScene, cuts.data(), (uint32_t)cuts.size()));
+		}
+
+		void BuildVolume(const std::shared_ptr<const volume::Grid> &grid, scene::Scene *outScene)
+		{
+			*outScene = scene::Scene();
+
+			const glm::vec3 lo = volume::MinCorner(*grid);
+			const glm::vec3 hi = volume::MaxCorner(*grid);
+			const glm::vec3 center = (lo + hi) * 0.5f;
+			const float scale = 2.0f / std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z));
+			const glm::mat4 identity(1.0f);
+			glm::mat4 localToWorld = glm::translate(identity, glm::vec3(0.0f, -1.0f - (lo.y - center.y) * scale, 0.0f));
+
+			localToWorld = glm::scale(localToWorld, glm::vec3(scale));
+			localToWorld = glm::translate(localToWorld, -center);
+
+			const uint32_t volume = scene::AddTransform(outScene, scene::AddVolume(outScene, grid, 1), localToWorld);
+			const uint32_t cutter = scene::AddTranslate(outScene, scene::AddSphere(outScene, 0.5f, 2), glm::vec3(0.7f, 0.0f, 0.7f));
+			const uint32_t ground = AddGround(outScene, 0);
+
+			scene::AddUnion(outScene, ground, scene::AddSubtract(outScene, volume, cutter));
+		}
+
+		bool Build(const char *name, scene::Scene *outScene)
+		{
+			const size_t length = std::strlen(name);
+
+			if (std::strcmp(name, "primitives") == 0)
+				BuildPrimitives(outScene);
+			else if (std::strcmp(name, "csg") == 0)
+				BuildCSG(outScene);
+			else if (std::strncmp(name, "grid", 4) == 0)
+			{
+				const long count = std::strtol(name + 4, nullptr, 10);
+
+				if (count <= 0)
+					return false;
+
+				BuildGrid((uint32_t)count, outScene);
+			}
+			else if (std::strncmp(name, "clutter", 7) == 0)
+			{
+				const long count = std::strtol(name + 7, nullptr, 10);
+
+				if (count <= 0)
+					return false;
+
+				BuildClutter((uint32_t)count, outScene);
+			}
+			else if (std::strncmp(name, "instances", 9) == 0 || std::strncmp(name, "copies", 6) == 0)
+			{
+				const bool useTable = name[0] == 'i';
+				const long count = std::strtol(name + (useTable ? 9 : 6), nullptr, 10);
+
+				if (count <= 0)
+					return false;
+
+				BuildInstances((uint32_t)count, useTable, outScene);
+			}
+			else if (std::strncmp(name, "repeat", 6) == 0)
+			{
+				const long count = std::strtol(name + 6, nullptr, 10);
+
+				if (count <= 0)
+					return false;
+
+				BuildRepeat((uint32_t)count, outScene);
+			}
+			else if (std::strncmp(name, "shared", 6) == 0)
+			{
+				const long count = std::strtol(name + 6, nullptr, 10);
+
+				if (count <= 0)
+					return false;
+
+				BuildShared((uint32_t)count, outScene);
+			}
+			else if (length > 5 && std::strcmp(name + length - 5, ".sdfv") == 0)
+			{
+				std::shared_ptr<volume::Grid> grid = std::make_shared<volume::Grid>();
+
+				if (!volume::Load(name, grid.get()))
+					return false;
+
+				BuildVolume(grid, outScene);
+			}
+			else
+				return false;
+
+			return true;
+		}
+	}
+}
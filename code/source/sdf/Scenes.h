@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Scene.h"
+
+// Procedural scenes used as golden image subjects and benchmark inputs. They are
+// deterministic, so results can be compared across machines and runs.
+namespace sdf
+{
+	namespace scenes
+	{
+		void BuildPrimitives(scene::Scene *outScene);
+		void BuildCSG(scene::Scene *outScene);
+		void BuildGrid(uint32_t primitiveCount, scene::Scene *outScene);
+
+		// copyCount copies of a part the way an editor leaves it: pasted duplicates,
+		// stacked transforms, nested unions and cutters that miss. Optimizer input.
+		void BuildClutter(uint32_t copyCount, scene::Scene *outScene);
+
+		// copyCount copies of one small part scattered over the ground, each
+		// turned and sized differently. Placed by a single instance node, or as a
+		// union of copyCount transforms of the shared part, for comparison.
+		void BuildInstances(uint32_t copyCount, bool useTable, scene::Scene *outScene);
+
+		// The part on a square lattice of about copyCount cells by finite domain
+		// repetition, all the same way up.
+		void BuildRepeat(uint32_t copyCount, scene::Scene *outScene);
+
+		// sharedCount small parts on a grid, each referenced twice: once as it is
+		// and once cut by a slab. Every part is a shared sub-tree for the program
+		// compiler, so there are more of them than registers to keep them in.
+		void BuildShared(uint32_t sharedCount, scene::Scene *outScene);
+
+		// A baked volume fitted onto the ground, with a sphere cut out of one corner
+		// to show it combining with analytic shapes.
+		void BuildVolume(const std::shared_ptr<const volume::Grid> &grid, scene::Scene *outScene);
+
+		// name is one of "primitives", "csg", "grid<N>" (e.g. "grid1000"), "clutter<N>",
+		// "instances<N>", "copies<N>", "repeat<N>", "shared<N>" or the path of a .sdfv volume file.
+		bool Build(const char *name, scene::Scene *outScene);
+	}
+}
@@ -0,0 +1,348 @@
+#include "Sculpt.h"
+#include <algorithm>
+#include <cmath>
+
+namespace sdf
+{
+	namespace sculpt
+	{
+		namespace
+		{
+			typedef std::chrono::high_resolution_clock Clock;
+			using simd::float8;
+
+			// Tiles are worked on in a copy with a sample of apron on every side,
+			// for SMOOTH's neighbours.
+			static const uint32_t APRON_ROW = TILE_SAMPLES + 2;
+			static const uint32_t APRON_SLICE = APRON_ROW * APRON_ROW;
+			static const uint32_t APRON_SAMPLES = APRON_SLICE * APRON_ROW;
+
+			glm::uvec3 TileAt(const glm::uvec3 &tileDims, uint64_t tileIndex)
+			{
+				return glm::uvec3((uint32_t)(tileIndex % tileDims.x), (uint32_t)(tileIndex / tileDims.x % tileDims.y), (uint32_t)(tileIndex / ((uint64_t)tileDims.x * tileDims.y)));
+			}
+
+			// How far from its center a dab can change the field.
+			float Reach(const Dab &dab, float voxelSize)
+			{
+				if (!(dab.radius > 0.0f))
+					return 0.0f;
+
+				return dab.brush == Brush::ADD || dab.brush == Brush::SUBTRACT ? dab.radius + BAND * voxelSize : dab.radius;
+			}
+
+			// Tiles holding samples within reach of the dab's center. False if the
+			// dab misses the grid.
+			bool DabTiles(const volume::Grid &grid, const Dab &dab, float reach, glm::uvec3 *outLo, glm::uvec3 *outHi)
+			{
+				for (unsigned axis = 0; axis < 3; ++axis)
+				{
+					const float lo = std::ceil((dab.center[axis] - reach - grid.origin[axis]) / grid.voxelSize);
+					const float hi = std::floor((dab.center[axis] + reach - grid.origin[axis]) / grid.voxelSize);
+
+					if (!(lo <= hi) || hi < 0.0f || lo > (float)(grid.dims[axis] - 1))
+						return false;
+
+					(*outLo)[axis] = (uint32_t)std::max(lo, 0.0f) / TILE_SAMPLES;
+					(*outHi)[axis] = (uint32_t)std::min(hi, (float)(grid.dims[axis] - 1)) / TILE_SAMPLES;
+				}
+
+				return true;
+			}
+
+			// Samples past the grid's edge repeat the edge.
+			void LoadTile(const volume::Grid &grid, const glm::uvec3 &tile, float *outSamples)
+			{
+				const glm::ivec3 first = glm::ivec3(tile * TILE_SAMPLES) - glm::ivec3(1);
+				const glm::ivec3 last = glm::ivec3(grid.dims) - glm::ivec3(1);
+
+				for (uint32_t z = 0; z < APRON_ROW; ++z)
+				{
+					const uint32_t gz = (uint32_t)glm::clamp(first.z + (int)z, 0, last.z);
+
+					for (uint32_t y = 0; y < APRON_ROW; ++y)
+					{
+						const uint32_t gy = (uint32_t)glm::clamp(first.y + (int)y, 0, last.y);
+						const float * const src = grid.values.data() + volume::Index(grid, 0, gy, gz);
+						float * const dst = outSamples + z * APRON_SLICE + y * APRON_ROW;
+
+						for (uint32_t x = 0; x < APRON_ROW; ++x)
+							dst[x] = src[glm::clamp(first.x + (int)x, 0, last.x)];
+					}
+				}
+			}
+
+			// Writes back the tile's own samples. Returns whether any changed.
+			bool StoreTile(const float *samples, const glm::uvec3 &tile, volume::Grid *inoutGrid)
+			{
+				const glm::uvec3 first = tile * TILE_SAMPLES;
+				const glm::uvec3 count = glm::min(inoutGrid->dims - first, glm::uvec3(TILE_SAMPLES));
+				bool changed = false;
+
+				for (uint32_t z = 0; z < count.z; ++z)
+				{
+					for (uint32_t y = 0; y < count.y; ++y)
+					{
+						const float * const src = samples + (z + 1) * APRON_SLICE + (y + 1) * APRON_ROW + 1;
+						float * const dst = inoutGrid->values.data() + volume::Index(*inoutGrid, first.x, first.y + y, first.z + z);
+
+						for (uint32_t x = 0; x < count.x; ++x)
+						{
+							if (dst[x] != src[x])
+							{
+								dst[x] = src[x];
+								changed = true;
+							}
+						}
+					}
+				}
+
+				return changed;
+			}
+
+			// (1 - (d / radius)^2)^2 inside the radius, 0 outside.
+			float8 Falloff(const float8 &distanceSquared, const float8 &inverseRadiusSquared)
+			{
+				const float8 t = simd::Max(simd::Set1(1.0f) - distanceSquared * inverseRadiusSquared, simd::Zero());
+
+				return t * t;
+			}
+
+			void ApplyDab(const volume::Grid &grid, const glm::uvec3 &tile, const Dab &dab, float reach, float *inoutSamples)
+			{
+				const glm::vec3 offset = grid.origin + glm::vec3(tile * TILE_SAMPLES) * grid.voxelSize - dab.center;
+				const float reachSquared = reach * reach;
+				const float8 radius = simd::Set1(dab.radius);
+				const float8 inverseRadiusSquared = simd::Set1(1.0f / (dab.radius * dab.radius));
+				const float8 strength = simd::Set1(dab.strength);
+				float laneOffsets[TILE_SAMPLES];
+
+				for (unsigned lane = 0; lane < TILE_SAMPLES; ++lane)
+					laneOffsets[lane] = offset.x + (float)lane * grid.voxelSize;
+
+				const float8 dx = simd::Load(laneOffsets);
+
+				for (uint32_t z = 0; z < TILE_SAMPLES; ++z)
+				{
+					const float dz = offset.z + (float)z * grid.voxelSize;
+
+					if (dz * dz > reachSquared)
+						continue;
+
+					for (uint32_t y = 0; y < TILE_SAMPLES; ++y)
+					{
+						const float dy = offset.y + (float)y * grid.voxelSize;
+						const float rowSquared = dy * dy + dz * dz;
+
+						if (rowSquared > reachSquared)
+							continue;
+
+						float * const row = inoutSamples + (z + 1) * APRON_SLICE + (y + 1) * APRON_ROW + 1;
+						const float8 value = simd::Load(row);
+						const float8 distanceSquared = dx * dx + simd::Set1(rowSquared);
+						float8 target, weight;
+
+						switch (dab.brush)
+						{
+							case Brush::ADD:
+								target = simd::Min(value, simd::Sqrt(distanceSquared) - radius);
+								weight = strength;
+							break;
+							case Brush::SUBTRACT:
+								target = simd::Max(value, radius - simd::Sqrt(distanceSquared));
+								weight = strength;
+							break;
+							case Brush::SMOOTH:
+								target = (simd::Load(row - 1) + simd::Load(row + 1) + simd::Load(row - APRON_ROW) + simd::Load(row + APRON_ROW) + simd::Load(row - APRON_SLICE) + simd::Load(row + APRON_SLICE)) * simd::Set1(1.0f / 6.0f);
+								weight = strength * Falloff(distanceSquared, inverseRadiusSquared);
+							break;
+							default:
+								target = dx * simd::Set1(dab.normal.x) + simd::Set1(dy * dab.normal.y + dz * dab.normal.z);
+								weight = strength * Falloff(distanceSquared, inverseRadiusSquared);
+							break;
+						}
+
+						const float8 inside = simd::CmpLt(distanceSquared, simd::Set1(reachSquared));
+
+						simd::Store(row, simd::Select(inside, value + (target - value) * weight, value));
+					}
+				}
+			}
+
+			template<typename Fn>
+			void ForEachTile(jobs::Pool *optPool, uint32_t tileCount, const Fn &fn)
+			{
+				if (optPool)
+				{
+					jobs::ParallelFor(optPool, tileCount, [&](uint32_t tileIndex, unsigned) { fn(tileIndex); });
+				}
+				else
+				{
+					for (uint32_t tileIndex = 0; tileIndex < tileCount; ++tileIndex)
+						fn(tileIndex);
+				}
+			}
+		}
+
+		void AddDab(Frame *inoutFrame, const Dab &dab)
+		{
+			inoutFrame->dabs.push_back(dab);
+			inoutFrame->queueTimes.push_back(Clock::now());
+		}
+
+		void AddStroke(Frame *inoutFrame, const Dab &dab, const glm::vec3 &end, float spacing)
+		{
+			const glm::vec3 delta = end - dab.center;
+			const float length = glm::length(delta);
+			const float step = std::max(spacing * dab.radius, 1e-6f);
+			const uint32_t steps = (uint32_t)(length / step);
+			Dab stepDab = dab;
+
+			for (uint32_t stepIndex = 0; stepIndex <= steps; ++stepIndex)
+			{
+				stepDab.center = dab.center + delta * (length > 0.0f ? (float)stepIndex * step / length : 0.0f);
+				AddDab(inoutFrame, stepDab);
+			}
+		}
+
+		bool Apply(jobs::Pool *optPool, Frame *inoutFrame, volume::Grid *inoutGrid, DirtySet *outDirty, Stats *outoptStats)
+		{
+			const Clock::time_point startTime = Clock::now();
+			const glm::uvec3 tileDims = TileDims(*inoutGrid);
+			std::vector<std::pair<uint64_t, uint32_t>> dabTiles;   // tile index, dab index
+			std::vector<float> reaches(inoutFrame->dabs.size());
+
+			// Binning every dab into the tiles it reaches, sorted by tile then dab,
+			// gives each tile its dabs in the order they were queued.
+			for (uint32_t dabIndex = 0; dabIndex < (uint32_t)inoutFrame->dabs.size(); ++dabIndex)
+			{
+				const Dab &dab = inoutFrame->dabs[dabIndex];
+				glm::uvec3 lo, hi;
+
+				reaches[dabIndex] = Reach(dab, inoutGrid->voxelSize);
+
+				if (!(reaches[dabIndex] > 0.0f) || !DabTiles(*inoutGrid, dab, reaches[dabIndex], &lo, &hi))
+					continue;
+
+				for (uint32_t z = lo.z; z <= hi.z; ++z)
+				{
+					for (uint32_t y = lo.y; y <= hi.y; ++y)
+					{
+						for (uint32_t x = lo.x; x <= hi.x; ++x)
+							dabTiles.emplace_back(((uint64_t)z * tileDims.y + y) * tileDims.x + x, dabIndex);
+					}
+				}
+			}
+
+			std::sort(dabTiles.begin(), dabTiles.end());
+
+			std::vector<uint64_t> tiles;
+			std::vector<uint32_t> tileStarts;   // tile t's dabs are dabTiles[tileStarts[t], tileStarts[t + 1])
+
+			for (uint32_t pairIndex = 0; pairIndex < (uint32_t)dabTiles.size(); ++pairIndex)
+			{
+				if (pairIndex == 0 || dabTiles[pairIndex].first != dabTiles[pairIndex - 1].first)
+				{
+					tiles.push_back(dabTiles[pairIndex].first);
+					tileStarts.push_back(pairIndex);
+				}
+			}
+
+			tileStarts.push_back((uint32_t)dabTiles.size());
+
+			// Every tile is copied out before any is written back, so SMOOTH reads
+			// the same apron whichever thread gets to its neighbours first.
+			std::vector<float> samples(tiles.size() * APRON_SAMPLES);
+			std::vector<uint8_t> changed(tiles.size(), 0);
+
+			ForEachTile(optPool, (uint32_t)tiles.size(), [&](uint32_t tileIndex)
+			{
+				LoadTile(*inoutGrid, TileAt(tileDims, tiles[tileIndex]), samples.data() + (size_t)tileIndex * APRON_SAMPLES);
+			});
+
+			ForEachTile(optPool, (uint32_t)tiles.size(), [&](uint32_t tileIndex)
+			{
+				const glm::uvec3 tile = TileAt(tileDims, tiles[tileIndex]);
+				float * const tileSamples = samples.data() + (size_t)tileIndex * APRON_SAMPLES;
+
+				for (uint32_t pairIndex = tileStarts[tileIndex]; pairIndex < tileStarts[tileIndex + 1]; ++pairIndex)
+				{
+					const uint32_t dabIndex = dabTiles[pairIndex].second;
+
+					ApplyDab(*inoutGrid, tile, inoutFrame->dabs[dabIndex], reaches[dabIndex], tileSamples);
+				}
+
+				changed[tileIndex] = StoreTile(tileSamples, tile, inoutGrid);
+			});
+
+			outDirty->tiles.clear();
+			outDirty->sampleMin = glm::uvec3(0);
+			outDirty->sampleMax = glm::uvec3(0);
+
+			for (size_t tileIndex = 0; tileIndex < tiles.size(); ++tileIndex)
+			{
+				if (!changed[tileIndex])
+					continue;
+
+				const glm::uvec3 tile = TileAt(tileDims, tiles[tileIndex]);
+				glm::uvec3 sampleMin, sampleMax;
+
+				TileSamples(*inoutGrid, tile, &sampleMin, &sampleMax);
+				outDirty->sampleMin = outDirty->tiles.empty() ? sampleMin : glm::min(outDirty->sampleMin, sampleMin);
+				outDirty->sampleMax = outDirty->tiles.empty() ? sampleMax : glm::max(outDirty->sampleMax, sampleMax);
+				outDirty->tiles.push_back(tile);
+			}
+
+			if (outoptStats)
+			{
+				const Clock::time_point endTime = Clock::now();
+
+				outoptStats->dabs = (uint32_t)inoutFrame->dabs.size();
+				outoptStats->tilesTouched = (uint32_t)tiles.size();
+				outoptStats->tilesChanged = (uint32_t)outDirty->tiles.size();
+				outoptStats->dabTiles = dabTiles.size();
+				outoptStats->seconds = std::chrono::duration<double>(endTime - startTime).count();
+				outoptStats->meanLatency = 0.0;
+				outoptStats->maxLatency = 0.0;
+
+				for (const Clock::time_point &queueTime : inoutFrame->queueTimes)
+				{
+					const double latency = std::chrono::duration<double>(endTime - queueTime).count();
+
+					outoptStats->meanLatency += latency;
+					outoptStats->maxLatency = std::max(outoptStats->maxLatency, latency);
+				}
+
+				if (!inoutFrame->queueTimes.empty())
+					outoptStats->meanLatency /= (double)inoutFrame->queueTimes.size();
+			}
+
+			inoutFrame->dabs.clear();
+			inoutFrame->queueTimes.clear();
+
+			return !outDirty->tiles.empty();
+		}
+
+		glm::uvec3 TileDims(const volume::Grid &grid)
+		{
+			return (grid.dims + glm::uvec3(TILE_SAMPLES - 1)) / TILE_SAMPLES;
+		}
+
+		void TileSamples(const volume::Grid &grid, const glm::uvec3 &tile, glm::uvec3 *outMin, glm::uvec3 *outMax)
+		{
+			*outMin = tile * TILE_SAMPLES;
+			*outMax = glm::min(*outMin + glm::uvec3(TILE_SAMPLES - 1), grid.dims - glm::uvec3(1));
+		}
+
+		void MarkDirty(const DirtySet &dirty, const volume::Grid &grid, uint32_t volumeIndex, bricks::Atlas *inoutAtlas)
+		{
+			for (const glm::uvec3 &tile : dirty.tiles)
+			{
+				glm::uvec3 sampleMin, sampleMax;
+
+				TileSamples(grid, tile, &sampleMin, &sampleMax);
+				bricks::MarkDirty(inoutAtlas, volumeIndex, sampleMin, sampleMax);
+			}
+		}
+	}
+}
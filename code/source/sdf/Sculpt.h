@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Bricks.h"
+#include "Jobs.h"
+#include "Simd.h"
+#include <chrono>
+
+// Sculpt brushes applied straight to sampled volumes. Dabs queue up over a
+// frame and are applied together, tile by tile: each tile the frame touches is
+// read and written once however many dabs overlap it, and its rows run through
+// 8-wide SIMD kernels. The tiles that changed come back as a dirty set for the
+// brick atlas, the mip pyramid or re-meshing.
+namespace sdf
+{
+	namespace sculpt
+	{
+		static const uint32_t TILE_SAMPLES = simd::WIDTH;   // samples per tile side, so a tile row is one packet
+		static const float BAND = 4.0f;                     // in voxels. ADD and SUBTRACT keep the field a distance this close to the surface.
+
+		enum class Brush : unsigned char
+		{
+			ADD,        // union with the dab's sphere
+			SUBTRACT,   // the dab's sphere carved out
+			SMOOTH,     // towards the mean of the 6 neighbours
+			FLATTEN     // towards the plane through the dab's center
+		};
+
+		struct Dab
+		{
+			Brush brush = Brush::ADD;
+			glm::vec3 center = glm::vec3(0.0f);
+			float radius = 0.0f;
+			float strength = 1.0f;                          // 0 to 1. SMOOTH and FLATTEN also fall off towards the radius.
+			glm::vec3 normal = glm::vec3(0.0f, 1.0f, 0.0f); // FLATTEN's plane, normalized
+		};
+
+		// Dabs waiting for the next Apply.
+		struct Frame
+		{
+			std::vector<Dab> dabs;
+			std::vector<std::chrono::high_resolution_clock::time_point> queueTimes;
+		};
+
+		// Tile (x, y, z) owns samples [x, y, z] * TILE_SAMPLES up to the next tile.
+		struct DirtySet
+		{
+			std::vector<glm::uvec3> tiles;   // that changed
+			glm::uvec3 sampleMin;            // over every changed tile, inclusive
+			glm::uvec3 sampleMax;
+		};
+
+		struct Stats
+		{
+			uint32_t dabs = 0;
+			uint32_t tilesTouched = 0;
+			uint32_t tilesChanged = 0;
+			uint64_t dabTiles = 0;           // dab and tile pairs. Over tilesTouched, how much coalescing saved.
+			double seconds = 0.0;
+			double meanLatency = 0.0;        // seconds from a dab being queued to its frame being applied
+			double maxLatency = 0.0;
+		};
+
+		void AddDab(Frame *inoutFrame, const Dab &dab);
+
+		// Dabs spaced spacing * radius apart from dab's center to end, as a
+		// pointer dragged over a frame leaves them.
+		void AddStroke(Frame *inoutFrame, const Dab &dab, const glm::vec3 &end, float spacing);
+
+		// Applies and clears the frame's dabs, in the order they were queued.
+		// Dabs reading neighbours across a tile border see them as they were
+		// before the frame. A null pool runs on the calling thread. Returns whether
+		// any sample changed.
+		bool Apply(jobs::Pool *optPool, Frame *inoutFrame, volume::Grid *inoutGrid, DirtySet *outDirty, Stats *outoptStats = nullptr);
+
+		glm::uvec3 TileDims(const volume::Grid &grid);
+		void TileSamples(const volume::Grid &grid, const glm::uvec3 &tile, glm::uvec3 *outMin, glm::uvec3 *outMax);
+
+		// bricks::MarkDirty for every changed tile.
+		void MarkDirty(const DirtySet &dirty, const volume::Grid &grid, uint32_t volumeIndex, bricks::Atlas *inoutAtlas);
+	}
+}
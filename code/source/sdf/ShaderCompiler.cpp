@@ -0,0 +1,502 @@
+#include "ShaderCompiler.h"
+#include "Memory.h"
+#include <SPIRV/GlslangToSpv.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace sdf
+{
+	namespace shader
+	{
+		namespace
+		{
+			unsigned long CurrentProcessId()
+			{
+#if defined(_WIN32)
+				return (unsigned long)_getpid();
+#else
+				return (unsigned long)getpid();
+#endif
+			}
+
+			// Bump when compile options or the disk cache layout change so stale entries miss.
+			static const uint32_t CACHE_VERSION = 2;
+			static const uint32_t SPIRV_MAGIC = 0x07230203;
+
+			typedef std::chrono::high_resolution_clock Clock;
+			typedef memory::Vector<uint32_t, memory::Tag::SHADER_CACHE> CachedSpirv;
+			typedef std::shared_ptr<const CachedSpirv> SpirvPtr;
+
+			struct Job
+			{
+				uint64_t hash;
+				Stage stage;
+				std::string source;
+				Clock::time_point requestTime;
+			};
+
+			EShLanguage ToLanguage(Stage stage)
+			{
+				switch (stage)
+				{
+					case Stage::VERTEX:   return EShLangVertex;
+					case Stage::FRAGMENT: return EShLangFragment;
+					case Stage::COMPUTE:  return EShLangCompute;
+				}
+
+				return EShLangFragment;
+			}
+
+			void InitResources(TBuiltInResource *outResources)
+			{
+				*outResources = {};
+				outResources->maxLights = 32;
+				outResources->maxClipPlanes = 6;
+				outResources->maxTextureUnits = 32;
+				outResources->maxTextureCoords = 32;
+				outResources->maxVertexAttribs = 64;
+				outResources->maxVertexUniformComponents = 4096;
+				outResources->maxVaryingFloats = 64;
+				outResources->maxVertexTextureImageUnits = 32;
+				outResources->maxCombinedTextureImageUnits = 80;
+				outResources->maxTextureImageUnits = 32;
+				outResources->maxFragmentUniformComponents = 4096;
+				outResources->maxDrawBuffers = 32;
+				outResources->maxVertexUniformVectors = 128;
+				outResources->maxVaryingVectors = 8;
+				outResources->maxFragmentUniformVectors = 16;
+				outResources->maxVertexOutputVectors = 16;
+				outResources->maxFragmentInputVectors = 15;
+				outResources->minProgramTexelOffset = -8;
+				outResources->maxProgramTexelOffset = 7;
+				outResources->maxClipDistances = 8;
+				outResources->maxComputeWorkGroupCountX = 65535;
+				outResources->maxComputeWorkGroupCountY = 65535;
+				outResources->maxComputeWorkGroupCountZ = 65535;
+				outResources->maxComputeWorkGroupSizeX = 1024;
+				outResources->maxComputeWorkGroupSizeY = 1024;
+				outResources->maxComputeWorkGroupSizeZ = 64;
+				outResources->maxComputeUniformComponents = 1024;
+				outResources->maxComputeTextureImageUnits = 16;
+				outResources->maxComputeImageUniforms = 8;
+				outResources->maxComputeAtomicCounters = 8;
+				outResources->maxComputeAtomicCounterBuffers = 1;
+				outResources->maxVaryingComponents = 60;
+				outResources->maxVertexOutputComponents = 64;
+				outResources->maxGeometryInputComponents = 64;
+				outResources->maxGeometryOutputComponents = 128;
+				outResources->maxFragmentInputComponents = 128;
+				outResources->maxImageUnits = 8;
+				outResources->maxCombinedImageUnitsAndFragmentOutputs = 8;
+				outResources->maxCombinedShaderOutputResources = 8;
+				outResources->maxFragmentImageUniforms = 8;
+				outResources->maxCombinedImageUniforms = 8;
+				outResources->maxGeometryTextureImageUnits = 16;
+				outResources->maxGeometryOutputVertices = 256;
+				outResources->maxGeometryTotalOutputComponents = 1024;
+				outResources->maxGeometryUniformComponents = 1024;
+				outResources->maxGeometryVaryingComponents = 64;
+				outResources->maxTessControlInputComponents = 128;
+				outResources->maxTessControlOutputComponents = 128;
+				outResources->maxTessControlTextureImageUnits = 16;
+				outResources->maxTessControlUniformComponents = 1024;
+				outResources->maxTessControlTotalOutputComponents = 4096;
+				outResources->maxTessEvaluationInputComponents = 128;
+				outResources->maxTessEvaluationOutputComponents = 128;
+				outResources->maxTessEvaluationTextureImageUnits = 16;
+				outResources->maxTessEvaluationUniformComponents = 1024;
+				outResources->maxTessPatchComponents = 120;
+				outResources->maxPatchVertices = 32;
+				outResources->maxTessGenLevel = 64;
+				outResources->maxViewports = 16;
+				outResources->maxFragmentAtomicCounters = 8;
+				outResources->maxCombinedAtomicCounters = 8;
+				outResources->maxAtomicCounterBindings = 1;
+				outResources->maxFragmentAtomicCounterBuffers = 1;
+				outResources->maxCombinedAtomicCounterBuffers = 1;
+				outResources->maxAtomicCounterBufferSize = 16384;
+				outResources->maxTransformFeedbackBuffers = 4;
+				outResources->maxTransformFeedbackInterleavedComponents = 64;
+				outResources->maxCullDistances = 8;
+				outResources->maxCombinedClipAndCullDistances = 8;
+				outResources->maxSamples = 4;
+				outResources->limits.nonInductiveForLoops = 1;
+				outResources->limits.whileLoops = 1;
+				outResources->limits.doWhileLoops = 1;
+				outResources->limits.generalUniformIndexing = 1;
+				outResources->limits.generalAttributeMatrixVectorIndexing = 1;
+				outResources->limits.generalVaryingIndexing = 1;
+				outResources->limits.generalSamplerIndexing = 1;
+				outResources->limits.generalVariableIndexing = 1;
+				outResources->limits.generalConstantMatrixVectorIndexing = 1;
+			}
+
+			std::string CachePath(const std::string &cacheDir, uint64_t hash)
+			{
+				char name[32];
+
+				std::snprintf(name, sizeof(name), "%016llx.spv", (unsigned long long)hash);
+
+				return (std::filesystem::path(cacheDir) / name).string();
+			}
+
+			// Disk cache files carry a header so a short or corrupted file misses instead
+			// of reaching the driver.
+			struct CacheHeader
+			{
+				uint32_t magic;
+				uint32_t version;
+				uint32_t words;
+				uint32_t checksum;
+			};
+
+			static const uint32_t CACHE_MAGIC = 0x43564453; // 'SDVC'
+
+			uint32_t Checksum(const uint32_t *words, size_t count)
+			{
+				// FNV-1a over the words.
+				uint32_t hash = 2166136261u;
+
+				for (size_t i = 0; i < count; ++i)
+				{
+					hash ^= words[i];
+					hash *= 16777619u;
+				}
+
+				return hash;
+			}
+
+			bool LoadCachedSpirv(const std::string &path, std::vector<uint32_t> *outSpirv)
+			{
+				std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+				if (!file)
+					return false;
+
+				const std::streamoff size = file.tellg();
+				CacheHeader header;
+
+				if (size < (std::streamoff)sizeof(header))
+					return false;
+
+				file.seekg(0);
+
+				if (!file.read((char*)&header, sizeof(header)))
+					return false;
+
+				if (header.magic != CACHE_MAGIC || header.version != CACHE_VERSION || header.words == 0 ||
+					size != (std::streamoff)(sizeof(header) + (uint64_t)header.words * sizeof(uint32_t)))
+					return false;
+
+				outSpirv->resize(header.words);
+
+				if (!file.read((char*)outSpirv->data(), header.words * sizeof(uint32_t)))
+					return false;
+
+				return (*outSpirv)[0] == SPIRV_MAGIC && Checksum(outSpirv->data(), outSpirv->size()) == header.checksum;
+			}
+
+			void StoreCachedSpirv(const std::string &path, const std::vector<uint32_t> &spirv)
+			{
+				// Written aside under a name unique to this process and thread, then renamed
+				// into place, so a crash or a second instance never observes a torn file.
+				char suffix[48];
+				std::snprintf(suffix, sizeof(suffix), ".%lu.%zx.tmp", (unsigned long)CurrentProcessId(),
+					std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+				const std::string tempPath = path + suffix;
+				const CacheHeader header = { CACHE_MAGIC, CACHE_VERSION, (uint32_t)spirv.size(), Checksum(spirv.data(), spirv.size()) };
+				std::error_code err;
+
+				{
+					std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+
+					if (!file)
+						return;
+
+					if (!file.write((const char*)&header, sizeof(header)) ||
+						!file.write((const char*)spirv.data(), spirv.size() * sizeof(uint32_t)))
+					{
+						file.close();
+						std::filesystem::remove(tempPath, err);
+						return;
+					}
+				}
+
+				std::filesystem::rename(tempPath, path, err);
+
+				if (err)
+					std::filesystem::remove(tempPath, err);
+			}
+		}
+
+		struct Compiler
+		{
+			std::string cacheDir;
+			std::thread worker;
+			mutable std::mutex mutex;
+			std::condition_variable wake;
+			std::deque<Job> pending;
+			std::deque<Result> finished;
+			std::unordered_set<uint64_t> inFlight;
+			std::unordered_map<uint64_t, SpirvPtr> memoryCache;
+			Stats stats;
+			bool quit = false;
+		};
+
+		namespace
+		{
+			void CompileJob(Compiler *compiler, Job *job)
+			{
+				Result result;
+				const auto startTime = Clock::now();
+				const std::string path = compiler->cacheDir.empty() ? std::string() : CachePath(compiler->cacheDir, job->hash);
+
+				result.hash = job->hash;
+				result.stage = job->stage;
+
+				if (!path.empty() && LoadCachedSpirv(path, &result.spirv))
+				{
+					result.origin = Origin::DISK;
+					result.success = true;
+				}
+				else
+				{
+					result.origin = Origin::COMPILED;
+					result.success = CompileGlsl(job->source, job->stage, &result.spirv, &result.log);
+
+					if (result.success && !path.empty())
+						StoreCachedSpirv(path, result.spirv);
+				}
+
+				const auto endTime = Clock::now();
+				result.seconds = std::chrono::duration<double>(endTime - job->requestTime).count();
+
+				std::lock_guard<std::mutex> lock(compiler->mutex);
+
+				if (result.origin == Origin::DISK)
+					++compiler->stats.diskHits;
+				else
+				{
+					++compiler->stats.compiles;
+					compiler->stats.compileSeconds += std::chrono::duration<double>(endTime - startTime).count();
+				}
+
+				if (result.success)
+					compiler->memoryCache[result.hash] = std::make_shared<const CachedSpirv>(result.spirv.begin(), result.spirv.end());
+				else
+					++compiler->stats.failures;
+
+				compiler->inFlight.erase(result.hash);
+				compiler->finished.push_back(std::move(result));
+			}
+
+			void WorkerMain(Compiler *compiler)
+			{
+				for (;;)
+				{
+					Job job;
+
+					{
+						std::unique_lock<std::mutex> lock(compiler->mutex);
+
+						compiler->wake.wait(lock, [compiler]() { return compiler->quit || !compiler->pending.empty(); });
+
+						if (compiler->quit)
+							return;
+
+						job = std::move(compiler->pending.front());
+						compiler->pending.pop_front();
+					}
+
+					CompileJob(compiler, &job);
+				}
+			}
+		}
+
+		uint64_t HashSource(const std::string &source, Stage stage)
+		{
+			// FNV-1a, 64 bit. Sources are a few KB, so this is noise next to a compile.
+			uint64_t hash = 0xCBF29CE484222325ull;
+			const auto Mix = [&hash](uint8_t byte)
+			{
+				hash ^= byte;
+				hash *= 0x100000001B3ull;
+			};
+
+			for (const char ch : source)
+				Mix((uint8_t)ch);
+
+			Mix((uint8_t)stage);
+
+			for (unsigned byteIndex = 0; byteIndex < 4; ++byteIndex)
+				Mix((uint8_t)(CACHE_VERSION >> (byteIndex * 8)));
+
+			return hash;
+		}
+
+		bool CompileGlsl(const std::string &source, Stage stage, std::vector<uint32_t> *outSpirv, std::string *outoptLog)
+		{
+			const EShLanguage language = ToLanguage(stage);
+			const EShMessages messages = (EShMessages)(EShMsgSpvRules | EShMsgVulkanRules);
+			const char * const sourceText = source.c_str();
+			const int sourceLength = (int)source.length();
+			glslang::TShader shader(language);
+			glslang::TProgram program;
+			TBuiltInResource resources;
+
+			InitResources(&resources);
+			outSpirv->clear();
+
+			shader.setStringsWithLengths(&sourceText, &sourceLength, 1);
+
+			if (!shader.parse(&resources, 100, ECoreProfile, false, false, messages))
+			{
+				if (outoptLog)
+					*outoptLog = std::string(shader.getInfoLog()) + shader.getInfoDebugLog();
+
+				return false;
+			}
+
+			program.addShader(&shader);
+
+			if (!program.link(messages))
+			{
+				if (outoptLog)
+					*outoptLog = std::string(program.getInfoLog()) + program.getInfoDebugLog();
+
+				return false;
+			}
+
+			glslang::SpvOptions buildOptions;
+#ifdef NDEBUG
+			buildOptions.generateDebugInfo = false;
+			buildOptions.disableOptimizer = false;
+#else //#ifdef NDEBUG
+			buildOptions.generateDebugInfo = true;
+			buildOptions.disableOptimizer = true;
+#endif //#else //#ifdef NDEBUG
+			buildOptions.optimizeSize = false;
+			buildOptions.disassemble = false;
+			buildOptions.validate = true;
+
+			glslang::GlslangToSpv(*program.getIntermediate(language), *outSpirv, &buildOptions);
+
+			if (outSpirv->empty())
+			{
+				if (outoptLog)
+					*outoptLog = "No binary data generated.";
+
+				return false;
+			}
+
+			return true;
+		}
+
+		Compiler* CreateCompiler(const char *optCacheDir)
+		{
+			if (!glslang::InitializeProcess())
+				return nullptr;
+
+			Compiler * const compiler = new Compiler;
+
+			if (optCacheDir && *optCacheDir)
+			{
+				std::error_code err;
+
+				std::filesystem::create_directories(optCacheDir, err);
+
+				if (!err)
+					compiler->cacheDir = optCacheDir;
+			}
+
+			compiler->worker = std::thread(WorkerMain, compiler);
+
+			return compiler;
+		}
+
+		void DestroyCompiler(Compiler *compiler)
+		{
+			if (!compiler)
+				return;
+
+			{
+				std::lock_guard<std::mutex> lock(compiler->mutex);
+				compiler->quit = true;
+			}
+
+			compiler->wake.notify_one();
+			compiler->worker.join();
+
+			delete compiler;
+
+			glslang::FinalizeProcess();
+		}
+
+		uint64_t Request(Compiler *compiler, std::string source, Stage stage)
+		{
+			const uint64_t hash = HashSource(source, stage);
+			std::unique_lock<std::mutex> lock(compiler->mutex);
+			const auto cacheIt = compiler->memoryCache.find(hash);
+
+			if (cacheIt != compiler->memoryCache.end())
+			{
+				Result result;
+				result.hash = hash;
+				result.stage = stage;
+				result.origin = Origin::MEMORY;
+				result.success = true;
+				result.spirv.assign(cacheIt->second->begin(), cacheIt->second->end());
+
+				++compiler->stats.memoryHits;
+				compiler->finished.push_back(std::move(result));
+
+				return hash;
+			}
+
+			if (compiler->inFlight.insert(hash).second)
+			{
+				compiler->pending.push_back({ hash, stage, std::move(source), Clock::now() });
+				lock.unlock();
+				compiler->wake.notify_one();
+			}
+
+			return hash;
+		}
+
+		bool Poll(Compiler *compiler, Result *outResult)
+		{
+			std::lock_guard<std::mutex> lock(compiler->mutex);
+
+			if (compiler->finished.empty())
+				return false;
+
+			*outResult = std::move(compiler->finished.front());
+			compiler->finished.pop_front();
+
+			return true;
+		}
+
+		Stats GetStats(const Compiler *compiler)
+		{
+			std::lock_guard<std::mutex> lock(compiler->mutex);
+
+			return compiler->stats;
+		}
+	}
+}
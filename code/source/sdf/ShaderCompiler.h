@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Runtime GLSL to SPIR-V compilation with glslang, for shaders generated from
+// scenes that change while the app runs. Results are keyed by a hash of the
+// source and cached in memory and on disk, and the compile itself happens on a
+// background thread so an edit never stalls a frame.
+namespace sdf
+{
+	namespace shader
+	{
+		enum class Stage : unsigned char
+		{
+			VERTEX,
+			FRAGMENT,
+			COMPUTE
+		};
+
+		enum class Origin : unsigned char
+		{
+			MEMORY,
+			DISK,
+			COMPILED
+		};
+
+		struct Result
+		{
+			uint64_t hash = 0;
+			Stage stage = Stage::FRAGMENT;
+			Origin origin = Origin::COMPILED;
+			bool success = false;
+			std::vector<uint32_t> spirv;
+			std::string log;          // glslang diagnostics on failure
+			double seconds = 0.0;     // time from request to result
+		};
+
+		struct Stats
+		{
+			uint64_t memoryHits = 0;
+			uint64_t diskHits = 0;
+			uint64_t compiles = 0;
+			uint64_t failures = 0;
+			double compileSeconds = 0.0;
+		};
+
+		struct Compiler;
+
+		// Content hash of a shader. Also covers the stage and compiler settings, so a
+		// cached binary is never reused for a different configuration.
+		uint64_t HashSource(const std::string &source, Stage stage);
+
+		// Synchronous compile on the calling thread. glslang must be initialized,
+		// which CreateCompiler does for the lifetime of the compiler.
+		bool CompileGlsl(const std::string &source, Stage stage, std::vector<uint32_t> *outSpirv, std::string *outoptLog);
+
+		// optCacheDir may be null for a memory only cache. It is created if missing.
+		Compiler* CreateCompiler(const char *optCacheDir);
+		void DestroyCompiler(Compiler *compiler);
+
+		// Queues source for compilation and returns its hash. Never blocks on glslang.
+		// Requests for a hash already in flight collapse into a single result.
+		uint64_t Request(Compiler *compiler, std::string source, Stage stage);
+
+		// Pops one finished result. Returns false if none are ready.
+		bool Poll(Compiler *compiler, Result *outResult);
+
+		Stats GetStats(const Compiler *compiler);
+	}
+}
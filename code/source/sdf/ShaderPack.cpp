@@ -0,0 +1,471 @@
+#include "ShaderPack.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace sdf
+{
+	namespace shaderpack
+	{
+		namespace
+		{
+			static const uint32_t NO_PROGRAM = ~0u;
+			static const uint32_t MAX_SEED = 1u << 24;
+
+			// FNV-1a with the seed mixed into its basis, then the murmur3 finalizer
+			// so neighbouring seeds give unrelated slots. Seed 0 picks the bucket,
+			// the bucket's seed the slot.
+			uint32_t HashName(const char *name, uint32_t seed)
+			{
+				uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);
+
+				for (; *name; ++name)
+				{
+					hash ^= (uint8_t)*name;
+					hash *= 16777619u;
+				}
+
+				hash ^= hash >> 16;
+				hash *= 0x85ebca6bu;
+				hash ^= hash >> 13;
+				hash *= 0xc2b2ae35u;
+				hash ^= hash >> 16;
+
+				return hash;
+			}
+
+			// FNV-1a over program words, for finding duplicates while writing.
+			uint32_t HashWords(const std::vector<uint32_t> &words)
+			{
+				uint32_t hash = 2166136261u;
+
+				for (uint32_t word : words)
+				{
+					hash ^= word;
+					hash *= 16777619u;
+				}
+
+				return hash;
+			}
+
+			uint64_t AlignUp(uint64_t value, uint64_t alignment)
+			{
+				return (value + alignment - 1) / alignment * alignment;
+			}
+
+			const FileHeader &Header(const Pack &pack)
+			{
+				return *(const FileHeader *)pack.data;
+			}
+
+			bool InRange(uint64_t offset, uint64_t bytes, size_t size)
+			{
+				return offset <= size && bytes <= size - offset;
+			}
+
+			// Hash and displace: buckets are placed biggest first, each trying seeds
+			// until all its names land on free slots. About two names per bucket
+			// keeps the search short and the seed table small.
+			bool BuildHash(const std::vector<Program> &programs, std::vector<uint32_t> *outSeeds, std::vector<uint32_t> *outSlotPrograms)
+			{
+				const uint32_t count = (uint32_t)programs.size();
+				const uint32_t bucketCount = std::max((count + 1) / 2, 1u);
+				std::vector<std::vector<uint32_t>> buckets(bucketCount);
+				std::vector<uint32_t> order(bucketCount);
+				std::vector<uint32_t> slots;
+
+				for (uint32_t programIndex = 0; programIndex < count; ++programIndex)
+					buckets[HashName(programs[programIndex].name.c_str(), 0) % bucketCount].push_back(programIndex);
+
+				for (uint32_t bucketIndex = 0; bucketIndex < bucketCount; ++bucketIndex)
+					order[bucketIndex] = bucketIndex;
+
+				std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return buckets[a].size() > buckets[b].size(); });
+
+				outSeeds->assign(bucketCount, 0);
+				outSlotPrograms->assign(count, NO_PROGRAM);
+
+				for (uint32_t bucketIndex : order)
+				{
+					const std::vector<uint32_t> &bucket = buckets[bucketIndex];
+					uint32_t seed = 1;
+
+					if (bucket.empty())
+						break;
+
+					for (;; ++seed)
+					{
+						if (seed == MAX_SEED)
+							return false;
+
+						slots.clear();
+						for (uint32_t programIndex : bucket)
+						{
+							const uint32_t slot = HashName(programs[programIndex].name.c_str(), seed) % count;
+
+							if ((*outSlotPrograms)[slot] != NO_PROGRAM || std::find(slots.begin(), slots.end(), slot) != slots.end())
+								break;
+
+							slots.push_back(slot);
+						}
+
+						if (slots.size() == bucket.size())
+							break;
+					}
+
+					(*outSeeds)[bucketIndex] = seed;
+					for (size_t keyIndex = 0; keyIndex < bucket.size(); ++keyIndex)
+						(*outSlotPrograms)[slots[keyIndex]] = bucket[keyIndex];
+				}
+
+				return true;
+			}
+		}
+
+		bool Write(const std::vector<Program> &programs, std::string *outBytes)
+		{
+			std::unordered_set<std::string> names;
+			std::vector<uint32_t> seeds;
+			std::vector<uint32_t> slotPrograms;
+
+			for (const Program &program : programs)
+			{
+				if (!names.insert(program.name).second)
+					return false;
+			}
+
+			if (!BuildHash(programs, &seeds, &slotPrograms))
+				return false;
+
+			// Sizes first, so string offsets are known while entries are filled.
+			uint64_t end = sizeof(FileHeader) + seeds.size() * sizeof(uint32_t) + programs.size() * sizeof(Entry);
+			std::vector<uint32_t> ubosOffsets(programs.size());
+			std::vector<uint32_t> bindingsOffsets(programs.size());
+			std::vector<uint32_t> vertexInputsOffsets(programs.size());
+			std::vector<uint32_t> programOffsets(programs.size());
+
+			for (size_t programIndex = 0; programIndex < programs.size(); ++programIndex)
+			{
+				ubosOffsets[programIndex] = (uint32_t)end;
+				end += programs[programIndex].ubos.size() * sizeof(UniformBlock);
+			}
+
+			for (size_t programIndex = 0; programIndex < programs.size(); ++programIndex)
+			{
+				bindingsOffsets[programIndex] = (uint32_t)end;
+				end += programs[programIndex].bindings.size() * sizeof(DescriptorBinding);
+			}
+
+			for (size_t programIndex = 0; programIndex < programs.size(); ++programIndex)
+			{
+				vertexInputsOffsets[programIndex] = (uint32_t)end;
+				end += programs[programIndex].vertexInputs.size() * sizeof(VertexInput);
+			}
+
+			// Programs with the same words, as variants of a shader often are, are
+			// laid out once and shared by their entries.
+			std::unordered_multimap<uint32_t, size_t> programsByHash;
+			std::vector<bool> sharedProgram(programs.size(), false);
+
+			for (size_t programIndex = 0; programIndex < programs.size(); ++programIndex)
+			{
+				const std::vector<uint32_t> &words = programs[programIndex].words;
+				const uint32_t hash = HashWords(words);
+				const auto range = programsByHash.equal_range(hash);
+				const auto found = std::find_if(range.first, range.second, [&](const std::pair<const uint32_t, size_t> &other) { return programs[other.second].words == words; });
+
+				if (found != range.second)
+				{
+					programOffsets[programIndex] = programOffsets[found->second];
+					sharedProgram[programIndex] = true;
+					continue;
+				}
+
+				programsByHash.emplace(hash, programIndex);
+				end = AlignUp(end, PROGRAM_ALIGNMENT);
+				programOffsets[programIndex] = (uint32_t)end;
+				end += words.size() * sizeof(uint32_t);
+			}
+
+			if (end > UINT32_MAX)
+				return false;
+
+			const uint32_t stringsOffset = (uint32_t)end;
+			std::string strings(1, '\0');   // never empty, so the file always ends with a terminator
+			std::unordered_map<std::string, uint32_t> stringOffsets;
+			const auto AddString = [&](const std::string &str) -> uint32_t
+			{
+				const auto found = stringOffsets.find(str);
+
+				if (found != stringOffsets.end())
+					return found->second;
+
+				const uint32_t offset = stringsOffset + (uint32_t)strings.size();
+
+				strings.append(str.c_str(), str.length() + 1);
+				stringOffsets.emplace(str, offset);
+				return offset;
+			};
+
+			FileHeader header = {};
+			std::vector<Entry> entries(programs.size());
+			std::vector<UniformBlock> ubos;
+			std::vector<DescriptorBinding> bindings;
+			std::vector<VertexInput> vertexInputs;
+
+			header.magic = MAGIC;
+			header.version = VERSION;
+			header.shaderCount = (uint32_t)programs.size();
+			header.bucketCount = (uint32_t)seeds.size();
+			header.bucketsOffset = sizeof(FileHeader);
+			header.entriesOffset = header.bucketsOffset + header.bucketCount * sizeof(uint32_t);
+
+			for (uint32_t slot = 0; slot < header.shaderCount; ++slot)
+			{
+				const uint32_t programIndex = slotPrograms[slot];
+				const Program &program = programs[programIndex];
+				Entry &entry = entries[slot];
+
+				entry.nameOffset = AddString(program.name);
+				entry.entryPointOffset = AddString(program.entryPoint);
+				entry.programOffset = programOffsets[programIndex];
+				entry.programWords = (uint32_t)program.words.size();
+				entry.ubosOffset = ubosOffsets[programIndex];
+				entry.uboCount = (uint32_t)program.ubos.size();
+				entry.stage = program.stage;
+				entry.inputCount = program.inputCount;
+				entry.outputCount = program.outputCount;
+				entry.bindingsOffset = bindingsOffsets[programIndex];
+				entry.bindingCount = (uint32_t)program.bindings.size();
+				entry.vertexInputsOffset = vertexInputsOffsets[programIndex];
+				entry.vertexInputCount = (uint32_t)program.vertexInputs.size();
+				entry.pushConstantBytes = program.pushConstantBytes;
+			}
+
+			for (const Program &program : programs)
+			{
+				for (const Program::Ubo &ubo : program.ubos)
+					ubos.push_back(UniformBlock{ AddString(ubo.name), ubo.binding, ubo.sizeBytes });
+
+				bindings.insert(bindings.end(), program.bindings.begin(), program.bindings.end());
+				vertexInputs.insert(vertexInputs.end(), program.vertexInputs.begin(), program.vertexInputs.end());
+			}
+
+			if (end + strings.size() > UINT32_MAX)
+				return false;
+
+			header.fileBytes = stringsOffset + (uint32_t)strings.size();
+
+			std::string &bytes = *outBytes;
+
+			bytes.assign(header.fileBytes, '\0');
+			std::memcpy(&bytes[0], &header, sizeof(header));
+			std::memcpy(&bytes[header.bucketsOffset], seeds.data(), seeds.size() * sizeof(uint32_t));
+			if (!entries.empty())
+				std::memcpy(&bytes[header.entriesOffset], entries.data(), entries.size() * sizeof(Entry));
+			if (!ubos.empty())
+				std::memcpy(&bytes[ubosOffsets.front()], ubos.data(), ubos.size() * sizeof(UniformBlock));
+			if (!bindings.empty())
+				std::memcpy(&bytes[bindingsOffsets.front()], bindings.data(), bindings.size() * sizeof(DescriptorBinding));
+			if (!vertexInputs.empty())
+				std::memcpy(&bytes[vertexInputsOffsets.front()], vertexInputs.data(), vertexInputs.size() * sizeof(VertexInput));
+			for (size_t programIndex = 0; programIndex < programs.size(); ++programIndex)
+			{
+				const std::vector<uint32_t> &words = programs[programIndex].words;
+
+				if (!words.empty() && !sharedProgram[programIndex])
+					std::memcpy(&bytes[programOffsets[programIndex]], words.data(), words.size() * sizeof(uint32_t));
+			}
+			std::memcpy(&bytes[stringsOffset], strings.data(), strings.size());
+
+			return true;
+		}
+
+		bool View(const void *data, size_t size, Pack *outPack)
+		{
+			const uint8_t * const bytes = (const uint8_t *)data;
+
+			if (size < sizeof(FileHeader) || (uintptr_t)data % sizeof(uint32_t) != 0 || bytes[size - 1] != 0)
+				return false;
+
+			const FileHeader &header = *(const FileHeader *)data;
+
+			if (header.magic != MAGIC || header.version != VERSION || header.fileBytes != size || header.bucketCount == 0)
+				return false;
+
+			if (header.bucketsOffset % sizeof(uint32_t) != 0 || !InRange(header.bucketsOffset, (uint64_t)header.bucketCount * sizeof(uint32_t), size))
+				return false;
+
+			if (header.entriesOffset % sizeof(uint32_t) != 0 || !InRange(header.entriesOffset, (uint64_t)header.shaderCount * sizeof(Entry), size))
+				return false;
+
+			const Entry * const entries = (const Entry *)(bytes + header.entriesOffset);
+
+			for (uint32_t entryIndex = 0; entryIndex < header.shaderCount; ++entryIndex)
+			{
+				const Entry &entry = entries[entryIndex];
+
+				if (entry.nameOffset >= size || entry.entryPointOffset >= size)
+					return false;
+
+				if (entry.programOffset % sizeof(uint32_t) != 0 || !InRange(entry.programOffset, (uint64_t)entry.programWords * sizeof(uint32_t), size))
+					return false;
+
+				if (entry.ubosOffset % sizeof(uint32_t) != 0 || !InRange(entry.ubosOffset, (uint64_t)entry.uboCount * sizeof(UniformBlock), size))
+					return false;
+
+				if (entry.bindingsOffset % sizeof(uint32_t) != 0 || !InRange(entry.bindingsOffset, (uint64_t)entry.bindingCount * sizeof(DescriptorBinding), size))
+					return false;
+
+				if (entry.vertexInputsOffset % sizeof(uint32_t) != 0 || !InRange(entry.vertexInputsOffset, (uint64_t)entry.vertexInputCount * sizeof(VertexInput), size))
+					return false;
+			}
+
+			outPack->data = bytes;
+			outPack->size = size;
+			outPack->mapped = false;
+			return true;
+		}
+
+		bool Open(const char *path, Pack *outPack)
+		{
+			const void *view = nullptr;
+			size_t size = 0;
+
+#if defined(_WIN32)
+			// Shared for delete, so glsltoc can rename a new pack over a mapped one.
+			const HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			LARGE_INTEGER fileSize;
+
+			if (file == INVALID_HANDLE_VALUE)
+				return false;
+
+			if (GetFileSizeEx(file, &fileSize) && (uint64_t)fileSize.QuadPart >= sizeof(FileHeader) && (uint64_t)fileSize.QuadPart <= UINT32_MAX)
+			{
+				const HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+				if (mapping)
+				{
+					view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+					size = (size_t)fileSize.QuadPart;
+					CloseHandle(mapping);
+				}
+			}
+
+			CloseHandle(file);
+
+			if (!view)
+				return false;
+
+			if (!View(view, size, outPack))
+			{
+				UnmapViewOfFile(view);
+				return false;
+			}
+#else
+			const int file = open(path, O_RDONLY);
+			struct stat fileStat;
+
+			if (file < 0)
+				return false;
+
+			if (fstat(file, &fileStat) == 0 && (uint64_t)fileStat.st_size >= sizeof(FileHeader) && (uint64_t)fileStat.st_size <= UINT32_MAX)
+			{
+				size = (size_t)fileStat.st_size;
+				view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+				if (view == MAP_FAILED)
+					view = nullptr;
+			}
+
+			close(file);
+
+			if (!view)
+				return false;
+
+			if (!View(view, size, outPack))
+			{
+				munmap(const_cast<void *>(view), size);
+				return false;
+			}
+#endif
+
+			outPack->mapped = true;
+			return true;
+		}
+
+		void Close(Pack *inoutPack)
+		{
+			if (inoutPack->mapped)
+			{
+#if defined(_WIN32)
+				UnmapViewOfFile(inoutPack->data);
+#else
+				munmap(const_cast<uint8_t *>(inoutPack->data), inoutPack->size);
+#endif
+			}
+
+			*inoutPack = Pack();
+		}
+
+		uint32_t ShaderCount(const Pack &pack)
+		{
+			return Header(pack).shaderCount;
+		}
+
+		const Entry &GetEntry(const Pack &pack, uint32_t entryIndex)
+		{
+			return ((const Entry *)(pack.data + Header(pack).entriesOffset))[entryIndex];
+		}
+
+		const Entry *Find(const Pack &pack, const char *name)
+		{
+			const FileHeader &header = Header(pack);
+
+			if (header.shaderCount == 0)
+				return nullptr;
+
+			const uint32_t * const seeds = (const uint32_t *)(pack.data + header.bucketsOffset);
+			const uint32_t seed = seeds[HashName(name, 0) % header.bucketCount];
+			const Entry &entry = GetEntry(pack, HashName(name, seed) % header.shaderCount);
+
+			return std::strcmp(String(pack, entry.nameOffset), name) == 0 ? &entry : nullptr;
+		}
+
+		const uint32_t *ProgramWords(const Pack &pack, const Entry &entry)
+		{
+			return (const uint32_t *)(pack.data + entry.programOffset);
+		}
+
+		const UniformBlock *UniformBlocks(const Pack &pack, const Entry &entry)
+		{
+			return (const UniformBlock *)(pack.data + entry.ubosOffset);
+		}
+
+		const DescriptorBinding *DescriptorBindings(const Pack &pack, const Entry &entry)
+		{
+			return (const DescriptorBinding *)(pack.data + entry.bindingsOffset);
+		}
+
+		const VertexInput *VertexInputs(const Pack &pack, const Entry &entry)
+		{
+			return (const VertexInput *)(pack.data + entry.vertexInputsOffset);
+		}
+
+		const char *String(const Pack &pack, uint32_t offset)
+		{
+			return (const char *)(pack.data + offset);
+		}
+	}
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Compiled SPIR-V programs with their reflection in one binary file, written
+// by glsltoc -p and loaded by mapping the file into memory. Everything is used
+// where it lies, so opening a pack costs a map and a header check however many
+// programs it holds, and programs go to vkCreateShaderModule without copies.
+// Names are found through a minimal perfect hash built when the pack is
+// written: a lookup hashes the name twice and compares one string.
+namespace sdf
+{
+	namespace shaderpack
+	{
+		static const uint32_t MAGIC = 0x4b505653;       // "SVPK"
+		static const uint32_t VERSION = 2;
+		static const uint32_t PROGRAM_ALIGNMENT = 16;   // bytes, for each program's first word
+
+		// Same order as ShaderStageType in glsltoc's generated reflection.
+		enum class Stage : uint32_t
+		{
+			VERTEX,
+			TESS_CONTROL,
+			TESS_EVAL,
+			GEOMETRY,
+			FRAGMENT,
+			COMPUTE
+		};
+
+		// File layout: this header, the bucket seeds, the entries, every uniform
+		// block, descriptor binding and vertex input, the programs and then the
+		// strings. Offsets are in bytes from the
+		// start of the file. Strings are null terminated and the file ends with
+		// one, so no string runs off its end.
+		struct FileHeader
+		{
+			uint32_t magic;
+			uint32_t version;
+			uint32_t fileBytes;
+			uint32_t shaderCount;
+			uint32_t bucketCount;
+			uint32_t bucketsOffset;   // a hash seed per bucket
+			uint32_t entriesOffset;   // an Entry per shader, at its name's slot
+			uint32_t reserved;
+		};
+
+		struct UniformBlock
+		{
+			uint32_t nameOffset;
+			uint32_t binding;
+			uint32_t sizeBytes;
+		};
+
+		struct DescriptorBinding
+		{
+			uint32_t set;
+			uint32_t binding;
+			uint32_t type;    // a VkDescriptorType
+			uint32_t count;   // array elements
+		};
+
+		// Same order as ShaderComponentType in glsltoc's generated reflection.
+		enum class ComponentType : uint32_t
+		{
+			FLOAT,
+			INT,
+			UINT,
+			DOUBLE
+		};
+
+		struct VertexInput
+		{
+			uint32_t location;
+			uint32_t components;   // of a vector, or a matrix column
+			uint32_t locations;    // matrix columns times array elements
+			ComponentType componentType;
+		};
+
+		// Carries everything a pipeline layout and vertex input state are built
+		// from, so a packed program never pairs with compiled in reflection.
+		struct Entry
+		{
+			uint32_t nameOffset;
+			uint32_t entryPointOffset;
+			uint32_t programOffset;
+			uint32_t programWords;
+			uint32_t ubosOffset;
+			uint32_t uboCount;
+			Stage stage;
+			uint32_t inputCount;
+			uint32_t outputCount;
+			uint32_t bindingsOffset;       // by set, then binding
+			uint32_t bindingCount;
+			uint32_t vertexInputsOffset;   // by location
+			uint32_t vertexInputCount;
+			uint32_t pushConstantBytes;
+		};
+
+		// What Write takes for each program.
+		struct Program
+		{
+			struct Ubo
+			{
+				std::string name;
+				uint32_t binding;
+				uint32_t sizeBytes;
+			};
+
+			std::string name;         // what Find looks for, as "trivial.vert"
+			std::string entryPoint = "main";
+			Stage stage;
+			std::vector<uint32_t> words;
+			std::vector<Ubo> ubos;
+			std::vector<DescriptorBinding> bindings;
+			std::vector<VertexInput> vertexInputs;
+			uint32_t pushConstantBytes = 0;
+			uint32_t inputCount = 0;
+			uint32_t outputCount = 0;
+		};
+
+		// A pack mapped by Open, or over bytes already in memory from View.
+		struct Pack
+		{
+			const uint8_t *data = nullptr;
+			size_t size = 0;
+			bool mapped = false;
+		};
+
+		// Lays out a pack of programs, storing programs with the same words once.
+		// Fails when two programs share a name.
+		bool Write(const std::vector<Program> &programs, std::string *outBytes);
+
+		// Maps the file read only. Fails when it is missing or isn't a pack of
+		// this version; the header and entry ranges are checked, programs are not.
+		bool Open(const char *path, Pack *outPack);
+
+		// The same checks over bytes the caller keeps alive, 4 byte aligned.
+		bool View(const void *data, size_t size, Pack *outPack);
+
+		// Unmaps a pack from Open. Pointers into it are dangling after.
+		void Close(Pack *inoutPack);
+
+		uint32_t ShaderCount(const Pack &pack);
+
+		// Entry index is the hash slot, so entries aren't in any useful order.
+		const Entry &GetEntry(const Pack &pack, uint32_t entryIndex);
+
+		// Null when the pack holds no shader of that name.
+		const Entry *Find(const Pack &pack, const char *name);
+
+		const uint32_t *ProgramWords(const Pack &pack, const Entry &entry);
+		const UniformBlock *UniformBlocks(const Pack &pack, const Entry &entry);
+		const DescriptorBinding *DescriptorBindings(const Pack &pack, const Entry &entry);
+		const VertexInput *VertexInputs(const Pack &pack, const Entry &entry);
+		const char *String(const Pack &pack, uint32_t offset);
+	}
+}
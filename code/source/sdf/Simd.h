@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <emmintrin.h>
+#if defined(__AVX__)
+# include <immintrin.h>
+#endif //#if defined(__AVX__)
+
+// 8-wide float packets. Uses AVX when the compiler targets it (/arch:AVX2, -mavx2),
+// otherwise a pair of SSE2 registers. Masks are float8s with all bits set per true lane.
+namespace sdf
+{
+	namespace simd
+	{
+		static const unsigned WIDTH = 8;
+
+#if defined(__AVX__)
+		struct float8
+		{
+			__m256 v;
+		};
+
+		inline float8 Set1(float f) { return { _mm256_set1_ps(f) }; }
+		inline float8 Set1Bits(uint32_t bits) { return { _mm256_castsi256_ps(_mm256_set1_epi32((int)bits)) }; }
+		inline float8 Zero() { return { _mm256_setzero_ps() }; }
+		inline float8 Load(const float *src) { return { _mm256_loadu_ps(src) }; }
+		inline void Store(float *dst, float8 a) { _mm256_storeu_ps(dst, a.v); }
+
+		inline float8 operator+(float8 a, float8 b) { return { _mm256_add_ps(a.v, b.v) }; }
+		inline float8 operator-(float8 a, float8 b) { return { _mm256_sub_ps(a.v, b.v) }; }
+		inline float8 operator*(float8 a, float8 b) { return { _mm256_mul_ps(a.v, b.v) }; }
+		inline float8 operator/(float8 a, float8 b) { return { _mm256_div_ps(a.v, b.v) }; }
+		inline float8 Min(float8 a, float8 b) { return { _mm256_min_ps(a.v, b.v) }; }
+		inline float8 Max(float8 a, float8 b) { return { _mm256_max_ps(a.v, b.v) }; }
+		inline float8 Sqrt(float8 a) { return { _mm256_sqrt_ps(a.v) }; }
+		inline float8 Floor(float8 a) { return { _mm256_floor_ps(a.v) }; }
+
+		inline float8 And(float8 a, float8 b) { return { _mm256_and_ps(a.v, b.v) }; }
+		inline float8 Or(float8 a, float8 b) { return { _mm256_or_ps(a.v, b.v) }; }
+		inline float8 AndNot(float8 a, float8 b) { return { _mm256_andnot_ps(a.v, b.v) }; }
+		inline float8 Xor(float8 a, float8 b) { return { _mm256_xor_ps(a.v, b.v) }; }
+
+		inline float8 CmpLt(float8 a, float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+		inline float8 CmpLe(float8 a, float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+		inline float8 CmpGt(float8 a, float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+		inline float8 CmpGe(float8 a, float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+
+		inline unsigned MoveMask(float8 a) { return (unsigned)_mm256_movemask_ps(a.v); }
+#else //#if defined(__AVX__)
+		struct float8
+		{
+			__m128 lo;
+			__m128 hi;
+		};
+
+		inline float8 Set1(float f) { const __m128 s = _mm_set1_ps(f); return { s, s }; }
+		inline float8 Set1Bits(uint32_t bits) { const __m128 s = _mm_castsi128_ps(_mm_set1_epi32((int)bits)); return { s, s }; }
+		inline float8 Zero() { return { _mm_setzero_ps(), _mm_setzero_ps() }; }
+		inline float8 Load(const float *src) { return { _mm_loadu_ps(src), _mm_loadu_ps(src + 4) }; }
+		inline void Store(float *dst, float8 a) { _mm_storeu_ps(dst, a.lo); _mm_storeu_ps(dst + 4, a.hi); }
+
+		inline float8 operator+(float8 a, float8 b) { return { _mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi) }; }
+		inline float8 operator-(float8 a, float8 b) { return { _mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi) }; }
+		inline float8 operator*(float8 a, float8 b) { return { _mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi) }; }
+		inline float8 operator/(float8 a, float8 b) { return { _mm_div_ps(a.lo, b.lo), _mm_div_ps(a.hi, b.hi) }; }
+		inline float8 Min(float8 a, float8 b) { return { _mm_min_ps(a.lo, b.lo), _mm_min_ps(a.hi, b.hi) }; }
+		inline float8 Max(float8 a, float8 b) { return { _mm_max_ps(a.lo, b.lo), _mm_max_ps(a.hi, b.hi) }; }
+		inline float8 Sqrt(float8 a) { return { _mm_sqrt_ps(a.lo), _mm_sqrt_ps(a.hi) }; }
+
+		inline float8 And(float8 a, float8 b) { return { _mm_and_ps(a.lo, b.lo), _mm_and_ps(a.hi, b.hi) }; }
+		inline float8 Or(float8 a, float8 b) { return { _mm_or_ps(a.lo, b.lo), _mm_or_ps(a.hi, b.hi) }; }
+		inline float8 AndNot(float8 a, float8 b) { return { _mm_andnot_ps(a.lo, b.lo), _mm_andnot_ps(a.hi, b.hi) }; }
+		inline float8 Xor(float8 a, float8 b) { return { _mm_xor_ps(a.lo, b.lo), _mm_xor_ps(a.hi, b.hi) }; }
+
+		inline float8 CmpLt(float8 a, float8 b) { return { _mm_cmplt_ps(a.lo, b.lo), _mm_cmplt_ps(a.hi, b.hi) }; }
+		inline float8 CmpLe(float8 a, float8 b) { return { _mm_cmple_ps(a.lo, b.lo), _mm_cmple_ps(a.hi, b.hi) }; }
+		inline float8 CmpGt(float8 a, float8 b) { return { _mm_cmpgt_ps(a.lo, b.lo), _mm_cmpgt_ps(a.hi, b.hi) }; }
+		inline float8 CmpGe(float8 a, float8 b) { return { _mm_cmpge_ps(a.lo, b.lo), _mm_cmpge_ps(a.hi, b.hi) }; }
+
+		inline unsigned MoveMask(float8 a) { return (unsigned)(_mm_movemask_ps(a.lo) | (_mm_movemask_ps(a.hi) << 4)); }
+
+		inline float8 Floor(float8 a)
+		{
+			// SSE2 has no round instruction; truncate and fix up negatives.
+			const __m128 lo = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.lo));
+			const __m128 hi = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.hi));
+			const __m128 one = _mm_set1_ps(1.0f);
+
+			return { _mm_sub_ps(lo, _mm_and_ps(_mm_cmpgt_ps(lo, a.lo), one)), _mm_sub_ps(hi, _mm_and_ps(_mm_cmpgt_ps(hi, a.hi), one)) };
+		}
+#endif //#else //#if defined(__AVX__)
+
+		inline float8 operator-(float8 a) { return Xor(a, Set1Bits(0x80000000u)); }
+		inline float8 Abs(float8 a) { return AndNot(Set1Bits(0x80000000u), a); }
+		inline float8 Select(float8 mask, float8 ifTrue, float8 ifFalse) { return Or(And(mask, ifTrue), AndNot(mask, ifFalse)); }
+		inline float8 Clamp(float8 a, float8 lo, float8 hi) { return Min(Max(a, lo), hi); }
+		inline float8 AllBits() { return Set1Bits(~0u); }
+
+		inline bool Any(float8 mask) { return MoveMask(mask) != 0; }
+
+		inline float8 Length(float8 x, float8 y) { return Sqrt(x * x + y * y); }
+		inline float8 Length(float8 x, float8 y, float8 z) { return Sqrt(x * x + y * y + z * z); }
+
+		inline float Lane(float8 a, unsigned lane)
+		{
+			float lanes[WIDTH];
+
+			Store(lanes, a);
+			return lanes[lane];
+		}
+
+		inline uint32_t LaneBits(float8 a, unsigned lane)
+		{
+			const float f = Lane(a, lane);
+			uint32_t bits;
+
+			std::memcpy(&bits, &f, sizeof(bits));
+			return bits;
+		}
+
+		inline float HorizontalSum(float8 a)
+		{
+			float lanes[WIDTH];
+			float sum = 0.0f;
+
+			Store(lanes, a);
+			for (unsigned lane = 0; lane < WIDTH; ++lane)
+				sum += lanes[lane];
+
+			return sum;
+		}
+	}
+}
@@ -0,0 +1,260 @@
+#include "SpirvCodec.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace sdf
+{
+	namespace spirvcodec
+	{
+		namespace
+		{
+			static const size_t MIN_MATCH = 4;
+			static const size_t MAX_OFFSET = 0xffff;
+			static const uint32_t HASH_BITS = 14;
+
+			void WriteVarint(uint32_t value, std::vector<uint8_t> *outBytes)
+			{
+				while (value >= 0x80)
+				{
+					outBytes->push_back((uint8_t)(value | 0x80));
+					value >>= 7;
+				}
+
+				outBytes->push_back((uint8_t)value);
+			}
+
+			bool ReadVarint(const uint8_t **inoutIn, const uint8_t *end, uint32_t *outValue)
+			{
+				const uint8_t *in = *inoutIn;
+				uint32_t value = 0;
+				uint8_t byte;
+
+				for (uint32_t shift = 0;; shift += 7)
+				{
+					if (in == end || shift > 28)
+						return false;
+
+					byte = *in++;
+					value |= (uint32_t)(byte & 0x7f) << shift;
+
+					if (!(byte & 0x80))
+						break;
+				}
+
+				*inoutIn = in;
+				*outValue = value;
+				return true;
+			}
+
+			// The part of a length past its token nibble, as 255s and a remainder.
+			void WriteLength(size_t length, std::vector<uint8_t> *outBytes)
+			{
+				for (; length >= 255; length -= 255)
+					outBytes->push_back(255);
+
+				outBytes->push_back((uint8_t)length);
+			}
+
+			bool ReadLength(const uint8_t **inoutIn, const uint8_t *end, size_t *inoutLength)
+			{
+				uint8_t byte;
+
+				do
+				{
+					if (*inoutIn == end)
+						return false;
+
+					byte = *(*inoutIn)++;
+					*inoutLength += byte;
+				} while (byte == 255);
+
+				return true;
+			}
+
+			// A token with the literal count and match length in its nibbles, the
+			// literals, then the match offset. The last sequence has no match.
+			void WriteSequence(const uint8_t *literals, size_t literalCount, size_t offset, size_t matchLength, std::vector<uint8_t> *outBytes)
+			{
+				const size_t extraMatch = matchLength ? matchLength - MIN_MATCH : 0;
+
+				outBytes->push_back((uint8_t)((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(extraMatch, 15)));
+				if (literalCount >= 15)
+					WriteLength(literalCount - 15, outBytes);
+				outBytes->insert(outBytes->end(), literals, literals + literalCount);
+
+				if (!matchLength)
+					return;
+
+				outBytes->push_back((uint8_t)offset);
+				outBytes->push_back((uint8_t)(offset >> 8));
+				if (extraMatch >= 15)
+					WriteLength(extraMatch - 15, outBytes);
+			}
+
+			// Greedy, taking the last position with the same 4 bytes.
+			void Compress(const uint8_t *src, size_t size, std::vector<uint8_t> *outBytes)
+			{
+				std::vector<uint32_t> lastPositions(1u << HASH_BITS, 0);   // position + 1, 0 when none
+				size_t anchor = 0;
+				size_t pos = 0;
+
+				while (pos + MIN_MATCH <= size)
+				{
+					uint32_t sequence;
+
+					std::memcpy(&sequence, src + pos, sizeof(sequence));
+
+					const uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+					const size_t candidate = lastPositions[hash];
+
+					lastPositions[hash] = (uint32_t)(pos + 1);
+
+					if (candidate == 0 || pos + 1 - candidate > MAX_OFFSET || std::memcmp(src + candidate - 1, src + pos, MIN_MATCH) != 0)
+					{
+						++pos;
+						continue;
+					}
+
+					const size_t match = candidate - 1;
+					size_t length = MIN_MATCH;
+
+					while (pos + length < size && src[match + length] == src[pos + length])
+						++length;
+
+					WriteSequence(src + anchor, pos - anchor, pos - match, length, outBytes);
+					pos += length;
+					anchor = pos;
+				}
+
+				WriteSequence(src + anchor, size - anchor, 0, 0, outBytes);
+			}
+
+			bool Decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t dstSize)
+			{
+				const uint8_t *in = src;
+				const uint8_t * const end = src + size;
+				uint8_t *out = dst;
+				uint8_t * const outEnd = dst + dstSize;
+
+				while (in < end)
+				{
+					const uint8_t token = *in++;
+					size_t literalCount = token >> 4;
+
+					if (literalCount == 15 && !ReadLength(&in, end, &literalCount))
+						return false;
+					if (literalCount > (size_t)(end - in) || literalCount > (size_t)(outEnd - out))
+						return false;
+
+					if (literalCount > 0)
+						std::memcpy(out, in, literalCount);
+					in += literalCount;
+					out += literalCount;
+
+					if (in == end)
+						break;
+					if (end - in < 2)
+						return false;
+
+					const size_t offset = in[0] | ((size_t)in[1] << 8);
+					size_t length = token & 15;
+
+					in += 2;
+					if (length == 15 && !ReadLength(&in, end, &length))
+						return false;
+					length += MIN_MATCH;
+
+					if (offset == 0 || offset > (size_t)(out - dst) || length > (size_t)(outEnd - out))
+						return false;
+
+					const uint8_t *match = out - offset;
+
+					if (offset >= length)
+					{
+						std::memcpy(out, match, length);
+						out += length;
+					}
+					else
+					{
+						for (size_t byteIndex = 0; byteIndex < length; ++byteIndex)
+							*out++ = *match++;
+					}
+				}
+
+				return out == outEnd;
+			}
+		}
+
+		void Encode(const uint32_t *words, size_t wordCount, std::vector<uint8_t> *outBytes)
+		{
+			std::vector<uint8_t> varints;
+
+			varints.reserve(wordCount * 2);
+			for (size_t wordIndex = 0; wordIndex < wordCount; ++wordIndex)
+				WriteVarint(words[wordIndex], &varints);
+
+			outBytes->clear();
+			WriteVarint((uint32_t)varints.size(), outBytes);
+			Compress(varints.data(), varints.size(), outBytes);
+		}
+
+		bool Decode(const uint8_t *bytes, size_t byteCount, uint32_t *outWords, size_t wordCount)
+		{
+			const uint8_t *in = bytes;
+			uint32_t varintBytes;
+
+			// Every word is 1 to 5 varint bytes.
+			if (!ReadVarint(&in, bytes + byteCount, &varintBytes) || varintBytes < wordCount || varintBytes > wordCount * 5)
+				return false;
+
+			std::vector<uint8_t> varints(varintBytes);
+
+			if (!Decompress(in, bytes + byteCount - in, varints.data(), varints.size()))
+				return false;
+
+			const uint8_t *varint = varints.data();
+			const uint8_t * const varintEnd = varint + varints.size();
+
+			for (size_t wordIndex = 0; wordIndex < wordCount; ++wordIndex)
+			{
+				if (!ReadVarint(&varint, varintEnd, &outWords[wordIndex]))
+					return false;
+			}
+
+			return varint == varintEnd;
+		}
+
+		const uint32_t *Get(Cache *inoutCache, const uint8_t *bytes, size_t byteCount, size_t wordCount)
+		{
+			Cache::Program *program;
+
+			{
+				std::lock_guard<std::mutex> lock(inoutCache->mutex);
+				std::unique_ptr<Cache::Program> &slot = inoutCache->programs[bytes];
+
+				if (!slot)
+					slot.reset(new Cache::Program);
+				program = slot.get();
+			}
+
+			std::call_once(program->decoded, [&]()
+			{
+				const auto start = std::chrono::high_resolution_clock::now();
+
+				program->words.resize(wordCount);
+				if (!Decode(bytes, byteCount, program->words.data(), wordCount))
+					program->words.clear();
+
+				const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+				std::lock_guard<std::mutex> lock(inoutCache->mutex);
+
+				inoutCache->stats.words += wordCount;
+				inoutCache->stats.bytes += byteCount;
+				inoutCache->stats.seconds += seconds;
+			});
+
+			return program->words.empty() ? nullptr : program->words.data();
+		}
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Compact encoding of SPIR-V for programs embedded by glsltoc -z. Words are
+// written as LEB128 varints, as ids, counts and most literals are small, and
+// the varint bytes then go through an LZ77 pass in the style of LZ4 blocks,
+// which picks up the repeated instruction shapes. Decoding is a single
+// forward pass over each stage with no tables to build.
+namespace sdf
+{
+	namespace spirvcodec
+	{
+		struct Stats
+		{
+			uint64_t words = 0;
+			uint64_t bytes = 0;   // encoded
+			double seconds = 0.0;
+		};
+
+		void Encode(const uint32_t *words, size_t wordCount, std::vector<uint8_t> *outBytes);
+
+		// Fails when the bytes are malformed or don't decode to wordCount words.
+		bool Decode(const uint8_t *bytes, size_t byteCount, uint32_t *outWords, size_t wordCount);
+
+		// Programs decoded the first time any thread asks for them, then kept.
+		// Keyed by where the encoded bytes live, so they have to outlive the cache.
+		struct Cache
+		{
+			struct Program
+			{
+				std::once_flag decoded;
+				std::vector<uint32_t> words;   // empty when decoding failed
+			};
+
+			std::mutex mutex;
+			std::unordered_map<const uint8_t *, std::unique_ptr<Program>> programs;
+			Stats stats;   // of the programs decoded so far
+		};
+
+		// Null when the bytes don't decode. Threads asking for a program another
+		// is decoding wait for it; different programs decode in parallel.
+		const uint32_t *Get(Cache *inoutCache, const uint8_t *bytes, size_t byteCount, size_t wordCount);
+	}
+}
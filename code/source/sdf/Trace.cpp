@@ -0,0 +1,296 @@
+#include "Trace.h"
+#include "Jobs.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+
+namespace sdf
+{
+	namespace trace
+	{
+		namespace
+		{
+			using simd::float8;
+
+			// Lane layout of a packet: 4 pixels wide, 2 high, for better coherence than a row of 8.
+			static const uint32_t PACKET_WIDTH = 4;
+			static const uint32_t PACKET_HEIGHT = 2;
+
+			struct alignas(64) ThreadStats
+			{
+				uint64_t rays;
+				uint64_t hits;
+				uint64_t steps;
+				uint64_t skips;
+				uint64_t evaluations;
+			};
+
+			struct Frame
+			{
+				glm::vec3 eye;
+				glm::vec3 forward;
+				glm::vec3 right;
+				glm::vec3 up;
+				float pixelCone; // world size of a pixel at unit distance
+			};
+
+			Frame MakeFrame(const Camera &camera, uint32_t width, uint32_t height)
+			{
+				const float tanHalf = std::tan(camera.fovY * 0.5f);
+				const float aspect = (float)width / (float)height;
+				Frame frame;
+
+				frame.eye = camera.eye;
+				frame.forward = glm::normalize(camera.target - camera.eye);
+				frame.right = glm::normalize(glm::cross(frame.forward, camera.up)) * (tanHalf * aspect);
+				frame.up = glm::normalize(glm::cross(frame.right, frame.forward)) * tanHalf;
+				frame.pixelCone = 2.0f * tanHalf / (float)height;
+
+				return frame;
+			}
+
+			glm::vec3 PrimitiveColor(uint32_t primitiveId)
+			{
+				if (primitiveId == 0)
+					return glm::vec3(0.55f, 0.55f, 0.5f);
+
+				uint32_t h = primitiveId * 0x9E3779B1u;
+				h ^= h >> 15;
+				h *= 0x85EBCA77u;
+				h ^= h >> 13;
+
+				return glm::vec3(0.25f + 0.75f * ((h & 0xFF) / 255.0f), 0.25f + 0.75f * (((h >> 8) & 0xFF) / 255.0f), 0.25f + 0.75f * (((h >> 16) & 0xFF) / 255.0f));
+			}
+
+			uint8_t ToByte(float linear)
+			{
+				const float srgbApprox = std::sqrt(glm::clamp(linear, 0.0f, 1.0f));
+
+				return (uint8_t)(srgbApprox * 255.0f + 0.5f);
+			}
+
+			// Moves active lanes standing in empty cells past every empty cell ahead
+			// of them, and stops lanes that leave maxDistance.
+			void SkipEmpty(const occupancy::Hierarchy &occupancy, const float8 origin[3], const float8 dir[3], const float8 invDir[3], const float8 &maxDistance, float8 *inoutT, float8 *inoutActive, float8 *inoutSkips)
+			{
+				for (float8 candidates = *inoutActive; simd::Any(candidates);)
+				{
+					const float8 pos[3] = { origin[0] + dir[0] * *inoutT, origin[1] + dir[1] * *inoutT, origin[2] + dir[2] * *inoutT };
+					const float8 skip = occupancy::SkipEmpty(occupancy, pos, invDir, candidates);
+
+					candidates = simd::CmpGt(skip, simd::Zero());
+					*inoutSkips = *inoutSkips + simd::And(candidates, simd::Set1(1.0f));
+					*inoutT = *inoutT + skip;
+					*inoutActive = simd::AndNot(simd::CmpGt(*inoutT, maxDistance), *inoutActive);
+					candidates = simd::And(candidates, *inoutActive);
+				}
+			}
+
+			void TracePacket(const program::Program &prog, const occupancy::Hierarchy *optOccupancy, const Frame &frame, const Settings &settings, uint32_t packetX, uint32_t packetY, Image *inoutImage, ThreadStats *inoutStats)
+			{
+				float dirs[3][simd::WIDTH];
+				float valid[simd::WIDTH];
+				uint32_t validCount = 0;
+
+				for (unsigned lane = 0; lane < simd::WIDTH; ++lane)
+				{
+					const uint32_t px = packetX + lane % PACKET_WIDTH;
+					const uint32_t py = packetY + lane / PACKET_WIDTH;
+					const float ndcX = ((px + 0.5f) / settings.width) * 2.0f - 1.0f;
+					const float ndcY = 1.0f - ((py + 0.5f) / settings.height) * 2.0f;
+					const glm::vec3 dir = glm::normalize(frame.forward + frame.right * ndcX + frame.up * ndcY);
+					const bool inImage = px < settings.width && py < settings.height;
+
+					dirs[0][lane] = dir.x;
+					dirs[1][lane] = dir.y;
+					dirs[2][lane] = dir.z;
+					valid[lane] = inImage ? -1.0f : 0.0f; // sign bit only, widened below
+					validCount += inImage;
+				}
+
+				const float8 ox = simd::Set1(frame.eye.x);
+				const float8 oy = simd::Set1(frame.eye.y);
+				const float8 oz = simd::Set1(frame.eye.z);
+				const float8 dx = simd::Load(dirs[0]);
+				const float8 dy = simd::Load(dirs[1]);
+				const float8 dz = simd::Load(dirs[2]);
+				const float8 one = simd::Set1(1.0f);
+				const float8 cone = simd::Set1(frame.pixelCone * settings.hitScale);
+				const float8 minHit = simd::Set1(1e-5f);
+				const float8 maxDist = simd::Set1(settings.maxDistance);
+				float8 active = simd::CmpLt(simd::Load(valid), simd::Zero());
+				float8 hit = simd::Zero();
+				float8 t = simd::Zero();
+				float8 steps = simd::Zero();
+				float8 ids = simd::Zero();
+				float8 skips = simd::Zero();
+				const float8 origin[3] = { ox, oy, oz };
+				const float8 dir[3] = { dx, dy, dz };
+				float8 invDir[3];
+
+				for (unsigned axis = 0; axis < 3; ++axis)
+					invDir[axis] = one / simd::Select(simd::CmpLt(simd::Abs(dir[axis]), simd::Set1(1e-20f)), simd::Set1(1e-20f), dir[axis]);
+
+				for (uint32_t step = 0; step < settings.maxSteps && simd::Any(active); ++step)
+				{
+					float8 dist, stepIds;
+
+					if (optOccupancy)
+					{
+						SkipEmpty(*optOccupancy, origin, dir, invDir, maxDist, &t, &active, &skips);
+
+						if (!simd::Any(active))
+							break;
+					}
+
+					program::EvaluatePacket(prog, ox + dx * t, oy + dy * t, oz + dz * t, &dist, &stepIds);
+					++inoutStats->evaluations;
+
+					steps = steps + simd::And(active, one);
+
+					// Per lane termination: lanes that hit or escape stop advancing, the rest keep marching.
+					const float8 laneHit = simd::And(active, simd::CmpLt(dist, simd::Max(minHit, cone * t)));
+					hit = simd::Or(hit, laneHit);
+					ids = simd::Select(laneHit, stepIds, ids);
+					active = simd::AndNot(laneHit, active);
+
+					t = t + simd::And(active, dist);
+					active = simd::AndNot(simd::CmpGt(t, maxDist), active);
+				}
+
+				inoutStats->rays += validCount;
+				inoutStats->steps += (uint64_t)simd::HorizontalSum(steps);
+				inoutStats->skips += (uint64_t)simd::HorizontalSum(skips);
+
+				float normals[3][simd::WIDTH] = {};
+				const unsigned hitBits = simd::MoveMask(hit);
+
+				if (hitBits)
+				{
+					const float8 px = ox + dx * t;
+					const float8 py = oy + dy * t;
+					const float8 pz = oz + dz * t;
+					float8 dist;
+					float8 n[3];
+
+					// One dual number pass instead of 6 taps. Lanes sitting on a kink in the
+					// field get patched with central differences inside the call.
+					program::EvaluatePacketGradient(prog, px, py, pz, &dist, n, nullptr);
+					inoutStats->evaluations += 1;
+
+					const float8 invLen = one / simd::Max(simd::Length(n[0], n[1], n[2]), simd::Set1(1e-20f));
+					for (unsigned axis = 0; axis < 3; ++axis)
+						simd::Store(normals[axis], n[axis] * invLen);
+				}
+
+				const glm::vec3 lightDir = glm::normalize(glm::vec3(0.6f, 0.8f, 0.4f));
+
+				for (unsigned lane = 0; lane < simd::WIDTH; ++lane)
+				{
+					const uint32_t px = packetX + lane % PACKET_WIDTH;
+					const uint32_t py = packetY + lane / PACKET_WIDTH;
+
+					if (px >= settings.width || py >= settings.height)
+						continue;
+
+					glm::vec3 color;
+
+					if (hitBits & (1u << lane))
+					{
+						const glm::vec3 n(normals[0][lane], normals[1][lane], normals[2][lane]);
+						const float diffuse = std::max(glm::dot(n, lightDir), 0.0f);
+						const float sky = 0.5f + 0.5f * n.y;
+
+						color = PrimitiveColor(simd::LaneBits(ids, lane)) * (0.15f + 0.2f * sky + 0.75f * diffuse);
+						++inoutStats->hits;
+					}
+					else
+					{
+						const float skyT = 0.5f + 0.5f * dirs[1][lane];
+
+						color = glm::mix(glm::vec3(0.9f, 0.9f, 0.95f), glm::vec3(0.35f, 0.5f, 0.8f), skyT);
+					}
+
+					uint8_t * const dst = &inoutImage->rgb[(py * settings.width + px) * 3];
+					dst[0] = ToByte(color.x);
+					dst[1] = ToByte(color.y);
+					dst[2] = ToByte(color.z);
+				}
+			}
+		}
+
+		Camera DefaultCamera()
+		{
+			Camera camera;
+			camera.eye = glm::vec3(0.0f, 1.5f, 4.5f);
+			camera.target = glm::vec3(0.0f, -0.4f, 0.0f);
+			camera.up = glm::vec3(0.0f, 1.0f, 0.0f);
+			camera.fovY = glm::radians(45.0f);
+
+			return camera;
+		}
+
+		bool Render(const program::Program &prog, const occupancy::Hierarchy *optOccupancy, const Camera &camera, const Settings &settings, Image *outImage, Stats *outoptStats)
+		{
+			if (settings.width == 0 || settings.height == 0 || prog.code.empty())
+				return false;
+
+			const auto startTime = std::chrono::high_resolution_clock::now();
+			const uint32_t tileSize = std::max<uint32_t>((settings.tileSize + PACKET_WIDTH - 1) / PACKET_WIDTH * PACKET_WIDTH, PACKET_WIDTH);
+			const uint32_t tilesX = (settings.width + tileSize - 1) / tileSize;
+			const uint32_t tilesY = (settings.height + tileSize - 1) / tileSize;
+			const unsigned threadCount = settings.threadCount ? settings.threadCount : jobs::HardwareThreadCount();
+			const Frame frame = MakeFrame(camera, settings.width, settings.height);
+			std::vector<ThreadStats> threadStats(threadCount, ThreadStats{});
+
+			outImage->width = settings.width;
+			outImage->height = settings.height;
+			outImage->rgb.assign((size_t)settings.width * settings.height * 3, 0);
+
+			jobs::ParallelFor(tilesX * tilesY, threadCount, [&](uint32_t tileIndex, unsigned threadIndex)
+			{
+				const uint32_t tileX = (tileIndex % tilesX) * tileSize;
+				const uint32_t tileY = (tileIndex / tilesX) * tileSize;
+				const uint32_t endX = std::min(tileX + tileSize, settings.width);
+				const uint32_t endY = std::min(tileY + tileSize, settings.height);
+
+				for (uint32_t y = tileY; y < endY; y += PACKET_HEIGHT)
+					for (uint32_t x = tileX; x < endX; x += PACKET_WIDTH)
+						TracePacket(prog, optOccupancy, frame, settings, x, y, outImage, &threadStats[threadIndex]);
+			});
+
+			if (outoptStats)
+			{
+				*outoptStats = Stats();
+
+				for (const ThreadStats &stats : threadStats)
+				{
+					outoptStats->rays += stats.rays;
+					outoptStats->hits += stats.hits;
+					outoptStats->steps += stats.steps;
+					outoptStats->skips += stats.skips;
+					outoptStats->evaluations += stats.evaluations;
+				}
+
+				outoptStats->seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+			}
+
+			return true;
+		}
+
+		bool WritePPM(const char *fileName, const Image &image)
+		{
+			FILE * const file = std::fopen(fileName, "wb");
+
+			if (!file)
+				return false;
+
+			std::fprintf(file, "P6\n%u %u\n255\n", image.width, image.height);
+			const size_t written = std::fwrite(image.rgb.data(), 1, image.rgb.size(), file);
+			std::fclose(file);
+
+			return written == image.rgb.size();
+		}
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Occupancy.h"
+#include "Program.h"
+#include <vector>
+
+// CPU reference sphere tracer. Needs no GPU, so it doubles as the golden image
+// oracle for the GPU raymarchers and as a throughput benchmark.
+namespace sdf
+{
+	namespace trace
+	{
+		struct Camera
+		{
+			glm::vec3 eye;
+			glm::vec3 target;
+			glm::vec3 up;
+			float fovY; // radians
+		};
+
+		struct Settings
+		{
+			uint32_t width = 640;
+			uint32_t height = 480;
+			uint32_t tileSize = 32;      // rounded up to a multiple of the 4x2 packet footprint
+			uint32_t maxSteps = 256;
+			float maxDistance = 50.0f;
+			float hitScale = 1.0f;       // hit when distance < hitScale * pixel footprint at t
+			unsigned threadCount = 0;    // 0 uses every hardware thread
+		};
+
+		struct Stats
+		{
+			uint64_t rays = 0;
+			uint64_t hits = 0;
+			uint64_t steps = 0;          // primary ray steps, summed over rays
+			uint64_t skips = 0;          // empty occupancy cells primary rays stepped over, likewise
+			uint64_t evaluations = 0;    // packet evaluations including normals
+			double seconds = 0.0;
+		};
+
+		struct Image
+		{
+			uint32_t width = 0;
+			uint32_t height = 0;
+			std::vector<uint8_t> rgb;
+		};
+
+		Camera DefaultCamera();
+
+		// With an occupancy hierarchy, rays step over its empty cells before
+		// sphere tracing. It should hold prog's surface, or what it misses is
+		// skipped too.
+		bool Render(const program::Program &prog, const occupancy::Hierarchy *optOccupancy, const Camera &camera, const Settings &settings, Image *outImage, Stats *outoptStats);
+
+		bool WritePPM(const char *fileName, const Image &image);
+	}
+}
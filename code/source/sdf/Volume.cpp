@@ -0,0 +1,181 @@
+#include "Volume.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace sdf
+{
+	namespace volume
+	{
+		namespace
+		{
+			static const char FILE_MAGIC[4] = { 'S', 'D', 'F', 'V' };
+			static const uint32_t FILE_VERSION = 1;
+
+			struct FileHeader
+			{
+				char magic[4];
+				uint32_t version;
+				uint32_t dims[3];
+				float origin[3];
+				float voxelSize;
+			};
+
+			// pos must be inside the grid.
+			float Trilinear(const Grid &grid, const glm::vec3 &pos, glm::vec3 *outoptGrad)
+			{
+				const glm::vec3 f = (pos - grid.origin) / grid.voxelSize;
+				uint32_t cell[3];
+				float t[3];
+
+				for (unsigned axis = 0; axis < 3; ++axis)
+				{
+					const float clamped = std::min(std::max(f[axis], 0.0f), (float)(grid.dims[axis] - 1));
+
+					cell[axis] = std::min((uint32_t)clamped, grid.dims[axis] - 2);
+					t[axis] = clamped - (float)cell[axis];
+				}
+
+				const size_t dx = 1;
+				const size_t dy = grid.dims.x;
+				const size_t dz = (size_t)grid.dims.x * grid.dims.y;
+				const float * const v = grid.values.data() + Index(grid, cell[0], cell[1], cell[2]);
+
+				const float x00 = v[0] + (v[dx] - v[0]) * t[0];
+				const float x10 = v[dy] + (v[dy + dx] - v[dy]) * t[0];
+				const float x01 = v[dz] + (v[dz + dx] - v[dz]) * t[0];
+				const float x11 = v[dz + dy] + (v[dz + dy + dx] - v[dz + dy]) * t[0];
+				const float y0 = x00 + (x10 - x00) * t[1];
+				const float y1 = x01 + (x11 - x01) * t[1];
+
+				if (outoptGrad)
+				{
+					const float gx00 = v[dx] - v[0];
+					const float gx10 = v[dy + dx] - v[dy];
+					const float gx01 = v[dz + dx] - v[dz];
+					const float gx11 = v[dz + dy + dx] - v[dz + dy];
+					const float gx0 = gx00 + (gx10 - gx00) * t[1];
+					const float gx1 = gx01 + (gx11 - gx01) * t[1];
+					const float gy0 = x10 - x00;
+					const float gy1 = x11 - x01;
+
+					outoptGrad->x = (gx0 + (gx1 - gx0) * t[2]) / grid.voxelSize;
+					outoptGrad->y = (gy0 + (gy1 - gy0) * t[2]) / grid.voxelSize;
+					outoptGrad->z = (y1 - y0) / grid.voxelSize;
+				}
+
+				return y0 + (y1 - y0) * t[2];
+			}
+		}
+
+		glm::vec3 MinCorner(const Grid &grid)
+		{
+			return grid.origin;
+		}
+
+		glm::vec3 MaxCorner(const Grid &grid)
+		{
+			return grid.origin + glm::vec3(grid.dims - glm::uvec3(1)) * grid.voxelSize;
+		}
+
+		float Sample(const Grid &grid, const glm::vec3 &pos)
+		{
+			const glm::vec3 clamped = glm::clamp(pos, MinCorner(grid), MaxCorner(grid));
+			const float outside = glm::length(pos - clamped);
+			const float border = Trilinear(grid, clamped, nullptr);
+
+			// The surface is inside the grid, so it is at least as far as the grid
+			// itself, and the field is 1-Lipschitz from the nearest border sample.
+			return outside > 0.0f ? std::max(outside, border - outside) : border;
+		}
+
+		float SampleGradient(const Grid &grid, const glm::vec3 &pos, glm::vec3 *outGrad)
+		{
+			const glm::vec3 clamped = glm::clamp(pos, MinCorner(grid), MaxCorner(grid));
+			const glm::vec3 offset = pos - clamped;
+			const float outside = glm::length(offset);
+			glm::vec3 borderGrad;
+			const float border = Trilinear(grid, clamped, &borderGrad);
+
+			if (!(outside > 0.0f))
+			{
+				*outGrad = borderGrad;
+				return border;
+			}
+
+			const glm::vec3 away = offset / outside;
+
+			if (outside >= border - outside)
+			{
+				*outGrad = away;
+				return outside;
+			}
+
+			// The border sample only moves along the axes pos is within the grid on.
+			for (unsigned axis = 0; axis < 3; ++axis)
+				if (offset[axis] != 0.0f)
+					borderGrad[axis] = 0.0f;
+
+			*outGrad = borderGrad - away;
+			return border - outside;
+		}
+
+		bool Save(const char *fileName, const Grid &grid)
+		{
+			FILE * const file = std::fopen(fileName, "wb");
+
+			if (!file)
+				return false;
+
+			FileHeader header;
+			std::memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+			header.version = FILE_VERSION;
+
+			for (unsigned axis = 0; axis < 3; ++axis)
+			{
+				header.dims[axis] = grid.dims[axis];
+				header.origin[axis] = grid.origin[axis];
+			}
+
+			header.voxelSize = grid.voxelSize;
+
+			const bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+				std::fwrite(grid.values.data(), sizeof(float), grid.values.size(), file) == grid.values.size();
+
+			std::fclose(file);
+
+			return written;
+		}
+
+		bool Load(const char *fileName, Grid *outGrid)
+		{
+			FILE * const file = std::fopen(fileName, "rb");
+			FileHeader header;
+
+			if (!file)
+				return false;
+
+			if (std::fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 ||
+				header.version != FILE_VERSION || header.dims[0] < 2 || header.dims[1] < 2 || header.dims[2] < 2 || !(header.voxelSize > 0.0f))
+			{
+				std::fclose(file);
+				return false;
+			}
+
+			for (unsigned axis = 0; axis < 3; ++axis)
+			{
+				outGrid->dims[axis] = header.dims[axis];
+				outGrid->origin[axis] = header.origin[axis];
+			}
+
+			outGrid->voxelSize = header.voxelSize;
+			outGrid->values.resize((size_t)header.dims[0] * header.dims[1] * header.dims[2]);
+
+			const bool read = std::fread(outGrid->values.data(), sizeof(float), outGrid->values.size(), file) == outGrid->values.size();
+			std::fclose(file);
+
+			return read;
+		}
+	}
+}
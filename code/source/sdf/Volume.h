@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Memory.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+
+// Sampled signed distance fields on a regular grid. Baked meshes and anything
+// else without a closed form end up here.
+namespace sdf
+{
+	namespace volume
+	{
+		// Samples sit on grid points: sample (x, y, z) is at origin + voxelSize * (x, y, z),
+		// so the field covers [origin, origin + voxelSize * (dims - 1)].
+		struct Grid
+		{
+			glm::uvec3 dims = glm::uvec3(0);
+			glm::vec3 origin = glm::vec3(0.0f);
+			float voxelSize = 0.0f;
+			memory::Vector<float, memory::Tag::VOLUMES> values; // x fastest, then y, then z
+		};
+
+		inline size_t Index(const Grid &grid, uint32_t x, uint32_t y, uint32_t z)
+		{
+			return ((size_t)z * grid.dims.y + y) * grid.dims.x + x;
+		}
+
+		glm::vec3 MinCorner(const Grid &grid);
+		glm::vec3 MaxCorner(const Grid &grid);
+
+		// Trilinear distance. Outside the grid the result stays a lower bound on
+		// the true distance, as long as the surface is inside the grid.
+		float Sample(const Grid &grid, const glm::vec3 &pos);
+
+		// Sample plus the exact gradient of what it returns, inside the grid and out.
+		float SampleGradient(const Grid &grid, const glm::vec3 &pos, glm::vec3 *outGrad);
+
+		// First order upwind solution of the eikonal equation at a sample, from
+		// the smallest neighbour magnitude along each axis. Infinity when every
+		// neighbour is.
+		inline float SolveEikonal(float a0, float a1, float a2, float h)
+		{
+			if (a0 > a1) std::swap(a0, a1);
+			if (a1 > a2) std::swap(a1, a2);
+			if (a0 > a1) std::swap(a0, a1);
+
+			float u = a0 + h;
+
+			if (u > a1)
+			{
+				u = 0.5f * (a0 + a1 + std::sqrt(2.0f * h * h - (a0 - a1) * (a0 - a1)));
+
+				if (u > a2)
+				{
+					const float sum = a0 + a1 + a2;
+					const float sumSq = a0 * a0 + a1 * a1 + a2 * a2;
+
+					u = (sum + std::sqrt(std::max(sum * sum - 3.0f * (sumSq - h * h), 0.0f))) / 3.0f;
+				}
+			}
+
+			return u;
+		}
+
+		bool Save(const char *fileName, const Grid &grid);
+		bool Load(const char *fileName, Grid *outGrid);
+	}
+}
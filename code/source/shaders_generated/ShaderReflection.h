@@ -29,6 +29,44 @@ struct ShaderUniformBlock
 	unsigned short sizeBytes;
 };
 
+// Same values as VkDescriptorType.
+enum class ShaderDescriptorType : unsigned char
+{
+	SAMPLER = 0,
+	COMBINED_IMAGE_SAMPLER = 1,
+	SAMPLED_IMAGE = 2,
+	STORAGE_IMAGE = 3,
+	UNIFORM_TEXEL_BUFFER = 4,
+	STORAGE_TEXEL_BUFFER = 5,
+	UNIFORM_BUFFER = 6,
+	STORAGE_BUFFER = 7,
+	INPUT_ATTACHMENT = 10
+};
+
+struct ShaderDescriptorBinding
+{
+	unsigned short set;
+	unsigned short binding;
+	unsigned short count;
+	ShaderDescriptorType type;
+};
+
+enum class ShaderComponentType : unsigned char
+{
+	FLOAT,
+	INT,
+	UINT,
+	DOUBLE
+};
+
+struct ShaderVertexInput
+{
+	unsigned char location;
+	unsigned char components;   // of a vector, or a matrix column
+	unsigned char locations;    // matrix columns times array elements
+	ShaderComponentType componentType;
+};
+
 //struct GLSLType
 //{
 //	GLSLBasicType basicType;
@@ -62,4 +100,33 @@ struct ShaderModule
 	unsigned char uboCount;
 	unsigned char inputCount;
 	unsigned char outputCount;
+	const ShaderDescriptorBinding* const bindings;   // by set, then binding; stage is type
+	const ShaderVertexInput* const vertexInputs;     // by location
+	unsigned short pushConstantBytes;
+	unsigned char bindingCount;
+	unsigned char vertexInputCount;
+	const unsigned char* const compressedProgram;   // with glsltoc -z, progam is null and this decodes
+	const unsigned compressedBytes;                  // to it through sdf::spirvcodec
 };
+
+// Modules of a source built once per combination of its .variants values.
+// Variants with the same SPIR-V share a module.
+struct ShaderVariants
+{
+	const char* const name;
+	const char* const* const axisNames;
+	const unsigned* const axisValueCounts;
+	const ShaderModule* const* const modules;   // by variant key
+	const unsigned axisCount;
+	const unsigned variantCount;
+	const unsigned programCount;                // distinct among the modules
+};
+
+// Key of a value index per axis, the first axis varying fastest.
+inline unsigned ShaderVariantKey(const ShaderVariants& variants, const unsigned* valueIndices)
+{
+	unsigned key = 0;
+	for (unsigned axis = variants.axisCount; axis-- > 0;)
+		key = key * variants.axisValueCounts[axis] + valueIndices[axis];
+	return key;
+}
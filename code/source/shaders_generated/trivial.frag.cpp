@@ -34,6 +34,14 @@ static const ShaderUniformBlock trivial_frag_ubos[] = {
 	{}
 };
 
+static const ShaderDescriptorBinding trivial_frag_bindings[] = {
+	{}
+};
+
+static const ShaderVertexInput trivial_frag_vertex_inputs[] = {
+	{}
+};
+
 extern "C" const ShaderModule trivial_frag_shader = {
 	"trivial.frag",
 	"main",
@@ -44,6 +52,13 @@ extern "C" const ShaderModule trivial_frag_shader = {
 	ShaderStageType::FRAGMENT,
 	0,
 	1,
-	1
+	1,
+	trivial_frag_bindings,
+	trivial_frag_vertex_inputs,
+	0,
+	0,
+	0,
+	nullptr,
+	0
 };
 
@@ -63,6 +63,17 @@ static const ShaderUniformBlock trivial_vert_ubos[] = {
 	{}
 };
 
+static const ShaderDescriptorBinding trivial_vert_bindings[] = {
+	{ 0, 0, 1, ShaderDescriptorType::UNIFORM_BUFFER },
+	{}
+};
+
+static const ShaderVertexInput trivial_vert_vertex_inputs[] = {
+	{ 0, 3, 1, ShaderComponentType::FLOAT },
+	{ 1, 3, 1, ShaderComponentType::FLOAT },
+	{}
+};
+
 const ShaderModule trivial_vert_shader = {
 	"trivial.vert",
 	"main",
@@ -73,6 +84,13 @@ const ShaderModule trivial_vert_shader = {
 	ShaderStageType::VERTEX,
 	1,
 	2,
-	2
+	2,
+	trivial_vert_bindings,
+	trivial_vert_vertex_inputs,
+	0,
+	1,
+	2,
+	nullptr,
+	0
 };
 
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Protocol of glsltoc's compile server (glsltoc -s<name>), shared with the
+// ShaderWatcher. Clients connect to a byte mode named pipe and send requests,
+// each answered by one response. Both are framed as a 32 bit size followed by
+// that many bytes.
+namespace compile_server
+{
+	static const uint32_t VERSION = 1;
+	static const uint32_t BUFFER_SIZE = 64 * 1024;
+	static const uint32_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+
+	enum RequestFlags : uint32_t
+	{
+		FLAG_FORCE = 1 << 0,   // compile every input, whatever the caches hold
+		FLAG_QUIT = 1 << 1     // stop the server instead of building
+	};
+
+	struct Request
+	{
+		uint32_t version = VERSION;
+		uint32_t flags = 0;
+	};
+
+	// Followed in its frame by the build's log.
+	struct Response
+	{
+		uint32_t version = VERSION;
+		int32_t status = 0;       // what a glsltoc run would have returned
+		uint32_t compiled = 0;    // files that missed the caches
+		double seconds = 0.0;     // from receiving the request to answering it
+	};
+
+	inline std::string PipeName(const std::string &name)
+	{
+		return "\\\\.\\pipe\\" + name;
+	}
+
+	inline bool WriteExact(HANDLE pipe, const void *data, uint32_t size)
+	{
+		const char *bytes = (const char *)data;
+
+		while (size > 0)
+		{
+			DWORD written = 0;
+
+			if (!WriteFile(pipe, bytes, size, &written, nullptr) || written == 0)
+			{
+				return false;
+			}
+
+			bytes += written;
+			size -= written;
+		}
+
+		return true;
+	}
+
+	inline bool ReadExact(HANDLE pipe, void *outData, uint32_t size)
+	{
+		char *bytes = (char *)outData;
+
+		while (size > 0)
+		{
+			DWORD read = 0;
+
+			if (!ReadFile(pipe, bytes, size, &read, nullptr) || read == 0)
+			{
+				return false;
+			}
+
+			bytes += read;
+			size -= read;
+		}
+
+		return true;
+	}
+
+	inline bool WriteFrame(HANDLE pipe, const std::string &payload)
+	{
+		const uint32_t size = (uint32_t)payload.size();
+
+		return WriteExact(pipe, &size, sizeof(size)) && WriteExact(pipe, payload.data(), size);
+	}
+
+	inline bool ReadFrame(HANDLE pipe, std::string *outPayload)
+	{
+		uint32_t size;
+
+		if (!ReadExact(pipe, &size, sizeof(size)) || size > MAX_FRAME_SIZE)
+		{
+			return false;
+		}
+
+		outPayload->resize(size);
+
+		return size == 0 || ReadExact(pipe, &(*outPayload)[0], size);
+	}
+
+	inline bool WriteRequest(HANDLE pipe, const Request &request)
+	{
+		return WriteFrame(pipe, std::string((const char *)&request, sizeof(request)));
+	}
+
+	// Fails on a request from another version, which the server treats as
+	// the client going away.
+	inline bool ReadRequest(HANDLE pipe, Request *outRequest)
+	{
+		std::string payload;
+
+		if (!ReadFrame(pipe, &payload) || payload.size() != sizeof(Request))
+		{
+			return false;
+		}
+
+		std::memcpy(outRequest, payload.data(), sizeof(Request));
+
+		return outRequest->version == VERSION;
+	}
+
+	inline bool WriteResponse(HANDLE pipe, const Response &response, const std::string &log)
+	{
+		return WriteFrame(pipe, std::string((const char *)&response, sizeof(response)) + log);
+	}
+
+	inline bool ReadResponse(HANDLE pipe, Response *outResponse, std::string *outLog)
+	{
+		std::string payload;
+
+		if (!ReadFrame(pipe, &payload) || payload.size() < sizeof(Response))
+		{
+			return false;
+		}
+
+		std::memcpy(outResponse, payload.data(), sizeof(Response));
+		outLog->assign(payload, sizeof(Response), std::string::npos);
+
+		return outResponse->version == VERSION;
+	}
+}
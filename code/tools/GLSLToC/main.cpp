@@ -9,13 +9,63 @@
 #include <string>
 #include <sstream>
 #include <algorithm>
+#include <cstdlib>
 #include <unordered_set>
 #include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
 #include <SPIRV/GlslangToSpv.h>
+#include <glslang/Include/Types.h>
+#include <glslang/Include/revision.h>
+#ifndef ENABLE_OPT
+#define ENABLE_OPT 0
+#endif
+#if ENABLE_OPT
+#include <spirv-tools/optimizer.hpp>
+#endif
+#include "CompileServer.h"
+#include "../../source/sdf/ShaderPack.h"
+#include "../../source/sdf/SpirvCodec.h"
 
-typedef std::unordered_map<std::string, uint64_t> FileModifiedMap;
 typedef std::vector<std::string> StringList;
-typedef std::unordered_map<std::string, std::string> FileCache;
+
+// SPIR-V optimizer passes run on each program, chosen for all of them with -o
+// and for one with "#pragma glsltoc_optimize(<profile>)" in its source.
+enum class OptimizeProfile : uint8_t
+{
+	NONE,
+	SIZE,
+	PERFORMANCE
+};
+
+static const char * const OPTIMIZE_PROFILE_NAMES[] = { "none", "size", "performance" };
+
+// The caches below are shared by the compile threads. Entries are never
+// replaced once inserted, so references to them stay valid outside the lock.
+struct FileHashMap
+{
+	std::mutex mutex;
+	std::unordered_map<std::string, uint64_t> hashes;
+};
+
+struct Header
+{
+	std::string contents;
+	uint64_t hash;              // of contents
+	StringList includeFiles;    // every header it pulls in, nested ones too
+};
+
+struct FileCache
+{
+	std::mutex mutex;
+	std::unordered_map<std::string, Header> headers;       // by full path
+	std::unordered_map<std::string, std::string> paths;    // full path of each include name, for the includer
+	std::atomic<unsigned> loads{ 0 };                      // headers read from disk
+};
 
 struct SourceFile
 {
@@ -23,16 +73,45 @@ struct SourceFile
 	StringList includeFiles;
 	std::string contents;
 	EShLanguage stage;
+	OptimizeProfile optimize = OptimizeProfile::NONE;
+	std::string defines;   // "#define" lines of the variant, ahead of everything else
+	std::string variant;   // ":<key>" when the source has variants, naming the program in logs and packs
+};
+
+// A source's variants, from the sidecar "<source>.variants" next to it: a line
+// per axis, with the name of a define and the values it takes. Variants are
+// the cross product of the axes, each compiled with a "#define <name> <value>"
+// per axis. A variant's key counts through the values mixed radix, first axis
+// fastest. No sidecar, or one without axes, is a single variant.
+struct VariantAxis
+{
+	std::string name;
+	StringList values;
+};
+
+struct Variants
+{
+	std::vector<VariantAxis> axes;
+	unsigned count = 1;
 };
 
+static const unsigned MAX_VARIANTS = 4096;   // per source
+
 struct Settings
 {
 	StringList includeDirs;
 	std::string forceInclude;
-	StringList inputFiles;
+	StringList inputPaths;      // files and directories to scan, in the order given
 	std::string outputDir;
+	std::string cacheDir;
+	std::string serverName;
 	bool force = false;
 	bool generateMonolithic = false;
+	bool generatePack = false;
+	bool compress = false;      // embedded programs, not packed ones
+	OptimizeProfile optimize = OptimizeProfile::NONE;
+	unsigned threads = 1;
+	unsigned benchmarkShaders = 0;
 };
 
 static const char* GetFilename(const char* dir)
@@ -85,7 +164,7 @@ static bool ValidateExtension(const char *path)
 	switch (tolower(ext[1]))
 	{
 		case 'v':
-			return tolower(ext[2]) != 'c'; // ignore .vcxproj*
+			return tolower(ext[2]) != 'c' && _stricmp(ext + 1, "variants") != 0; // ignore .vcxproj* and variant sidecars
 		case 'f':
 			return tolower(ext[2]) != 'i'; // ignore .filters
 		case 'c':
@@ -150,6 +229,84 @@ static bool ScanDirForFiles(const char *path, StringList *outFiles)
 	return ret;
 }
 
+static bool GatherInputFiles(const Settings &settings, StringList *outFiles, std::ostream *outLog)
+{
+	for (const std::string &path : settings.inputPaths)
+	{
+		if (!IsDirectory(path.c_str()))
+		{
+			outFiles->push_back(path);
+		}
+		else if (!ScanDirForFiles(path.c_str(), outFiles))
+		{
+			*outLog << "Failed to scan \"" << path << "\" for files." << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static std::string VariantsPath(const std::string &sourceFile)
+{
+	return sourceFile + ".variants";
+}
+
+// Lines are "<name> <value> <value> ...", and those starting with # comments.
+static bool LoadVariants(const std::string &sourceFile, Variants *outVariants, std::ostream *outLog)
+{
+	const std::string path = VariantsPath(sourceFile);
+	std::ifstream file(path);
+	std::string line;
+
+	while (std::getline(file, line))
+	{
+		std::istringstream tokens(line);
+		VariantAxis axis;
+		std::string value;
+
+		if (!(tokens >> axis.name) || axis.name[0] == '#')
+		{
+			continue;
+		}
+
+		while (tokens >> value)
+		{
+			axis.values.push_back(value);
+		}
+
+		if (axis.values.empty())
+		{
+			*outLog << "Variant axis \"" << axis.name << "\" in \"" << path << "\" has no values." << std::endl;
+			return false;
+		}
+
+		outVariants->count *= (unsigned)axis.values.size();
+		if (outVariants->count > MAX_VARIANTS)
+		{
+			*outLog << "\"" << path << "\" declares more than " << MAX_VARIANTS << " variants." << std::endl;
+			return false;
+		}
+
+		outVariants->axes.push_back(std::move(axis));
+	}
+
+	return true;
+}
+
+static std::string VariantDefines(const Variants &variants, unsigned key)
+{
+	std::string defines;
+
+	for (const VariantAxis &axis : variants.axes)
+	{
+		defines += "#define " + axis.name + " " + axis.values[key % axis.values.size()] + "\n";
+		key /= (unsigned)axis.values.size();
+	}
+
+	return defines;
+}
+
 static bool FindFile(const StringList &paths, std::string *inoutPath)
 {
 	char fileBuf[MAX_PATH];
@@ -188,6 +345,20 @@ static bool FindFile(const StringList &paths, std::string *inoutPath)
 	return false;
 }
 
+static bool ParseOptimizeProfile(const std::string &name, OptimizeProfile *outProfile)
+{
+	for (size_t profileIndex = 0; profileIndex < std::size(OPTIMIZE_PROFILE_NAMES); ++profileIndex)
+	{
+		if (name == OPTIMIZE_PROFILE_NAMES[profileIndex])
+		{
+			*outProfile = (OptimizeProfile)profileIndex;
+			return true;
+		}
+	}
+
+	return false;
+}
+
 static bool ParseSettings(int argc, char *argv[], Settings *outSettings)
 {
 	for (int argIndex = 1; argIndex < argc; ++argIndex)
@@ -227,9 +398,61 @@ static bool ParseSettings(int argc, char *argv[], Settings *outSettings)
 				case 'm':
 					outSettings->generateMonolithic = true;
 				break;
+				case 'p':
+					outSettings->generatePack = true;
+				break;
+				case 'z':
+					outSettings->compress = true;
+				break;
+				case 'o':
+					if (!ParseOptimizeProfile(arg + 2, &outSettings->optimize))
+					{
+						std::cout << "Unknown optimization profile \"" << arg + 2 << "\"." << std::endl;
+						return false;
+					}
+
+					if (!ENABLE_OPT && outSettings->optimize != OptimizeProfile::NONE)
+					{
+						std::cout << "Optimization profile \"" << arg + 2 << "\" needs SPIRV-Tools, which is not in this build (ENABLE_OPT)." << std::endl;
+						return false;
+					}
+				break;
 				case 'f':
 					outSettings->force = true;
 				break;
+				case 'j':
+					outSettings->threads = arg[2] ? (unsigned)std::strtoul(arg + 2, nullptr, 10) : std::thread::hardware_concurrency();
+					if (outSettings->threads == 0)
+					{
+						std::cout << "Invalid thread count \"" << arg + 2 << "\"." << std::endl;
+						return false;
+					}
+				break;
+				case 'b':
+					outSettings->benchmarkShaders = arg[2] ? (unsigned)std::strtoul(arg + 2, nullptr, 10) : 200;
+					if (outSettings->benchmarkShaders == 0)
+					{
+						std::cout << "Invalid benchmark shader count \"" << arg + 2 << "\"." << std::endl;
+						return false;
+					}
+				break;
+				case 's':
+					outSettings->serverName = arg + 2;
+					if (outSettings->serverName.empty())
+					{
+						std::cout << "A server needs a pipe name." << std::endl;
+						return false;
+					}
+				break;
+				case 'C':
+					if (!GetFullPathName(arg + 2, sizeof(fileBuf), fileBuf, nullptr))
+					{
+						std::cout << "Couldn't get the full path of \"" << arg + 2 << "\"." << std::endl;
+						return false;
+					}
+
+					outSettings->cacheDir = fileBuf;
+				break;
 				case 'O':
 					if (!GetFullPathName(arg + 2, sizeof(fileBuf), fileBuf, nullptr))
 					{
@@ -270,15 +493,7 @@ static bool ParseSettings(int argc, char *argv[], Settings *outSettings)
 				return false;
 			}
 
-			if (IsDirectory(fileBuf))
-			{
-				if (!ScanDirForFiles(fileBuf, &outSettings->inputFiles))
-				{
-					std::cout << "Failed to scan \"" << fileBuf << "\" for files." << std::endl;
-					return false;
-				}
-			}
-			else
+			if (!IsDirectory(fileBuf))
 			{
 				if (!FileExists(fileBuf))
 				{
@@ -292,11 +507,17 @@ static bool ParseSettings(int argc, char *argv[], Settings *outSettings)
 					return false;
 				}
 
-				outSettings->inputFiles.push_back(fileBuf);
 			}
+
+			outSettings->inputPaths.push_back(fileBuf);
 		}
 	}
 
+	if (outSettings->cacheDir.empty())
+	{
+		outSettings->cacheDir = (outSettings->outputDir.empty() ? std::string(".") : outSettings->outputDir) + "\\ShaderCache";
+	}
+
 	if (!outSettings->forceInclude.empty())
 	{
 		if (!FindFile(outSettings->includeDirs, &outSettings->forceInclude))
@@ -331,13 +552,18 @@ static void PrintHelp()
 	std::cout << "    Output files will be given the same name as their inputs with \".h\"" << std::endl;
 	std::cout << "    appended. If an output directory is supplied, all source files will" << std::endl;
 	std::cout << "    be placed there. If a directory is supplied as an input file, it is" << std::endl;
-	std::cout << "    scanned for supported file types. A file will only be compiled if it" << std::endl;
-	std::cout << "    has been updated relative to output (as determined by last modified" << std::endl;
-	std::cout << "    time)." << std::endl;
+	std::cout << "    scanned for supported file types. Compiled programs are cached by a" << std::endl;
+	std::cout << "    hash of their source with includes, stage and compile options, so a" << std::endl;
+	std::cout << "    file is only compiled if that content was never compiled before, and" << std::endl;
+	std::cout << "    outputs are only written when they change." << std::endl;
 	std::cout << "    Include directives are supported, with the ability to specify N" << std::endl;
 	std::cout << "    search directories. Additionaly, you may supply a force include file." << std::endl;
 	std::cout << "    If supplied, the force include file will be loaded first in the shader," << std::endl;
 	std::cout << "    making it ideal for version and extension definitions." << std::endl;
+	std::cout << "    A source with a sidecar <source>.variants is compiled once for every" << std::endl;
+	std::cout << "    combination of the values its lines give, \"<define> <value> ...\"," << std::endl;
+	std::cout << "    in parallel. Variants that compile to the same SPIR-V share one" << std::endl;
+	std::cout << "    program, and <prefix>variants selects them by key at runtime." << std::endl;
 	std::cout << "    Options should be specified without a space between the option" << std::endl;
 	std::cout << "    signifier and its text." << std::endl;
 	std::cout << std::endl;
@@ -346,42 +572,149 @@ static void PrintHelp()
 	std::cout << "    -O: The output directory you'd like the header files placed in." << std::endl;
 	std::cout << "    -F: The path to the force include file. Include directories are searched." << std::endl;
 	std::cout << "    -f: Force recompile, even if no changes." << std::endl;
+	std::cout << "    -C: The cache directory. Defaults to ShaderCache in the output directory." << std::endl;
+	std::cout << "    -b: Benchmarks incremental builds of N generated shaders, 200 without N," << std::endl;
+	std::cout << "        sharing a header, in IncludeBenchmark under the output directory." << std::endl;
+	std::cout << "    -s: Serves builds on the named pipe \\\\.\\pipe\\<name> until asked to quit," << std::endl;
+	std::cout << "        keeping glslang and compiled programs in memory between them." << std::endl;
+	std::cout << "        Each request rescans the inputs and builds what changed." << std::endl;
 	std::cout << "    -m: Generates a monolithic shader source file including all shaders." << std::endl;
+	std::cout << "    -p: Packs every program with its reflection into Shaders.spvpack in the" << std::endl;
+	std::cout << "        output directory, for loading at runtime, instead of C sources." << std::endl;
+	std::cout << "    -z: Embeds programs compressed with sdf::spirvcodec, to be decoded on first" << std::endl;
+	std::cout << "        use. Sizes and decode speed are printed. Packs are not compressed." << std::endl;
+	std::cout << "    -o: SPIR-V optimization profile: none (the default), size or performance." << std::endl;
+	std::cout << "        Both optimizing profiles inline, replace aggregates with scalars," << std::endl;
+	std::cout << "        remove dead code and unroll loops marked [[unroll]]; performance" << std::endl;
+	std::cout << "        also folds constants and flattens branches. A source overrides it" << std::endl;
+	std::cout << "        with #pragma glsltoc_optimize(<profile>). Word and instruction" << std::endl;
+	std::cout << "        counts before and after are printed for every compiled program." << std::endl;
+	std::cout << "        Profiles other than none are errors in builds without SPIRV-Tools." << std::endl;
+	std::cout << "    -j: Compiles N files at once, as in -j8, or one per core without N." << std::endl;
+	std::cout << "        Messages are still printed in input order." << std::endl;
 	std::cout << std::endl;
 }
 
-static uint64_t GetLastModifiedTime(const std::string &file, FileModifiedMap *inoutMap)
+// FNV-1a, 64 bit.
+static uint64_t HashBytes(const void *data, size_t size, uint64_t hash = 0xCBF29CE484222325ull)
 {
-	const FileModifiedMap::const_iterator fileIt = inoutMap->find(file);
+	const unsigned char * const bytes = (const unsigned char *)data;
 
-	if (fileIt != inoutMap->cend())
+	for (size_t byteIndex = 0; byteIndex < size; ++byteIndex)
 	{
-		return fileIt->second;
+		hash ^= bytes[byteIndex];
+		hash *= 0x100000001B3ull;
 	}
-	else
+
+	return hash;
+}
+
+static uint64_t HashString(const std::string &str, uint64_t hash)
+{
+	const uint64_t length = str.length();
+
+	return HashBytes(str.data(), str.length(), HashBytes(&length, sizeof(length), hash));
+}
+
+// Missing files hash as empty, so the key still changes when they appear.
+static uint64_t GetContentHash(const std::string &file, FileHashMap *inoutMap)
+{
+	{
+		std::lock_guard<std::mutex> lock(inoutMap->mutex);
+		const auto fileIt = inoutMap->hashes.find(file);
+
+		if (fileIt != inoutMap->hashes.cend())
+		{
+			return fileIt->second;
+		}
+	}
+
+	std::ifstream stream(file, std::ios::binary);
+	std::ostringstream contents;
+
+	contents << stream.rdbuf();
+
+	const uint64_t hash = HashString(contents.str(), HashBytes(nullptr, 0));
+	std::lock_guard<std::mutex> lock(inoutMap->mutex);
+
+	return inoutMap->hashes.emplace(file, hash).first->second;
+}
+
+// Leaves files that already hold contents alone, so a rebuild that changes
+// nothing doesn't make the project recompile what includes them.
+static bool WriteIfChanged(const std::string &fileName, const std::string &contents, std::ostream *outLog)
+{
 	{
-		const auto lastWrite = std::filesystem::last_write_time(file);
-		const size_t lastWriteTime = lastWrite.time_since_epoch().count();
+		std::ifstream existing(fileName);
+
+		if (existing)
+		{
+			std::ostringstream existingContents;
+
+			existingContents << existing.rdbuf();
+			if (existingContents.str() == contents)
+			{
+				return true;
+			}
+		}
+	}
 
-		inoutMap->insert(std::make_pair(file, lastWriteTime));
+	std::ofstream file(fileName, std::ios::out | std::ios::trunc);
 
-		return lastWriteTime;
+	if (!file || !file.write(contents.data(), contents.length()))
+	{
+		*outLog << "Failed to open \"" << fileName.c_str() << "\" for writing." << std::endl;
+		return false;
 	}
+
+	return true;
 }
 
-static void UpdateLastModifiedTime(const std::string *files, unsigned count, FileModifiedMap *outMap)
+// The same for a shader pack, which is also written aside and renamed into
+// place: a running app may have the old one mapped, and keeps reading that.
+static bool WritePackIfChanged(const std::string &fileName, const std::string &bytes, std::ostream *outLog)
 {
-	for (unsigned fileIndex = 0; fileIndex < count; ++fileIndex)
 	{
-		const std::string &file = files[fileIndex];
+		std::ifstream existing(fileName, std::ios::binary);
+
+		if (existing)
+		{
+			std::ostringstream existingBytes;
+
+			existingBytes << existing.rdbuf();
+			if (existingBytes.str() == bytes)
+			{
+				return true;
+			}
+		}
+	}
+
+	const std::string tempName = fileName + ".tmp";
+	std::error_code error;
+
+	{
+		std::ofstream file(tempName, std::ios::binary | std::ios::trunc);
+
+		if (!file || !file.write(bytes.data(), bytes.length()))
+		{
+			*outLog << "Failed to open \"" << tempName.c_str() << "\" for writing." << std::endl;
+			return false;
+		}
+	}
 
-		GetLastModifiedTime(file, outMap);
+	std::filesystem::rename(tempName, fileName, error);
+	if (error)
+	{
+		*outLog << "Failed to replace \"" << fileName.c_str() << "\": " << error.message() << std::endl;
+		return false;
 	}
+
+	return true;
 }
 
-static bool LoadHeaderFile(const std::string &fileName, const std::string &fileCacheName, const StringList &includeDirs, FileCache *inoutFileCache, StringList* outIncludeFiles);
+static bool LoadHeaderFile(const std::string &fileName, const std::string &fileCacheName, const StringList &includeDirs, FileCache *inoutFileCache, StringList* outIncludeFiles, std::ostream *outLog);
 
-static bool ParseIncludeDirective(const std::string &line, const StringList &includeDirs, FileCache *inoutFileCache, StringList* outIncludeFiles)
+static bool ParseIncludeDirective(const std::string &line, const StringList &includeDirs, FileCache *inoutFileCache, StringList* outIncludeFiles, std::ostream *outLog)
 {
 	size_t includeStart;
 	size_t includeEnd;
@@ -401,7 +734,7 @@ static bool ParseIncludeDirective(const std::string &line, const StringList &inc
 
 	if (includeStart == std::string::npos || includeEnd == std::string::npos)
 	{
-		std::cout << "Include directive \"" << line << "\" could not be parsed." << std::endl;
+		*outLog << "Include directive \"" << line << "\" could not be parsed." << std::endl;
 		return false;
 	}
 
@@ -409,22 +742,22 @@ static bool ParseIncludeDirective(const std::string &line, const StringList &inc
 	includeFile = includeName;
 	if (!FindFile(includeDirs, &includeFile))
 	{
-		std::cout << "Include file \"" << includeFile << "\" not found." << std::endl;
+		*outLog << "Include file \"" << includeFile << "\" not found." << std::endl;
 		return false;
 	}
 
 	outIncludeFiles->push_back(includeFile);
 
-	if(!LoadHeaderFile(includeFile, includeName, includeDirs, inoutFileCache, outIncludeFiles))
+	if(!LoadHeaderFile(includeFile, includeName, includeDirs, inoutFileCache, outIncludeFiles, outLog))
 	{
-		std::cout << "Failed to load header file \"" << includeFile << "\"." << std::endl;
+		*outLog << "Failed to load header file \"" << includeFile << "\"." << std::endl;
 		return false;
 	}
 
 	return true;
 }
 
-static bool LoadFileFromStream(std::istream *stream, const StringList &includeDirs, FileCache *inoutFileCache, StringList *outIncludeFiles, std::ostream *outFile)
+static bool LoadFileFromStream(std::istream *stream, const StringList &includeDirs, FileCache *inoutFileCache, StringList *outIncludeFiles, std::ostream *outFile, std::ostream *outLog)
 {
 	std::string line;
 
@@ -432,7 +765,7 @@ static bool LoadFileFromStream(std::istream *stream, const StringList &includeDi
 	{
 		if (line.find("#include ") == 0)
 		{
-			if (!ParseIncludeDirective(line, includeDirs, inoutFileCache, outIncludeFiles))
+			if (!ParseIncludeDirective(line, includeDirs, inoutFileCache, outIncludeFiles, outLog))
 			{
 				return false;
 			}
@@ -444,30 +777,50 @@ static bool LoadFileFromStream(std::istream *stream, const StringList &includeDi
 	return true;
 }
 
-static bool LoadHeaderFile(const std::string &fileName, const std::string &fileCacheName, const StringList &includeDirs, FileCache* inoutFileCache, StringList *outIncludeFiles)
+// Each header is read and expanded once per build, however many sources
+// include it. Loads outside the lock, so threads including the same header
+// at once may both load it, and the first to finish fills the cache.
+static bool LoadHeaderFile(const std::string &fileName, const std::string &fileCacheName, const StringList &includeDirs, FileCache* inoutFileCache, StringList *outIncludeFiles, std::ostream *outLog)
 {
-	if (inoutFileCache->count(fileName) == 0)
 	{
-		std::ifstream file(fileName.c_str());
-		std::ostringstream contents;
+		std::lock_guard<std::mutex> lock(inoutFileCache->mutex);
+		const auto headerIt = inoutFileCache->headers.find(fileName);
 
-		if (!LoadFileFromStream(&file, includeDirs, inoutFileCache, outIncludeFiles, &contents))
+		inoutFileCache->paths.emplace(fileCacheName, fileName);
+		if (headerIt != inoutFileCache->headers.cend())
 		{
-			return false;
+			outIncludeFiles->insert(outIncludeFiles->end(), headerIt->second.includeFiles.begin(), headerIt->second.includeFiles.end());
+			return true;
 		}
+	}
+
+	std::ifstream file(fileName.c_str());
+	std::ostringstream contents;
+	Header header;
 
-		inoutFileCache->insert(std::make_pair(fileCacheName, std::move(contents.str())));
+	if (!LoadFileFromStream(&file, includeDirs, inoutFileCache, &header.includeFiles, &contents, outLog))
+	{
+		return false;
 	}
 
+	header.contents = contents.str();
+	header.hash = HashString(header.contents, HashBytes(nullptr, 0));
+	++inoutFileCache->loads;
+	outIncludeFiles->insert(outIncludeFiles->end(), header.includeFiles.begin(), header.includeFiles.end());
+
+	std::lock_guard<std::mutex> lock(inoutFileCache->mutex);
+
+	inoutFileCache->headers.emplace(fileName, std::move(header));
+
 	return true;
 }
 
-static bool LoadSourceFile(const std::string &fileName, const StringList &includeDirs, FileCache *inoutFileCache, StringList *outIncludeFiles, std::string *outFile)
+static bool LoadSourceFile(const std::string &fileName, const StringList &includeDirs, FileCache *inoutFileCache, StringList *outIncludeFiles, std::string *outFile, std::ostream *outLog)
 {
 	std::ifstream file(fileName.c_str());
 	std::ostringstream contents;
 
-	if (!LoadFileFromStream(&file, includeDirs, inoutFileCache, outIncludeFiles, &contents))
+	if (!LoadFileFromStream(&file, includeDirs, inoutFileCache, outIncludeFiles, &contents, outLog))
 	{
 		return false;
 	}
@@ -477,14 +830,52 @@ static bool LoadSourceFile(const std::string &fileName, const StringList &includ
 	return true;
 }
 
-static bool DetermineStageFromFileName(const std::string &fileName, EShLanguage *outStage)
+// The profile a "#pragma glsltoc_optimize(<profile>)" line of the source asks
+// for, else the default. Only the source itself is searched, not its includes.
+static bool FindOptimizeProfile(const SourceFile &source, OptimizeProfile defaultProfile, OptimizeProfile *outProfile, std::ostream *outLog)
+{
+	static const char PRAGMA[] = "glsltoc_optimize";
+	std::istringstream contents(source.contents);
+	std::string line;
+
+	*outProfile = defaultProfile;
+
+	while (std::getline(contents, line))
+	{
+		const size_t pragmaStart = line.find_first_not_of(" \t");
+
+		if (pragmaStart == std::string::npos || line.compare(pragmaStart, 7, "#pragma") != 0 || line.find(PRAGMA, pragmaStart) == std::string::npos)
+		{
+			continue;
+		}
+
+		const size_t nameStart = line.find('(');
+		const size_t nameEnd = line.find(')', nameStart);
+
+		if (nameStart == std::string::npos || nameEnd == std::string::npos || !ParseOptimizeProfile(line.substr(nameStart + 1, nameEnd - nameStart - 1), outProfile))
+		{
+			*outLog << "Optimization pragma \"" << line << "\" in \"" << source.fileName << "\" could not be parsed." << std::endl;
+			return false;
+		}
+
+		if (!ENABLE_OPT && *outProfile != OptimizeProfile::NONE)
+		{
+			*outLog << "Optimization pragma \"" << line << "\" in \"" << source.fileName << "\" needs SPIRV-Tools, which is not in this build (ENABLE_OPT)." << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool DetermineStageFromFileName(const std::string &fileName, EShLanguage *outStage, std::ostream *outLog)
 {
 	size_t extStart;
 
 	extStart = fileName.rfind('.');
 	if (extStart == std::string::npos)
 	{
-		std::cout << "No extension on \"" << fileName.c_str() << "\". Excluding from build." << std::endl;
+		*outLog << "No extension on \"" << fileName.c_str() << "\". Excluding from build." << std::endl;
 		return false;
 	}
 
@@ -521,7 +912,7 @@ static bool DetermineStageFromFileName(const std::string &fileName, EShLanguage
 			}
 		}
 		default:
-			std::cout << "Unkown extension on \"" << fileName.c_str() << "\". Excluding from build." << std::endl;
+			*outLog << "Unkown extension on \"" << fileName.c_str() << "\". Excluding from build." << std::endl;
 			return false;
 	}
 
@@ -627,10 +1018,10 @@ static void InitResources(TBuiltInResource *outResources)
 class ShaderIncluder : public glslang::TShader::Includer
 {
 private:
-	const FileCache &headers;
+	FileCache &headers;
 
 public:
-	ShaderIncluder(const FileCache &headers) : headers(headers) {}
+	ShaderIncluder(FileCache &headers) : headers(headers) {}
 
 	// Resolves an inclusion request by name, type, current source name,
 	// and include depth.
@@ -643,11 +1034,14 @@ public:
 	// IncludeResult object.
 	virtual IncludeResult* includeSystem(const char* requested_source, const char* requesting_source, size_t inclusion_depth)
 	{
-		const FileCache::const_iterator headerIt = headers.find(requested_source);
+		std::lock_guard<std::mutex> lock(headers.mutex);
+		const auto pathIt = headers.paths.find(requested_source);
 
-		if (headerIt != headers.cend())
+		if (pathIt != headers.paths.cend())
 		{
-			return new IncludeResult(headerIt->first, headerIt->second.c_str(), headerIt->second.length(), nullptr);
+			const Header &header = headers.headers.at(pathIt->second);
+
+			return new IncludeResult(pathIt->first, header.contents.c_str(), header.contents.length(), nullptr);
 		}
 
 		return nullptr;
@@ -681,94 +1075,713 @@ const std::string GetOutputName(const std::string &source, const std::string &ou
 	return outputName;
 }
 
-static bool IsUpToDate(const SourceFile &source, const std::string &outputFile, FileModifiedMap *inoutLastModified)
+// Everything ShaderProgramToC needs from glslang's reflection, so cached
+// programs can be written out without compiling them.
+struct UniformBlock
+{
+	std::string name;
+	unsigned binding;
+	unsigned sizeBytes;
+};
+
+// Same values as VkDescriptorType.
+enum class DescriptorType : uint32_t
 {
-	const uint64_t sourceOutputTime = GetLastModifiedTime(outputFile + ".cpp", inoutLastModified);
-	const uint64_t headerOutputTime = GetLastModifiedTime(outputFile + ".h", inoutLastModified);
-	const uint64_t outputTime = std::max(sourceOutputTime, headerOutputTime);
+	SAMPLER = 0,
+	COMBINED_IMAGE_SAMPLER = 1,
+	SAMPLED_IMAGE = 2,
+	STORAGE_IMAGE = 3,
+	UNIFORM_TEXEL_BUFFER = 4,
+	STORAGE_TEXEL_BUFFER = 5,
+	UNIFORM_BUFFER = 6,
+	STORAGE_BUFFER = 7,
+	INPUT_ATTACHMENT = 10
+};
 
-	UpdateLastModifiedTime(source.includeFiles.data(), (unsigned)source.includeFiles.size(), inoutLastModified);
+struct DescriptorBinding
+{
+	unsigned set;
+	unsigned binding;
+	DescriptorType type;
+	unsigned count;   // array elements
+};
 
-	if (GetLastModifiedTime(source.fileName, inoutLastModified) > outputTime)
-	{
-		return false;
-	}
+enum class ComponentType : uint32_t
+{
+	FLOAT,
+	INT,
+	UINT,
+	DOUBLE
+};
 
-	for (size_t headerIndex = 0; headerIndex < source.includeFiles.size(); ++headerIndex)
-	{
-		if (GetLastModifiedTime(source.includeFiles[headerIndex], inoutLastModified) > outputTime)
-		{
-			return false;
-		}
-	}
+struct VertexInput
+{
+	unsigned location;
+	ComponentType componentType;
+	unsigned components;   // of a vector, or a matrix column
+	unsigned locations;    // matrix columns times array elements
+};
 
-	return true;
+struct Reflection
+{
+	std::vector<UniformBlock> ubos;
+	std::vector<DescriptorBinding> bindings;   // by set, then binding
+	std::vector<VertexInput> vertexInputs;     // vertex shaders only, by location
+	unsigned pushConstantBytes = 0;
+	unsigned inputCount = 0;
+	unsigned outputCount = 0;
+};
+
+struct CachedProgram
+{
+	std::vector<unsigned> programDWords;
+	Reflection reflection;
+};
+
+// Programs by key, kept in memory by a server between requests.
+struct ProgramCache
+{
+	std::mutex mutex;
+	std::unordered_map<uint64_t, CachedProgram> programs;
+};
+
+// Debug info in debug builds only. glslang's own optimizer stays off, as the
+// profile's passes run after it.
+static void GetSpvOptions(glslang::SpvOptions *outOptions)
+{
+#ifdef NDEBUG
+	outOptions->generateDebugInfo = false;
+#else //#ifdef NDEBUG
+	outOptions->generateDebugInfo = true;
+#endif //#else //#ifdef NDEBUG
+	outOptions->disableOptimizer = true;
+	outOptions->optimizeSize = false;
+	outOptions->disassemble = false;
+	outOptions->validate = true;
 }
 
-static bool CompileSourceFile(const SourceFile *optForceInclude, SourceFile *inoutSource, const TBuiltInResource &resources, const FileCache &headers, glslang::TProgram *outProgram, std::vector<unsigned> *outProgramDWords)
+// Bump when the cache file layout or anything else that decides the output
+// changes, so stale entries miss.
+static const uint32_t CACHE_VERSION = 3;
+static const uint32_t CACHE_MAGIC = 0x43435447; // "GTCC"
+
+static uint64_t HashHeaders(const StringList &includeFiles, FileCache &headers, uint64_t hash)
 {
-	glslang::TShader shader(inoutSource->stage);
-	const EShMessages messages = (EShMessages)(EShMsgSpvRules | EShMsgVulkanRules);
-	ShaderIncluder includer(headers);
-	std::vector<const char *> fileNames;
-	std::vector<const char *> fileContents;
-	std::vector<int> fileContentLengths;
+	std::lock_guard<std::mutex> lock(headers.mutex);
 
-	if (optForceInclude)
+	for (const std::string &includeFile : includeFiles)
 	{
-		inoutSource->includeFiles.push_back(optForceInclude->fileName.c_str());
-		inoutSource->includeFiles.insert(inoutSource->includeFiles.end(), optForceInclude->includeFiles.begin(), optForceInclude->includeFiles.end());
+		const uint64_t includeHash = headers.headers.at(includeFile).hash;
 
-		fileNames.push_back(optForceInclude->fileName.c_str());
-		fileContents.push_back(optForceInclude->contents.c_str());
-		fileContentLengths.push_back(static_cast<int>(optForceInclude->contents.length()));
+		hash = HashBytes(&includeHash, sizeof(includeHash), hash);
 	}
 
-	fileNames.push_back(inoutSource->fileName.c_str());
-	fileContents.push_back(inoutSource->contents.c_str());
-	fileContentLengths.push_back(static_cast<int>(inoutSource->contents.length()));
+	return hash;
+}
+
+// Key of everything glslang sees and is told: the variant's defines, the force
+// include and source with their includes expanded, the stage, the SPIR-V options, the
+// optimization profile and the glslang version.
+static uint64_t HashSource(const SourceFile *optForceInclude, const SourceFile &source, FileCache &headers)
+{
+	const uint32_t stage = source.stage;
+	glslang::SpvOptions options;
+	uint64_t hash;
 
-	shader.setStringsWithLengthsAndNames(fileContents.data(), fileContentLengths.data(), fileNames.data(), static_cast<int>(fileNames.size()));
+	GetSpvOptions(&options);
 
-	if (!shader.parse(&resources, 100, ECoreProfile, false, false, messages, includer))
+	const uint8_t optionBits[] = { options.generateDebugInfo, options.disableOptimizer, options.optimizeSize, options.validate, ENABLE_OPT };
+
+	hash = HashBytes(&CACHE_VERSION, sizeof(CACHE_VERSION));
+	hash = HashString(GLSLANG_REVISION, hash);
+
+	if (optForceInclude)
 	{
-		std::cout << shader.getInfoLog() << std::endl << shader.getInfoDebugLog() << std::endl;
-		std::cout << "Failed to parse \"" << inoutSource->fileName << "\". Excluding from build." << std::endl;
-		return false;
+		hash = HashString(optForceInclude->contents, hash);
+		hash = HashHeaders(optForceInclude->includeFiles, headers, hash);
 	}
 
-	outProgram->addShader(&shader);
+	hash = HashString(source.defines, hash);
+	hash = HashString(source.contents, hash);
+	hash = HashHeaders(source.includeFiles, headers, hash);
 
-	if (!outProgram->link(messages))
+	hash = HashBytes(&stage, sizeof(stage), hash);
+	hash = HashBytes(optionBits, sizeof(optionBits), hash);
+	hash = HashBytes(&source.optimize, sizeof(source.optimize), hash);
+
+	return hash;
+}
+
+static std::string CachePath(const std::string &cacheDir, uint64_t hash)
+{
+	char name[32];
+
+	std::snprintf(name, sizeof(name), "%016llx.spvc", (unsigned long long)hash);
+
+	return cacheDir + "\\" + name;
+}
+
+// Layout, in 32 bit words unless noted: magic, version, stage, SPIR-V size and
+// words, uniform block count, each block's binding, size, name length and
+// name bytes, descriptor binding count, each binding's set, binding, type and
+// count, vertex input count, each input's location, component type,
+// components and locations, push constant bytes, input count, output count.
+static bool LoadCachedProgram(const std::string &path, EShLanguage stage, std::vector<unsigned> *outProgramDWords, Reflection *outReflection)
+{
+	std::ifstream file(path, std::ios::binary);
+	const auto Read = [&file](uint32_t *outValue) { return (bool)file.read((char*)outValue, sizeof(*outValue)); };
+	uint32_t magic, version, cachedStage, dwordCount, uboCount;
+
+	if (!file || !Read(&magic) || !Read(&version) || !Read(&cachedStage) || !Read(&dwordCount))
+	{
+		return false;
+	}
+
+	if (magic != CACHE_MAGIC || version != CACHE_VERSION || cachedStage != (uint32_t)stage || dwordCount == 0)
 	{
-		std::cout << outProgram->getInfoLog() << std::endl << outProgram->getInfoDebugLog() << std::endl;
-		std::cout << "Failed to link \"" << inoutSource->fileName << "\". Excluding from build." << std::endl;
+		return false;
+	}
+
+	outProgramDWords->resize(dwordCount);
+	if (!file.read((char*)outProgramDWords->data(), dwordCount * sizeof(uint32_t)) || !Read(&uboCount))
+	{
+		return false;
+	}
+
+	outReflection->ubos.resize(uboCount);
+	for (UniformBlock &ubo : outReflection->ubos)
+	{
+		uint32_t nameLength;
+
+		if (!Read(&ubo.binding) || !Read(&ubo.sizeBytes) || !Read(&nameLength))
+		{
+			return false;
+		}
+
+		ubo.name.resize(nameLength);
+		if (nameLength != 0 && !file.read(&ubo.name[0], nameLength))
+		{
+			return false;
+		}
+	}
+
+	uint32_t bindingCount, vertexInputCount;
+
+	if (!Read(&bindingCount))
+	{
+		return false;
+	}
+
+	outReflection->bindings.resize(bindingCount);
+	for (DescriptorBinding &binding : outReflection->bindings)
+	{
+		if (!Read(&binding.set) || !Read(&binding.binding) || !Read((uint32_t*)&binding.type) || !Read(&binding.count))
+		{
+			return false;
+		}
+	}
+
+	if (!Read(&vertexInputCount))
+	{
+		return false;
+	}
+
+	outReflection->vertexInputs.resize(vertexInputCount);
+	for (VertexInput &input : outReflection->vertexInputs)
+	{
+		if (!Read(&input.location) || !Read((uint32_t*)&input.componentType) || !Read(&input.components) || !Read(&input.locations))
+		{
+			return false;
+		}
+	}
+
+	return Read(&outReflection->pushConstantBytes) && Read(&outReflection->inputCount) && Read(&outReflection->outputCount);
+}
+
+static bool FindProgram(ProgramCache *inoutPrograms, uint64_t hash, std::vector<unsigned> *outProgramDWords, Reflection *outReflection)
+{
+	std::lock_guard<std::mutex> lock(inoutPrograms->mutex);
+	const auto programIt = inoutPrograms->programs.find(hash);
+
+	if (programIt == inoutPrograms->programs.cend())
+	{
+		return false;
+	}
+
+	*outProgramDWords = programIt->second.programDWords;
+	*outReflection = programIt->second.reflection;
+
+	return true;
+}
+
+// Written aside and renamed into place, so a crash or another instance never
+// reads a torn entry.
+static void StoreCachedProgram(const std::string &path, EShLanguage stage, const std::vector<unsigned> &programDWords, const Reflection &reflection)
+{
+	const std::string tempPath = path + ".tmp";
+	std::error_code error;
+
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		const auto Write = [&file](uint32_t value) { file.write((const char*)&value, sizeof(value)); };
+
+		Write(CACHE_MAGIC);
+		Write(CACHE_VERSION);
+		Write((uint32_t)stage);
+		Write((uint32_t)programDWords.size());
+		file.write((const char*)programDWords.data(), programDWords.size() * sizeof(uint32_t));
+		Write((uint32_t)reflection.ubos.size());
+		for (const UniformBlock &ubo : reflection.ubos)
+		{
+			Write(ubo.binding);
+			Write(ubo.sizeBytes);
+			Write((uint32_t)ubo.name.length());
+			file.write(ubo.name.data(), ubo.name.length());
+		}
+		Write((uint32_t)reflection.bindings.size());
+		for (const DescriptorBinding &binding : reflection.bindings)
+		{
+			Write(binding.set);
+			Write(binding.binding);
+			Write((uint32_t)binding.type);
+			Write(binding.count);
+		}
+		Write((uint32_t)reflection.vertexInputs.size());
+		for (const VertexInput &input : reflection.vertexInputs)
+		{
+			Write(input.location);
+			Write((uint32_t)input.componentType);
+			Write(input.components);
+			Write(input.locations);
+		}
+		Write(reflection.pushConstantBytes);
+		Write(reflection.inputCount);
+		Write(reflection.outputCount);
+
+		if (!file)
+		{
+			return;
+		}
+	}
+
+	std::filesystem::rename(tempPath, path, error);
+}
+
+// What each source was last built from, kept in the cache directory. Its
+// reverse, from each header to the sources including it, tells which sources
+// a header change dirties without expanding any of them. Clean sources reuse
+// their key and skip loading altogether.
+struct IncludeGraph
+{
+	struct Source
+	{
+		uint64_t contentHash;      // of the file on disk
+		std::vector<uint64_t> keys;   // of its cached programs, by variant key
+		StringList includeFiles;   // the force include's first, then its own, then its variants sidecar
+	};
+
+	uint64_t settingsHash = 0;
+	std::unordered_map<std::string, uint64_t> headerHashes;   // on disk, as the sources were built with them
+	std::unordered_map<std::string, Source> sources;
+};
+
+static const uint32_t INCLUDE_GRAPH_VERSION = 2;
+
+// Whatever decides keys besides file contents. A graph from other settings
+// is dropped, as its keys would be stale.
+static uint64_t HashBuildSettings(const Settings &settings)
+{
+	glslang::SpvOptions options;
+	uint64_t hash;
+
+	GetSpvOptions(&options);
+
+	const uint8_t optionBits[] = { options.generateDebugInfo, options.disableOptimizer, options.optimizeSize, options.validate, ENABLE_OPT };
+
+	hash = HashBytes(&CACHE_VERSION, sizeof(CACHE_VERSION));
+	hash = HashString(GLSLANG_REVISION, hash);
+	hash = HashBytes(optionBits, sizeof(optionBits), hash);
+	hash = HashBytes(&settings.optimize, sizeof(settings.optimize), hash);
+	hash = HashString(settings.forceInclude, hash);
+	for (const std::string &includeDir : settings.includeDirs)
+	{
+		hash = HashString(includeDir, hash);
+	}
+
+	return hash;
+}
+
+// Lines of "header <hash> <path>", and "source <hash> <path>" each followed
+// by a "key <key>" line per variant and "include <path>" lines, under a
+// version line. Paths run to the
+// end of the line.
+static bool LoadIncludeGraph(const std::string &path, IncludeGraph *outGraph)
+{
+	std::ifstream file(path);
+	std::string line;
+	IncludeGraph::Source *source = nullptr;
+	unsigned version = 0;
+
+	if (!std::getline(file, line) || std::sscanf(line.c_str(), "glsltoc include graph %u %llx", &version, (unsigned long long *)&outGraph->settingsHash) != 2 || version != INCLUDE_GRAPH_VERSION)
+	{
+		return false;
+	}
+
+	while (std::getline(file, line))
+	{
+		unsigned long long hash;
+		int pathStart = 0;
+
+		if (std::sscanf(line.c_str(), "header %llx %n", &hash, &pathStart) == 1 && pathStart > 0)
+		{
+			outGraph->headerHashes[line.substr(pathStart)] = hash;
+		}
+		else if (std::sscanf(line.c_str(), "source %llx %n", &hash, &pathStart) == 1 && pathStart > 0)
+		{
+			source = &outGraph->sources[line.substr(pathStart)];
+			source->contentHash = hash;
+		}
+		else if (std::sscanf(line.c_str(), "key %llx", &hash) == 1 && source)
+		{
+			source->keys.push_back(hash);
+		}
+		else if (line.compare(0, 8, "include ") == 0 && source)
+		{
+			source->includeFiles.push_back(line.substr(8));
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Written aside and renamed into place, as cache entries are.
+static void StoreIncludeGraph(const std::string &path, const IncludeGraph &graph)
+{
+	const std::string tempPath = path + ".tmp";
+	std::error_code error;
+
+	{
+		std::ofstream file(tempPath, std::ios::out | std::ios::trunc);
+
+		file << "glsltoc include graph " << INCLUDE_GRAPH_VERSION << " " << std::hex << graph.settingsHash << std::endl;
+		for (const auto &header : graph.headerHashes)
+		{
+			file << "header " << header.second << " " << header.first << std::endl;
+		}
+
+		for (const auto &source : graph.sources)
+		{
+			file << "source " << source.second.contentHash << " " << source.first << std::endl;
+			for (uint64_t key : source.second.keys)
+			{
+				file << "key " << key << std::endl;
+			}
+			for (const std::string &includeFile : source.second.includeFiles)
+			{
+				file << "include " << includeFile << std::endl;
+			}
+		}
+
+		if (!file)
+		{
+			return;
+		}
+	}
+
+	std::filesystem::rename(tempPath, path, error);
+}
+
+// Sources of the graph that changed, or include a header that did, by way
+// of the reverse graph. Also counts the headers that changed.
+static void FindDirtySources(const IncludeGraph &graph, FileHashMap *inoutFileHashes, std::unordered_set<std::string> *outDirty, unsigned *outChangedHeaders)
+{
+	std::unordered_map<std::string, StringList> dependents;
+
+	for (const auto &source : graph.sources)
+	{
+		for (const std::string &includeFile : source.second.includeFiles)
+		{
+			dependents[includeFile].push_back(source.first);
+		}
+
+		if (GetContentHash(source.first, inoutFileHashes) != source.second.contentHash)
+		{
+			outDirty->insert(source.first);
+		}
+	}
+
+	*outChangedHeaders = 0;
+	for (const auto &header : graph.headerHashes)
+	{
+		if (GetContentHash(header.first, inoutFileHashes) != header.second)
+		{
+			const StringList &headerDependents = dependents[header.first];
+
+			outDirty->insert(headerDependents.begin(), headerDependents.end());
+			++*outChangedHeaders;
+		}
+	}
+}
+
+// Instructions in a SPIR-V module, after its 5 word header. Each one's first
+// word holds its word count in the high 16 bits.
+static unsigned CountInstructions(const std::vector<unsigned> &programDWords)
+{
+	unsigned count = 0;
+
+	for (size_t wordIndex = 5; wordIndex < programDWords.size(); wordIndex += std::max(programDWords[wordIndex] >> 16, 1u))
+	{
+		++count;
+	}
+
+	return count;
+}
+
+// Both optimizing profiles inline everything, replace aggregates with scalars
+// and promote them to SSA, unroll loops marked [[unroll]] (with
+// GL_EXT_control_flow_attributes) and remove dead code. Performance adds
+// constant folding, branch flattening and redundancy elimination, size only
+// cleans up the control flow. Without SPIRV-Tools in the build, -o and the
+// pragma reject these profiles before anything is compiled.
+static bool OptimizeProgram(OptimizeProfile profile, std::vector<unsigned> *inoutProgramDWords, std::ostream *outLog)
+{
+	if (profile == OptimizeProfile::NONE)
+	{
+		return true;
+	}
+
+#if ENABLE_OPT
+	spvtools::Optimizer optimizer(SPV_ENV_VULKAN_1_0);
+	std::vector<uint32_t> optimized;
+
+	optimizer.SetMessageConsumer([outLog](spv_message_level_t level, const char *, const spv_position_t &, const char *message)
+	{
+		if (level <= SPV_MSG_ERROR)
+		{
+			*outLog << "SPIR-V optimizer: " << message << std::endl;
+		}
+	});
+
+	optimizer.RegisterPass(spvtools::CreateMergeReturnPass())
+		.RegisterPass(spvtools::CreateInlineExhaustivePass())
+		.RegisterPass(spvtools::CreateEliminateDeadFunctionsPass())
+		.RegisterPass(spvtools::CreatePrivateToLocalPass())
+		.RegisterPass(spvtools::CreateScalarReplacementPass())
+		.RegisterPass(spvtools::CreateLocalSingleBlockLoadStoreElimPass())
+		.RegisterPass(spvtools::CreateLocalSingleStoreElimPass())
+		.RegisterPass(spvtools::CreateSSARewritePass())
+		.RegisterPass(spvtools::CreateAggressiveDCEPass())
+		.RegisterPass(spvtools::CreateLoopUnrollPass(true))
+		.RegisterPass(spvtools::CreateDeadBranchElimPass());
+
+	if (profile == OptimizeProfile::PERFORMANCE)
+	{
+		optimizer.RegisterPass(spvtools::CreateCCPPass())
+			.RegisterPass(spvtools::CreateSimplificationPass())
+			.RegisterPass(spvtools::CreateIfConversionPass())
+			.RegisterPass(spvtools::CreateCopyPropagateArraysPass())
+			.RegisterPass(spvtools::CreateVectorDCEPass())
+			.RegisterPass(spvtools::CreateDeadInsertElimPass())
+			.RegisterPass(spvtools::CreateRedundancyEliminationPass());
+	}
+
+	optimizer.RegisterPass(spvtools::CreateCFGCleanupPass())
+		.RegisterPass(spvtools::CreateAggressiveDCEPass());
+
+	if (!optimizer.Run(inoutProgramDWords->data(), inoutProgramDWords->size(), &optimized))
+	{
+		return false;
+	}
+
+	inoutProgramDWords->assign(optimized.begin(), optimized.end());
+
+	return true;
+#else
+	*outLog << "SPIR-V optimizer: not in this build." << std::endl;
+
+	return false;
+#endif //#if ENABLE_OPT
+}
+
+static void AddDescriptorBinding(const glslang::TObjectReflection &object, DescriptorType type, unsigned count, Reflection *inoutReflection)
+{
+	const glslang::TQualifier &qualifier = object.getType()->getQualifier();
+	const unsigned set = qualifier.hasSet() ? qualifier.layoutSet : 0;
+	const unsigned binding = (unsigned)std::max(object.getBinding(), 0);
+
+	// Arrays of blocks are reflected an element at a time.
+	for (DescriptorBinding &existing : inoutReflection->bindings)
+	{
+		if (existing.set == set && existing.binding == binding)
+		{
+			existing.count += count;
+			return;
+		}
+	}
+
+	inoutReflection->bindings.push_back({ set, binding, type, count });
+}
+
+static DescriptorType SamplerDescriptorType(const glslang::TSampler &sampler)
+{
+	if (sampler.isSubpass())
+		return DescriptorType::INPUT_ATTACHMENT;
+	if (sampler.isPureSampler())
+		return DescriptorType::SAMPLER;
+	if (sampler.dim == glslang::EsdBuffer)
+		return sampler.isImage() ? DescriptorType::STORAGE_TEXEL_BUFFER : DescriptorType::UNIFORM_TEXEL_BUFFER;
+	if (sampler.isImage())
+		return DescriptorType::STORAGE_IMAGE;
+
+	return sampler.isCombined() ? DescriptorType::COMBINED_IMAGE_SAMPLER : DescriptorType::SAMPLED_IMAGE;
+}
+
+// Uniform blocks, descriptor bindings, push constants and vertex inputs of a
+// linked program, for building its pipeline's layouts. Only what the program
+// uses is reflected.
+static void ReflectLayout(glslang::TProgram &program, EShLanguage stage, Reflection *outReflection)
+{
+	for (int uboIndex = 0; uboIndex < program.getNumUniformBlocks(); ++uboIndex)
+	{
+		const glslang::TObjectReflection& ubo = program.getUniformBlock(uboIndex);
+
+		if (ubo.getType()->getQualifier().isPushConstant())
+		{
+			outReflection->pushConstantBytes = std::max(outReflection->pushConstantBytes, (unsigned)ubo.size);
+			continue;
+		}
+
+		outReflection->ubos.push_back({ ubo.name, (unsigned)ubo.getBinding(), (unsigned)ubo.size });
+		AddDescriptorBinding(ubo, DescriptorType::UNIFORM_BUFFER, 1, outReflection);
+	}
+
+	for (int bufferIndex = 0; bufferIndex < program.getNumBufferBlocks(); ++bufferIndex)
+	{
+		AddDescriptorBinding(program.getBufferBlock(bufferIndex), DescriptorType::STORAGE_BUFFER, 1, outReflection);
+	}
+
+	// Block members are uniform variables too; only opaque types take bindings.
+	for (int uniformIndex = 0; uniformIndex < program.getNumUniformVariables(); ++uniformIndex)
+	{
+		const glslang::TObjectReflection& uniform = program.getUniform(uniformIndex);
+		const glslang::TType &type = *uniform.getType();
+
+		if (type.getBasicType() == glslang::EbtSampler)
+		{
+			AddDescriptorBinding(uniform, SamplerDescriptorType(type.getSampler()), (unsigned)std::max(uniform.size, 1), outReflection);
+		}
+	}
+
+	std::sort(outReflection->bindings.begin(), outReflection->bindings.end(), [](const DescriptorBinding &a, const DescriptorBinding &b) { return a.set != b.set ? a.set < b.set : a.binding < b.binding; });
+
+	for (int inputIndex = 0; stage == EShLangVertex && inputIndex < program.getNumPipeInputs(); ++inputIndex)
+	{
+		const glslang::TType &type = *program.getPipeInput(inputIndex).getType();
+		VertexInput input;
+
+		if (type.getQualifier().builtIn != glslang::EbvNone || !type.getQualifier().hasLocation())
+			continue;
+
+		switch (type.getBasicType())
+		{
+			case glslang::EbtFloat:  input.componentType = ComponentType::FLOAT;  break;
+			case glslang::EbtInt:    input.componentType = ComponentType::INT;    break;
+			case glslang::EbtUint:   input.componentType = ComponentType::UINT;   break;
+			case glslang::EbtDouble: input.componentType = ComponentType::DOUBLE; break;
+			default: continue;
+		}
+
+		input.location = type.getQualifier().layoutLocation;
+		input.components = type.isMatrix() ? type.getMatrixRows() : type.getVectorSize();
+		input.locations = (type.isMatrix() ? type.getMatrixCols() : 1) * (type.isArray() ? type.getCumulativeArraySize() : 1);
+		outReflection->vertexInputs.push_back(input);
+	}
+
+	std::sort(outReflection->vertexInputs.begin(), outReflection->vertexInputs.end(), [](const VertexInput &a, const VertexInput &b) { return a.location < b.location; });
+
+	outReflection->inputCount = program.getNumPipeInputs();
+	outReflection->outputCount = program.getNumPipeOutputs();
+}
+
+// glslang allocates from a pool per shader and program, so threads compile
+// with objects of their own and only share the process wide setup.
+static bool CompileSourceFile(const SourceFile *optForceInclude, const SourceFile &source, const TBuiltInResource &resources, FileCache &headers, std::vector<unsigned> *outProgramDWords, Reflection *outReflection, std::ostream *outLog)
+{
+	glslang::TProgram program;
+	glslang::TShader shader(source.stage);
+	const EShMessages messages = (EShMessages)(EShMsgSpvRules | EShMsgVulkanRules);
+	ShaderIncluder includer(headers);
+	std::vector<const char *> fileNames;
+	std::vector<const char *> fileContents;
+	std::vector<int> fileContentLengths;
+
+	if (optForceInclude)
+	{
+		fileNames.push_back(optForceInclude->fileName.c_str());
+		fileContents.push_back(optForceInclude->contents.c_str());
+		fileContentLengths.push_back(static_cast<int>(optForceInclude->contents.length()));
+	}
+
+	fileNames.push_back(source.fileName.c_str());
+	fileContents.push_back(source.contents.c_str());
+	fileContentLengths.push_back(static_cast<int>(source.contents.length()));
+
+	shader.setStringsWithLengthsAndNames(fileContents.data(), fileContentLengths.data(), fileNames.data(), static_cast<int>(fileNames.size()));
+	shader.setPreamble(source.defines.c_str());
+
+	if (!shader.parse(&resources, 100, ECoreProfile, false, false, messages, includer))
+	{
+		*outLog << shader.getInfoLog() << std::endl << shader.getInfoDebugLog() << std::endl;
+		*outLog << "Failed to parse \"" << source.fileName << "\". Excluding from build." << std::endl;
+		return false;
+	}
+
+	program.addShader(&shader);
+
+	if (!program.link(messages))
+	{
+		*outLog << program.getInfoLog() << std::endl << program.getInfoDebugLog() << std::endl;
+		*outLog << "Failed to link \"" << source.fileName << "\". Excluding from build." << std::endl;
 		return false;
 	}
 
 	glslang::SpvOptions buildOptions;
-#ifdef NDEBUG
-	buildOptions.generateDebugInfo = true; 
-	buildOptions.disableOptimizer = true;
-#else //#ifdef NDEBUG
-	buildOptions.generateDebugInfo = false;
-	buildOptions.disableOptimizer = false;
-#endif //#else //#ifdef NDEBUG
-	buildOptions.optimizeSize = false;
-	buildOptions.disassemble = false;
-	buildOptions.validate = true;
 
-	glslang::GlslangToSpv(*outProgram->getIntermediate(inoutSource->stage), *outProgramDWords, &buildOptions);
+	GetSpvOptions(&buildOptions);
+
+	glslang::GlslangToSpv(*program.getIntermediate(source.stage), *outProgramDWords, &buildOptions);
 	if (outProgramDWords->empty())
 	{
-		std::cout << "No binary data generated for \"" << inoutSource->fileName << "\". Excluding from build." << std::endl;
+		*outLog << "No binary data generated for \"" << source.fileName << "\". Excluding from build." << std::endl;
 		return false;
 	}
 	else
 	{
-		outProgram->buildReflection(EShReflectionAllBlockVariables | EShReflectionIntermediateIO );
+		program.buildReflection(EShReflectionAllBlockVariables | EShReflectionIntermediateIO );
+	}
+
+	const size_t wordsBefore = outProgramDWords->size();
+	const unsigned instructionsBefore = CountInstructions(*outProgramDWords);
+
+	if (!OptimizeProgram(source.optimize, outProgramDWords, outLog))
+	{
+		*outLog << "Failed to optimize \"" << source.fileName << "\". Excluding from build." << std::endl;
+		return false;
 	}
 
+	if (source.optimize != OptimizeProfile::NONE)
+	{
+		const unsigned instructionsAfter = CountInstructions(*outProgramDWords);
+
+		*outLog << "  " << GetFilename(source.fileName.c_str()) << source.variant << " (" << OPTIMIZE_PROFILE_NAMES[(unsigned)source.optimize] << "): " << wordsBefore << " -> " << outProgramDWords->size() << " words, " << instructionsBefore << " -> " << instructionsAfter << " instructions." << std::endl;
+	}
+
+	ReflectLayout(program, source.stage, outReflection);
+
 	return true;
 }
 
@@ -787,241 +1800,831 @@ static const char* StageToReflectionStr(EShLanguage stage)
 	return "<ERROR -- UNKNOWN STAGE>";
 }
 
+static const char* DescriptorTypeToReflectionStr(DescriptorType type)
+{
+	switch (type)
+	{
+		case DescriptorType::SAMPLER:                return "ShaderDescriptorType::SAMPLER";
+		case DescriptorType::COMBINED_IMAGE_SAMPLER: return "ShaderDescriptorType::COMBINED_IMAGE_SAMPLER";
+		case DescriptorType::SAMPLED_IMAGE:          return "ShaderDescriptorType::SAMPLED_IMAGE";
+		case DescriptorType::STORAGE_IMAGE:          return "ShaderDescriptorType::STORAGE_IMAGE";
+		case DescriptorType::UNIFORM_TEXEL_BUFFER:   return "ShaderDescriptorType::UNIFORM_TEXEL_BUFFER";
+		case DescriptorType::STORAGE_TEXEL_BUFFER:   return "ShaderDescriptorType::STORAGE_TEXEL_BUFFER";
+		case DescriptorType::UNIFORM_BUFFER:         return "ShaderDescriptorType::UNIFORM_BUFFER";
+		case DescriptorType::STORAGE_BUFFER:         return "ShaderDescriptorType::STORAGE_BUFFER";
+		case DescriptorType::INPUT_ATTACHMENT:       return "ShaderDescriptorType::INPUT_ATTACHMENT";
+	}
+
+	return "<ERROR -- UNKNOWN DESCRIPTOR TYPE>";
+}
+
+static const char * const COMPONENT_TYPE_REFLECTION_NAMES[] = { "ShaderComponentType::FLOAT", "ShaderComponentType::INT", "ShaderComponentType::UINT", "ShaderComponentType::DOUBLE" };
+
 static std::string FilenameToReflectionPrefix(const std::string& outputName)
 {
 	const size_t lastSlash = outputName.find_last_of("\\/");
 	std::string prefix = outputName.substr(lastSlash + 1) + "_";
 
-	for (char& ch : prefix)
+	for (char& ch : prefix)
+	{
+		if (ch == '.')
+			ch = '_';
+	}
+
+	return prefix;
+}
+
+// Start of a generated header, up to its declarations.
+static void HeaderPreambleToC(std::ostream *outHeader)
+{
+	std::ostream &header = *outHeader;
+
+	header << "// Generated by GLSLToC. Do no modify." << std::endl;
+	header << std::endl;
+	header << "#pragma once" << std::endl;
+	header << std::endl;
+	header << "#include \"ShaderReflection.h\"" << std::endl;
+	header << std::endl;
+
+	header << "#ifdef EXPORT" << std::endl;
+	header << "# error \"'EXPORT' already defined.\"" << std::endl;
+	header << "#endif //#ifdef EXPORT" << std::endl;
+	header << std::endl;
+
+	header << "#if BUILD_DLL" << std::endl;
+	header << "# define EXPORT __declspec(dllexport)" << std::endl;
+	header << "#elif USE_DLL //#if BUILD_DLL" << std::endl;
+	header << "# define EXPORT __declspec(dllimport)" << std::endl;
+	header << "#else //#elif USE_DLL //#if BUILD_DLL" << std::endl;
+	header << "# define EXPORT" << std::endl;
+	header << "#endif //#else //#elif USE_DLL //#if BUILD_DLL" << std::endl;
+	header << std::endl;
+}
+
+// Encodes the program and checks it decodes back, timing the decode. Empty
+// when it doesn't.
+static std::vector<uint8_t> CompressProgram(const std::vector<unsigned> &progDWords, sdf::spirvcodec::Stats *inoutStats)
+{
+	std::vector<uint8_t> bytes;
+	std::vector<uint32_t> decoded(progDWords.size());
+
+	sdf::spirvcodec::Encode(progDWords.data(), progDWords.size(), &bytes);
+
+	const auto decodeStart = std::chrono::high_resolution_clock::now();
+	const bool valid = sdf::spirvcodec::Decode(bytes.data(), bytes.size(), decoded.data(), decoded.size());
+
+	inoutStats->seconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - decodeStart).count();
+	if (!valid || !std::equal(decoded.begin(), decoded.end(), progDWords.begin()))
+	{
+		return std::vector<uint8_t>();
+	}
+
+	inoutStats->words += progDWords.size();
+	inoutStats->bytes += bytes.size();
+
+	return bytes;
+}
+
+// The program's words, uniform block names and uniform blocks, as arrays
+// named with prefix. With optCompression the words are written encoded, as
+// <prefix>prog_z, unless they fail to decode back. Returns the encoded size,
+// 0 when the words are written as they are.
+static size_t ProgramArraysToC(const std::string &prefix, const Reflection &reflection, const std::vector<unsigned> &progDWords, sdf::spirvcodec::Stats *optCompression, std::ostream *outSource)
+{
+	std::ostream &source = *outSource;
+	const std::vector<uint8_t> compressed = optCompression ? CompressProgram(progDWords, optCompression) : std::vector<uint8_t>();
+
+	if (!compressed.empty())
+	{
+		source << "static const unsigned char " << prefix << "prog_z[] = {" << std::hex << std::endl;
+		for (size_t byteIndex = 0; byteIndex < compressed.size();)
+		{
+			source << "\t";
+			for (size_t lineIndex = 0; lineIndex < 16 && byteIndex < compressed.size(); ++lineIndex, ++byteIndex)
+			{
+				source << "0x" << std::setw(2) << std::setfill('0') << (unsigned)compressed[byteIndex];
+
+				if (byteIndex + 1 < compressed.size())
+					source << ", ";
+			}
+
+			source << std::endl;
+		}
+		source << "};" << std::dec << std::endl;
+		source << std::endl;
+	}
+	else
+	{
+		source << "static const unsigned " << prefix << "prog[] = {" << std::hex << std::endl;
+		for (size_t progIndex = 0; progIndex < progDWords.size();)
+		{
+			source << "\t";
+			for (size_t lineIndex = 0; lineIndex < 8 && progIndex < progDWords.size(); ++lineIndex, ++progIndex)
+			{
+				source << "0x" << std::setw(8) << std::setfill('0') << progDWords[progIndex];
+
+				if (progIndex + 1 < progDWords.size())
+					source << ", ";
+			}
+
+			source << std::endl;
+		}
+		source << "};" << std::dec << std::endl;
+		source << std::endl;
+	}
+
+	source << "static const char * const " << prefix << "ubo_names[] = {" << std::endl;
+	for (const UniformBlock& ubo : reflection.ubos)
+	{
+		source << "\t\"" << ubo.name << "\"," << std::endl;
+	}
+	source << "\t\"\"" << std::endl;
+	source << "};" << std::endl;
+	source << std::endl;
+
+	source << "static const ShaderUniformBlock " << prefix << "ubos[] = {" << std::endl;
+	for (const UniformBlock& ubo : reflection.ubos)
+	{
+		source << "\t{ " << ubo.binding << ", " << ubo.sizeBytes << " }," << std::endl;
+	}
+	source << "\t{}" << std::endl;
+	source << "};" << std::endl;
+	source << std::endl;
+
+	source << "static const ShaderDescriptorBinding " << prefix << "bindings[] = {" << std::endl;
+	for (const DescriptorBinding& binding : reflection.bindings)
+	{
+		source << "\t{ " << binding.set << ", " << binding.binding << ", " << binding.count << ", " << DescriptorTypeToReflectionStr(binding.type) << " }," << std::endl;
+	}
+	source << "\t{}" << std::endl;
+	source << "};" << std::endl;
+	source << std::endl;
+
+	source << "static const ShaderVertexInput " << prefix << "vertex_inputs[] = {" << std::endl;
+	for (const VertexInput& input : reflection.vertexInputs)
+	{
+		source << "\t{ " << input.location << ", " << input.components << ", " << input.locations << ", " << COMPONENT_TYPE_REFLECTION_NAMES[(unsigned)input.componentType] << " }," << std::endl;
+	}
+	source << "\t{}" << std::endl;
+	source << "};" << std::endl;
+	source << std::endl;
+
+	return compressed.size();
+}
+
+// A ShaderModule initializer over the arrays ProgramArraysToC wrote with
+// prefix, given the size it returned.
+static void ShaderModuleToC(const std::string &name, const std::string &prefix, EShLanguage stage, const Reflection &reflection, size_t progDWordCount, size_t compressedBytes, std::ostream *outSource)
+{
+	std::ostream &source = *outSource;
+
+	source << "{" << std::endl;
+	source << "\t\"" << name << "\"," << std::endl;
+	source << "\t\"main\"," << std::endl;
+	source << "\t" << (compressedBytes ? "nullptr" : prefix + "prog") << "," << std::endl;
+	source << "\t" << prefix << "ubo_names," << std::endl;
+	source << "\t" << prefix << "ubos," << std::endl;
+	source << "\t" << progDWordCount << "," << std::endl;
+	source << "\t" << StageToReflectionStr(stage) << "," << std::endl;
+	source << "\t" << reflection.ubos.size() << "," << std::endl;
+	source << "\t" << reflection.inputCount << "," << std::endl;
+	source << "\t" << reflection.outputCount << "," << std::endl;
+	source << "\t" << prefix << "bindings," << std::endl;
+	source << "\t" << prefix << "vertex_inputs," << std::endl;
+	source << "\t" << reflection.pushConstantBytes << "," << std::endl;
+	source << "\t" << reflection.bindings.size() << "," << std::endl;
+	source << "\t" << reflection.vertexInputs.size() << "," << std::endl;
+	source << "\t" << (compressedBytes ? prefix + "prog_z" : "nullptr") << "," << std::endl;
+	source << "\t" << compressedBytes << std::endl;
+	source << "};" << std::endl;
+	source << std::endl;
+}
+
+static bool ShaderProgramToC(const std::string& outputName, EShLanguage stage, const Reflection& reflection, const std::vector<unsigned> &progDWords, sdf::spirvcodec::Stats *optCompression, std::ostream *outLog)
+{
+	const std::string headerName = outputName + ".h";
+	const std::string sourceName = outputName + ".cpp";
+	const std::string prefix = FilenameToReflectionPrefix(outputName);
+	std::ostringstream header;
+	std::ostringstream source;
+
+	HeaderPreambleToC(&header);
+
+	source << "// Generated by GLSLToC. Do no modify." << std::endl;
+	source << std::endl;
+	source << "#include \"" << GetFilename(headerName.c_str()) << "\"" << std::endl;
+	source << std::endl;
+
+	const size_t compressedBytes = ProgramArraysToC(prefix, reflection, progDWords, optCompression, &source);
+
+	header << "#if EXPORT_SHADER_SYM" << std::endl;
+	header << "extern \"C\" EXPORT const char * const shader_sym;" << std::endl;
+	header << "#endif //#if EXPORT_SHADER_SYM" << std::endl;
+	header << std::endl;
+
+	source << "#if EXPORT_SHADER_SYM" << std::endl;
+	source << "extern \"C\" const char * const shader_sym = \"" << prefix << "shader\";" << std::endl;
+	source << "#endif //#if EXPORT_SHADER_SYM" << std::endl;
+	source << std::endl;
+
+	header << "extern \"C\" EXPORT const ShaderModule " << prefix << "shader;" << std::endl;
+	header << std::endl;
+
+	source << "extern \"C\" const ShaderModule " << prefix << "shader = ";
+	ShaderModuleToC(GetFilename(outputName.c_str()), prefix, stage, reflection, progDWords.size(), compressedBytes, &source);
+
+	header << "#undef EXPORT" << std::endl;
+
+	return WriteIfChanged(headerName, header.str(), outLog) && WriteIfChanged(sourceName, source.str(), outLog);
+}
+
+// Every variant of a source, with identical programs written once. Variants
+// map to their program through a table indexed by variant key, so the source
+// grows with the distinct programs rather than the variants. <prefix>shader is
+// variant 0, as for a source without variants.
+static bool ShaderVariantsToC(const std::string &outputName, EShLanguage stage, const Variants &variants, const std::vector<const CachedProgram *> &programs, sdf::spirvcodec::Stats *optCompression, unsigned *outUniqueCount, std::ostream *outLog)
+{
+	const std::string headerName = outputName + ".h";
+	const std::string sourceName = outputName + ".cpp";
+	const std::string prefix = FilenameToReflectionPrefix(outputName);
+	const std::string name = GetFilename(outputName.c_str());
+	std::unordered_multimap<uint64_t, unsigned> uniqueByHash;
+	std::vector<const CachedProgram *> uniquePrograms;
+	std::vector<unsigned> variantPrograms(programs.size());
+	std::vector<size_t> compressedBytes;
+	std::ostringstream header;
+	std::ostringstream source;
+
+	for (size_t variantKey = 0; variantKey < programs.size(); ++variantKey)
+	{
+		const std::vector<unsigned> &words = programs[variantKey]->programDWords;
+		const uint64_t hash = HashBytes(words.data(), words.size() * sizeof(unsigned));
+		const auto range = uniqueByHash.equal_range(hash);
+		const auto found = std::find_if(range.first, range.second, [&](const std::pair<const uint64_t, unsigned> &unique) { return uniquePrograms[unique.second]->programDWords == words; });
+
+		if (found != range.second)
+		{
+			variantPrograms[variantKey] = found->second;
+		}
+		else
+		{
+			variantPrograms[variantKey] = (unsigned)uniquePrograms.size();
+			uniqueByHash.emplace(hash, (unsigned)uniquePrograms.size());
+			uniquePrograms.push_back(programs[variantKey]);
+		}
+	}
+
+	HeaderPreambleToC(&header);
+
+	source << "// Generated by GLSLToC. Do no modify." << std::endl;
+	source << std::endl;
+	source << "#include \"" << GetFilename(headerName.c_str()) << "\"" << std::endl;
+	source << std::endl;
+
+	for (size_t uniqueIndex = 0; uniqueIndex < uniquePrograms.size(); ++uniqueIndex)
+	{
+		const std::string uniquePrefix = prefix + std::to_string(uniqueIndex) + "_";
+		const CachedProgram &program = *uniquePrograms[uniqueIndex];
+
+		compressedBytes.push_back(ProgramArraysToC(uniquePrefix, program.reflection, program.programDWords, optCompression, &source));
+
+		source << "static const ShaderModule " << uniquePrefix << "module = ";
+		ShaderModuleToC(name, uniquePrefix, stage, program.reflection, program.programDWords.size(), compressedBytes.back(), &source);
+	}
+
+	source << "static const char * const " << prefix << "axis_names[] = {" << std::endl;
+	for (const VariantAxis &axis : variants.axes)
+	{
+		source << "\t\"" << axis.name << "\"," << std::endl;
+	}
+	source << "};" << std::endl;
+	source << std::endl;
+
+	source << "static const unsigned " << prefix << "axis_value_counts[] = {" << std::endl;
+	for (const VariantAxis &axis : variants.axes)
+	{
+		source << "\t" << axis.values.size() << ", //";
+		for (const std::string &value : axis.values)
+		{
+			source << " " << value;
+		}
+		source << std::endl;
+	}
+	source << "};" << std::endl;
+	source << std::endl;
+
+	source << "static const ShaderModule * const " << prefix << "variant_modules[] = {" << std::endl;
+	for (unsigned uniqueIndex : variantPrograms)
+	{
+		source << "\t&" << prefix << uniqueIndex << "_module," << std::endl;
+	}
+	source << "};" << std::endl;
+	source << std::endl;
+
+	header << "extern \"C\" EXPORT const ShaderModule " << prefix << "shader;" << std::endl;
+	header << "extern \"C\" EXPORT const ShaderVariants " << prefix << "variants;" << std::endl;
+	header << std::endl;
+
+	source << "extern \"C\" const ShaderModule " << prefix << "shader = ";
+	ShaderModuleToC(name, prefix + std::to_string(variantPrograms[0]) + "_", stage, uniquePrograms[variantPrograms[0]]->reflection, uniquePrograms[variantPrograms[0]]->programDWords.size(), compressedBytes[variantPrograms[0]], &source);
+
+	source << "extern \"C\" const ShaderVariants " << prefix << "variants = {" << std::endl;
+	source << "\t\"" << name << "\"," << std::endl;
+	source << "\t" << prefix << "axis_names," << std::endl;
+	source << "\t" << prefix << "axis_value_counts," << std::endl;
+	source << "\t" << prefix << "variant_modules," << std::endl;
+	source << "\t" << variants.axes.size() << "," << std::endl;
+	source << "\t" << programs.size() << "," << std::endl;
+	source << "\t" << uniquePrograms.size() << std::endl;
+	source << "};" << std::endl;
+
+	header << "#undef EXPORT" << std::endl;
+
+	*outUniqueCount = (unsigned)uniquePrograms.size();
+
+	return WriteIfChanged(headerName, header.str(), outLog) && WriteIfChanged(sourceName, source.str(), outLog);
+}
+
+// An input file's build, which may run on any thread. Its messages are
+// kept until the files before it have been reported, so the output doesn't
+// depend on which finishes first.
+struct BuildJob
+{
+	SourceFile source;
+	std::string outputName;
+	std::ostringstream log;
+	const IncludeGraph::Source *optClean = nullptr;   // as last built, when nothing it is built from changed since
+	IncludeGraph::Source built;                        // what it was built from this time
+	CachedProgram program;                             // kept for BuildAll to pack, with -p, or to write with the other variants
+	const Variants *optVariants = nullptr;             // of its source, when its sidecar declares any
+	unsigned variantKey = 0;
+	bool valid = false;      // outputs written or already up to date
+	bool failed = false;
+	bool cacheHit = false;
+	bool compiled = false;
+	bool expanded = false;   // loaded with its includes
+	double seconds = 0.0;
+	sdf::spirvcodec::Stats compression;   // of what it wrote, with -z
+};
+
+// C sources of the program. With -p, or for a variant, the program itself is
+// kept instead, for BuildAll to pack with the others or to write with the
+// source's other variants once they are built.
+static bool WriteProgram(const Settings &settings, std::vector<unsigned> *inoutProgramDWords, Reflection *inoutReflection, BuildJob *inoutJob)
+{
+	if (!settings.generatePack && !inoutJob->optVariants)
+	{
+		return ShaderProgramToC(inoutJob->outputName, inoutJob->source.stage, *inoutReflection, *inoutProgramDWords, settings.compress ? &inoutJob->compression : nullptr, &inoutJob->log);
+	}
+
+	inoutJob->program.programDWords = std::move(*inoutProgramDWords);
+	inoutJob->program.reflection = std::move(*inoutReflection);
+
+	return true;
+}
+
+// Outputs of a clean source straight from its last key, without loading it.
+// Fails when the program has left the caches since.
+static bool BuildCleanFile(const Settings &settings, ProgramCache *inoutPrograms, BuildJob *inoutJob)
+{
+	std::vector<unsigned> shaderProg;
+	Reflection reflection;
+	SourceFile &source = inoutJob->source;
+	std::ostringstream stageLog;
+
+	if (!DetermineStageFromFileName(source.fileName, &source.stage, &stageLog))
+	{
+		return false;
+	}
+
+	const uint64_t key = inoutJob->optClean->keys[inoutJob->variantKey];
+
+	if (!FindProgram(inoutPrograms, key, &shaderProg, &reflection) && !LoadCachedProgram(CachePath(settings.cacheDir, key), source.stage, &shaderProg, &reflection))
+	{
+		return false;
+	}
+
+	inoutJob->cacheHit = true;
+	inoutJob->built.contentHash = inoutJob->optClean->contentHash;
+	inoutJob->built.keys.assign(1, key);
+	inoutJob->built.includeFiles = inoutJob->optClean->includeFiles;
+	inoutJob->valid = WriteProgram(settings, &shaderProg, &reflection, inoutJob);
+
+	return true;
+}
+
+static void BuildChangedFile(const Settings &settings, const SourceFile *optForceInclude, const TBuiltInResource &resources, FileCache *inoutHeaderCache, FileHashMap *inoutFileHashes, ProgramCache *inoutPrograms, BuildJob *inoutJob)
+{
+	SourceFile &source = inoutJob->source;
+	std::ostream &log = inoutJob->log;
+
+	inoutJob->expanded = true;
+	if (!LoadSourceFile(source.fileName, settings.includeDirs, inoutHeaderCache, &source.includeFiles, &source.contents, &log))
+	{
+		inoutJob->failed = true;
+		log << "Failed to load and parse \"" << source.fileName << "\". Exluding from build." << std::endl;
+	}
+	else if (!DetermineStageFromFileName(source.fileName, &source.stage, &log) || !FindOptimizeProfile(source, settings.optimize, &source.optimize, &log))
+	{
+		inoutJob->failed = true;
+	}
+	else
+	{
+		const uint64_t hash = HashSource(optForceInclude, source, *inoutHeaderCache);
+		const std::string cachePath = CachePath(settings.cacheDir, hash);
+		std::vector<unsigned> shaderProg;
+		Reflection reflection;
+
+		if (!settings.force && (FindProgram(inoutPrograms, hash, &shaderProg, &reflection) || LoadCachedProgram(cachePath, source.stage, &shaderProg, &reflection)))
+		{
+			inoutJob->cacheHit = true;
+		}
+		else
+		{
+			log << "Building '" << source.fileName << source.variant << "'." << std::endl;
+
+			inoutJob->compiled = true;
+			if (!CompileSourceFile(optForceInclude, source, resources, *inoutHeaderCache, &shaderProg, &reflection, &log))
+			{
+				inoutJob->failed = true;
+				log << "Failed to compile \"" << source.fileName << "\". Exluding from build." << std::endl;
+			}
+			else
+			{
+				StoreCachedProgram(cachePath, source.stage, shaderProg, reflection);
+			}
+		}
+
+		if (!inoutJob->failed)
+		{
+			std::unique_lock<std::mutex> lock(inoutPrograms->mutex);
+
+			inoutPrograms->programs.insert_or_assign(hash, CachedProgram{ shaderProg, reflection });
+			lock.unlock();
+
+			inoutJob->valid = WriteProgram(settings, &shaderProg, &reflection, inoutJob);
+		}
+
+		inoutJob->built.contentHash = GetContentHash(source.fileName, inoutFileHashes);
+		inoutJob->built.keys.assign(1, hash);
+		if (optForceInclude)
+		{
+			inoutJob->built.includeFiles.push_back(optForceInclude->fileName);
+			inoutJob->built.includeFiles.insert(inoutJob->built.includeFiles.end(), optForceInclude->includeFiles.begin(), optForceInclude->includeFiles.end());
+		}
+		inoutJob->built.includeFiles.insert(inoutJob->built.includeFiles.end(), source.includeFiles.begin(), source.includeFiles.end());
+		inoutJob->built.includeFiles.push_back(VariantsPath(source.fileName));   // listed even when missing, so one appearing dirties the source
+	}
+}
+
+static void BuildFile(const Settings &settings, const SourceFile *optForceInclude, const TBuiltInResource &resources, FileCache *inoutHeaderCache, FileHashMap *inoutFileHashes, ProgramCache *inoutPrograms, BuildJob *inoutJob)
+{
+	const auto start = std::chrono::high_resolution_clock::now();
+
+	// Clean sources only fall through when their program left the caches.
+	if (!inoutJob->optClean || !BuildCleanFile(settings, inoutPrograms, inoutJob))
+	{
+		BuildChangedFile(settings, optForceInclude, resources, inoutHeaderCache, inoutFileHashes, inoutPrograms, inoutJob);
+	}
+
+	inoutJob->seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+struct BuildStats
+{
+	unsigned files = 0;
+	unsigned compiled = 0;         // cache misses
+	unsigned cacheHits = 0;
+	unsigned expanded = 0;         // sources loaded with their includes
+	unsigned headerReads = 0;
+	unsigned changedHeaders = 0;   // of those in the include graph
+	double seconds = 0.0;
+};
+
+// Builds every input, as a run does and a server does per request, and
+// reports to outLog. Returns 0, or less for each file that failed.
+static int BuildAll(const Settings &settings, const TBuiltInResource &resources, ProgramCache *inoutPrograms, std::ostream *outLog, BuildStats *outoptStats = nullptr)
+{
+	const std::string graphPath = settings.cacheDir + "\\IncludeGraph.txt";
+	FileCache headerCache;
+	FileHashMap fileHashes;
+	SourceFile forceInclude;
+	const SourceFile *forceIncludePtr;
+	StringList inputFiles;
+	IncludeGraph graph;
+	std::unordered_set<std::string> dirtySources;
+	unsigned changedHeaders = 0;
+	int ret;
+
+	if (!GatherInputFiles(settings, &inputFiles, outLog))
+	{
+		return -103;
+	}
+
+	if (!settings.forceInclude.empty())
+	{
+		forceInclude.fileName = settings.forceInclude;
+		if (!LoadSourceFile(forceInclude.fileName, settings.includeDirs, &headerCache, &forceInclude.includeFiles, &forceInclude.contents, outLog))
+		{
+			*outLog << "Failed to load force include file." << std::endl;
+			return -101;
+		}
+
+		forceIncludePtr = &forceInclude;
+	}
+	else
+	{
+		forceIncludePtr = nullptr;
+	}
+
+	const auto buildStart = std::chrono::high_resolution_clock::now();
+	std::vector<Variants> fileVariants(inputFiles.size());
+	size_t jobCount = 0;
+	int variantFailures = 0;
+
+	for (size_t fileIndex = 0; fileIndex < inputFiles.size(); ++fileIndex)
+	{
+		if (!LoadVariants(inputFiles[fileIndex], &fileVariants[fileIndex], outLog))
+		{
+			*outLog << "Failed to load the variants of \"" << inputFiles[fileIndex] << "\". Exluding from build." << std::endl;
+			fileVariants[fileIndex].count = 0;
+			++variantFailures;
+		}
+
+		jobCount += fileVariants[fileIndex].count;
+	}
+
+	const unsigned threadCount = (unsigned)std::min<size_t>(settings.threads, std::max<size_t>(jobCount, 1));
+	std::vector<BuildJob> jobs(jobCount);
+	std::atomic<size_t> nextJob(0);
+	std::vector<std::thread> threads;
+	std::mutex doneMutex;
+	std::condition_variable doneCondition;
+	std::vector<char> done(jobs.size(), 0);
+
+	if (!settings.force && LoadIncludeGraph(graphPath, &graph) && graph.settingsHash == HashBuildSettings(settings))
 	{
-		if (ch == '.')
-			ch = '_';
+		FindDirtySources(graph, &fileHashes, &dirtySources, &changedHeaders);
+	}
+	else
+	{
+		graph.sources.clear();
 	}
 
-	return prefix;
-}
+	// A job per variant, a source's variants one after another in key order.
+	for (size_t fileIndex = 0, jobIndex = 0; fileIndex < inputFiles.size(); ++fileIndex)
+	{
+		const Variants &variants = fileVariants[fileIndex];
+		const auto graphIt = graph.sources.find(inputFiles[fileIndex]);
+		const bool clean = graphIt != graph.sources.cend() && dirtySources.count(graphIt->first) == 0 && graphIt->second.keys.size() == variants.count;
 
-static bool ShaderProgramToC(const std::string& outputName, EShLanguage stage, glslang::TProgram& prog, const std::vector<unsigned> &progDWords)
-{
-	const std::string headerName = outputName + ".h";
-	std::ofstream header(headerName, std::ios::out);
+		for (unsigned variantKey = 0; variantKey < variants.count; ++variantKey, ++jobIndex)
+		{
+			BuildJob &job = jobs[jobIndex];
+
+			job.source.fileName = inputFiles[fileIndex];
+			job.outputName = GetOutputName(inputFiles[fileIndex], settings.outputDir);
+			job.optClean = clean ? &graphIt->second : nullptr;
+			if (!variants.axes.empty())
+			{
+				job.optVariants = &variants;
+				job.variantKey = variantKey;
+				job.source.defines = VariantDefines(variants, variantKey);
+				job.source.variant = ":" + std::to_string(variantKey);
+			}
+		}
+	}
 
-	if (!header)
+	// With one thread, files build on this one as they are reported.
+	if (threadCount > 1)
 	{
-		std::cout << "Failed to open \"" << headerName.c_str() << "\" for writing." << std::endl;
-		return false;
+		for (unsigned threadIndex = 0; threadIndex < threadCount; ++threadIndex)
+		{
+			threads.emplace_back([&]()
+			{
+				for (size_t jobIndex = nextJob++; jobIndex < jobs.size(); jobIndex = nextJob++)
+				{
+					BuildFile(settings, forceIncludePtr, resources, &headerCache, &fileHashes, inoutPrograms, &jobs[jobIndex]);
+
+					std::lock_guard<std::mutex> lock(doneMutex);
+					done[jobIndex] = 1;
+					doneCondition.notify_all();
+				}
+			});
+		}
 	}
-	else
+
+	ret = -variantFailures;
+	std::vector<std::string> validPrograms;
+	std::vector<std::string> validVariants;   // of validPrograms, those built from a .variants
+	std::vector<sdf::shaderpack::Program> packPrograms;
+	unsigned compiledCount = 0;
+	unsigned cacheHits = 0;
+	unsigned expandedCount = 0;
+	unsigned variantSources = 0;
+	unsigned variantCount = 0;
+	unsigned uniqueVariantCount = 0;
+	sdf::spirvcodec::Stats compression;
+	double compileSeconds = 0.0;
+	IncludeGraph builtGraph;
+	bool sourceValid = false;   // every variant of the source so far
+	for (size_t jobIndex = 0; jobIndex < jobs.size(); ++jobIndex)
 	{
-		const std::string sourceName = outputName + ".cpp";
-		std::ofstream source(sourceName, std::ios::out);
+		BuildJob &job = jobs[jobIndex];
 
-		if (!source)
+		if (threads.empty())
 		{
-			std::cout << "Failed to open \"" << sourceName.c_str() << "\" for writing." << std::endl;
-			return false;
+			BuildFile(settings, forceIncludePtr, resources, &headerCache, &fileHashes, inoutPrograms, &job);
 		}
 		else
 		{
-			const std::string prefix = FilenameToReflectionPrefix(outputName);
-
-			header << "// Generated by GLSLToC. Do no modify." << std::endl;
-			header << std::endl;
-			header << "#pragma once" << std::endl;
-			header << std::endl;
-			header << "#include \"ShaderReflection.h\"" << std::endl;
-			header << std::endl;
-
-			header << "#ifdef EXPORT" << std::endl;
-			header << "# error \"'EXPORT' already defined.\"" << std::endl;
-			header << "#endif //#ifdef EXPORT" << std::endl;
-			header << std::endl;
-
-			header << "#if BUILD_DLL" << std::endl;
-			header << "# define EXPORT __declspec(dllexport)" << std::endl;
-			header << "#elif USE_DLL //#if BUILD_DLL" << std::endl;
-			header << "# define EXPORT __declspec(dllimport)" << std::endl;
-			header << "#else //#elif USE_DLL //#if BUILD_DLL" << std::endl;
-			header << "# define EXPORT" << std::endl;
-			header << "#endif //#else //#elif USE_DLL //#if BUILD_DLL" << std::endl;
-			header << std::endl;
-
-			source << "// Generated by GLSLToC. Do no modify." << std::endl;
-			source << std::endl;
-			source << "#include \"" << GetFilename(headerName.c_str()) << "\"" << std::endl;
-			source << std::endl;
+			std::unique_lock<std::mutex> lock(doneMutex);
 
-			source << "static const unsigned " << prefix << "prog[] = {" << std::hex << std::endl;
-			for (size_t progIndex = 0; progIndex < progDWords.size();)
-			{
-				source << "\t";
-				for (size_t lineIndex = 0; lineIndex < 8 && progIndex < progDWords.size(); ++lineIndex, ++progIndex)
-				{
-					source << "0x" << std::setw(8) << std::setfill('0') << progDWords[progIndex];
+			doneCondition.wait(lock, [&]() { return done[jobIndex] != 0; });
+		}
 
-					if (progIndex + 1 < progDWords.size())
-						source << ", ";
-				}
+		*outLog << job.log.str();
 
-				source << std::endl;
-			}
-			source << "};" << std::dec << std::endl;
-			source << std::endl;
+		if (job.failed)
+		{
+			--ret;
+		}
 
-			const int uboCount = prog.getNumUniformBlocks();
+		if (job.valid && settings.generatePack)
+		{
+			sdf::shaderpack::Program program;
 
-			source << "static const char * const " << prefix << "ubo_names[] = {" << std::endl;
-			for (int uboIndex = 0; uboIndex < uboCount; ++uboIndex)
+			program.name = GetFilename(job.outputName.c_str()) + job.source.variant;
+			program.stage = (sdf::shaderpack::Stage)job.source.stage;   // the same order as EShLanguage
+			program.words = std::move(job.program.programDWords);
+			for (const UniformBlock &ubo : job.program.reflection.ubos)
 			{
-				const glslang::TObjectReflection& ubo = prog.getUniformBlock(uboIndex);
-
-				source << "\t\"" << ubo.name << "\"," << std::endl;
+				program.ubos.push_back(sdf::shaderpack::Program::Ubo{ ubo.name, ubo.binding, ubo.sizeBytes });
 			}
-			source << "\t\"\"" << std::endl;
-			source << "};" << std::endl;
-			source << std::endl;
-
-			source << "static const ShaderUniformBlock " << prefix << "ubos[] = {" << std::endl;
-			for (int uboIndex = 0; uboIndex < uboCount; ++uboIndex)
+			for (const DescriptorBinding &binding : job.program.reflection.bindings)
 			{
-				const glslang::TObjectReflection& ubo = prog.getUniformBlock(uboIndex);
-
-				source << "\t{ " << ubo.getBinding() << ", " << ubo.size << " }," << std::endl;
+				program.bindings.push_back(sdf::shaderpack::DescriptorBinding{ binding.set, binding.binding, (uint32_t)binding.type, binding.count });
 			}
-			source << "\t{}" << std::endl;
-			source << "};" << std::endl;
-			source << std::endl;
+			for (const VertexInput &input : job.program.reflection.vertexInputs)
+			{
+				program.vertexInputs.push_back(sdf::shaderpack::VertexInput{ input.location, input.components, input.locations, (sdf::shaderpack::ComponentType)input.componentType });
+			}
+			program.pushConstantBytes = job.program.reflection.pushConstantBytes;
+			program.inputCount = job.program.reflection.inputCount;
+			program.outputCount = job.program.reflection.outputCount;
 
-			header << "#if EXPORT_SHADER_SYM" << std::endl;
-			header << "extern \"C\" EXPORT const char * const shader_sym;" << std::endl;
-			header << "#endif //#if EXPORT_SHADER_SYM" << std::endl;
-			header << std::endl;
+			packPrograms.push_back(std::move(program));
+		}
 
-			source << "#if EXPORT_SHADER_SYM" << std::endl;
-			source << "extern \"C\" const char * const shader_sym = \"" << prefix << "shader\";" << std::endl;
-			source << "#endif //#if EXPORT_SHADER_SYM" << std::endl;
-			source << std::endl;
+		if (job.valid)
+		{
+			IncludeGraph::Source &built = builtGraph.sources[job.source.fileName];
 
-			header << "extern \"C\" EXPORT const ShaderModule " << prefix << "shader;" << std::endl;
-			header << std::endl;
-
-			source << "extern \"C\" const ShaderModule " << prefix << "shader = {" << std::endl;
-			source << "\t\"" << GetFilename(outputName.c_str()) << "\"," << std::endl;
-			source << "\t\"main\"," << std::endl;
-			source << "\t" << prefix << "prog," << std::endl;
-			source << "\t" << prefix << "ubo_names," << std::endl;
-			source << "\t" << prefix << "ubos," << std::endl;
-			source << "\t" << progDWords.size() << "," << std::endl;
-			source << "\t" << StageToReflectionStr(stage) << "," << std::endl;
-			source << "\t" << prog.getNumUniformBlocks() << "," << std::endl;
-			source << "\t" << prog.getNumPipeInputs() << "," << std::endl;
-			source << "\t" << prog.getNumPipeOutputs() << std::endl;
-			source << "};" << std::endl;
-			source << std::endl;
+			if (job.variantKey == 0)
+			{
+				built.contentHash = job.built.contentHash;
+				built.includeFiles = std::move(job.built.includeFiles);
+				built.keys.clear();
+			}
 
-			header << "#undef EXPORT" << std::endl;
+			built.keys.push_back(job.built.keys.front());
 		}
-	}
 
-	return true;
-}
+		sourceValid = (job.variantKey == 0 || sourceValid) && job.valid;
 
-int main(int argc, char *argv[])
-{
-	Settings settings;
-	FileCache headerCache;
-	FileModifiedMap lastModifiedMap;
-	SourceFile forceInclude;
-	SourceFile *forceIncludePtr;
-	TBuiltInResource resources;
-	int ret;
+		// Once its last variant is in, a source's outputs are written, or the
+		// source is left out of the graph, so it builds again next time.
+		if (!job.optVariants || job.variantKey + 1 == job.optVariants->count)
+		{
+			if (sourceValid && job.optVariants && !settings.generatePack)
+			{
+				std::vector<const CachedProgram *> variantPrograms;
+				unsigned uniqueCount = 0;
 
-	if (argc < 2 || !ParseSettings(argc, argv, &settings))
-	{
-		PrintHelp();
-		return 0;
+				for (size_t variantJobIndex = jobIndex + 1 - job.optVariants->count; variantJobIndex <= jobIndex; ++variantJobIndex)
+				{
+					variantPrograms.push_back(&jobs[variantJobIndex].program);
+				}
+
+				if (ShaderVariantsToC(job.outputName, job.source.stage, *job.optVariants, variantPrograms, settings.compress ? &compression : nullptr, &uniqueCount, outLog))
+				{
+					++variantSources;
+					variantCount += job.optVariants->count;
+					uniqueVariantCount += uniqueCount;
+				}
+				else
+				{
+					sourceValid = false;
+					--ret;
+				}
+			}
+
+			if (sourceValid)
+			{
+				if (job.optVariants)
+				{
+					validVariants.push_back(job.outputName);
+				}
+
+				validPrograms.emplace_back(std::move(job.outputName));
+			}
+			else
+			{
+				builtGraph.sources.erase(job.source.fileName);
+			}
+		}
+
+		compiledCount += job.compiled ? 1 : 0;
+		cacheHits += job.cacheHit ? 1 : 0;
+		expandedCount += job.expanded ? 1 : 0;
+		compileSeconds += job.seconds;
+		compression.words += job.compression.words;
+		compression.bytes += job.compression.bytes;
+		compression.seconds += job.compression.seconds;
 	}
 
-	UpdateLastModifiedTime(settings.inputFiles.data(), (unsigned)settings.inputFiles.size(), &lastModifiedMap);
+	for (std::thread &thread : threads)
+	{
+		thread.join();
+	}
 
-	if (!glslang::InitializeProcess())
+	builtGraph.settingsHash = HashBuildSettings(settings);
+	for (const auto &source : builtGraph.sources)
 	{
-		std::cout << "Failed to initialize glslang." << std::endl;
-		return -100;
+		for (const std::string &includeFile : source.second.includeFiles)
+		{
+			builtGraph.headerHashes[includeFile] = GetContentHash(includeFile, &fileHashes);
+		}
 	}
 
-	InitResources(&resources);
+	StoreIncludeGraph(graphPath, builtGraph);
 
-	if (!settings.forceInclude.empty())
+	if (settings.generatePack)
 	{
-		UpdateLastModifiedTime(&settings.forceInclude, 1, &lastModifiedMap);
+		const std::string packName = GetOutputName("Shaders.spvpack", settings.outputDir);
+		const auto packStart = std::chrono::high_resolution_clock::now();
+		std::string packBytes;
 
-		forceInclude.fileName.swap(settings.forceInclude);
-		if (!LoadSourceFile(forceInclude.fileName, settings.includeDirs, &headerCache, &forceInclude.includeFiles, &forceInclude.contents))
+		if (!sdf::shaderpack::Write(packPrograms, &packBytes) || !WritePackIfChanged(packName, packBytes, outLog))
 		{
-			std::cout << "Failed to load force include file." << std::endl;
-			return -101;
+			*outLog << "Failed to pack programs into \"" << packName << "\"." << std::endl;
+			--ret;
 		}
+		else
+		{
+			const double packSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - packStart).count();
 
-		forceIncludePtr = &forceInclude;
+			*outLog << "Packed " << packPrograms.size() << " programs into " << (packBytes.size() + 1023) / 1024 << " KB in " << packSeconds * 1000.0 << " ms." << std::endl;
+		}
 	}
-	else
+
+	const double buildSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - buildStart).count();
+
+	*outLog << "Compiled " << compiledCount << " of " << jobs.size() << " programs in " << std::fixed << std::setprecision(2) << buildSeconds << " s on " << threadCount << " thread" << (threadCount == 1 ? "" : "s");
+	if (compiledCount > 0)
 	{
-		forceIncludePtr = nullptr;
+		*outLog << ", " << compileSeconds / buildSeconds << "x the " << compileSeconds << " s they take one after another";
 	}
+	*outLog << "." << std::endl;
 
-	ret = 0;
-	std::vector<std::string> validPrograms;
-	for (size_t sourceIndex = 0; sourceIndex < settings.inputFiles.size(); ++sourceIndex)
+	// Misses are the files compiled, failed or not.
+	if (cacheHits + compiledCount > 0)
 	{
-		const std::string inputFilename = settings.inputFiles[sourceIndex];
- 		std::string outputName = GetOutputName(inputFilename, settings.outputDir);
-		SourceFile source;
+		*outLog << "Cache: " << cacheHits << " hits, " << compiledCount << " misses, " << std::setprecision(1) << 100.0 * cacheHits / (cacheHits + compiledCount) << "% hit rate." << std::endl;
+	}
+	*outLog << std::defaultfloat;
 
-		source.fileName.swap(settings.inputFiles[sourceIndex]);
+	if (variantSources > 0)
+	{
+		*outLog << "Variants: " << variantCount << " from " << variantSources << " sources, " << uniqueVariantCount << " distinct programs written." << std::endl;
+	}
 
-		if (!LoadSourceFile(source.fileName, settings.includeDirs, &headerCache, &source.includeFiles, &source.contents))
-		{
-			--ret;
-			std::cout << "Failed to load and parse \"" << source.fileName << "\". Exluding from build." << std::endl;
-		}
-		else
-		{
-			if (!settings.force && IsUpToDate(source, outputName, &lastModifiedMap))
-			{
-				validPrograms.emplace_back(std::move(outputName));
-			}
-			else
-			{
-				std::cout << "Building '" << source.fileName << "'." << std::endl;
-				if (!DetermineStageFromFileName(source.fileName, &source.stage))
-				{
-					--ret;
-				}
-				else
-				{
-					glslang::TProgram shaderProgReflection;
-					std::vector<unsigned> shaderProg;
-					if (!CompileSourceFile(forceIncludePtr, &source, resources, headerCache, &shaderProgReflection, &shaderProg))
-					{
-						--ret;
-						std::cout << "Failed to compile \"" << source.fileName << "\". Exluding from build." << std::endl;
-					}
-					else
-					{
-						if (ShaderProgramToC(outputName, source.stage, shaderProgReflection, shaderProg))
-						{
-							validPrograms.emplace_back(outputName);
-						}
-					}
-				}
-			}
-		}
+	// Decode speed is of the words decoded, as the shaders will see it.
+	if (compression.words > 0)
+	{
+		const double rawBytes = compression.words * sizeof(uint32_t);
+
+		*outLog << "Compression: " << std::fixed << std::setprecision(1) << rawBytes / 1024.0 << " KB -> " << compression.bytes / 1024.0 << " KB (" << 100.0 * compression.bytes / rawBytes << "%), decoded at " << std::setprecision(0) << rawBytes / (1024.0 * 1024.0) / std::max(compression.seconds, 1e-9) << " MB/s." << std::endl;
+		*outLog << std::defaultfloat;
+	}
+
+	*outLog << "Includes: " << changedHeaders << " headers changed, " << expandedCount << " of " << jobs.size() << " sources expanded, " << headerCache.loads << " headers read." << std::endl;
+
+	if (outoptStats)
+	{
+		outoptStats->files = (unsigned)jobs.size();
+		outoptStats->compiled = compiledCount;
+		outoptStats->cacheHits = cacheHits;
+		outoptStats->expanded = expandedCount;
+		outoptStats->headerReads = headerCache.loads;
+		outoptStats->changedHeaders = changedHeaders;
+		outoptStats->seconds = buildSeconds;
 	}
 
-	if (!validPrograms.empty())
+	// Packed programs carry their own reflection.
+	if (!validPrograms.empty() && !settings.generatePack)
 	{
-		std::ofstream refHeader(settings.outputDir + "\\ShaderReflection.h");
+		std::ostringstream refHeader;
 
 		refHeader << "// Generated by GLSLToC. Do no modify." << std::endl;
 		refHeader << std::endl;
@@ -1054,6 +2657,44 @@ int main(int argc, char *argv[])
 		refHeader << "	unsigned short sizeBytes;" << std::endl;
 		refHeader << "};" << std::endl;
 		refHeader << std::endl;
+		refHeader << "// Same values as VkDescriptorType." << std::endl;
+		refHeader << "enum class ShaderDescriptorType : unsigned char" << std::endl;
+		refHeader << "{" << std::endl;
+		refHeader << "	SAMPLER = 0," << std::endl;
+		refHeader << "	COMBINED_IMAGE_SAMPLER = 1," << std::endl;
+		refHeader << "	SAMPLED_IMAGE = 2," << std::endl;
+		refHeader << "	STORAGE_IMAGE = 3," << std::endl;
+		refHeader << "	UNIFORM_TEXEL_BUFFER = 4," << std::endl;
+		refHeader << "	STORAGE_TEXEL_BUFFER = 5," << std::endl;
+		refHeader << "	UNIFORM_BUFFER = 6," << std::endl;
+		refHeader << "	STORAGE_BUFFER = 7," << std::endl;
+		refHeader << "	INPUT_ATTACHMENT = 10" << std::endl;
+		refHeader << "};" << std::endl;
+		refHeader << std::endl;
+		refHeader << "struct ShaderDescriptorBinding" << std::endl;
+		refHeader << "{" << std::endl;
+		refHeader << "	unsigned short set;" << std::endl;
+		refHeader << "	unsigned short binding;" << std::endl;
+		refHeader << "	unsigned short count;" << std::endl;
+		refHeader << "	ShaderDescriptorType type;" << std::endl;
+		refHeader << "};" << std::endl;
+		refHeader << std::endl;
+		refHeader << "enum class ShaderComponentType : unsigned char" << std::endl;
+		refHeader << "{" << std::endl;
+		refHeader << "	FLOAT," << std::endl;
+		refHeader << "	INT," << std::endl;
+		refHeader << "	UINT," << std::endl;
+		refHeader << "	DOUBLE" << std::endl;
+		refHeader << "};" << std::endl;
+		refHeader << std::endl;
+		refHeader << "struct ShaderVertexInput" << std::endl;
+		refHeader << "{" << std::endl;
+		refHeader << "	unsigned char location;" << std::endl;
+		refHeader << "	unsigned char components;   // of a vector, or a matrix column" << std::endl;
+		refHeader << "	unsigned char locations;    // matrix columns times array elements" << std::endl;
+		refHeader << "	ShaderComponentType componentType;" << std::endl;
+		refHeader << "};" << std::endl;
+		refHeader << std::endl;
 		refHeader << "//struct GLSLType" << std::endl;
 		refHeader << "//{" << std::endl;
 		refHeader << "//	GLSLBasicType basicType;" << std::endl;
@@ -1087,13 +2728,47 @@ int main(int argc, char *argv[])
 		refHeader << "	unsigned char uboCount;" << std::endl;
 		refHeader << "	unsigned char inputCount;" << std::endl;
 		refHeader << "	unsigned char outputCount;" << std::endl;
+		refHeader << "	const ShaderDescriptorBinding* const bindings;   // by set, then binding; stage is type" << std::endl;
+		refHeader << "	const ShaderVertexInput* const vertexInputs;     // by location" << std::endl;
+		refHeader << "	unsigned short pushConstantBytes;" << std::endl;
+		refHeader << "	unsigned char bindingCount;" << std::endl;
+		refHeader << "	unsigned char vertexInputCount;" << std::endl;
+		refHeader << "	const unsigned char* const compressedProgram;   // with glsltoc -z, progam is null and this decodes" << std::endl;
+		refHeader << "	const unsigned compressedBytes;                  // to it through sdf::spirvcodec" << std::endl;
+		refHeader << "};" << std::endl;
+		refHeader << std::endl;
+		refHeader << "// Modules of a source built once per combination of its .variants values." << std::endl;
+		refHeader << "// Variants with the same SPIR-V share a module." << std::endl;
+		refHeader << "struct ShaderVariants" << std::endl;
+		refHeader << "{" << std::endl;
+		refHeader << "	const char* const name;" << std::endl;
+		refHeader << "	const char* const* const axisNames;" << std::endl;
+		refHeader << "	const unsigned* const axisValueCounts;" << std::endl;
+		refHeader << "	const ShaderModule* const* const modules;   // by variant key" << std::endl;
+		refHeader << "	const unsigned axisCount;" << std::endl;
+		refHeader << "	const unsigned variantCount;" << std::endl;
+		refHeader << "	const unsigned programCount;                // distinct among the modules" << std::endl;
 		refHeader << "};" << std::endl;
+		refHeader << std::endl;
+		refHeader << "// Key of a value index per axis, the first axis varying fastest." << std::endl;
+		refHeader << "inline unsigned ShaderVariantKey(const ShaderVariants& variants, const unsigned* valueIndices)" << std::endl;
+		refHeader << "{" << std::endl;
+		refHeader << "	unsigned key = 0;" << std::endl;
+		refHeader << "	for (unsigned axis = variants.axisCount; axis-- > 0;)" << std::endl;
+		refHeader << "		key = key * variants.axisValueCounts[axis] + valueIndices[axis];" << std::endl;
+		refHeader << "	return key;" << std::endl;
+		refHeader << "}" << std::endl;
+
+		if (!WriteIfChanged(settings.outputDir + "\\ShaderReflection.h", refHeader.str(), outLog))
+		{
+			--ret;
+		}
 
 		if (settings.generateMonolithic)
 		{
 			std::string allFilename = settings.outputDir + "\\Shaders";
-			std::ofstream allHeader(allFilename + ".h");
-			std::ofstream allSource(allFilename + ".cpp");
+			std::ostringstream allHeader;
+			std::ostringstream allSource;
 
 			allHeader << "// Generated by GLSLToC. Do no modify." << std::endl;
 			allHeader << std::endl;
@@ -1101,6 +2776,7 @@ int main(int argc, char *argv[])
 			allHeader << std::endl;
 
 			allHeader << "struct ShaderModule;" << std::endl;
+			allHeader << "struct ShaderVariants;" << std::endl;
 			allHeader << std::endl;
 
 			allHeader << "#ifdef EXPORT" << std::endl;
@@ -1119,6 +2795,8 @@ int main(int argc, char *argv[])
 
 			allHeader << "extern \"C\" EXPORT const unsigned shader_count;" << std::endl;
 			allHeader << "extern \"C\" EXPORT const ShaderModule * const shaders[];" << std::endl;
+			allHeader << "extern \"C\" EXPORT const unsigned shader_variants_count;" << std::endl;
+			allHeader << "extern \"C\" EXPORT const ShaderVariants * const shader_variants[];" << std::endl;
 			allHeader << std::endl;
 
 			allHeader << "#undef EXPORT" << std::endl;
@@ -1141,8 +2819,239 @@ int main(int argc, char *argv[])
 			}
 			allSource << "\tnullptr" << std::endl;
 			allSource << "};" << std::endl;
+			allSource << std::endl;
+
+			allSource << "extern \"C\" const unsigned shader_variants_count = " << validVariants.size() << ";" << std::endl;
+			allSource << "extern \"C\" const ShaderVariants * const shader_variants[] = {" << std::endl;
+			for (const std::string& file : validVariants)
+			{
+				allSource << "\t&" << FilenameToReflectionPrefix(file) << "variants," << std::endl;
+			}
+			allSource << "\tnullptr" << std::endl;
+			allSource << "};" << std::endl;
+
+			if (!WriteIfChanged(allFilename + ".h", allHeader.str(), outLog) || !WriteIfChanged(allFilename + ".cpp", allSource.str(), outLog))
+			{
+				--ret;
+			}
 		}
 	}
 
 	return ret;
 }
+
+// Serves builds until a request asks to quit. glslang stays set up and
+// compiled programs stay in memory between requests, so a request costs the
+// rescan plus compiling what changed. Headers are read again each time, as
+// they may be what changed.
+static int Serve(const Settings &settings, const TBuiltInResource &resources)
+{
+	const std::string pipeName = compile_server::PipeName(settings.serverName);
+	const HANDLE pipe = CreateNamedPipe(pipeName.c_str(), PIPE_ACCESS_DUPLEX, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT, 1, compile_server::BUFFER_SIZE, compile_server::BUFFER_SIZE, 0, nullptr);
+	ProgramCache programs;
+	bool quit = false;
+
+	if (pipe == INVALID_HANDLE_VALUE)
+	{
+		std::cout << "Failed to create pipe \"" << pipeName << "\" with " << GetLastError() << "." << std::endl;
+		return -104;
+	}
+
+	std::cout << "Serving builds on \"" << pipeName << "\"." << std::endl;
+
+	while (!quit)
+	{
+		compile_server::Request request;
+
+		if (!ConnectNamedPipe(pipe, nullptr) && GetLastError() != ERROR_PIPE_CONNECTED)
+		{
+			std::cout << "Failed to accept a client on \"" << pipeName << "\" with " << GetLastError() << "." << std::endl;
+			break;
+		}
+
+		// A client may send any number of requests before disconnecting.
+		while (compile_server::ReadRequest(pipe, &request))
+		{
+			const auto requestStart = std::chrono::high_resolution_clock::now();
+			Settings requestSettings = settings;
+			compile_server::Response response;
+			BuildStats stats;
+			std::ostringstream log;
+
+			if (request.flags & compile_server::FLAG_QUIT)
+			{
+				quit = true;
+				break;
+			}
+
+			requestSettings.force = settings.force || (request.flags & compile_server::FLAG_FORCE) != 0;
+			response.status = BuildAll(requestSettings, resources, &programs, &log, &stats);
+			response.compiled = stats.compiled;
+			response.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - requestStart).count();
+
+			if (!compile_server::WriteResponse(pipe, response, log.str()))
+			{
+				break;
+			}
+		}
+
+		FlushFileBuffers(pipe);
+		DisconnectNamedPipe(pipe);
+	}
+
+	CloseHandle(pipe);
+
+	return 0;
+}
+
+// Builds shaders that all include a common header, and a few a second one,
+// from cold and after the edits a working session makes, to show what the
+// include graph and the caches leave to compile.
+static int RunIncludeBenchmark(const Settings &settings, const TBuiltInResource &resources)
+{
+	const std::string dir = (settings.outputDir.empty() ? std::string(".") : settings.outputDir) + "\\IncludeBenchmark";
+	const std::string sourceDir = dir + "\\src";
+	const unsigned lightingStride = 20;
+	Settings benchSettings;
+	ProgramCache programs;
+	std::error_code error;
+
+	std::filesystem::remove_all(dir, error);
+	std::filesystem::create_directories(sourceDir, error);
+	std::filesystem::create_directories(dir + "\\out", error);
+	if (error)
+	{
+		std::cout << "Failed to create \"" << dir << "\"." << std::endl;
+		return -105;
+	}
+
+	const auto WriteCommon = [&](unsigned revision)
+	{
+		std::ofstream common(sourceDir + "\\sdf_common.glsl");
+
+		common << "// revision " << revision << std::endl;
+		for (unsigned functionIndex = 0; functionIndex < 64; ++functionIndex)
+		{
+			common << "float sdf" << functionIndex << "(vec3 p, float r)" << std::endl;
+			common << "{" << std::endl;
+			common << "	vec3 q = abs(p) - vec3(r * " << 0.5f + functionIndex * 0.01f << ");" << std::endl;
+			common << "	return length(max(q, 0.0)) + min(max(q.x, max(q.y, q.z)), 0.0) - " << functionIndex * 0.001f << ";" << std::endl;
+			common << "}" << std::endl;
+			common << std::endl;
+		}
+	};
+	const auto WriteLighting = [&](unsigned revision)
+	{
+		std::ofstream lighting(sourceDir + "\\sdf_lighting.glsl");
+
+		lighting << "// revision " << revision << std::endl;
+		lighting << "vec3 shade(vec3 n, vec3 l) { return vec3(max(dot(n, l), 0.0) + " << revision * 0.01f << "); }" << std::endl;
+	};
+	const auto WriteShader = [&](unsigned shaderIndex, unsigned revision)
+	{
+		std::ofstream shader(sourceDir + "\\shader" + std::to_string(shaderIndex) + ".frag");
+
+		shader << "#version 450" << std::endl;
+		shader << "#include \"sdf_common.glsl\"" << std::endl;
+		if (shaderIndex % lightingStride == 0)
+		{
+			shader << "#include \"sdf_lighting.glsl\"" << std::endl;
+		}
+		shader << "layout(location = 0) in vec3 inPosition;" << std::endl;
+		shader << "layout(location = 0) out vec4 outColor;" << std::endl;
+		shader << "void main()" << std::endl;
+		shader << "{" << std::endl;
+		shader << "	float d = sdf" << shaderIndex % 64 << "(inPosition, " << shaderIndex + revision * 1000 << ".0);" << std::endl;
+		shader << "	outColor = vec4(d);" << std::endl;
+		shader << "}" << std::endl;
+	};
+	const auto Run = [&](const char *name)
+	{
+		std::ostringstream log;
+		BuildStats stats;
+		const int ret = BuildAll(benchSettings, resources, &programs, &log, &stats);
+
+		std::cout << "  " << std::left << std::setw(22) << name << std::right << std::fixed << std::setprecision(1) << std::setw(9) << stats.seconds * 1000.0 << " ms, ";
+		std::cout << std::setw(4) << stats.compiled << " compiled, " << std::setw(4) << stats.expanded << " expanded, " << stats.headerReads << " headers read" << std::defaultfloat << std::endl;
+		if (ret != 0)
+		{
+			std::cout << log.str();
+		}
+	};
+
+	WriteCommon(0);
+	WriteLighting(0);
+	for (unsigned shaderIndex = 0; shaderIndex < settings.benchmarkShaders; ++shaderIndex)
+	{
+		WriteShader(shaderIndex, 0);
+	}
+
+	benchSettings.includeDirs.push_back(sourceDir);
+	benchSettings.inputPaths.push_back(sourceDir);
+	benchSettings.outputDir = dir + "\\out";
+	benchSettings.cacheDir = dir + "\\cache";
+	benchSettings.generateMonolithic = true;
+	benchSettings.threads = settings.threads;
+	std::filesystem::create_directories(benchSettings.cacheDir, error);
+
+	std::cout << "Include benchmark: " << settings.benchmarkShaders << " shaders including sdf_common.glsl, every " << lightingStride << "th sdf_lighting.glsl too, on " << settings.threads << " thread" << (settings.threads == 1 ? "" : "s") << "." << std::endl;
+	Run("cold");
+	Run("unchanged");
+	WriteShader(1, 1);
+	Run("one shader edited");
+	WriteLighting(1);
+	Run("sdf_lighting edited");
+	WriteCommon(1);
+	Run("sdf_common edited");
+	WriteCommon(0);
+	Run("sdf_common reverted");
+
+	// A fresh process, as the first build after a branch switch back is.
+	programs.programs.clear();
+	WriteLighting(0);
+	Run("sdf_lighting reverted");
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	Settings settings;
+	TBuiltInResource resources;
+	ProgramCache programs;
+
+	if (argc < 2 || !ParseSettings(argc, argv, &settings) || (settings.inputPaths.empty() && settings.benchmarkShaders == 0))
+	{
+		PrintHelp();
+		return 0;
+	}
+
+	std::error_code cacheDirError;
+
+	std::filesystem::create_directories(settings.cacheDir, cacheDirError);
+	if (cacheDirError)
+	{
+		std::cout << "Failed to create cache directory \"" << settings.cacheDir << "\"." << std::endl;
+		return -102;
+	}
+
+	if (!glslang::InitializeProcess())
+	{
+		std::cout << "Failed to initialize glslang." << std::endl;
+		return -100;
+	}
+
+	InitResources(&resources);
+
+	if (!settings.serverName.empty())
+	{
+		return Serve(settings, resources);
+	}
+
+	if (settings.benchmarkShaders > 0)
+	{
+		return RunIncludeBenchmark(settings, resources);
+	}
+
+	return BuildAll(settings, resources, &programs, &std::cout);
+}
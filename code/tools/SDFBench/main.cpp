@@ -0,0 +1,991 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include "../../source/sdf/Bake.h"
+#include "../../source/sdf/Bricks.h"
+#include "../../source/sdf/DirWatch.h"
+#include "../../source/sdf/Extract.h"
+#include "../../source/sdf/Glsl.h"
+#include "../../source/sdf/Memory.h"
+#include "../../source/sdf/Optimize.h"
+#include "../../source/sdf/Query.h"
+#include "../../source/sdf/Redistance.h"
+#include "../../source/sdf/Scenes.h"
+#include "../../source/sdf/Sculpt.h"
+#include "../../source/sdf/ShaderPack.h"
+#include "../../source/sdf/SpirvCodec.h"
+#include "../../source/sdf/Trace.h"
+#if SDFBENCH_SHADERS
+#include "../../source/sdf/ShaderCompiler.h"
+#endif
+
+#ifndef SDFBENCH_SHADER_DIR
+#define SDFBENCH_SHADER_DIR "shaders"
+#endif
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// The canonical scenes, from a handful of primitives up to 100k. Names are part
+// of the result names, so changing this list breaks comparisons with old runs.
+// The last three place the same part 100k times through an instance table, as
+// a union of transforms and by domain repetition.
+static const char * const SCENES[] = { "primitives", "csg", "grid100", "grid1000", "grid10000", "grid100000", "instances100000", "copies100000", "repeat100000", "shared30", "shared100" };
+
+// Meshing and shader costs grow with every primitive, so the largest scenes
+// skip them. The grid scenes have a ground plane on top of their count.
+static const size_t MESH_MAX_PRIMITIVES = 1024;
+static const size_t SHADER_MAX_PRIMITIVES = 1024;
+
+struct Settings
+{
+	std::string outputFile;
+	std::string baselineFile;
+	std::string shaderDir = SDFBENCH_SHADER_DIR;
+	std::string filter;
+	double threshold = 0.1;       // relative change that counts as a regression
+	double minSeconds = 0.25;     // per measurement
+	unsigned threadCount = 0;
+};
+
+struct Result
+{
+	std::string name;
+	double value;
+	std::string unit;
+	bool higherIsBetter;
+};
+
+static void PrintHelp()
+{
+	std::cout << "SDFBench: " << std::endl;
+	std::cout << "    Benchmark suite for the SDF library." << std::endl;
+	std::cout << std::endl;
+	std::cout << "Usage: " << std::endl;
+	std::cout << "    sdfbench [options]" << std::endl;
+	std::cout << std::endl;
+	std::cout << "Description:" << std::endl;
+	std::cout << "    Times distance evaluation (scalar and SIMD), ray and closest point" << std::endl;
+	std::cout << "    queries, meshing, mesh baking (BVH build and queries), shader" << std::endl;
+	std::cout << "    generation and compilation, the brick atlas upload path and sculpt" << std::endl;
+	std::cout << "    brushes with redistancing over a fixed set of procedural scenes, and" << std::endl;
+	std::cout << "    shader pack output and loading against C arrays, the embedded SPIR-V" << std::endl;
+	std::cout << "    encoding and shader file watching. Each result is the best of as many" << std::endl;
+	std::cout << "    runs as fit the time budget. Results are written as JSON, one per" << std::endl;
+	std::cout << "    line, so runs can be diffed, and can be checked against a baseline." << std::endl;
+	std::cout << "    Each scene's compiled program is checked against the scalar reference" << std::endl;
+	std::cout << "    first, and the run exits with -3 if any fails to compile or disagrees." << std::endl;
+	std::cout << "    Options should be specified without a space between the option" << std::endl;
+	std::cout << "    signifier and its text." << std::endl;
+	std::cout << std::endl;
+	std::cout << "Options:" << std::endl;
+	std::cout << "    -o: JSON output file. Default is stdout only." << std::endl;
+	std::cout << "    -c: Baseline JSON file. Exits with 1 if any result regressed." << std::endl;
+	std::cout << "    -r: Regression threshold in percent. Default 10." << std::endl;
+	std::cout << "    -f: Only run benchmarks whose name contains the text." << std::endl;
+	std::cout << "    -s: Shader directory. Default is the repository's." << std::endl;
+	std::cout << "    -b: Time budget per measurement in milliseconds. Default 250." << std::endl;
+	std::cout << "    -T: Thread count. Default is every hardware thread." << std::endl;
+	std::cout << std::endl;
+}
+
+static bool ParseSettings(int argc, char *argv[], Settings *outSettings)
+{
+	for (int argIndex = 1; argIndex < argc; ++argIndex)
+	{
+		const char * const arg = argv[argIndex];
+
+		if (*arg != '-')
+		{
+			std::cout << "Unkown argument \"" << arg << "\"." << std::endl;
+			return false;
+		}
+
+		switch (arg[1])
+		{
+			case 'o':
+				outSettings->outputFile = arg + 2;
+			break;
+			case 'c':
+				outSettings->baselineFile = arg + 2;
+			break;
+			case 'r':
+				outSettings->threshold = std::strtod(arg + 2, nullptr) / 100.0;
+			break;
+			case 'f':
+				outSettings->filter = arg + 2;
+			break;
+			case 's':
+				outSettings->shaderDir = arg + 2;
+			break;
+			case 'b':
+				outSettings->minSeconds = std::strtod(arg + 2, nullptr) / 1000.0;
+			break;
+			case 'T':
+				outSettings->threadCount = (unsigned)std::strtoul(arg + 2, nullptr, 10);
+			break;
+			case 'h':
+				return false;
+			default:
+				std::cout << "Unkown argument \"" << arg << "\"." << std::endl;
+				return false;
+		}
+	}
+
+	return true;
+}
+
+// Best time of fn over at least 3 runs, and as many more as fit in minSeconds.
+template<typename Fn>
+static double Measure(double minSeconds, const Fn &fn)
+{
+	const Clock::time_point start = Clock::now();
+	double best = INFINITY;
+
+	for (unsigned run = 0; run < 3 || std::chrono::duration<double>(Clock::now() - start).count() < minSeconds; ++run)
+	{
+		const Clock::time_point runStart = Clock::now();
+
+		fn();
+		best = std::min(best, std::chrono::duration<double>(Clock::now() - runStart).count());
+	}
+
+	return best;
+}
+
+class Suite
+{
+public:
+	explicit Suite(const Settings &settings) : settings(settings) {}
+
+	bool Enabled(const std::string &name) const
+	{
+		return settings.filter.empty() || name.find(settings.filter) != std::string::npos;
+	}
+
+	void Add(const std::string &name, double value, const char *unit, bool higherIsBetter)
+	{
+		std::cout << std::left << std::setw(44) << name << std::right << std::setprecision(4) << std::setw(12) << value << " " << unit << std::endl;
+		results.push_back(Result{ name, value, unit, higherIsBetter });
+	}
+
+	const Settings &settings;
+	sdf::jobs::Pool *pool = nullptr;   // for the benchmarks that take one
+	std::vector<Result> results;
+	bool failed = false;               // a scene's program didn't compile or disagreed with the scene
+};
+
+static void MakePoints(uint32_t count, uint32_t seed, std::vector<float> *outXs, std::vector<float> *outYs, std::vector<float> *outZs)
+{
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> coord(-2.0f, 2.0f);
+
+	outXs->resize(count);
+	outYs->resize(count);
+	outZs->resize(count);
+
+	for (uint32_t pointIndex = 0; pointIndex < count; ++pointIndex)
+	{
+		(*outXs)[pointIndex] = coord(rng);
+		(*outYs)[pointIndex] = coord(rng) * 0.5f;
+		(*outZs)[pointIndex] = coord(rng);
+	}
+}
+
+static void RunSceneBenchmarks(const char *sceneName, Suite *inoutSuite)
+{
+	static const char * const BENCHMARKS[] = { "compile", "eval.simd", "eval.scalar", "query.rays", "query.closest", "mesh", "shader.scene.generate", "shader.scene.compile" };
+
+	const std::string prefix = std::string(".") + sceneName;
+
+	// Building the largest scenes alone takes seconds.
+	if (std::none_of(std::begin(BENCHMARKS), std::end(BENCHMARKS), [&](const char *benchmark) { return inoutSuite->Enabled(benchmark + prefix); }))
+		return;
+
+	const double budget = inoutSuite->settings.minSeconds;
+	sdf::scene::Scene scene, optimized;
+	sdf::program::Program prog;
+	std::vector<float> xs, ys, zs, dist;
+
+	bool compiled = false;
+	const double buildSeconds = Measure(inoutSuite->Enabled("compile" + prefix) ? budget : 0.0, [&]()
+	{
+		sdf::scenes::Build(sceneName, &scene);
+		sdf::optimize::Optimize(scene, &optimized);
+		compiled = sdf::program::Compile(optimized, &prog);
+	});
+
+	if (!compiled)
+	{
+		std::cout << "Failed to compile scene \"" << sceneName << "\"." << std::endl;
+		inoutSuite->failed = true;
+		return;
+	}
+
+	// Every placement of an instance table counts, as it does for the scalar reference.
+	size_t primitiveCount = std::count_if(scene.nodes.begin(), scene.nodes.end(), [](const sdf::scene::Node &node) { return sdf::scene::IsPrimitive(node.type); });
+
+	for (const std::shared_ptr<const sdf::instance::Table> &table : scene.instances)
+		primitiveCount += table->placements.size();
+
+	// Fewer points for bigger scenes keeps every run to roughly the same time.
+	const uint32_t scale = (uint32_t)std::max<size_t>(primitiveCount / 100, 1);
+	const uint32_t simdPoints = std::max(65536 / scale, 64u);
+	const uint32_t scalarPoints = std::max(4096 / scale, 8u);
+	const uint32_t queryCount = std::max(4096 / scale, 64u);
+
+	if (inoutSuite->Enabled("compile" + prefix))
+		inoutSuite->Add("compile" + prefix, buildSeconds * 1000.0, "ms", false);
+
+	MakePoints(simdPoints, 1, &xs, &ys, &zs);
+	dist.resize(simdPoints);
+
+	// The optimizer and the compiler's register sharing must leave every
+	// distance as the scene's own, on the points the scalar timing uses.
+	{
+		float worst = 0.0f;
+
+		sdf::program::EvaluateBatch(prog, xs.data(), ys.data(), zs.data(), scalarPoints, dist.data());
+		for (uint32_t pointIndex = 0; pointIndex < scalarPoints; ++pointIndex)
+			worst = std::max(worst, std::abs(dist[pointIndex] - sdf::scene::EvaluateDistance(scene, glm::vec3(xs[pointIndex], ys[pointIndex], zs[pointIndex]))));
+
+		if (worst > 1e-3f)
+		{
+			std::cout << "Scene \"" << sceneName << "\" evaluates up to " << worst << " away from its scalar reference." << std::endl;
+			inoutSuite->failed = true;
+		}
+	}
+
+	if (inoutSuite->Enabled("eval.simd" + prefix))
+	{
+		const double seconds = Measure(budget, [&]() { sdf::program::EvaluateBatch(prog, xs.data(), ys.data(), zs.data(), simdPoints, dist.data()); });
+
+		inoutSuite->Add("eval.simd" + prefix, simdPoints / seconds / 1e6, "Mpoints/s", true);
+	}
+
+	if (inoutSuite->Enabled("eval.scalar" + prefix))
+	{
+		float sink = 0.0f;
+		const double seconds = Measure(budget, [&]()
+		{
+			for (uint32_t pointIndex = 0; pointIndex < scalarPoints; ++pointIndex)
+				sink += sdf::scene::EvaluateDistance(scene, glm::vec3(xs[pointIndex], ys[pointIndex], zs[pointIndex]));
+		});
+
+		inoutSuite->Add("eval.scalar" + prefix, scalarPoints / seconds / 1e6, "Mpoints/s", true);
+		if (sink == 1234.5f)
+			std::cout << std::endl;
+	}
+
+	if (inoutSuite->Enabled("query.rays" + prefix) || inoutSuite->Enabled("query.closest" + prefix))
+	{
+		const sdf::trace::Camera camera = sdf::trace::DefaultCamera();
+		const glm::vec3 forward = glm::normalize(camera.target - camera.eye);
+		const glm::vec3 right = glm::normalize(glm::cross(forward, camera.up));
+		const glm::vec3 up = glm::cross(right, forward);
+		std::vector<sdf::query::Ray> rays(queryCount);
+		std::vector<glm::vec3> points(queryCount);
+		std::vector<sdf::query::Hit> hits(queryCount);
+		const sdf::query::Settings querySettings;
+		sdf::jobs::Pool * const pool = inoutSuite->pool;
+
+		for (uint32_t queryIndex = 0; queryIndex < queryCount; ++queryIndex)
+		{
+			const float u = xs[queryIndex] * 0.2f;
+			const float v = zs[queryIndex] * 0.2f;
+
+			rays[queryIndex] = sdf::query::Ray{ camera.eye, glm::normalize(forward + right * u + up * v), 50.0f };
+			points[queryIndex] = glm::vec3(xs[queryIndex], ys[queryIndex], zs[queryIndex]);
+		}
+
+		const double castSeconds = Measure(budget, [&]() { sdf::query::CastRays(pool, prog, rays.data(), queryCount, querySettings, hits.data()); });
+		const double closestSeconds = Measure(budget, [&]() { sdf::query::ClosestPoints(pool, prog, points.data(), queryCount, querySettings, hits.data()); });
+
+		inoutSuite->Add("query.rays" + prefix, queryCount / castSeconds / 1e6, "Mqueries/s", true);
+		inoutSuite->Add("query.closest" + prefix, queryCount / closestSeconds / 1e6, "Mqueries/s", true);
+	}
+
+	if (primitiveCount <= MESH_MAX_PRIMITIVES && inoutSuite->Enabled("mesh" + prefix))
+	{
+		static const char * const MESH_FILE = "sdfbench_mesh.ply";
+
+		sdf::extract::Settings exportSettings;
+		sdf::extract::Stats stats;
+
+		exportSettings.min = glm::vec3(-2.0f, -1.1f, -2.0f);
+		exportSettings.max = glm::vec3(2.0f, 1.5f, 2.0f);
+		exportSettings.resolution = 128;
+		exportSettings.threadCount = inoutSuite->settings.threadCount;
+
+		const double seconds = Measure(budget, [&]() { sdf::extract::ExportMesh(prog, exportSettings, MESH_FILE, sdf::extract::Format::PLY, &stats); });
+
+		std::remove(MESH_FILE);
+		inoutSuite->Add("mesh" + prefix, stats.triangles / seconds / 1e6, "Mtriangles/s", true);
+	}
+
+#if SDFBENCH_SHADERS
+	if (primitiveCount <= SHADER_MAX_PRIMITIVES && (inoutSuite->Enabled("shader.scene.generate" + prefix) || inoutSuite->Enabled("shader.scene.compile" + prefix)))
+	{
+		std::string source;
+		std::vector<uint32_t> spirv;
+
+		const double generateSeconds = Measure(budget, [&]() { sdf::glsl::GenerateFragmentShader(prog, nullptr, 128, &source); });
+		const double compileSeconds = Measure(0.0, [&]() { sdf::shader::CompileGlsl(source, sdf::shader::Stage::FRAGMENT, &spirv, nullptr); });
+
+		inoutSuite->Add("shader.scene.generate" + prefix, generateSeconds * 1000.0, "ms", false);
+		inoutSuite->Add("shader.scene.compile" + prefix, compileSeconds * 1000.0, "ms", false);
+	}
+#endif
+}
+
+// Baking covers the mesh BVH: its build, and the closest triangle queries of
+// the narrow band.
+static void RunBakeBenchmarks(Suite *inoutSuite)
+{
+	static const uint32_t TRIANGLES = 100000;
+
+	if (!inoutSuite->Enabled("bake"))
+		return;
+
+	sdf::mesh::Mesh mesh;
+	sdf::bake::Settings bakeSettings;
+	sdf::bake::Stats stats, best;
+	sdf::volume::Grid grid;
+
+	sdf::mesh::MakeTorusKnot(TRIANGLES, &mesh);
+	bakeSettings.resolution = 128;
+	bakeSettings.threadCount = inoutSuite->settings.threadCount;
+
+	for (unsigned run = 0; run < 3; ++run)
+	{
+		sdf::bake::BakeMesh(mesh, bakeSettings, &grid, &stats);
+
+		if (run == 0 || stats.seconds < best.seconds)
+			best = stats;
+	}
+
+	inoutSuite->Add("bake.bvh_build.knot100k", best.bvhSeconds * 1000.0, "ms", false);
+	inoutSuite->Add("bake.bvh_query.knot100k", best.bandVoxels / best.bandSeconds / 1e6, "Mvoxels/s", true);
+	inoutSuite->Add("bake.sweep.knot100k", best.sweepSeconds * 1000.0, "ms", false);
+	inoutSuite->Add("bake.total.knot100k", best.seconds * 1000.0, "ms", false);
+}
+
+// The CPU half of the upload paths: staging a full brick atlas, staging the
+// bricks a small edit touches, and the copy into mapped memory they end with.
+static void RunUploadBenchmarks(Suite *inoutSuite)
+{
+	if (!inoutSuite->Enabled("upload"))
+		return;
+
+	const double budget = inoutSuite->settings.minSeconds;
+	sdf::mesh::Mesh mesh;
+	sdf::bake::Settings bakeSettings;
+	std::shared_ptr<sdf::volume::Grid> grid = std::make_shared<sdf::volume::Grid>();
+	sdf::bricks::Upload upload;
+
+	sdf::mesh::MakeTorusKnot(20000, &mesh);
+	bakeSettings.resolution = 160;
+	bakeSettings.threadCount = inoutSuite->settings.threadCount;
+	sdf::bake::BakeMesh(mesh, bakeSettings, grid.get());
+
+	const double fullSeconds = Measure(budget, [&]()
+	{
+		sdf::bricks::Atlas atlas;
+
+		sdf::bricks::CreateAtlas(&atlas);
+		sdf::bricks::AddVolume(&atlas, grid);
+		sdf::bricks::BuildUpload(&atlas, &upload);
+	});
+
+	inoutSuite->Add("upload.bricks.full", upload.staging.size() / fullSeconds / 1e6, "MB/s", true);
+
+	{
+		sdf::bricks::Atlas atlas;
+		const glm::uvec3 center = grid->dims / 2u;
+		const glm::uvec3 lo = center - glm::uvec3(5);
+		const glm::uvec3 hi = center + glm::uvec3(5);
+
+		sdf::bricks::CreateAtlas(&atlas);
+		sdf::bricks::AddVolume(&atlas, grid);
+		sdf::bricks::BuildUpload(&atlas, &upload);
+
+		const double editSeconds = Measure(budget, [&]()
+		{
+			sdf::bricks::MarkDirty(&atlas, 0, lo, hi);
+			sdf::bricks::BuildUpload(&atlas, &upload);
+		});
+
+		inoutSuite->Add("upload.bricks.edit", editSeconds * 1e6, "us", false);
+		inoutSuite->Add("upload.bricks.edit_bytes", upload.staging.size() / 1024.0, "KB", false);
+	}
+
+	{
+		std::vector<uint8_t> source(64 << 20, 1), mapped(64 << 20);
+		const double seconds = Measure(budget, [&]() { std::memcpy(mapped.data(), source.data(), source.size()); });
+
+		inoutSuite->Add("upload.staging_copy", source.size() / seconds / 1e9, "GB/s", true);
+	}
+}
+
+// A frame of overlapping dabs along the surface of a baked volume, applied
+// together and one at a time, then redistanced.
+static void RunSculptBenchmarks(Suite *inoutSuite)
+{
+	static const uint32_t DAB_COUNT = 64;
+
+	if (!inoutSuite->Enabled("sculpt"))
+		return;
+
+	const double budget = inoutSuite->settings.minSeconds;
+	sdf::mesh::Mesh mesh;
+	sdf::bake::Settings bakeSettings;
+	sdf::volume::Grid grid;
+	sdf::sculpt::Frame frame;
+	sdf::sculpt::DirtySet dirty;
+	std::vector<sdf::sculpt::Dab> dabs;
+
+	sdf::mesh::MakeTorusKnot(20000, &mesh);
+	bakeSettings.resolution = 160;
+	bakeSettings.threadCount = inoutSuite->settings.threadCount;
+	sdf::bake::BakeMesh(mesh, bakeSettings, &grid);
+
+	// Surface samples in scan order, a voxel or so apart, so dabs overlap.
+	for (size_t sampleIndex = grid.values.size() / 2; sampleIndex < grid.values.size() && dabs.size() < DAB_COUNT; ++sampleIndex)
+	{
+		if (std::abs(grid.values[sampleIndex]) > grid.voxelSize * 0.5f)
+			continue;
+
+		sdf::sculpt::Dab dab;
+		const glm::uvec3 sample((uint32_t)(sampleIndex % grid.dims.x), (uint32_t)(sampleIndex / grid.dims.x % grid.dims.y), (uint32_t)(sampleIndex / ((size_t)grid.dims.x * grid.dims.y)));
+
+		dab.brush = dabs.size() % 2 ? sdf::sculpt::Brush::SMOOTH : sdf::sculpt::Brush::ADD;
+		dab.center = grid.origin + glm::vec3(sample) * grid.voxelSize;
+		dab.radius = grid.voxelSize * 4.0f;
+		dab.strength = 0.5f;
+		dabs.push_back(dab);
+	}
+
+	const double frameSeconds = Measure(budget, [&]()
+	{
+		for (const sdf::sculpt::Dab &dab : dabs)
+			sdf::sculpt::AddDab(&frame, dab);
+
+		sdf::sculpt::Apply(inoutSuite->pool, &frame, &grid, &dirty);
+	});
+
+	const double singleSeconds = Measure(budget, [&]()
+	{
+		for (const sdf::sculpt::Dab &dab : dabs)
+		{
+			sdf::sculpt::AddDab(&frame, dab);
+			sdf::sculpt::Apply(inoutSuite->pool, &frame, &grid, &dirty);
+		}
+	});
+
+	inoutSuite->Add("sculpt.frame", frameSeconds * 1e6, "us", false);
+	inoutSuite->Add("sculpt.dabs.coalesced", dabs.size() / frameSeconds / 1000.0, "Kdabs/s", true);
+	inoutSuite->Add("sculpt.dabs.single", dabs.size() / singleSeconds / 1000.0, "Kdabs/s", true);
+
+	const double redistanceSeconds = Measure(budget, [&]()
+	{
+		for (const sdf::sculpt::Dab &dab : dabs)
+			sdf::sculpt::AddDab(&frame, dab);
+
+		sdf::sculpt::Apply(inoutSuite->pool, &frame, &grid, &dirty);
+		sdf::redistance::Redistance(inoutSuite->pool, sdf::redistance::Settings(), &grid, &dirty);
+	});
+
+	inoutSuite->Add("sculpt.redistance", (redistanceSeconds - frameSeconds) * 1e6, "us", false);
+}
+
+// glsltoc's two outputs for the same programs, sized like the trivial and
+// generated scene shaders. The C arrays cost builds the source text the
+// compiler parses for every program; a pack costs startup mapping the file
+// and finding each program in it, with no copies.
+static void RunShaderPackBenchmarks(Suite *inoutSuite)
+{
+	static const uint32_t PROGRAM_COUNT = 256;
+
+	if (!inoutSuite->Enabled("shader.pack") && !inoutSuite->Enabled("shader.carray"))
+		return;
+
+	const double budget = inoutSuite->settings.minSeconds;
+	const std::string packPath = (std::filesystem::temp_directory_path() / "sdfbench.spvpack").string();
+	std::mt19937 rng(7);
+	std::uniform_int_distribution<uint32_t> wordCount(512, 8192);
+	std::vector<sdf::shaderpack::Program> programs(PROGRAM_COUNT);
+
+	for (uint32_t programIndex = 0; programIndex < PROGRAM_COUNT; ++programIndex)
+	{
+		sdf::shaderpack::Program &program = programs[programIndex];
+		const bool vertex = programIndex % 2 == 0;
+
+		program.name = "shader" + std::to_string(programIndex / 2) + (vertex ? ".vert" : ".frag");
+		program.stage = vertex ? sdf::shaderpack::Stage::VERTEX : sdf::shaderpack::Stage::FRAGMENT;
+		program.words.resize(wordCount(rng));
+		for (uint32_t &word : program.words)
+			word = rng();
+		program.words[0] = 0x07230203;   // SPIR-V magic
+		program.ubos.push_back(sdf::shaderpack::Program::Ubo{ "UniformBufferObject", 0, 192 });
+		program.bindings.push_back(sdf::shaderpack::DescriptorBinding{ 0, 0, 6, 1 });   // VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+		if (vertex)
+		{
+			program.vertexInputs.push_back(sdf::shaderpack::VertexInput{ 0, 3, 1, sdf::shaderpack::ComponentType::FLOAT });
+			program.vertexInputs.push_back(sdf::shaderpack::VertexInput{ 1, 3, 1, sdf::shaderpack::ComponentType::FLOAT });
+		}
+		program.inputCount = 2;
+		program.outputCount = 1;
+	}
+
+	{
+		std::string source;
+		const double seconds = Measure(budget, [&]()
+		{
+			std::ostringstream text;
+
+			for (const sdf::shaderpack::Program &program : programs)
+			{
+				text << "static const unsigned prog[] = {" << std::hex << std::endl;
+				for (size_t wordIndex = 0; wordIndex < program.words.size();)
+				{
+					text << "\t";
+					for (size_t lineIndex = 0; lineIndex < 8 && wordIndex < program.words.size(); ++lineIndex, ++wordIndex)
+						text << "0x" << std::setw(8) << std::setfill('0') << program.words[wordIndex] << ", ";
+					text << std::endl;
+				}
+				text << "};" << std::dec << std::endl;
+			}
+
+			source = text.str();
+		});
+
+		inoutSuite->Add("shader.carray.write", seconds * 1000.0, "ms", false);
+		inoutSuite->Add("shader.carray.bytes", source.size() / 1024.0, "KB", false);
+	}
+
+	std::string bytes;
+	const double writeSeconds = Measure(budget, [&]() { sdf::shaderpack::Write(programs, &bytes); });
+
+	inoutSuite->Add("shader.pack.write", writeSeconds * 1000.0, "ms", false);
+	inoutSuite->Add("shader.pack.bytes", bytes.size() / 1024.0, "KB", false);
+
+	{
+		std::ofstream file(packPath, std::ios::binary | std::ios::trunc);
+
+		if (!file.write(bytes.data(), bytes.size()))
+		{
+			std::cout << "Failed to write \"" << packPath << "\". Skipping shader pack loading." << std::endl;
+			return;
+		}
+	}
+
+	// What an app's startup does: map, find every program and read its
+	// header, as vkCreateShaderModule would.
+	uint32_t found = 0;
+	const double startupSeconds = Measure(budget, [&]()
+	{
+		sdf::shaderpack::Pack pack;
+
+		if (!sdf::shaderpack::Open(packPath.c_str(), &pack))
+			return;
+
+		for (const sdf::shaderpack::Program &program : programs)
+		{
+			const sdf::shaderpack::Entry *entry = sdf::shaderpack::Find(pack, program.name.c_str());
+
+			found += entry && sdf::shaderpack::ProgramWords(pack, *entry)[0] == 0x07230203 ? 1 : 0;
+		}
+
+		sdf::shaderpack::Close(&pack);
+	});
+
+	sdf::shaderpack::Pack pack;
+
+	if (found == 0 || !sdf::shaderpack::View(bytes.data(), bytes.size(), &pack))
+	{
+		std::cout << "Failed to load \"" << packPath << "\"." << std::endl;
+		std::remove(packPath.c_str());
+		return;
+	}
+
+	const double findSeconds = Measure(budget, [&]()
+	{
+		for (const sdf::shaderpack::Program &program : programs)
+			found += sdf::shaderpack::Find(pack, program.name.c_str()) ? 1 : 0;
+	});
+
+	inoutSuite->Add("shader.pack.startup", startupSeconds * 1e6, "us", false);
+	inoutSuite->Add("shader.pack.find", findSeconds / PROGRAM_COUNT * 1e9, "ns", false);
+
+	std::remove(packPath.c_str());
+}
+
+// glsltoc -z's encoding over programs shaped like SPIR-V: instructions with
+// their word count and opcode in the first word, then mostly small ids and the
+// odd float constant. Ratio is encoded over raw bytes; decode speed is of the
+// words written, as ShaderModule users see it.
+static void RunSpirvCodecBenchmarks(Suite *inoutSuite)
+{
+	static const uint32_t PROGRAM_COUNT = 64;
+
+	if (!inoutSuite->Enabled("shader.codec"))
+		return;
+
+	const double budget = inoutSuite->settings.minSeconds;
+	std::mt19937 rng(11);
+	std::uniform_int_distribution<uint32_t> instructionCount(200, 3000);
+	std::uniform_int_distribution<uint32_t> operandCount(1, 5);
+	std::uniform_int_distribution<uint32_t> opcode(1, 400);
+	std::uniform_real_distribution<float> constant(-10.0f, 10.0f);
+	std::vector<std::vector<uint32_t>> programs(PROGRAM_COUNT);
+	std::vector<std::vector<uint8_t>> encoded(PROGRAM_COUNT);
+	uint64_t words = 0;
+	uint64_t bytes = 0;
+
+	for (std::vector<uint32_t> &program : programs)
+	{
+		const uint32_t instructions = instructionCount(rng);
+
+		program = { 0x07230203, 0x00010000, 0, instructions * 2, 0 };   // magic, version, generator, bound, schema
+		for (uint32_t instructionIndex = 0; instructionIndex < instructions; ++instructionIndex)
+		{
+			const uint32_t operands = operandCount(rng);
+			const uint32_t result = 5 + instructionIndex;
+
+			program.push_back(((operands + 1) << 16) | opcode(rng));
+			for (uint32_t operandIndex = 0; operandIndex < operands; ++operandIndex)
+			{
+				if (rng() % 16 == 0)
+				{
+					const float value = constant(rng);
+					uint32_t valueBits;
+
+					std::memcpy(&valueBits, &value, sizeof(valueBits));
+					program.push_back(valueBits);
+				}
+				else
+				{
+					program.push_back(operandIndex == 0 ? result : result - 1 - rng() % std::min<uint32_t>(result - 1, 64));
+				}
+			}
+		}
+
+		words += program.size();
+	}
+
+	const double encodeSeconds = Measure(budget, [&]()
+	{
+		for (uint32_t programIndex = 0; programIndex < PROGRAM_COUNT; ++programIndex)
+			sdf::spirvcodec::Encode(programs[programIndex].data(), programs[programIndex].size(), &encoded[programIndex]);
+	});
+
+	for (const std::vector<uint8_t> &program : encoded)
+		bytes += program.size();
+
+	std::vector<uint32_t> decoded;
+	uint32_t valid = 0;
+	const double decodeSeconds = Measure(budget, [&]()
+	{
+		for (uint32_t programIndex = 0; programIndex < PROGRAM_COUNT; ++programIndex)
+		{
+			decoded.resize(programs[programIndex].size());
+			valid += sdf::spirvcodec::Decode(encoded[programIndex].data(), encoded[programIndex].size(), decoded.data(), decoded.size()) ? 1 : 0;
+		}
+	});
+
+	if (valid == 0 || decoded != programs.back())
+	{
+		std::cout << "SPIR-V codec round trip failed." << std::endl;
+		return;
+	}
+
+	inoutSuite->Add("shader.codec.ratio", 100.0 * bytes / (words * sizeof(uint32_t)), "%", false);
+	inoutSuite->Add("shader.codec.encode", encodeSeconds * 1000.0, "ms", false);
+	inoutSuite->Add("shader.codec.decode", words * sizeof(uint32_t) / (1024.0 * 1024.0) / decodeSeconds, "MB/s", true);
+}
+
+// ShaderWatcher's file watching over a tree of 10k shaders: the walk it starts
+// with, and the time from an editor style save, a temporary written and renamed
+// over the file, to the save being dispatched. The save waits out the coalesce
+// window, so dispatch less the window is what the watching itself costs.
+static void RunWatchBenchmarks(Suite *inoutSuite)
+{
+	static const uint32_t DIR_COUNT = 100;
+	static const uint32_t FILES_PER_DIR = 100;
+
+	if (!inoutSuite->Enabled("watch"))
+		return;
+
+	const double budget = inoutSuite->settings.minSeconds;
+	const std::filesystem::path root = std::filesystem::temp_directory_path() / "sdfbench_watch";
+	std::error_code error;
+
+	std::filesystem::remove_all(root, error);
+	for (uint32_t dirIndex = 0; dirIndex < DIR_COUNT; ++dirIndex)
+	{
+		const std::filesystem::path dir = root / ("dir" + std::to_string(dirIndex));
+
+		std::filesystem::create_directories(dir, error);
+		for (uint32_t fileIndex = 0; fileIndex < FILES_PER_DIR; ++fileIndex)
+			std::ofstream(dir / ("shader" + std::to_string(fileIndex) + ".frag")) << "void main() {}" << std::endl;
+	}
+
+	const sdf::dirwatch::Settings settings;
+	sdf::dirwatch::Watcher *watcher = nullptr;
+	const double setupSeconds = Measure(budget, [&]()
+	{
+		if (watcher)
+			sdf::dirwatch::DestroyWatcher(watcher);
+		watcher = sdf::dirwatch::CreateWatcher(root.string().c_str(), settings);
+	});
+
+	if (!watcher)
+	{
+		std::cout << "Failed to watch \"" << root.string() << "\". Skipping watch benchmarks." << std::endl;
+		std::filesystem::remove_all(root, error);
+		return;
+	}
+
+	const std::filesystem::path target = root / "dir42" / "shader7.frag";
+	const std::filesystem::path temporary = root / "dir42" / "shader7.frag.tmp";
+	sdf::dirwatch::Changes changes;
+	uint32_t saves = 0;
+	bool exact = true;
+	const double saveSeconds = Measure(budget, [&]()
+	{
+		std::ofstream(temporary) << "void main() { /* " << saves++ << " */ }" << std::endl;
+		std::filesystem::rename(temporary, target, error);
+
+		exact = sdf::dirwatch::Wait(watcher, &changes) && exact && changes.added.empty() && changes.removed.empty() && changes.modified.size() == 1 && changes.modified[0] == target.string();
+	});
+	const sdf::dirwatch::Stats stats = sdf::dirwatch::GetStats(watcher);
+
+	// A walk after the first would mean events were lost.
+	if (!exact || stats.walks != 1)
+		std::cout << "Watching reported more than the saved file." << std::endl;
+
+	inoutSuite->Add("watch.setup", setupSeconds * 1000.0, "ms", false);
+	inoutSuite->Add("watch.save", saveSeconds * 1000.0, "ms", false);
+	inoutSuite->Add("watch.save.overhead", (saveSeconds - settings.coalesceMs / 1000.0) * 1000.0, "ms", false);
+
+	sdf::dirwatch::DestroyWatcher(watcher);
+	std::filesystem::remove_all(root, error);
+}
+
+// Peak memory by subsystem over the whole run.
+static void RunMemoryReport(Suite *inoutSuite)
+{
+	sdf::memory::Report report;
+
+	sdf::memory::GetReport(&report);
+
+	for (unsigned tag = 0; tag < (unsigned)sdf::memory::Tag::COUNT; ++tag)
+	{
+		const std::string name = std::string("memory.peak.") + sdf::memory::TagName((sdf::memory::Tag)tag);
+
+		if (inoutSuite->Enabled(name))
+			inoutSuite->Add(name, report.cpu[tag].peak / (1024.0 * 1024.0), "MB", false);
+	}
+}
+
+#if SDFBENCH_SHADERS
+static bool ReadFile(const std::string &fileName, std::string *outContents)
+{
+	std::ifstream file(fileName, std::ios::binary);
+	std::ostringstream contents;
+
+	if (!file)
+		return false;
+
+	contents << file.rdbuf();
+	*outContents = contents.str();
+	return true;
+}
+
+// The repository's shaders through the same glslang front end GLSLToC uses,
+// with the global extensions force included the way the build does.
+static void RunShaderFileBenchmarks(Suite *inoutSuite)
+{
+	static const char * const SHADER_FILES[] = { "trivial.vert", "trivial.frag" };
+
+	std::string prelude;
+
+	if (!ReadFile(inoutSuite->settings.shaderDir + "/global_extensions.glsl", &prelude))
+	{
+		std::cout << "No shaders in \"" << inoutSuite->settings.shaderDir << "\". Skipping shader file benchmarks." << std::endl;
+		return;
+	}
+
+	for (const char *fileName : SHADER_FILES)
+	{
+		const std::string name = std::string("shader.file.") + fileName;
+		std::string source;
+		std::vector<uint32_t> spirv;
+
+		if (!inoutSuite->Enabled(name) || !ReadFile(inoutSuite->settings.shaderDir + "/" + fileName, &source))
+			continue;
+
+		source = prelude + "\n" + source;
+
+		const sdf::shader::Stage stage = std::strstr(fileName, ".vert") ? sdf::shader::Stage::VERTEX : sdf::shader::Stage::FRAGMENT;
+		const double seconds = Measure(inoutSuite->settings.minSeconds, [&]() { sdf::shader::CompileGlsl(source, stage, &spirv, nullptr); });
+		std::vector<uint8_t> encoded;
+
+		inoutSuite->Add(name, seconds * 1000.0, "ms", false);
+
+		sdf::spirvcodec::Encode(spirv.data(), spirv.size(), &encoded);
+		inoutSuite->Add(name + ".codec.ratio", 100.0 * encoded.size() / std::max<size_t>(spirv.size() * sizeof(uint32_t), 1), "%", false);
+	}
+}
+#endif
+
+static bool WriteResults(const std::string &fileName, const Suite &suite, unsigned threadCount)
+{
+	std::ofstream file(fileName);
+
+	if (!file)
+		return false;
+
+	file << "{" << std::endl;
+	file << "\t\"benchmark\": \"SDFBench\"," << std::endl;
+	file << "\t\"version\": 1," << std::endl;
+	file << "\t\"threads\": " << threadCount << "," << std::endl;
+	file << "\t\"results\": [" << std::endl;
+
+	for (size_t resultIndex = 0; resultIndex < suite.results.size(); ++resultIndex)
+	{
+		const Result &result = suite.results[resultIndex];
+
+		file << "\t\t{ \"name\": \"" << result.name << "\", \"value\": " << std::setprecision(9) << result.value;
+		file << ", \"unit\": \"" << result.unit << "\", \"better\": \"" << (result.higherIsBetter ? "higher" : "lower") << "\" }";
+		file << (resultIndex + 1 < suite.results.size() ? "," : "") << std::endl;
+	}
+
+	file << "\t]" << std::endl;
+	file << "}" << std::endl;
+
+	return true;
+}
+
+// Reads back what WriteResults writes: one result object per line.
+static bool ReadResults(const std::string &fileName, std::vector<Result> *outResults)
+{
+	std::ifstream file(fileName);
+	std::string line;
+
+	if (!file)
+		return false;
+
+	while (std::getline(file, line))
+	{
+		const size_t nameStart = line.find("\"name\": \"");
+		const size_t valueStart = line.find("\"value\": ");
+
+		if (nameStart == std::string::npos || valueStart == std::string::npos)
+			continue;
+
+		const size_t nameEnd = line.find('"', nameStart + 9);
+		Result result;
+
+		result.name = line.substr(nameStart + 9, nameEnd - nameStart - 9);
+		result.value = std::strtod(line.c_str() + valueStart + 9, nullptr);
+		result.higherIsBetter = line.find("\"better\": \"higher\"") != std::string::npos;
+		outResults->push_back(result);
+	}
+
+	return true;
+}
+
+static int CompareResults(const std::vector<Result> &baseline, const Suite &suite)
+{
+	unsigned regressions = 0;
+
+	std::cout << std::endl << "Against " << suite.settings.baselineFile << ":" << std::endl;
+
+	for (const Result &result : suite.results)
+	{
+		const auto found = std::find_if(baseline.begin(), baseline.end(), [&](const Result &old) { return old.name == result.name; });
+
+		if (found == baseline.end() || found->value == 0.0)
+			continue;
+
+		const double change = (result.value - found->value) / found->value;
+		const bool regressed = result.higherIsBetter ? change < -suite.settings.threshold : change > suite.settings.threshold;
+
+		regressions += regressed;
+		std::cout << std::left << std::setw(44) << result.name << std::right << std::showpos << std::fixed << std::setprecision(1) << std::setw(8) << change * 100.0 << "%" << std::noshowpos << std::defaultfloat;
+		std::cout << (regressed ? "  REGRESSION" : "") << std::endl;
+	}
+
+	std::cout << regressions << " regression" << (regressions == 1 ? "" : "s") << " over " << suite.settings.threshold * 100.0 << "%." << std::endl;
+
+	return regressions ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	Settings settings;
+	std::vector<Result> baseline;
+
+	if (!ParseSettings(argc, argv, &settings))
+	{
+		PrintHelp();
+		return 0;
+	}
+
+	if (!settings.baselineFile.empty() && !ReadResults(settings.baselineFile, &baseline))
+	{
+		std::cout << "Failed to read \"" << settings.baselineFile << "\"." << std::endl;
+		return -1;
+	}
+
+	Suite suite(settings);
+
+	suite.pool = sdf::jobs::CreatePool(settings.threadCount);
+
+#if SDFBENCH_SHADERS
+	sdf::shader::Compiler * const compiler = sdf::shader::CreateCompiler(nullptr); // keeps glslang initialized
+	RunShaderFileBenchmarks(&suite);
+#endif
+
+	for (const char *sceneName : SCENES)
+		RunSceneBenchmarks(sceneName, &suite);
+
+	RunBakeBenchmarks(&suite);
+	RunUploadBenchmarks(&suite);
+	RunSculptBenchmarks(&suite);
+	RunShaderPackBenchmarks(&suite);
+	RunSpirvCodecBenchmarks(&suite);
+	RunWatchBenchmarks(&suite);
+	RunMemoryReport(&suite);
+
+#if SDFBENCH_SHADERS
+	sdf::shader::DestroyCompiler(compiler);
+#endif
+
+	const unsigned threadCount = sdf::jobs::ThreadCount(suite.pool);
+
+	sdf::jobs::DestroyPool(suite.pool);
+
+	if (!settings.outputFile.empty() && !WriteResults(settings.outputFile, suite, threadCount))
+	{
+		std::cout << "Failed to write \"" << settings.outputFile << "\"." << std::endl;
+		return -2;
+	}
+
+	if (suite.failed)
+		return -3;
+
+	return baseline.empty() ? 0 : CompareResults(baseline, suite);
+}
@@ -0,0 +1,1069 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <sstream>
+#include "../../source/sdf/Bake.h"
+#include "../../source/sdf/Bricks.h"
+#include "../../source/sdf/Extract.h"
+#include "../../source/sdf/Memory.h"
+#include "../../source/sdf/Mip.h"
+#include "../../source/sdf/Occupancy.h"
+#include "../../source/sdf/Optimize.h"
+#include "../../source/sdf/Query.h"
+#include "../../source/sdf/Redistance.h"
+#include "../../source/sdf/Scenes.h"
+#include "../../source/sdf/Sculpt.h"
+#include "../../source/sdf/Trace.h"
+
+struct Settings
+{
+	std::string sceneName = "csg";
+	std::string outputFile;
+	uint32_t gradientPoints = 0;
+	bool optimizerReport = false;
+	uint32_t queryCount = 0;
+	uint32_t brickEdits = 0;
+	uint32_t pyramidRays = 0;
+	uint32_t sculptDabs = 0;
+	uint32_t occupancyResolution = 0;
+	std::string meshName;
+	std::string exportFile;
+	std::string memoryFile;
+	sdf::bake::Settings bake;
+	sdf::trace::Settings trace;
+};
+
+static void PrintHelp()
+{
+	std::cout << "SDFTrace: " << std::endl;
+	std::cout << "    CPU reference sphere tracer for SDF scenes." << std::endl;
+	std::cout << std::endl;
+	std::cout << "Usage: " << std::endl;
+	std::cout << "    sdftrace [options] <output.ppm>" << std::endl;
+	std::cout << std::endl;
+	std::cout << "Description:" << std::endl;
+	std::cout << "    Renders one of the canonical procedural scenes entirely on the CPU," << std::endl;
+	std::cout << "    tracing 8 ray packets per SIMD evaluation across every core. Needs no" << std::endl;
+	std::cout << "    GPU, so the output is suitable as a golden image. Throughput is" << std::endl;
+	std::cout << "    reported as rays per second and sphere tracing steps per ray." << std::endl;
+	std::cout << "    Options should be specified without a space between the option" << std::endl;
+	std::cout << "    signifier and its text." << std::endl;
+	std::cout << std::endl;
+	std::cout << "Options:" << std::endl;
+	std::cout << "    -S: Scene name. primitives, csg (default), grid<N>, clutter<N> or a" << std::endl;
+	std::cout << "        .sdfv volume file." << std::endl;
+	std::cout << "    -W: Image width. Default 640." << std::endl;
+	std::cout << "    -H: Image height. Default 480." << std::endl;
+	std::cout << "    -T: Thread count. Default is every hardware thread." << std::endl;
+	std::cout << "    -N: Max steps per ray. Default 256." << std::endl;
+	std::cout << "    -t: Tile size in pixels. Default 32." << std::endl;
+	std::cout << "    -X: Occupancy. Renders skipping the empty cells of an occupancy" << std::endl;
+	std::cout << "        hierarchy with the given number of cells along the scene's longest" << std::endl;
+	std::cout << "        axis, and reports steps per pixel with and without it." << std::endl;
+	std::cout << "    -G: Gradient benchmark. Times analytic normals against 6 tap central" << std::endl;
+	std::cout << "        differences at the given number of near surface points instead" << std::endl;
+	std::cout << "        of rendering. No output file is needed." << std::endl;
+	std::cout << "    -O: Optimizer report. Runs the DAG optimizer over a corpus of scenes" << std::endl;
+	std::cout << "        and reports node counts and evaluation speed before and after." << std::endl;
+	std::cout << "        No output file is needed." << std::endl;
+	std::cout << "    -Q: Query benchmark. Times batches of the given number of ray casts and" << std::endl;
+	std::cout << "        closest point queries against the evaluations they needed. No" << std::endl;
+	std::cout << "        output file is needed." << std::endl;
+	std::cout << "    -A: Brick atlas benchmark. Stamps the given number of spheres onto the" << std::endl;
+	std::cout << "        scene's volume and reports what each edit uploads to the GPU atlas." << std::endl;
+	std::cout << "        No output file is needed." << std::endl;
+	std::cout << "    -V: Volume pyramid benchmark. Builds the mip pyramid of the scene's" << std::endl;
+	std::cout << "        volume and marches the given number of rays through it with and" << std::endl;
+	std::cout << "        without empty cell skipping. No output file is needed." << std::endl;
+	std::cout << "    -B: Sculpt benchmark. Drags add, subtract, smooth and flatten strokes" << std::endl;
+	std::cout << "        of the given total number of dabs over the scene's volume, a" << std::endl;
+	std::cout << "        frame at a time, and reports dab throughput and latency and what" << std::endl;
+	std::cout << "        each frame uploads to the GPU atlas and the occupancy hierarchy, then" << std::endl;
+	std::cout << "        again redistancing every frame's tiles. No output file is needed." << std::endl;
+	std::cout << "    -M: Mesh bake. Converts an .obj, .ply or .stl mesh, or knot<N> for a" << std::endl;
+	std::cout << "        procedural mesh of N triangles, into the .sdfv output file and" << std::endl;
+	std::cout << "        reports where the time went." << std::endl;
+	std::cout << "    -E: Mesh export. Streams the scene's surface into an .ply, .stl or .obj" << std::endl;
+	std::cout << "        file and reports triangles per second. No output file is needed." << std::endl;
+	std::cout << "    -R: Bake and export resolution along the longest axis. Default 256." << std::endl;
+	std::cout << "    -w: Bake with winding number signs instead of pseudo normals, for" << std::endl;
+	std::cout << "        meshes that are not closed." << std::endl;
+	std::cout << "    -m: Memory report. Prints memory by subsystem once done and writes it" << std::endl;
+	std::cout << "        to the given .json file." << std::endl;
+	std::cout << std::endl;
+}
+
+static bool ParseSettings(int argc, char *argv[], Settings *outSettings)
+{
+	for (int argIndex = 1; argIndex < argc; ++argIndex)
+	{
+		const char * const arg = argv[argIndex];
+
+		if (*arg == '-')
+		{
+			switch (arg[1])
+			{
+				case 'S':
+					outSettings->sceneName = arg + 2;
+				break;
+				case 'W':
+					outSettings->trace.width = (uint32_t)std::strtoul(arg + 2, nullptr, 10);
+				break;
+				case 'H':
+					outSettings->trace.height = (uint32_t)std::strtoul(arg + 2, nullptr, 10);
+				break;
+				case 'T':
+					outSettings->trace.threadCount = (unsigned)std::strtoul(arg + 2, nullptr, 10);
+					outSettings->bake.threadCount = outSettings->trace.threadCount;
+				break;
+				case 'N':
+					outSettings->trace.maxSteps = (uint32_t)std::strtoul(arg + 2, nullptr, 10);
+				break;
+				case 't':
+					outSettings->trace.tileSize = (uint32_t)std::strtoul(arg + 2, nullptr, 10);
+				break;
+				case 'X':
+					outSettings->occupancyResolution = (uint32_t)std::strtoul(arg + 2, nullptr, 10);
+				break;
+				case 'G':
+					outSettings->gradientPoints = (uint32_t)std::strtoul(arg + 2, nullptr, 10);
+				break;
+				case 'O':
+					outSettings->optimizerReport = true;
+				break;
+				case 'Q':
+					outSettings->queryCount = (uint32_t)std::strtoul(arg + 2, nullptr, 10);
+				break;
+				case 'A':
+					outSettings->brickEdits = (uint32_t)std::strtoul(arg + 2, nullptr, 10);
+				break;
+				case 'V':
+					outSettings->pyramidRays = (uint32_t)std::strtoul(arg + 2, nullptr, 10);
+				break;
+				case 'B':
+					outSettings->sculptDabs = (uint32_t)std::strtoul(arg + 2, nullptr, 10);
+				break;
+				case 'M':
+					outSettings->meshName = arg + 2;
+				break;
+				case 'E':
+					outSettings->exportFile = arg + 2;
+				break;
+				case 'R':
+					outSettings->bake.resolution = (uint32_t)std::strtoul(arg + 2, nullptr, 10);
+				break;
+				case 'w':
+					outSettings->bake.sign = sdf::bake::SignMode::WINDING_NUMBER;
+				break;
+				case 'm':
+					outSettings->memoryFile = arg + 2;
+				break;
+				default:
+					std::cout << "Unkown argument \"" << arg << "\"." << std::endl;
+					return false;
+			}
+		}
+		else
+		{
+			if (!outSettings->outputFile.empty())
+			{
+				std::cout << "Multiple output files defined." << std::endl;
+				return false;
+			}
+
+			outSettings->outputFile = arg;
+		}
+	}
+
+	if (outSettings->outputFile.empty() && outSettings->gradientPoints == 0 && !outSettings->optimizerReport && outSettings->queryCount == 0 && outSettings->brickEdits == 0 && outSettings->pyramidRays == 0 && outSettings->sculptDabs == 0 && outSettings->exportFile.empty())
+	{
+		std::cout << "No output file defined." << std::endl;
+		return false;
+	}
+
+	if (outSettings->trace.width == 0 || outSettings->trace.height == 0)
+	{
+		std::cout << "Invalid image size." << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+static int RunBake(const Settings &settings)
+{
+	sdf::mesh::Mesh mesh;
+	sdf::volume::Grid grid;
+	sdf::bake::Stats stats;
+	const auto loadStart = std::chrono::high_resolution_clock::now();
+
+	if (settings.meshName.compare(0, 4, "knot") == 0)
+		sdf::mesh::MakeTorusKnot((uint32_t)std::strtoul(settings.meshName.c_str() + 4, nullptr, 10), &mesh);
+	else if (!sdf::mesh::Load(settings.meshName.c_str(), &mesh))
+	{
+		std::cout << "Failed to load mesh \"" << settings.meshName << "\"." << std::endl;
+		return -1;
+	}
+
+	const double loadSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - loadStart).count();
+
+	if (!sdf::bake::BakeMesh(mesh, settings.bake, &grid, &stats))
+	{
+		std::cout << "Failed to bake \"" << settings.meshName << "\". It is empty or the resolution is too low." << std::endl;
+		return -2;
+	}
+
+	if (!sdf::volume::Save(settings.outputFile.c_str(), grid))
+	{
+		std::cout << "Failed to write \"" << settings.outputFile << "\"." << std::endl;
+		return -4;
+	}
+
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "Mesh:           " << settings.meshName << " (" << stats.triangles << " triangles, loaded in " << loadSeconds * 1000.0 << " ms)" << std::endl;
+	std::cout << "Volume:         " << grid.dims.x << "x" << grid.dims.y << "x" << grid.dims.z << " -> " << settings.outputFile << std::endl;
+	std::cout << "Sign:           " << (settings.bake.sign == sdf::bake::SignMode::WINDING_NUMBER ? "winding number" : "pseudo normals") << std::endl;
+	std::cout << "BVH:            " << stats.bvhSeconds * 1000.0 << " ms, " << stats.bvhNodes << " nodes" << std::endl;
+	std::cout << "Narrow band:    " << stats.bandSeconds * 1000.0 << " ms, " << stats.bandVoxels << " voxels" << std::endl;
+	std::cout << "Fast sweeping:  " << stats.sweepSeconds * 1000.0 << " ms" << std::endl;
+	std::cout << "Total:          " << stats.seconds * 1000.0 << " ms" << std::endl;
+
+	return 0;
+}
+
+static void RunGradientBenchmark(const sdf::program::Program &prog, uint32_t pointCount)
+{
+	using sdf::simd::float8;
+
+	const uint32_t packetCount = (pointCount + sdf::simd::WIDTH - 1) / sdf::simd::WIDTH;
+	std::vector<float> pts[3];
+	std::vector<float> analytic[3];
+	std::vector<float> numeric[3];
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> coord(-3.0f, 3.0f);
+
+	for (unsigned axis = 0; axis < 3; ++axis)
+	{
+		pts[axis].resize(packetCount * sdf::simd::WIDTH);
+		analytic[axis].resize(pts[axis].size());
+		numeric[axis].resize(pts[axis].size());
+	}
+
+	// Random points pulled to just outside the surface with a single Newton step,
+	// so the sample looks like the hit points of a render. Landing exactly on the
+	// surface would park many of them on cylinder rims where no gradient exists.
+	for (uint32_t packetIndex = 0; packetIndex < packetCount; ++packetIndex)
+	{
+		float in[3][sdf::simd::WIDTH];
+		float8 dist, grad[3];
+
+		for (unsigned axis = 0; axis < 3; ++axis)
+			for (unsigned lane = 0; lane < sdf::simd::WIDTH; ++lane)
+				in[axis][lane] = coord(rng);
+
+		const float8 x = sdf::simd::Load(in[0]);
+		const float8 y = sdf::simd::Load(in[1]);
+		const float8 z = sdf::simd::Load(in[2]);
+
+		sdf::program::EvaluatePacketGradient(prog, x, y, z, &dist, grad, nullptr);
+		dist = dist - sdf::simd::Set1(1e-2f);
+
+		sdf::simd::Store(pts[0].data() + packetIndex * sdf::simd::WIDTH, x - grad[0] * dist);
+		sdf::simd::Store(pts[1].data() + packetIndex * sdf::simd::WIDTH, y - grad[1] * dist);
+		sdf::simd::Store(pts[2].data() + packetIndex * sdf::simd::WIDTH, z - grad[2] * dist);
+	}
+
+	uint64_t fallbackLanes = 0;
+	const auto analyticStart = std::chrono::high_resolution_clock::now();
+
+	for (uint32_t packetIndex = 0; packetIndex < packetCount; ++packetIndex)
+	{
+		const size_t offset = packetIndex * sdf::simd::WIDTH;
+		float8 dist, grad[3];
+
+		const unsigned fallback = sdf::program::EvaluatePacketGradient(prog, sdf::simd::Load(pts[0].data() + offset), sdf::simd::Load(pts[1].data() + offset), sdf::simd::Load(pts[2].data() + offset), &dist, grad, nullptr);
+
+		for (unsigned axis = 0; axis < 3; ++axis)
+			sdf::simd::Store(analytic[axis].data() + offset, grad[axis]);
+
+		for (unsigned bits = fallback; bits; bits &= bits - 1)
+			++fallbackLanes;
+	}
+
+	const auto numericStart = std::chrono::high_resolution_clock::now();
+
+	for (uint32_t packetIndex = 0; packetIndex < packetCount; ++packetIndex)
+	{
+		const size_t offset = packetIndex * sdf::simd::WIDTH;
+		float8 grad[3];
+
+		sdf::program::EvaluatePacketCentralDifference(prog, sdf::simd::Load(pts[0].data() + offset), sdf::simd::Load(pts[1].data() + offset), sdf::simd::Load(pts[2].data() + offset), 1e-4f, grad);
+
+		for (unsigned axis = 0; axis < 3; ++axis)
+			sdf::simd::Store(numeric[axis].data() + offset, grad[axis]);
+	}
+
+	const auto numericEnd = std::chrono::high_resolution_clock::now();
+	const double analyticSeconds = std::chrono::duration<double>(numericStart - analyticStart).count();
+	const double numericSeconds = std::chrono::duration<double>(numericEnd - numericStart).count();
+	const double normalCount = (double)packetCount * sdf::simd::WIDTH;
+	double maxAngle = 0.0;
+	double sumAngle = 0.0;
+
+	for (size_t pointIndex = 0; pointIndex < pts[0].size(); ++pointIndex)
+	{
+		const glm::vec3 a(analytic[0][pointIndex], analytic[1][pointIndex], analytic[2][pointIndex]);
+		const glm::vec3 n(numeric[0][pointIndex], numeric[1][pointIndex], numeric[2][pointIndex]);
+		const float lengths = glm::length(a) * glm::length(n);
+		const double angle = lengths > 0.0f ? std::acos(glm::clamp(glm::dot(a, n) / lengths, -1.0f, 1.0f)) * 57.29577951 : 0.0;
+
+		maxAngle = std::max(maxAngle, angle);
+		sumAngle += angle;
+	}
+
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "Points:         " << (uint64_t)normalCount << " (single thread)" << std::endl;
+	std::cout << "Analytic:       " << normalCount / analyticSeconds / 1e6 << " M normals/sec" << std::endl;
+	std::cout << "6 tap:          " << normalCount / numericSeconds / 1e6 << " M normals/sec" << std::endl;
+	std::cout << "Speedup:        " << numericSeconds / analyticSeconds << "x" << std::endl;
+	std::cout << "Fallback lanes: " << fallbackLanes << std::endl;
+	std::cout << std::setprecision(4);
+	std::cout << "Angle error:    " << sumAngle / normalCount << " deg mean, " << maxAngle << " deg max" << std::endl;
+}
+
+// Best of a few runs of single threaded batch evaluation, in points per second.
+static double MeasureEvaluation(const sdf::program::Program &prog, const std::vector<float> pts[3], std::vector<float> *outDist)
+{
+	double bestSeconds = 0.0;
+
+	outDist->resize(pts[0].size());
+
+	for (unsigned run = 0; run < 5; ++run)
+	{
+		const auto start = std::chrono::high_resolution_clock::now();
+		sdf::program::EvaluateBatch(prog, pts[0].data(), pts[1].data(), pts[2].data(), pts[0].size(), outDist->data());
+		const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		if (run == 0 || seconds < bestSeconds)
+			bestSeconds = seconds;
+	}
+
+	return (double)pts[0].size() / bestSeconds;
+}
+
+static bool RunOptimizerReport()
+{
+	static const char * const corpus[] = { "primitives", "csg", "grid256", "clutter16", "clutter64", "clutter256" };
+	static const size_t POINT_COUNT = 1 << 16;
+
+	std::vector<float> pts[3];
+	std::vector<float> before, after;
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> coord(-2.0f, 2.0f);
+
+	for (unsigned axis = 0; axis < 3; ++axis)
+	{
+		pts[axis].resize(POINT_COUNT);
+
+		for (float &value : pts[axis])
+			value = coord(rng);
+	}
+
+	std::cout << std::left << std::setw(12) << "Scene" << std::setw(16) << "Nodes" << std::setw(16) << "Instructions";
+	std::cout << std::setw(22) << "M evals/sec" << std::setw(10) << "Speedup" << "Max error" << std::endl;
+
+	for (const char *name : corpus)
+	{
+		sdf::scene::Scene scene, optimized;
+		sdf::program::Program prog, optimizedProg;
+		sdf::optimize::Stats stats;
+
+		if (!sdf::scenes::Build(name, &scene) || !sdf::optimize::Optimize(scene, &optimized, &stats))
+			return false;
+
+		if (!sdf::program::Compile(scene, &prog) || !sdf::program::Compile(optimized, &optimizedProg))
+		{
+			std::cout << "Failed to compile scene \"" << name << "\"." << std::endl;
+			return false;
+		}
+
+		const double rateBefore = MeasureEvaluation(prog, pts, &before);
+		const double rateAfter = MeasureEvaluation(optimizedProg, pts, &after);
+		float maxError = 0.0f;
+
+		for (size_t pointIndex = 0; pointIndex < POINT_COUNT; ++pointIndex)
+			maxError = std::max(maxError, std::abs(before[pointIndex] - after[pointIndex]));
+
+		std::ostringstream nodes, instructions, rates;
+		nodes << stats.nodesBefore << " -> " << stats.nodesAfter;
+		instructions << prog.code.size() << " -> " << optimizedProg.code.size();
+		rates << std::fixed << std::setprecision(1) << rateBefore / 1e6 << " -> " << rateAfter / 1e6;
+
+		std::cout << std::setw(12) << name << std::setw(16) << nodes.str() << std::setw(16) << instructions.str() << std::setw(22) << rates.str();
+		std::cout << std::fixed << std::setprecision(2) << std::setw(10) << rateAfter / rateBefore;
+		std::cout << std::scientific << std::setprecision(1) << maxError << std::endl;
+		std::cout << std::setw(12) << "" << "shared " << stats.sharedNodes << ", folded " << stats.foldedTransforms;
+		std::cout << ", culled " << stats.culledBranches << ", flattened " << stats.flattenedOps << std::endl;
+	}
+
+	return true;
+}
+
+// Single threaded seconds per packet for plain and gradient evaluation.
+static void MeasurePacketCost(const sdf::program::Program &prog, double *outEvalSeconds, double *outGradientSeconds)
+{
+	static const uint32_t PACKET_COUNT = 1 << 14;
+
+	std::mt19937 rng(99);
+	std::uniform_real_distribution<float> coord(-2.0f, 2.0f);
+	std::vector<float> pts(PACKET_COUNT * 3 * sdf::simd::WIDTH);
+	sdf::simd::float8 sink = sdf::simd::Zero();
+
+	for (float &value : pts)
+		value = coord(rng);
+
+	const auto evalStart = std::chrono::high_resolution_clock::now();
+
+	for (uint32_t packetIndex = 0; packetIndex < PACKET_COUNT; ++packetIndex)
+	{
+		const float * const p = pts.data() + packetIndex * 3 * sdf::simd::WIDTH;
+		sdf::simd::float8 dist;
+
+		sdf::program::EvaluatePacket(prog, sdf::simd::Load(p), sdf::simd::Load(p + 8), sdf::simd::Load(p + 16), &dist, nullptr);
+		sink = sink + dist;
+	}
+
+	const auto gradientStart = std::chrono::high_resolution_clock::now();
+
+	for (uint32_t packetIndex = 0; packetIndex < PACKET_COUNT; ++packetIndex)
+	{
+		const float * const p = pts.data() + packetIndex * 3 * sdf::simd::WIDTH;
+		sdf::simd::float8 dist, grad[3];
+
+		sdf::program::EvaluatePacketGradient(prog, sdf::simd::Load(p), sdf::simd::Load(p + 8), sdf::simd::Load(p + 16), &dist, grad, nullptr);
+		sink = sink + dist + grad[0];
+	}
+
+	const auto end = std::chrono::high_resolution_clock::now();
+
+	*outEvalSeconds = std::chrono::duration<double>(gradientStart - evalStart).count() / PACKET_COUNT;
+	*outGradientSeconds = std::chrono::duration<double>(end - gradientStart).count() / PACKET_COUNT;
+
+	if (sdf::simd::HorizontalSum(sink) == 1234.5f)
+		std::cout << std::endl;
+}
+
+static void RunQueryBenchmark(const sdf::program::Program &prog, uint32_t queryCount, unsigned threadCount)
+{
+	static const unsigned BATCH_RUNS = 50;
+
+	const sdf::trace::Camera camera = sdf::trace::DefaultCamera();
+	const glm::vec3 forward = glm::normalize(camera.target - camera.eye);
+	const glm::vec3 right = glm::normalize(glm::cross(forward, camera.up));
+	const glm::vec3 up = glm::cross(right, forward);
+	std::vector<sdf::query::Ray> rays(queryCount);
+	std::vector<glm::vec3> points(queryCount);
+	std::vector<sdf::query::Hit> hits(queryCount);
+	std::mt19937 rng(4321);
+	std::uniform_real_distribution<float> ndc(-0.4f, 0.4f);
+	std::uniform_real_distribution<float> coord(-2.0f, 2.0f);
+	sdf::query::Settings settings;
+	double evalSeconds, gradientSeconds;
+
+	// Picking rays from the default camera, and snapping points around the scene.
+	for (uint32_t queryIndex = 0; queryIndex < queryCount; ++queryIndex)
+	{
+		rays[queryIndex].origin = camera.eye;
+		rays[queryIndex].direction = glm::normalize(forward + right * ndc(rng) + up * ndc(rng));
+		rays[queryIndex].maxDistance = 50.0f;
+		points[queryIndex] = glm::vec3(coord(rng), coord(rng), coord(rng));
+	}
+
+	MeasurePacketCost(prog, &evalSeconds, &gradientSeconds);
+
+	sdf::jobs::Pool * const pool = sdf::jobs::CreatePool(threadCount);
+	const unsigned poolThreads = sdf::jobs::ThreadCount(pool);
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "Batch:          " << queryCount << " queries on " << poolThreads << " threads, best of " << BATCH_RUNS << std::endl;
+
+	for (unsigned kind = 0; kind < 2; ++kind)
+	{
+		sdf::query::Stats stats, best;
+		uint32_t hitCount = 0;
+
+		for (unsigned run = 0; run < BATCH_RUNS; ++run)
+		{
+			if (kind == 0)
+				sdf::query::CastRays(pool, prog, rays.data(), rays.size(), settings, hits.data(), &stats);
+			else
+				sdf::query::ClosestPoints(pool, prog, points.data(), points.size(), settings, hits.data(), &stats);
+
+			if (run == 0 || stats.seconds < best.seconds)
+				best = stats;
+		}
+
+		for (const sdf::query::Hit &hit : hits)
+			hitCount += hit.hit;
+
+		// What the same evaluations cost on their own, perfectly spread over the pool.
+		const double pureSeconds = (best.evaluations * evalSeconds + best.gradientEvaluations * gradientSeconds) / poolThreads;
+
+		std::cout << (kind == 0 ? "Ray casts:      " : "Closest points: ") << best.seconds * 1000.0 << " ms, ";
+		std::cout << best.queries / best.seconds / 1e6 << " M queries/sec, " << hitCount << " hits" << std::endl;
+		std::cout << "  evaluation:   " << pureSeconds * 1000.0 << " ms for " << best.evaluations << " + " << best.gradientEvaluations << " gradient packets, ";
+		std::cout << "batch costs " << best.seconds / pureSeconds << "x" << std::endl;
+	}
+
+	sdf::jobs::DestroyPool(pool);
+}
+
+// Bounds of the whole scene, with unbounded shapes such as the ground plane cut
+// off around the origin.
+// The scene's bounds, with unbounded surfaces such as planes cut off.
+static void SceneBox(const sdf::scene::Scene &scene, glm::vec3 *outMin, glm::vec3 *outMax)
+{
+	static const float UNBOUNDED_EXTENT = 3.0f;
+
+	std::vector<sdf::scene::Bounds> bounds;
+
+	sdf::scene::ComputeBounds(scene, &bounds);
+	*outMin = glm::max(bounds[scene.root].min, glm::vec3(-UNBOUNDED_EXTENT)) - glm::vec3(0.05f);
+	*outMax = glm::min(bounds[scene.root].max, glm::vec3(UNBOUNDED_EXTENT)) + glm::vec3(0.05f);
+}
+
+static bool RunExport(const sdf::scene::Scene &scene, const sdf::program::Program &prog, const Settings &settings)
+{
+	sdf::extract::Settings exportSettings;
+	sdf::extract::Format format;
+	sdf::extract::Stats stats;
+
+	if (!sdf::extract::FormatFromFileName(settings.exportFile.c_str(), &format))
+	{
+		std::cout << "Unknown mesh format \"" << settings.exportFile << "\"." << std::endl;
+		return false;
+	}
+
+	SceneBox(scene, &exportSettings.min, &exportSettings.max);
+	exportSettings.resolution = settings.bake.resolution;
+	exportSettings.threadCount = settings.trace.threadCount;
+
+	if (!sdf::extract::ExportMesh(prog, exportSettings, settings.exportFile.c_str(), format, &stats))
+	{
+		std::cout << "Failed to export \"" << settings.exportFile << "\"." << std::endl;
+		return false;
+	}
+
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "Scene:          " << settings.sceneName << " (" << prog.code.size() << " instructions)" << std::endl;
+	std::cout << "Mesh:           " << stats.triangles << " triangles, " << stats.vertices << " vertices -> " << settings.exportFile << std::endl;
+	std::cout << "Chunks:         " << stats.chunks << " (" << stats.emptyChunks << " skipped), peak seam " << stats.peakSeamVertices << " vertices" << std::endl;
+	std::cout << "File:           " << stats.bytes / (1024.0 * 1024.0) << " MB" << std::endl;
+	std::cout << "Time:           " << stats.seconds * 1000.0 << " ms (" << stats.meshSeconds * 1000.0 << " ms meshing)" << std::endl;
+	std::cout << "Triangles/sec:  " << stats.triangles / stats.seconds / 1e6 << " M" << std::endl;
+
+	return true;
+}
+
+// Sculpting in miniature: sphere stamps near the surface of the first volume,
+// each followed by the upload the renderer would submit for it.
+static bool RunBrickBenchmark(const sdf::program::Program &prog, uint32_t editCount)
+{
+	if (prog.volumes.empty())
+	{
+		std::cout << "The scene has no volume." << std::endl;
+		return false;
+	}
+
+	const std::shared_ptr<sdf::volume::Grid> grid = std::make_shared<sdf::volume::Grid>(*prog.volumes[0]);
+	const float radius = grid->voxelSize * 4.0f;
+	const int reach = 5;
+	sdf::bricks::Atlas atlas;
+	sdf::bricks::Upload upload;
+	std::mt19937 rng(1234);
+	std::uniform_int_distribution<uint32_t> pick(0, (uint32_t)grid->values.size() - 1);
+
+	sdf::bricks::CreateAtlas(&atlas);
+	sdf::bricks::AddVolume(&atlas, grid);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	const bool fits = sdf::bricks::BuildUpload(&atlas, &upload);
+	const double initialSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	const glm::uvec3 brickDims = atlas.volumes[0].brickDims;
+
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "Volume:         " << grid->dims.x << "x" << grid->dims.y << "x" << grid->dims.z << ", " << brickDims.x << "x" << brickDims.y << "x" << brickDims.z << " bricks" << std::endl;
+	std::cout << "Initial upload: " << upload.bricksWritten << " bricks (" << atlas.usedSlots * 100.0 / (sdf::bricks::ATLAS_SLOTS * sdf::bricks::ATLAS_SLOTS * sdf::bricks::ATLAS_SLOTS) << "% of the atlas), ";
+	std::cout << upload.staging.size() / 1024.0 << " KB in " << initialSeconds * 1000.0 << " ms" << (fits ? "" : ", atlas full") << std::endl;
+	std::cout << "Dense upload:   " << grid->values.size() * sdf::bricks::ATLAS_TEXEL_BYTES / 1024.0 << " KB as a plain half float volume" << std::endl;
+
+	uint64_t totalBytes = 0, totalBricks = 0, totalFreed = 0, maxBytes = 0;
+	double totalSeconds = 0.0;
+
+	for (uint32_t editIndex = 0; editIndex < editCount; ++editIndex)
+	{
+		// A sample on the surface, so the stamp changes its shape.
+		size_t centerIndex = pick(rng);
+		for (unsigned attempt = 0; attempt < 1000 && std::abs(grid->values[centerIndex]) > grid->voxelSize; ++attempt)
+			centerIndex = pick(rng);
+
+		const glm::ivec3 center((int)(centerIndex % grid->dims.x), (int)(centerIndex / grid->dims.x % grid->dims.y), (int)(centerIndex / ((size_t)grid->dims.x * grid->dims.y)));
+		const glm::ivec3 lo = glm::max(center - glm::ivec3(reach), glm::ivec3(0));
+		const glm::ivec3 hi = glm::min(center + glm::ivec3(reach), glm::ivec3(grid->dims) - glm::ivec3(1));
+
+		for (int z = lo.z; z <= hi.z; ++z)
+		{
+			for (int y = lo.y; y <= hi.y; ++y)
+			{
+				for (int x = lo.x; x <= hi.x; ++x)
+				{
+					float &value = grid->values[sdf::volume::Index(*grid, x, y, z)];
+
+					value = std::min(value, glm::length(glm::vec3(glm::ivec3(x, y, z) - center)) * grid->voxelSize - radius);
+				}
+			}
+		}
+
+		start = std::chrono::high_resolution_clock::now();
+		sdf::bricks::MarkDirty(&atlas, 0, glm::uvec3(lo), glm::uvec3(hi));
+		sdf::bricks::BuildUpload(&atlas, &upload);
+		totalSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		totalBytes += upload.staging.size();
+		totalBricks += upload.bricksWritten;
+		totalFreed += upload.bricksFreed;
+		maxBytes = std::max<uint64_t>(maxBytes, upload.staging.size());
+	}
+
+	if (editCount)
+	{
+		std::cout << "Edits:          " << editCount << " sphere stamps of radius 4 voxels" << std::endl;
+		std::cout << "Per edit:       " << totalBytes / 1024.0 / editCount << " KB uploaded (max " << maxBytes / 1024.0 << " KB), ";
+		std::cout << (double)totalBricks / editCount << " bricks written, " << (double)totalFreed / editCount << " freed" << std::endl;
+		std::cout << "Build time:     " << totalSeconds * 1e6 / editCount << " us per edit" << std::endl;
+	}
+
+	return true;
+}
+
+// Strokes dragged over the surface of the first volume, DABS_PER_FRAME dabs a
+// frame, each frame followed by the upload the renderer would submit for it.
+// The same dabs applied one per frame show what coalescing them saves, and a
+// third run redistances every frame's tiles before uploading them.
+static bool RunSculptBenchmark(const sdf::program::Program &prog, uint32_t dabCount, unsigned threadCount)
+{
+	static const uint32_t DABS_PER_FRAME = 64;
+	static const uint32_t DABS_PER_STROKE = 32;
+	static const sdf::sculpt::Brush BRUSHES[] = { sdf::sculpt::Brush::ADD, sdf::sculpt::Brush::SUBTRACT, sdf::sculpt::Brush::SMOOTH, sdf::sculpt::Brush::FLATTEN };
+
+	if (prog.volumes.empty())
+	{
+		std::cout << "The scene has no volume." << std::endl;
+		return false;
+	}
+
+	const sdf::volume::Grid &source = *prog.volumes[0];
+	std::mt19937 rng(1234);
+	std::uniform_int_distribution<uint32_t> pick(0, (uint32_t)source.values.size() - 1);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::vector<sdf::sculpt::Dab> dabs;
+
+	// Strokes start on the surface and wander along it about a brush radius a
+	// dab, so consecutive dabs overlap as they do under a pointer.
+	while (dabs.size() < dabCount)
+	{
+		size_t sampleIndex = pick(rng);
+		for (unsigned attempt = 0; attempt < 1000 && std::abs(source.values[sampleIndex]) > source.voxelSize; ++attempt)
+			sampleIndex = pick(rng);
+
+		const glm::uvec3 sample((uint32_t)(sampleIndex % source.dims.x), (uint32_t)(sampleIndex / source.dims.x % source.dims.y), (uint32_t)(sampleIndex / ((size_t)source.dims.x * source.dims.y)));
+		sdf::sculpt::Dab dab;
+
+		dab.brush = BRUSHES[dabs.size() / DABS_PER_STROKE % 4];
+		dab.center = source.origin + glm::vec3(sample) * source.voxelSize;
+		dab.radius = source.voxelSize * 4.0f;
+		dab.strength = 0.5f;
+
+		for (uint32_t dabIndex = 0; dabIndex < DABS_PER_STROKE && dabs.size() < dabCount; ++dabIndex)
+		{
+			glm::vec3 normal;
+
+			sdf::volume::SampleGradient(source, dab.center, &normal);
+			dab.normal = glm::length(normal) > 0.0f ? glm::normalize(normal) : glm::vec3(0.0f, 1.0f, 0.0f);
+			dabs.push_back(dab);
+			dab.center += glm::vec3(unit(rng), unit(rng), unit(rng)) * dab.radius * 0.25f;
+		}
+	}
+
+	sdf::jobs::Pool * const pool = sdf::jobs::CreatePool(threadCount);
+
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "Volume:         " << source.dims.x << "x" << source.dims.y << "x" << source.dims.z << ", " << sdf::jobs::ThreadCount(pool) << " threads" << std::endl;
+	std::cout << "Dabs:           " << dabCount << " of radius 4 voxels, in strokes of " << DABS_PER_STROKE << std::endl;
+
+	for (unsigned run = 0; run < 3; ++run)
+	{
+		static const char * const RUN_NAMES[] = { "Coalesced:", "One per frame:", "Redistanced:" };
+		const uint32_t dabsPerFrame = run == 1 ? 1 : DABS_PER_FRAME;
+		const bool redistanced = run == 2;
+		const std::shared_ptr<sdf::volume::Grid> grid = std::make_shared<sdf::volume::Grid>(source);
+		sdf::bricks::Atlas atlas;
+		sdf::bricks::Upload upload;
+		sdf::sculpt::Frame frame;
+		sdf::sculpt::DirtySet dirty;
+		uint64_t tilesTouched = 0, tilesChanged = 0, dabTiles = 0, bricksWritten = 0;
+		double applySeconds = 0.0, uploadSeconds = 0.0, latencySum = 0.0, maxLatency = 0.0;
+		double redistanceSeconds = 0.0, errorBefore = 0.0, errorAfter = 0.0;
+		uint32_t frameCount = 0;
+
+		// The coalesced run also keeps an occupancy hierarchy of 2 voxel cells
+		// over the sculpted grid up to date, as the renderer would.
+		const bool occupied = run == 0;
+		sdf::scene::Scene gridScene;
+		sdf::program::Program gridProg;
+		sdf::occupancy::Hierarchy occupancy;
+		sdf::occupancy::Upload occupancyUpload;
+		double occupancySeconds = 0.0;
+		uint64_t occupancyBytes = 0;
+
+		if (occupied)
+		{
+			gridScene.root = sdf::scene::AddVolume(&gridScene, grid, 1);
+			sdf::program::Compile(gridScene, &gridProg);
+			sdf::occupancy::Build(pool, gridProg, sdf::volume::MinCorner(*grid), sdf::volume::MaxCorner(*grid), std::max(grid->dims.x, std::max(grid->dims.y, grid->dims.z)) / 2, &occupancy);
+			sdf::occupancy::BuildUpload(&occupancy, &occupancyUpload);
+		}
+
+		sdf::bricks::CreateAtlas(&atlas);
+		sdf::bricks::AddVolume(&atlas, grid);
+		sdf::bricks::BuildUpload(&atlas, &upload);
+
+		for (uint32_t first = 0; first < dabCount; first += dabsPerFrame)
+		{
+			const uint32_t last = std::min(first + dabsPerFrame, dabCount);
+			sdf::sculpt::Stats stats;
+
+			for (uint32_t dabIndex = first; dabIndex < last; ++dabIndex)
+				sdf::sculpt::AddDab(&frame, dabs[dabIndex]);
+
+			sdf::sculpt::Apply(pool, &frame, grid.get(), &dirty, &stats);
+
+			if (redistanced)
+			{
+				sdf::redistance::Stats redistanceStats;
+
+				sdf::redistance::Redistance(pool, sdf::redistance::Settings(), grid.get(), &dirty, &redistanceStats);
+				redistanceSeconds += redistanceStats.seconds;
+				errorBefore += redistanceStats.before.mean;
+				errorAfter += redistanceStats.after.mean;
+			}
+
+			const auto start = std::chrono::high_resolution_clock::now();
+			sdf::sculpt::MarkDirty(dirty, *grid, 0, &atlas);
+			sdf::bricks::BuildUpload(&atlas, &upload);
+			uploadSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+			// Tile by tile, as a frame's strokes may be far apart. Samples a voxel
+			// past the dirty ones interpolate from them.
+			if (occupied)
+			{
+				const auto occupancyStart = std::chrono::high_resolution_clock::now();
+
+				for (const glm::uvec3 &tile : dirty.tiles)
+				{
+					glm::uvec3 sampleMin, sampleMax;
+
+					sdf::sculpt::TileSamples(*grid, tile, &sampleMin, &sampleMax);
+					sdf::occupancy::Update(gridProg, grid->origin + (glm::vec3(sampleMin) - glm::vec3(1.0f)) * grid->voxelSize, grid->origin + (glm::vec3(sampleMax) + glm::vec3(1.0f)) * grid->voxelSize, &occupancy);
+				}
+
+				sdf::occupancy::BuildUpload(&occupancy, &occupancyUpload);
+				occupancySeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - occupancyStart).count();
+				occupancyBytes += occupancyUpload.staging.size();
+			}
+
+			applySeconds += stats.seconds;
+			latencySum += stats.meanLatency * stats.dabs;
+			maxLatency = std::max(maxLatency, stats.maxLatency);
+			tilesTouched += stats.tilesTouched;
+			tilesChanged += stats.tilesChanged;
+			dabTiles += stats.dabTiles;
+			bricksWritten += upload.bricksWritten;
+			++frameCount;
+		}
+
+		std::cout << RUN_NAMES[run] << " " << dabsPerFrame << " dabs per frame" << std::endl;
+		std::cout << "  Throughput:   " << dabCount / applySeconds / 1000.0 << " K dabs/sec applied" << std::endl;
+		std::cout << "  Latency:      " << latencySum * 1e6 / dabCount << " us mean, " << maxLatency * 1e6 << " us max per dab" << std::endl;
+		std::cout << "  Per frame:    " << applySeconds * 1e6 / frameCount << " us applying, " << uploadSeconds * 1e6 / frameCount << " us building the upload" << std::endl;
+		std::cout << "  Tiles:        " << (double)tilesTouched / frameCount << " touched, " << (double)tilesChanged / frameCount << " changed per frame, ";
+		std::cout << (tilesTouched ? (double)dabTiles / tilesTouched : 0.0) << " dabs per tile" << std::endl;
+		std::cout << "  Bricks:       " << (double)bricksWritten / frameCount << " uploaded per frame" << std::endl;
+
+		if (occupied)
+			std::cout << "  Occupancy:    " << occupancySeconds * 1e6 / frameCount << " us updating, " << occupancyBytes / 1024.0 / frameCount << " KB uploaded per frame" << std::endl;
+
+		if (redistanced)
+		{
+			std::cout << "  Redistancing: " << redistanceSeconds * 1e6 / frameCount << " us per frame, mean ||grad d| - 1| in the band ";
+			std::cout << std::setprecision(4) << errorBefore / frameCount << " before, " << errorAfter / frameCount << " after" << std::setprecision(2) << std::endl;
+		}
+	}
+
+	sdf::jobs::DestroyPool(pool);
+
+	return true;
+}
+
+static bool RunPyramidBenchmark(const sdf::program::Program &prog, uint32_t rayCount, unsigned threadCount)
+{
+	static const uint32_t MAX_STEPS = 512;
+	static const uint32_t UPDATE_COUNT = 1000;
+
+	if (prog.volumes.empty())
+	{
+		std::cout << "The scene has no volume." << std::endl;
+		return false;
+	}
+
+	const sdf::volume::Grid &grid = *prog.volumes[0];
+	const glm::vec3 center = (sdf::volume::MinCorner(grid) + sdf::volume::MaxCorner(grid)) * 0.5f;
+	const float radius = glm::length(sdf::volume::MaxCorner(grid) - center);
+	sdf::mip::Pyramid pyramid;
+	sdf::mip::Stats buildStats;
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	size_t pyramidBytes = 0;
+
+	sdf::mip::Build(grid, threadCount, &pyramid, &buildStats);
+
+	for (const sdf::mip::Level &level : pyramid.levels)
+		pyramidBytes += level.bounds.size() * sizeof(float);
+
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "Volume:         " << grid.dims.x << "x" << grid.dims.y << "x" << grid.dims.z << std::endl;
+	std::cout << "Pyramid:        " << pyramid.levels.size() << " levels, " << pyramidBytes / 1024.0 << " KB (" << pyramidBytes * 100.0 / (grid.values.size() * sizeof(float)) << "% of the grid)" << std::endl;
+	std::cout << "Build time:     " << buildStats.seconds * 1000.0 << " ms" << std::endl;
+
+	// Rays from a sphere around the volume towards points inside it, so plenty
+	// of them graze the surface. Once through the grid as baked, and once with
+	// distances clamped to a narrow band, as sculpted volumes have them, where
+	// the far field is all small steps without the pyramid.
+	sdf::volume::Grid banded = grid;
+	sdf::mip::Pyramid bandedPyramid;
+	const float bandWidth = grid.voxelSize * 4.0f;
+
+	for (float &value : banded.values)
+		value = std::min(std::max(value, -bandWidth), bandWidth);
+
+	sdf::mip::Build(banded, threadCount, &bandedPyramid);
+
+	for (unsigned fieldIndex = 0; fieldIndex < 2 && rayCount; ++fieldIndex)
+	{
+		const sdf::volume::Grid &field = fieldIndex ? banded : grid;
+		const sdf::mip::Pyramid &fieldPyramid = fieldIndex ? bandedPyramid : pyramid;
+		std::mt19937 rayRng(5678);
+		uint64_t plainSteps = 0, pyramidSteps = 0;
+		uint32_t plainHits = 0, pyramidHits = 0, mismatches = 0;
+		double plainSeconds = 0.0, pyramidSeconds = 0.0;
+
+		for (uint32_t rayIndex = 0; rayIndex < rayCount; ++rayIndex)
+		{
+			glm::vec3 onSphere(unit(rayRng), unit(rayRng), unit(rayRng));
+			const glm::vec3 target = center + glm::vec3(unit(rayRng), unit(rayRng), unit(rayRng)) * (sdf::volume::MaxCorner(grid) - center);
+
+			if (glm::length(onSphere) < 1e-3f)
+				onSphere = glm::vec3(0.0f, 0.0f, 1.0f);
+
+			const glm::vec3 origin = center + glm::normalize(onSphere) * radius * 1.5f;
+			const glm::vec3 dir = glm::normalize(target - origin);
+			float plainT = 0.0f, pyramidT = 0.0f;
+			uint32_t steps;
+
+			auto start = std::chrono::high_resolution_clock::now();
+			const bool plainHit = sdf::mip::March(field, nullptr, origin, dir, radius * 4.0f, MAX_STEPS, &plainT, &steps);
+			plainSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+			plainSteps += steps;
+
+			start = std::chrono::high_resolution_clock::now();
+			const bool pyramidHit = sdf::mip::March(field, &fieldPyramid, origin, dir, radius * 4.0f, MAX_STEPS, &pyramidT, &steps);
+			pyramidSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+			pyramidSteps += steps;
+
+			plainHits += plainHit;
+			pyramidHits += pyramidHit;
+			mismatches += plainHit != pyramidHit || (plainHit && std::abs(plainT - pyramidT) > grid.voxelSize);
+		}
+
+		std::cout << (fieldIndex ? "Banded field:" : "Baked field:") << std::endl;
+		std::cout << "  Rays:         " << rayCount << " (" << plainHits << " hits plain, " << pyramidHits << " with the pyramid, " << mismatches << " differ by over a voxel)" << std::endl;
+		std::cout << "  Steps/ray:    " << (double)plainSteps / rayCount << " plain, " << (double)pyramidSteps / rayCount << " with the pyramid, ";
+		std::cout << (plainSteps ? 100.0 * ((double)plainSteps - (double)pyramidSteps) / (double)plainSteps : 0.0) << "% saved" << std::endl;
+		std::cout << "  Rays/sec:     " << rayCount / plainSeconds / 1e6 << " M plain, " << rayCount / pyramidSeconds / 1e6 << " M with the pyramid" << std::endl;
+	}
+
+	// Updates after edits the size of a brick atlas sphere stamp.
+	std::uniform_int_distribution<uint32_t> pickX(0, grid.dims.x - 1), pickY(0, grid.dims.y - 1), pickZ(0, grid.dims.z - 1);
+	double updateSeconds = 0.0;
+	uint64_t updateCells = 0;
+
+	for (uint32_t updateIndex = 0; updateIndex < UPDATE_COUNT; ++updateIndex)
+	{
+		const glm::uvec3 sample(pickX(rng), pickY(rng), pickZ(rng));
+		sdf::mip::Stats updateStats;
+
+		sdf::mip::Update(grid, glm::uvec3(glm::max(glm::ivec3(sample) - glm::ivec3(5), glm::ivec3(0))), glm::min(sample + glm::uvec3(5), grid.dims - glm::uvec3(1)), &pyramid, &updateStats);
+		updateSeconds += updateStats.seconds;
+		updateCells += updateStats.cells;
+	}
+
+	std::cout << "Update:         " << updateSeconds * 1e6 / UPDATE_COUNT << " us and " << updateCells / UPDATE_COUNT << " cells per 11^3 sample edit" << std::endl;
+
+	return true;
+}
+
+static bool WriteMemoryReport(const char *fileName)
+{
+	sdf::memory::Report report;
+	std::string text;
+
+	sdf::memory::GetReport(&report);
+	sdf::memory::FormatReport(report, &text);
+	std::cout << text;
+
+	return sdf::memory::WriteJson(fileName, report);
+}
+
+static int Run(const Settings &settings)
+{
+	sdf::scene::Scene scene;
+	sdf::program::Program prog;
+	sdf::trace::Image image, plainImage;
+	sdf::trace::Stats stats, plainStats;
+	sdf::occupancy::Hierarchy occupancy;
+	sdf::occupancy::Stats occupancyStats;
+
+	if (settings.optimizerReport)
+		return RunOptimizerReport() ? 0 : -5;
+
+	if (!settings.meshName.empty())
+		return RunBake(settings);
+
+	if (!sdf::scenes::Build(settings.sceneName.c_str(), &scene))
+	{
+		std::cout << "Unknown scene \"" << settings.sceneName << "\"." << std::endl;
+		return -1;
+	}
+
+	if (!sdf::program::Compile(scene, &prog))
+	{
+		std::cout << "Failed to compile scene \"" << settings.sceneName << "\". It is nested too deeply." << std::endl;
+		return -2;
+	}
+
+	if (settings.queryCount)
+	{
+		std::cout << "Scene:          " << settings.sceneName << " (" << prog.code.size() << " instructions)" << std::endl;
+		RunQueryBenchmark(prog, settings.queryCount, settings.trace.threadCount);
+		return 0;
+	}
+
+	if (!settings.exportFile.empty())
+		return RunExport(scene, prog, settings) ? 0 : -7;
+
+	if (settings.brickEdits)
+		return RunBrickBenchmark(prog, settings.brickEdits) ? 0 : -6;
+
+	if (settings.pyramidRays)
+		return RunPyramidBenchmark(prog, settings.pyramidRays, settings.trace.threadCount) ? 0 : -9;
+
+	if (settings.sculptDabs)
+		return RunSculptBenchmark(prog, settings.sculptDabs, settings.trace.threadCount) ? 0 : -10;
+
+	if (settings.gradientPoints)
+	{
+		std::cout << "Scene:          " << settings.sceneName << " (" << prog.code.size() << " instructions)" << std::endl;
+		RunGradientBenchmark(prog, settings.gradientPoints);
+		return 0;
+	}
+
+	// The plain render stays the reference the occupancy one is compared against.
+	if (settings.occupancyResolution)
+	{
+		glm::vec3 min, max;
+
+		SceneBox(scene, &min, &max);
+		sdf::occupancy::Build(nullptr, prog, min, max, settings.occupancyResolution, &occupancy, &occupancyStats);
+
+		if (!sdf::trace::Render(prog, nullptr, sdf::trace::DefaultCamera(), settings.trace, &plainImage, &plainStats))
+		{
+			std::cout << "Failed to render scene \"" << settings.sceneName << "\"." << std::endl;
+			return -3;
+		}
+	}
+
+	if (!sdf::trace::Render(prog, settings.occupancyResolution ? &occupancy : nullptr, sdf::trace::DefaultCamera(), settings.trace, &image, &stats))
+	{
+		std::cout << "Failed to render scene \"" << settings.sceneName << "\"." << std::endl;
+		return -3;
+	}
+
+	if (!sdf::trace::WritePPM(settings.outputFile.c_str(), image))
+	{
+		std::cout << "Failed to write \"" << settings.outputFile << "\"." << std::endl;
+		return -4;
+	}
+
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "Scene:          " << settings.sceneName << " (" << prog.code.size() << " instructions)" << std::endl;
+	std::cout << "Image:          " << image.width << "x" << image.height << " -> " << settings.outputFile << std::endl;
+	std::cout << "Time:           " << stats.seconds * 1000.0 << " ms" << std::endl;
+	std::cout << "Rays:           " << stats.rays << " (" << stats.hits << " hits)" << std::endl;
+	std::cout << "Rays/sec:       " << (stats.seconds > 0.0 ? stats.rays / stats.seconds / 1e6 : 0.0) << " M" << std::endl;
+	std::cout << "Steps/ray:      " << (stats.rays ? (double)stats.steps / (double)stats.rays : 0.0) << std::endl;
+	std::cout << "Packet evals:   " << stats.evaluations << std::endl;
+
+	if (settings.occupancyResolution)
+	{
+		const sdf::occupancy::Level &finest = occupancy.levels[0];
+		size_t differing = 0;
+
+		for (size_t pixelIndex = 0; pixelIndex < image.rgb.size() / 3; ++pixelIndex)
+			differing += std::memcmp(&image.rgb[pixelIndex * 3], &plainImage.rgb[pixelIndex * 3], 3) != 0;
+
+		std::cout << "Occupancy:      " << finest.blockDims.x * sdf::occupancy::BLOCK_CELLS << "x" << finest.blockDims.y * sdf::occupancy::BLOCK_CELLS << "x" << finest.blockDims.z * sdf::occupancy::BLOCK_CELLS;
+		std::cout << " cells, " << occupancy.levels.size() << " levels, " << sdf::occupancy::BufferBytes(occupancy) / 1024.0 << " KB, built in " << occupancyStats.seconds * 1000.0 << " ms" << std::endl;
+		std::cout << "Steps/pixel:    " << (double)plainStats.steps / plainStats.rays << " plain, " << (double)stats.steps / stats.rays << " with occupancy, ";
+		std::cout << (double)stats.skips / stats.rays << " empty cells skipped" << std::endl;
+		std::cout << "Plain time:     " << plainStats.seconds * 1000.0 << " ms, " << differing << " pixels differ" << std::endl;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	Settings settings;
+
+	if (argc < 2 || !ParseSettings(argc, argv, &settings))
+	{
+		PrintHelp();
+		return 0;
+	}
+
+	const int result = Run(settings);
+
+	if (!settings.memoryFile.empty() && !WriteMemoryReport(settings.memoryFile.c_str()))
+	{
+		std::cout << "Failed to write \"" << settings.memoryFile << "\"." << std::endl;
+		return result ? result : -8;
+	}
+
+	return result;
+}
@@ -9,6 +9,11 @@
 #include <functional>
 #include <sstream>
 #include <chrono>
+#include <mutex>
+#include <algorithm>
+#include <cstdlib>
+#include "../GLSLToC/CompileServer.h"
+#include "../../source/sdf/DirWatch.h"
 
 namespace
 {
@@ -59,7 +64,9 @@ namespace
 			std::string clPath;
 			std::string intermediateDir;
 			std::string glslToCOptions;
+			unsigned coalesceMs;
 			bool cleanRebuild;
+			bool useServer;
 		};
 
 		static void PrintHelp()
@@ -84,6 +91,10 @@ namespace
 			std::cout << "	-R: Force a clean rebuild on start of all files in the directory." << std::endl;
 			std::cout << "	-S: Precedes the path to the glsltoc compiler." << std::endl;
 			std::cout << "	-C: Precedes the path to the cl compiler." << std::endl;
+			std::cout << "	-D: Keeps a glsltoc compile server running and sends it each change," << std::endl;
+			std::cout << "	    instead of starting glsltoc every time." << std::endl;
+			std::cout << "	-W: Precedes the milliseconds a directory has to be quiet before its changes" << std::endl;
+			std::cout << "	    are built, so an editor's save is seen as one change. Default 50." << std::endl;
 			std::cout << std::endl;
 			exit(-1);
 		}
@@ -157,7 +168,9 @@ namespace
 			Settings settings;
 			int arg;
 
+			settings.coalesceMs = sdf::dirwatch::Settings().coalesceMs;
 			settings.cleanRebuild = false;
+			settings.useServer = false;
 			 
 			for (arg = 1; arg < argc; ++arg)
 			{
@@ -178,6 +191,9 @@ namespace
 				case 'R':
 					settings.cleanRebuild = true;
 					break;
+				case 'D':
+					settings.useServer = true;
+					break;
 				case 'S':
 					if (arg + 1 >= argc || argv[arg + 1][0] == '-')
 					{
@@ -196,6 +212,15 @@ namespace
 
 					settings.clPath = argv[++arg];
 					break;
+				case 'W':
+					if (arg + 1 >= argc || argv[arg + 1][0] == '-')
+					{
+						std::cout << "Arg '-W' must be followed by milliseconds." << std::endl;
+						PrintHelp();
+					}
+
+					settings.coalesceMs = (unsigned)std::strtoul(argv[++arg], nullptr, 10);
+					break;
 				default:
 					std::cout << "Unknown arg '" << argv[arg] << "'" << std::endl;
 					PrintHelp();
@@ -222,88 +247,44 @@ namespace
 
 	namespace dir
 	{
-		static std::unordered_map<ci_string, size_t> ScanDir(const std::string& dir)
+		static std::vector<ci_string> ToCiStrings(const std::vector<std::string> &paths)
 		{
-			std::unordered_map<ci_string, size_t> files;
+			std::vector<ci_string> ciPaths;
 
-			for (const auto& p : std::filesystem::recursive_directory_iterator(dir))
-			{
-				if (p.is_regular_file())
-				{
-					files.emplace(p.path().string().c_str(), p.last_write_time().time_since_epoch().count());
-				}
-			}
+			for (const std::string &path : paths)
+				ciPaths.emplace_back(path.c_str());
 
-			return files;
+			return ciPaths;
 		}
 
+		// Calls OnChange with each batch of changed files, coalesced by
+		// sdf::dirwatch, until watching fails.
 		template<typename Callback>
-		static bool WatchDir(const std::string& dir, const Callback &OnChange)
+		static bool WatchDir(const std::string& dir, unsigned coalesceMs, const Callback &OnChange)
 		{
-			std::unordered_map<ci_string, size_t> oldFiles = ScanDir(dir);
-			HANDLE change = FindFirstChangeNotification(dir.c_str(), true, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE);
+			sdf::dirwatch::Settings watchSettings;
+			sdf::dirwatch::Changes changes;
+
+			watchSettings.coalesceMs = coalesceMs;
+			watchSettings.maxCoalesceMs = std::max(watchSettings.maxCoalesceMs, coalesceMs);
 
-			if (change == INVALID_HANDLE_VALUE)
+			sdf::dirwatch::Watcher * const watcher = sdf::dirwatch::CreateWatcher(dir.c_str(), watchSettings);
+
+			if (!watcher)
 			{
-				std::cout << "Failed to watch directory '" << dir << "' with " << GetLastError() << std::endl;
+				std::cout << "Failed to watch directory '" << dir << "'." << std::endl;
 				return false;
 			}
 
-			for (;;)
+			while (sdf::dirwatch::Wait(watcher, &changes))
 			{
-				DWORD waitStatus = WaitForSingleObject(change, INFINITE);
-
-				std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
-				if (waitStatus == WAIT_OBJECT_0)
-				{
-					std::unordered_map<ci_string, size_t> curFiles = ScanDir(dir);
-					std::vector<ci_string> newFiles, deletedFiles, modifiedFiles;
-
-					// First do deletes and modifies (to better handle renames)
-					for (const auto& oldFilePair : oldFiles)
-					{
-						const ci_string& file = oldFilePair.first;
-						auto fileIt = curFiles.find(file);
-
-						if (fileIt == curFiles.end())
-							deletedFiles.emplace_back(file);
-						else
-						{
-							const size_t fileLastWrite = oldFilePair.second;
-
-							if (fileIt->second != fileLastWrite)
-								modifiedFiles.emplace_back(file);
-						}
-					}
-
-					for (const auto& filePair : curFiles)
-					{
-						auto oldFileIt = oldFiles.find(filePair.first);
-
-						if (oldFileIt == oldFiles.end())
-							newFiles.emplace_back(filePair.first);
-					}
-
-					oldFiles = std::move(curFiles);
-
-					OnChange(newFiles, deletedFiles, modifiedFiles);
-					std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
-					if (FindNextChangeNotification(change) == FALSE)
-					{
-						std::cout << "Failed to continue to watch directory '" << dir << "' with " << GetLastError() << std::endl;
-						return false;
-					}
-				}
-				else
-				{
-					std::cout << "Unknown wait status '" << waitStatus << "'. Failed with " << GetLastError() << std::endl;
-					return false;
-				}
+				OnChange(ToCiStrings(changes.added), ToCiStrings(changes.removed), ToCiStrings(changes.modified));
 			}
 
-			return true;
+			std::cout << "Failed to continue to watch directory '" << dir << "'." << std::endl;
+			sdf::dirwatch::DestroyWatcher(watcher);
+
+			return false;
 		}
 	}
 
@@ -380,6 +361,123 @@ namespace
 		}
 	}
 
+	namespace server
+	{
+		// A glsltoc compile server started by this process. It runs in a job
+		// object that ends it when this process exits, however that happens.
+		struct Server
+		{
+			std::string pipeName;
+			HANDLE job = nullptr;
+			HANDLE process = nullptr;
+			HANDLE pipe = INVALID_HANDLE_VALUE;
+			std::mutex mutex;    // requests from the watcher threads take turns
+		};
+
+		static bool Start(const std::string &glslToC, const std::string &inDir, const std::string &outDir, const std::string &options, Server *outServer)
+		{
+			const std::string name = "glsltoc-" + std::to_string(GetCurrentProcessId());
+			JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits = {};
+			PROCESS_INFORMATION proc = {};
+			STARTUPINFO si = {};
+			std::ostringstream cmdLineBuild;
+
+			cmdLineBuild << "\"" << glslToC << "\" ";
+			cmdLineBuild << "\"-O" << outDir << " \" ";
+			cmdLineBuild << options << " ";
+			cmdLineBuild << "-s" << name << " ";
+			cmdLineBuild << "\"" << inDir << " \"";
+
+			std::string cmdLine = cmdLineBuild.str();
+
+			outServer->job = CreateJobObject(nullptr, nullptr);
+			limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+			if (!outServer->job || !SetInformationJobObject(outServer->job, JobObjectExtendedLimitInformation, &limits, sizeof(limits)))
+			{
+				std::cout << "Failed to create a job for the glsltoc server with " << GetLastError() << std::endl;
+				return false;
+			}
+
+			si.cb = sizeof(si);
+			if (!CreateProcess(nullptr, &cmdLine[0], nullptr, nullptr, false, CREATE_SUSPENDED, nullptr, nullptr, &si, &proc))
+			{
+				std::cout << "Failed to create glsltoc server using cmdline '" << cmdLine << "' with " << GetLastError() << std::endl;
+				return false;
+			}
+
+			if (!AssignProcessToJobObject(outServer->job, proc.hProcess))
+			{
+				std::cout << "Failed to assign the glsltoc server to its job with " << GetLastError() << std::endl;
+				TerminateProcess(proc.hProcess, 0);
+				CloseHandle(proc.hThread);
+				CloseHandle(proc.hProcess);
+				return false;
+			}
+
+			ResumeThread(proc.hThread);
+			CloseHandle(proc.hThread);
+
+			outServer->pipeName = compile_server::PipeName(name);
+			outServer->process = proc.hProcess;
+
+			return true;
+		}
+
+		// Waits for the server to create its pipe, which takes as long as its
+		// start up.
+		static bool Connect(Server *inoutServer)
+		{
+			for (int attempt = 0; attempt < 200; ++attempt)
+			{
+				inoutServer->pipe = CreateFile(inoutServer->pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+				if (inoutServer->pipe != INVALID_HANDLE_VALUE)
+					return true;
+
+				if (GetLastError() == ERROR_PIPE_BUSY)
+					WaitNamedPipe(inoutServer->pipeName.c_str(), 1000);
+				else if (WaitForSingleObject(inoutServer->process, 50) == WAIT_OBJECT_0)
+					break;
+			}
+
+			std::cout << "Failed to connect to the glsltoc server on '" << inoutServer->pipeName << "'." << std::endl;
+			return false;
+		}
+
+		static bool Build(Server *server, bool force, std::string *out)
+		{
+			const auto start = std::chrono::high_resolution_clock::now();
+			std::lock_guard<std::mutex> lock(server->mutex);
+			compile_server::Request request;
+			compile_server::Response response;
+			std::ostringstream output;
+
+			request.flags = force ? compile_server::FLAG_FORCE : 0;
+
+			// Reconnects once, in case the server dropped the connection.
+			for (int attempt = 0; attempt < 2; ++attempt)
+			{
+				if (server->pipe == INVALID_HANDLE_VALUE && !Connect(server))
+					return false;
+
+				if (compile_server::WriteRequest(server->pipe, request) && compile_server::ReadResponse(server->pipe, &response, out))
+				{
+					const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+					output << "glsltoc server: " << response.compiled << " compiled in " << (int)(response.seconds * 1000.0) << " ms, ";
+					output << (int)(seconds * 1000.0) << " ms from request to reply." << std::endl;
+					*out += output.str();
+
+					return true;
+				}
+
+				CloseHandle(server->pipe);
+				server->pipe = INVALID_HANDLE_VALUE;
+			}
+
+			return false;
+		}
+	}
+
 	namespace compile
 	{
 		namespace shaders
@@ -402,6 +500,15 @@ namespace
 
 				return false;
 			}
+
+			// Through the server when there is one, falling back to running glsltoc.
+			static bool Build(server::Server *optServer, const std::string &glslToC, const std::string &inDir, const std::string &outDir, const std::string &options, bool force, std::string *out)
+			{
+				if (optServer && server::Build(optServer, force, out))
+					return true;
+
+				return CompileAll(glslToC, inDir, outDir, force ? options + " -f" : options, out);
+			}
 		}
 
 		namespace cpp
@@ -437,9 +544,20 @@ namespace
 int main(int argc, char* argv[])
 {
 	const pcl::Settings settings = pcl::ParseCommandLine(argc, argv);
+	server::Server shaderServer;
+	server::Server *shaderServerPtr = nullptr;
+
+	if (settings.useServer)
+	{
+		if (server::Start(settings.glslToCPath, settings.inputDir, settings.intermediateDir, settings.glslToCOptions, &shaderServer))
+			shaderServerPtr = &shaderServer;
+		else
+			std::cout << "Running glsltoc per change instead." << std::endl;
+	}
+
 	std::thread compileThread([&]()
 	{
-		dir::WatchDir(settings.intermediateDir, [&](const std::vector<ci_string>& newFiles, const std::vector<ci_string>& deletedFiles, const std::vector<ci_string>& modifiedFiles)
+		dir::WatchDir(settings.intermediateDir, settings.coalesceMs, [&](const std::vector<ci_string>& newFiles, const std::vector<ci_string>& deletedFiles, const std::vector<ci_string>& modifiedFiles)
 		{
 			auto CompileCpp = [&](const std::vector<ci_string>& files)
 			{
@@ -485,19 +603,19 @@ int main(int argc, char* argv[])
 		std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
 		std::cout << "Force rebuilding all..." << std::endl;
-		compile::shaders::CompileAll(settings.glslToCPath, settings.inputDir, settings.intermediateDir, settings.glslToCOptions + " -f", &out);
+		compile::shaders::Build(shaderServerPtr, settings.glslToCPath, settings.inputDir, settings.intermediateDir, settings.glslToCOptions, true, &out);
 
 		std::cout << out << std::endl;
 	}
 	std::thread shaderThread([&]()
 	{
-		dir::WatchDir(settings.inputDir, [&](const std::vector<ci_string>&newFiles, const std::vector<ci_string>& deletedFiles, const std::vector<ci_string> &modifiedFiles)
+		dir::WatchDir(settings.inputDir, settings.coalesceMs, [&](const std::vector<ci_string>&newFiles, const std::vector<ci_string>& deletedFiles, const std::vector<ci_string> &modifiedFiles)
 		{
 			if (!newFiles.empty() || !modifiedFiles.empty())
 			{
 				std::string out;
 
-				compile::shaders::CompileAll(settings.glslToCPath, settings.inputDir, settings.intermediateDir, settings.glslToCOptions, &out);
+				compile::shaders::Build(shaderServerPtr, settings.glslToCPath, settings.inputDir, settings.intermediateDir, settings.glslToCOptions, false, &out);
 
 				std::cout << out;
 			}